@@ -16,10 +16,12 @@ extern __u32 LINUX_KERNEL_VERSION __kconfig;
 const volatile bool filter_memcg = false;
 const volatile bool target_per_disk = false;
 const volatile bool target_per_flag = false;
+const volatile bool target_per_cgroup = false;
 const volatile bool target_queued = false;
 const volatile bool target_ms = false;
 const volatile bool filter_dev = false;
 const volatile __u32 target_dev = 0;
+const volatile __u64 slice_ns = 0;	/* heatmap mode if set */
 
 struct {
 	__uint(type, BPF_MAP_TYPE_CGROUP_ARRAY);
@@ -37,6 +39,35 @@ struct {
 
 static struct hist zero;
 
+struct {
+	__uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+	__uint(max_entries, MAX_SLICES);
+	__type(key, u32);
+	__type(value, struct slice);
+} slices SEC(".maps");
+
+/*
+ * Each CPU restarts its copy of a ring entry when the entry comes round
+ * to a new slice, user space only reads entries of slices that are over,
+ * so neither side has to clear anything behind the other.
+ */
+static __always_inline void heatmap_add(u64 ts, u64 slot)
+{
+	u64 idx = ts / slice_ns;
+	u32 key = idx % MAX_SLICES;
+	struct slice *s;
+
+	s = bpf_map_lookup_elem(&slices, &key);
+	if (!s)
+		return;
+	if (s->idx != idx) {
+		s->idx = idx;
+		for (int i = 0; i < MAX_SLOTS; i++)
+			s->slots[i] = 0;
+	}
+	s->slots[slot]++;
+}
+
 struct {
 	__uint(type, BPF_MAP_TYPE_HASH);
 	__uint(max_entries, MAX_ENTRIES);
@@ -116,6 +147,15 @@ static int handle_block_rq_complete(struct request *rq, int error,
 	if (delta < 0)
 		goto cleanup;
 
+	if (slice_ns) {
+		delta /= target_ms ? 1000000U : 1000U;
+		slot = log2l(delta);
+		if (slot >= MAX_SLOTS)
+			slot = MAX_SLOTS - 1;
+		heatmap_add(ts, slot);
+		goto cleanup;
+	}
+
 	if (target_per_disk) {
 		struct gendisk *disk = get_disk(rq);
 
@@ -126,6 +166,15 @@ static int handle_block_rq_complete(struct request *rq, int error,
 	if (target_per_flag)
 		hkey.cmd_flags = BPF_CORE_READ(rq, cmd_flags);
 
+	/*
+	 * The blkcg the I/O is charged to, which for writeback is the owner
+	 * of the dirty pages rather than the flusher thread completing it.
+	 * The bios are still attached when block_rq_complete fires.
+	 */
+	if (target_per_cgroup)
+		hkey.cgroup_id = get_kernfs_node_id(BPF_CORE_READ(rq, bio, bi_blkg,
+								  blkcg, css.cgroup, kn));
+
 	histp = bpf_map_lookup_or_try_init(&hists, &hkey, &zero);
 	if (!histp)
 		goto cleanup;
@@ -139,6 +188,8 @@ static int handle_block_rq_complete(struct request *rq, int error,
 	if (slot >= MAX_SLOTS)
 		slot = MAX_SLOTS - 1;
 	__sync_fetch_and_add(&histp->slots[slot], 1);
+	__sync_fetch_and_add(&histp->count, 1);
+	__sync_fetch_and_add(&histp->bytes, nr_bytes);
 
 cleanup:
 	bpf_map_delete_elem(&start, &rq);
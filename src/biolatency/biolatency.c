@@ -3,6 +3,7 @@
 #include "biolatency.h"
 #include "biolatency.skel.h"
 #include "trace_helpers.h"
+#include "cgroup_helpers.h"
 #include "blk_types.h"
 #include <sys/resource.h>
 
@@ -14,6 +15,10 @@ static struct env {
 	bool	queued;
 	bool	per_disk;
 	bool	per_flag;
+	bool	per_cgroup;
+	bool	heatmap;
+	bool	csv;
+	int	slice_ms;
 	bool	milliseconds;
 	bool	verbose;
 	char	*cgroupspath;
@@ -21,16 +26,19 @@ static struct env {
 } env = {
 	.interval = 99999999,
 	.times = 99999999,
+	.slice_ms = 100,
 };
 
 static volatile sig_atomic_t exiting;
+static struct cgroup_cache *cgroup_cache;
 
 const char *argp_program_version = "biolatency 0.1";
 const char *argp_program_bug_address = "Jackie Liu <liuyun01@kylinos.cn>";
 const char argp_program_doc[] =
 "Summarize block device I/O latency as a histogram.\n"
 "\n"
-"USAGE: biolatency [--help] [-T] [-m] [-Q] [-D] [-F] [-d DISK] [-c CG] [interval] [count]\n"
+"USAGE: biolatency [--help] [-T] [-m] [-Q] [-D] [-F] [-C] [-d DISK] [-c CG] [interval] [count]\n"
+"       biolatency -H [--slice MS] [--csv] [-m] [-Q] [-d DISK] [-c CG] [duration]\n"
 "\n"
 "EXAMPLES:\n"
 "    biolatency              # summarize block I/O latency as a histogram\n"
@@ -39,8 +47,16 @@ const char argp_program_doc[] =
 "    biolatency -Q           # include OS queued time in I/O time\n"
 "    biolatency -D           # show each disk device separately\n"
 "    biolatency -F           # show I/O flags separately\n"
+"    biolatency -C           # show each blkcg (container) separately\n"
+"    biolatency -CD          # show each (blkcg, disk) pair separately\n"
 "    biolatency -d sdc       # Trace sdc only\n"
-"    biolatency -c CG        # Trace process under cgroupsPath CG\n";
+"    biolatency -c CG        # Trace process under cgroupsPath CG\n"
+"    biolatency -H 60        # latency heatmap, one row per 100ms, for 60s\n"
+"    biolatency -H --slice 10 --csv > heatmap.csv\n"
+"                            # 10ms slices as CSV for heatmap renderers\n";
+
+#define OPT_SLICE	1	/* --slice */
+#define OPT_CSV		2	/* --csv */
 
 static const struct argp_option opts[] = {
 	{ "timestamp", 'T', NULL, 0, "Include timestamp on output" },
@@ -48,6 +64,10 @@ static const struct argp_option opts[] = {
 	{ "queued", 'Q', NULL, 0, "Include OS queued time in I/O time" },
 	{ "disk", 'D', NULL, 0, "Print a histogram per disk device" },
 	{ "flag", 'F', NULL, 0, "Print a histogram per set of I/O flags" },
+	{ "cgroups", 'C', NULL, 0, "Print a histogram per blkcg of the I/O" },
+	{ "heatmap", 'H', NULL, 0, "Print a latency heatmap, one row per time slice" },
+	{ "slice", OPT_SLICE, "MS", 0, "Heatmap time slice, default 100ms" },
+	{ "csv", OPT_CSV, NULL, 0, "Print the heatmap as CSV" },
 	{ "disk", 'd', "DISK", 0, "Trace this disk only" },
 	{ "verbose", 'v', NULL, 0, "Verbose debug output" },
 	{ "cgroup", 'c', "/sys/fs/cgroup/unified", 0, "Trace process in cgroup path" },
@@ -81,6 +101,22 @@ static error_t parse_arg(int key, char *arg, struct argp_state *state)
 	case 'F':
 		env.per_flag = true;
 		break;
+	case 'C':
+		env.per_cgroup = true;
+		break;
+	case 'H':
+		env.heatmap = true;
+		break;
+	case OPT_SLICE:
+		env.slice_ms = argp_parse_long(key, arg, state);
+		if (env.slice_ms < 10) {
+			warning("Slice must be at least 10ms\n");
+			argp_usage(state);
+		}
+		break;
+	case OPT_CSV:
+		env.csv = true;
+		break;
 	case 'c':
 		env.cgroupspath = arg;
 		env.cg = true;
@@ -206,6 +242,20 @@ static int print_log2_hists(struct bpf_map *hists, struct partitions *partitions
 		}
 		if (env.per_flag)
 			print_cmd_flags(next_key.cmd_flags);
+		if (env.per_cgroup) {
+			const char *path = cgroup_cache ?
+				cgroup_cache__get_path(cgroup_cache, next_key.cgroup_id) : NULL;
+
+			if (env.per_disk || env.per_flag)
+				printf("\t");
+			else
+				printf("\n");
+			if (path)
+				printf("cgroup = %s", path);
+			else
+				printf("cgroup = %llu", next_key.cgroup_id);
+			printf("\tios = %llu kbytes = %llu", hist.count, hist.bytes / 1024);
+		}
 		printf("\n");
 		print_log2_hist(hist.slots, MAX_SLOTS, units);
 		lookup_key = next_key;
@@ -224,6 +274,116 @@ static int print_log2_hists(struct bpf_map *hists, struct partitions *partitions
 	return 0;
 }
 
+/* slice tracing started in and first slice not printed yet */
+static __u64 first_slice, next_slice;
+
+static void print_heatmap_header(void)
+{
+	const char *units = env.milliseconds ? "msecs" : "usecs";
+	int i;
+
+	if (env.csv) {
+		/* each column labelled with the lower bound of its bucket */
+		printf("time_ms");
+		for (i = 0; i < MAX_SLOTS; i++)
+			printf(",%llu", i ? 1ULL << i : 0);
+		printf("\n");
+		return;
+	}
+
+	printf("Column i counts I/O of %s in [2^i, 2^(i+1)), column 0 in [0, 2),"
+	       " shade is log2(count): %s\n", units, HEATMAP_SHADES + 1);
+	printf("%10s  ", "");
+	for (i = 0; i < MAX_SLOTS; i++)
+		printf("%c", i % 10 ? ' ' : '0' + i / 10);
+	printf("\n%10s  ", "TIME(ms)");
+	for (i = 0; i < MAX_SLOTS; i++)
+		printf("%d", i % 10);
+	printf("  %s\n", "COUNT");
+}
+
+static void print_heatmap_row(__u64 idx, const __u32 *slots)
+{
+	__u64 time_ms = (idx - first_slice) * env.slice_ms;
+	int i;
+
+	if (env.csv) {
+		printf("%llu", time_ms);
+		for (i = 0; i < MAX_SLOTS; i++)
+			printf(",%u", slots[i]);
+		printf("\n");
+		return;
+	}
+
+	printf("%10llu ", time_ms);
+	print_heatmap_cells(slots, MAX_SLOTS);
+}
+
+/*
+ * Print every slice that is over, one behind the current one so that
+ * completions racing with the slice boundary are not missed.
+ */
+static int drain_slices(int fd, int nr_cpus)
+{
+	__u64 now = get_ktime_ns() / (env.slice_ms * 1000000ULL);
+	struct slice values[nr_cpus];
+	__u32 slots[MAX_SLOTS];
+	__u32 key;
+	int cpu, i;
+
+	if (now - next_slice > MAX_SLICES - 2) {
+		warning("Lost %llu slices\n", now - next_slice - (MAX_SLICES - 2));
+		next_slice = now - (MAX_SLICES - 2);
+	}
+
+	for (; next_slice + 1 < now; next_slice++) {
+		key = next_slice % MAX_SLICES;
+		if (bpf_map_lookup_elem(fd, &key, values)) {
+			warning("Failed to lookup slice: %s\n", strerror(errno));
+			return -1;
+		}
+
+		memset(slots, 0, sizeof(slots));
+		for (cpu = 0; cpu < nr_cpus; cpu++) {
+			if (values[cpu].idx != next_slice)
+				continue;
+			for (i = 0; i < MAX_SLOTS; i++)
+				slots[i] += values[cpu].slots[i];
+		}
+		print_heatmap_row(next_slice, slots);
+	}
+
+	fflush(stdout);
+	return 0;
+}
+
+static int run_heatmap(struct biolatency_bpf *obj)
+{
+	int fd = bpf_map__fd(obj->maps.slices);
+	int nr_cpus = libbpf_num_possible_cpus();
+	__u64 end = get_ktime_ns() + env.interval * 1000000000ULL;
+	int err;
+
+	if (nr_cpus < 0) {
+		warning("Failed to get # of possible cpus: '%s'!\n",
+			strerror(-nr_cpus));
+		return 1;
+	}
+
+	print_heatmap_header();
+
+	while (!exiting && get_ktime_ns() < end) {
+		/* well within the MAX_SLICES slices the ring holds */
+		usleep(min(env.slice_ms * MAX_SLICES / 8, 1000) * 1000);
+
+		err = drain_slices(fd, nr_cpus);
+		if (err)
+			return err;
+	}
+
+	return 0;
+}
+
 int main(int argc, char *argv[])
 {
 	static const struct argp argp = {
@@ -243,6 +403,11 @@ int main(int argc, char *argv[])
 	if (!bpf_is_root())
 		return 1;
 
+	if (env.heatmap && (env.per_disk || env.per_flag || env.per_cgroup)) {
+		warning("heatmap can't be used with -D, -F or -C\n");
+		return 1;
+	}
+
 	libbpf_set_print(libbpf_print_fn);
 
 	obj = biolatency_bpf__open();
@@ -269,9 +434,14 @@ int main(int argc, char *argv[])
 
 	obj->rodata->target_per_disk = env.per_disk;
 	obj->rodata->target_per_flag = env.per_flag;
+	obj->rodata->target_per_cgroup = env.per_cgroup;
 	obj->rodata->target_ms = env.milliseconds;
 	obj->rodata->target_queued = env.queued;
 	obj->rodata->filter_memcg = env.cg;
+	if (env.heatmap)
+		obj->rodata->slice_ns = env.slice_ms * 1000000ULL;
+	else
+		bpf_map__set_max_entries(obj->maps.slices, 1);
 
 	if (probe_tp_btf("block_rq_insert")) {
 		bpf_program__set_autoload(obj->progs.block_rq_insert_raw, false);
@@ -307,6 +477,19 @@ int main(int argc, char *argv[])
 		}
 	}
 
+	if (env.per_cgroup) {
+		cgroup_cache = cgroup_cache__new(NULL);
+		if (!cgroup_cache)
+			warning("Failed to find cgroup2 mount, printing cgroup ids\n");
+	}
+
+	/*
+	 * get_ktime_ns() reads the clock of bpf_ktime_get_ns(), start the
+	 * heatmap at the slice tracing starts in so that none is skipped
+	 */
+	if (env.heatmap)
+		first_slice = next_slice = get_ktime_ns() / (env.slice_ms * 1000000ULL);
+
 	err = biolatency_bpf__attach(obj);
 	if (err) {
 		warning("Failed to attach BPF object: %d\n", err);
@@ -315,6 +498,13 @@ int main(int argc, char *argv[])
 
 	signal(SIGINT, sig_handler);
 
+	if (env.heatmap) {
+		if (!env.csv)
+			printf("Tracing block device I/O... Hit Ctrl-C to end.\n");
+		err = run_heatmap(obj);
+		goto cleanup;
+	}
+
 	printf("Tracing block device I/O... Hit Ctrl-C to end.\n");
 
 	while (1) {
@@ -339,6 +529,7 @@ int main(int argc, char *argv[])
 cleanup:
 	biolatency_bpf__destroy(obj);
 	partitions__free(partitions);
+	cgroup_cache__free(cgroup_cache);
 	if (cgfd > 0)
 		close(cgfd);
 
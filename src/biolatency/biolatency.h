@@ -13,9 +13,20 @@
 struct hist_key {
 	__u32 cmd_flags;
 	__u32 dev;
+	__u64 cgroup_id;	/* blkcg of the request, with -C */
 };
 
 struct hist {
+	__u64 count;
+	__u64 bytes;
+	__u32 slots[MAX_SLOTS];
+};
+
+/* heatmap mode, a ring of per-CPU histograms of one time slice each */
+#define MAX_SLICES	512
+
+struct slice {
+	__u64 idx;	/* ktime / slice_ns of the slice these slots count */
 	__u32 slots[MAX_SLOTS];
 };
 
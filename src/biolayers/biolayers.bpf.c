@@ -0,0 +1,391 @@
+// SPDX-License-Identifier: GPL-2.0
+#include "vmlinux.h"
+#include <bpf/bpf_helpers.h>
+#include <bpf/bpf_core_read.h>
+#include <bpf/bpf_tracing.h>
+#include "biolayers.h"
+#include "bits.bpf.h"
+#include "maps.bpf.h"
+#include "core_fixes.bpf.h"
+
+#define MAX_ENTRIES	10240
+
+const volatile bool targ_ms = false;
+const volatile bool filter_dev = false;
+const volatile __u32 targ_dev = 0;
+
+/* bi_end_io of the bios md/dm send down from their own threads */
+const volatile __u64 crypt_endio = 0;
+const volatile __u64 raid1_end_read = 0;
+const volatile __u64 raid1_end_write = 0;
+const volatile __u64 raid10_end_read = 0;
+const volatile __u64 raid10_end_write = 0;
+
+extern __u32 LINUX_KERNEL_VERSION __kconfig;
+
+/*
+ * private structures of dm and md, from module BTF; every access is guarded
+ * by bpf_core_type_exists() so the paths of modules that are not loaded are
+ * dropped at load time instead of failing relocation
+ */
+struct dm_io___x {
+	struct bio *orig_bio;
+} __attribute__((preserve_access_index));
+
+struct dm_target_io___x {
+	struct dm_io___x *io;
+	struct bio clone;
+} __attribute__((preserve_access_index));
+
+struct dm_crypt_io___x {
+	struct bio *base_bio;
+} __attribute__((preserve_access_index));
+
+struct r1bio___x {
+	struct bio *master_bio;
+} __attribute__((preserve_access_index));
+
+struct r10bio___x {
+	struct bio *master_bio;
+} __attribute__((preserve_access_index));
+
+struct bio_info {
+	u64 start;
+	u64 first_child;
+	u64 last_child_end;
+	u64 parent;
+	u32 top_dev;
+	u32 dev;
+	u32 depth;
+	u32 nr_children;
+};
+
+struct {
+	__uint(type, BPF_MAP_TYPE_HASH);
+	__uint(max_entries, MAX_ENTRIES);
+	__type(key, u64);
+	__type(value, struct bio_info);
+} bios SEC(".maps");
+
+/* bio being submitted by each thread through dm or md */
+struct {
+	__uint(type, BPF_MAP_TYPE_HASH);
+	__uint(max_entries, MAX_ENTRIES);
+	__type(key, u32);
+	__type(value, u64);
+} submitting SEC(".maps");
+
+struct {
+	__uint(type, BPF_MAP_TYPE_PERCPU_HASH);
+	__uint(max_entries, MAX_ENTRIES);
+	__type(key, struct layer_key);
+	__type(value, struct hist);
+} hists SEC(".maps");
+
+static const struct hist zero;
+
+static void record(const struct bio_info *info, u32 kind, s64 delta)
+{
+	struct layer_key key = {};
+	struct hist *histp;
+	u64 slot;
+
+	if (delta < 0)
+		return;
+
+	key.top_dev = info->top_dev;
+	key.dev = info->dev;
+	key.depth = info->depth;
+	key.kind = kind;
+	histp = bpf_map_lookup_or_try_init(&hists, &key, &zero);
+	if (!histp)
+		return;
+
+	delta /= targ_ms ? 1000000U : 1000U;
+	slot = log2l(delta);
+	if (slot >= MAX_SLOTS)
+		slot = MAX_SLOTS - 1;
+	histp->slots[slot]++;
+	histp->count++;
+	histp->total += delta;
+}
+
+/* the bio dm received, from the per-target clone handed to the target */
+static u64 dm_orig_bio(struct bio *clone)
+{
+	struct dm_target_io___x *tio;
+
+	if (!clone || !bpf_core_type_exists(struct dm_target_io___x) ||
+	    !bpf_core_type_exists(struct dm_io___x))
+		return 0;
+	tio = (void *)clone - bpf_core_field_offset(struct dm_target_io___x, clone);
+	return (u64)BPF_CORE_READ(tio, io, orig_bio);
+}
+
+/*
+ * dm-crypt and md raid1/raid10 may send bios down from their own threads,
+ * follow bi_private back to the bio they were built for.
+ */
+static u64 async_parent(struct bio *bio)
+{
+	u64 endio = (u64)BPF_CORE_READ(bio, bi_end_io);
+	void *private;
+
+	if (!endio)
+		return 0;
+
+	private = BPF_CORE_READ(bio, bi_private);
+	if (bpf_core_type_exists(struct dm_crypt_io___x) && endio == crypt_endio)
+		return dm_orig_bio(BPF_CORE_READ((struct dm_crypt_io___x *)private,
+						 base_bio));
+	if (bpf_core_type_exists(struct r1bio___x) &&
+	    (endio == raid1_end_read || endio == raid1_end_write))
+		return (u64)BPF_CORE_READ((struct r1bio___x *)private, master_bio);
+	if (bpf_core_type_exists(struct r10bio___x) &&
+	    (endio == raid10_end_read || endio == raid10_end_write))
+		return (u64)BPF_CORE_READ((struct r10bio___x *)private, master_bio);
+	return 0;
+}
+
+static int trace_bio_queue(struct bio *bio)
+{
+	struct bio_info info = {}, *parentp = NULL;
+	u32 tid = (u32)bpf_get_current_pid_tgid();
+	u64 key = (u64)bio, parent = 0, *cur;
+	u64 ts = bpf_ktime_get_ns();
+
+	cur = bpf_map_lookup_elem(&submitting, &tid);
+	if (cur && *cur != key)
+		parent = *cur;
+	else
+		parent = async_parent(bio);
+
+	info.start = ts;
+	info.dev = get_bio_dev(bio);
+	if (parent) {
+		parentp = bpf_map_lookup_elem(&bios, &parent);
+		/* part of a tree that isn't traced */
+		if (!parentp || parentp->depth + 1 >= MAX_DEPTH)
+			return 0;
+		info.parent = parent;
+		info.top_dev = parentp->top_dev;
+		info.depth = parentp->depth + 1;
+	} else {
+		if (filter_dev && info.dev != targ_dev)
+			return 0;
+		info.top_dev = info.dev;
+	}
+
+	if (bpf_map_update_elem(&bios, &key, &info, BPF_ANY))
+		return 0;
+	if (parentp) {
+		if (!parentp->nr_children)
+			parentp->first_child = ts;
+		__sync_fetch_and_add(&parentp->nr_children, 1);
+	}
+	return 0;
+}
+
+/*
+ * md raid0 and linear, among others, send the bio they received down
+ * again after pointing it to the device below: the time until then is
+ * charged to the upper layer.
+ */
+static int trace_bio_remap(struct bio *bio)
+{
+	struct bio_info *infop;
+	u64 key = (u64)bio;
+	u64 ts = bpf_ktime_get_ns();
+
+	infop = bpf_map_lookup_elem(&bios, &key);
+	if (!infop || infop->depth + 1 >= MAX_DEPTH)
+		return 0;
+
+	record(infop, LAYER_PRE, ts - infop->start);
+	infop->dev = get_bio_dev(bio);
+	infop->depth++;
+	infop->start = ts;
+	infop->first_child = 0;
+	infop->nr_children = 0;
+	return 0;
+}
+
+/* split while its layer processes it, charge the split to that layer */
+static int trace_split(void)
+{
+	u32 tid = (u32)bpf_get_current_pid_tgid();
+	struct bio_info *infop;
+	struct layer_key key = {};
+	struct hist *histp;
+	u64 *cur;
+
+	cur = bpf_map_lookup_elem(&submitting, &tid);
+	if (!cur)
+		return 0;
+	infop = bpf_map_lookup_elem(&bios, cur);
+	if (!infop)
+		return 0;
+
+	key.top_dev = infop->top_dev;
+	key.dev = infop->dev;
+	key.depth = infop->depth;
+	key.kind = LAYER_TOTAL;
+	histp = bpf_map_lookup_or_try_init(&hists, &key, &zero);
+	if (histp)
+		histp->splits++;
+	return 0;
+}
+
+static int trace_bio_complete(struct bio *bio)
+{
+	struct bio_info *infop, *parentp;
+	u64 key = (u64)bio;
+	u64 ts = bpf_ktime_get_ns();
+
+	infop = bpf_map_lookup_elem(&bios, &key);
+	if (!infop)
+		return 0;
+
+	record(infop, LAYER_TOTAL, ts - infop->start);
+	if (infop->nr_children) {
+		record(infop, LAYER_PRE, infop->first_child - infop->start);
+		record(infop, LAYER_POST, ts - infop->last_child_end);
+	}
+
+	if (infop->parent) {
+		parentp = bpf_map_lookup_elem(&bios, &infop->parent);
+		if (parentp && ts > parentp->last_child_end)
+			parentp->last_child_end = ts;
+	}
+
+	bpf_map_delete_elem(&bios, &key);
+	return 0;
+}
+
+static int enter_submit(struct bio *bio)
+{
+	u32 tid = (u32)bpf_get_current_pid_tgid();
+	u64 key = (u64)bio;
+
+	bpf_map_update_elem(&submitting, &tid, &key, BPF_ANY);
+	return 0;
+}
+
+static int exit_submit(void)
+{
+	u32 tid = (u32)bpf_get_current_pid_tgid();
+
+	bpf_map_delete_elem(&submitting, &tid);
+	return 0;
+}
+
+/*
+ * commit a54895fa057c ("block: remove the request_queue to argument
+ * request based tracepoints") (v5.11-rc1) also dropped the request_queue
+ * argument of the bio tracepoints, but not of block_bio_complete.
+ */
+static struct bio *bio_arg(__u64 *ctx)
+{
+	if (LINUX_KERNEL_VERSION < KERNEL_VERSION(5, 11, 0))
+		return (void *)ctx[1];
+	return (void *)ctx[0];
+}
+
+SEC("tp_btf/block_bio_queue")
+int BPF_PROG(block_bio_queue_btf)
+{
+	return trace_bio_queue(bio_arg(ctx));
+}
+
+SEC("tp_btf/block_bio_remap")
+int BPF_PROG(block_bio_remap_btf)
+{
+	return trace_bio_remap(bio_arg(ctx));
+}
+
+SEC("tp_btf/block_split")
+int BPF_PROG(block_split_btf)
+{
+	return trace_split();
+}
+
+SEC("tp_btf/block_bio_complete")
+int BPF_PROG(block_bio_complete_btf, struct request_queue *q, struct bio *bio)
+{
+	return trace_bio_complete(bio);
+}
+
+SEC("raw_tp/block_bio_queue")
+int BPF_PROG(block_bio_queue_raw)
+{
+	return trace_bio_queue(bio_arg(ctx));
+}
+
+SEC("raw_tp/block_bio_remap")
+int BPF_PROG(block_bio_remap_raw)
+{
+	return trace_bio_remap(bio_arg(ctx));
+}
+
+SEC("raw_tp/block_split")
+int BPF_PROG(block_split_raw)
+{
+	return trace_split();
+}
+
+SEC("raw_tp/block_bio_complete")
+int BPF_PROG(block_bio_complete_raw, struct request_queue *q, struct bio *bio)
+{
+	return trace_bio_complete(bio);
+}
+
+/* dm and md bios are submitted through these since v5.9 */
+SEC("fentry/dm_submit_bio")
+int BPF_PROG(dm_submit_bio, struct bio *bio)
+{
+	return enter_submit(bio);
+}
+
+SEC("fexit/dm_submit_bio")
+int BPF_PROG(dm_submit_bio_exit)
+{
+	return exit_submit();
+}
+
+SEC("kprobe/dm_submit_bio")
+int BPF_KPROBE(kprobe_dm_submit_bio, struct bio *bio)
+{
+	return enter_submit(bio);
+}
+
+SEC("kretprobe/dm_submit_bio")
+int BPF_KRETPROBE(kretprobe_dm_submit_bio)
+{
+	return exit_submit();
+}
+
+SEC("fentry/md_submit_bio")
+int BPF_PROG(md_submit_bio, struct bio *bio)
+{
+	return enter_submit(bio);
+}
+
+SEC("fexit/md_submit_bio")
+int BPF_PROG(md_submit_bio_exit)
+{
+	return exit_submit();
+}
+
+SEC("kprobe/md_submit_bio")
+int BPF_KPROBE(kprobe_md_submit_bio, struct bio *bio)
+{
+	return enter_submit(bio);
+}
+
+SEC("kretprobe/md_submit_bio")
+int BPF_KRETPROBE(kretprobe_md_submit_bio)
+{
+	return exit_submit();
+}
+
+char LICENSE[] SEC("license") = "GPL";
@@ -0,0 +1,442 @@
+// SPDX-License-Identifier: (LGPL-2.1 OR BSD-2-Clause)
+#include "commons.h"
+#include "biolayers.h"
+#include "biolayers.skel.h"
+#include "btf_helpers.h"
+#include "trace_helpers.h"
+#include "map_helpers.h"
+
+#define MAX_ROWS	1024
+
+static struct env {
+	char *disk;
+	bool milliseconds;
+	bool hists;
+	time_t interval;
+	int times;
+	bool timestamp;
+	bool verbose;
+} env = {
+	.interval = 99999999,
+	.times = 99999999,
+};
+
+static volatile sig_atomic_t exiting;
+static int nr_cpus;
+
+const char *argp_program_version = "biolayers 0.1";
+const char *argp_program_bug_address = "Jackie Liu <liuyun01@kylinos.cn>";
+const char argp_program_doc[] =
+"Attribute block I/O latency to the layers of dm/md device stacks.\n"
+"\n"
+"USAGE: biolayers [--help] [-T] [-m] [-L] [-d DISK] [interval] [count]\n"
+"\n"
+"Each bio queued to a device that isn't sent down by dm or md starts a\n"
+"tree, the bios its layers send below are followed down to the disks.\n"
+"For every layer, PRE is the time until the first bio went to the layer\n"
+"below (e.g. md barriers, dm-crypt write encryption) and POST the time\n"
+"after the last one completed (e.g. dm-crypt read decryption).\n"
+"\n"
+"EXAMPLES:\n"
+"    biolayers              # per layer latency summary of all stacks\n"
+"    biolayers 1 10         # print 1 second summaries, 10 times\n"
+"    biolayers -d dm-0      # only trees started on dm-0\n"
+"    biolayers -L -m 5      # per layer histograms in msecs, every 5s\n";
+
+static const struct argp_option opts[] = {
+	{ "disk", 'd', "DISK", 0, "Trace trees started on this disk only" },
+	{ "milliseconds", 'm', NULL, 0, "Millisecond histograms" },
+	{ "hists", 'L', NULL, 0, "Print histograms instead of a summary" },
+	{ "timestamp", 'T', NULL, 0, "Include timestamp on output" },
+	{ "verbose", 'v', NULL, 0, "Verbose debug output" },
+	{ NULL, 'h', NULL, OPTION_HIDDEN, "Show the full help" },
+	{},
+};
+
+static error_t parse_arg(int key, char *arg, struct argp_state *state)
+{
+	static int pos_args;
+
+	switch (key) {
+	case 'h':
+		argp_state_help(state, stderr, ARGP_HELP_STD_HELP);
+		break;
+	case 'v':
+		env.verbose = true;
+		break;
+	case 'd':
+		env.disk = arg;
+		if (strlen(arg) + 1 > DISK_NAME_LEN) {
+			warning("Invalid disk name: too long\n");
+			argp_usage(state);
+		}
+		break;
+	case 'm':
+		env.milliseconds = true;
+		break;
+	case 'L':
+		env.hists = true;
+		break;
+	case 'T':
+		env.timestamp = true;
+		break;
+	case ARGP_KEY_ARG:
+		errno = 0;
+		if (pos_args == 0) {
+			env.interval = strtol(arg, NULL, 10);
+			if (errno || env.interval <= 0) {
+				warning("Invalid interval\n");
+				argp_usage(state);
+			}
+		} else if (pos_args == 1) {
+			env.times = strtol(arg, NULL, 10);
+			if (errno || env.times <= 0) {
+				warning("Invalid times\n");
+				argp_usage(state);
+			}
+		} else {
+			warning("Unrecognized positional argument: %s\n", arg);
+			argp_usage(state);
+		}
+		pos_args++;
+		break;
+	default:
+		return ARGP_ERR_UNKNOWN;
+	}
+	return 0;
+}
+
+static int libbpf_print_fn(enum libbpf_print_level level, const char *format,
+			   va_list args)
+{
+	if (level == LIBBPF_DEBUG && !env.verbose)
+		return 0;
+	return vfprintf(stderr, format, args);
+}
+
+static void sig_handler(int sig)
+{
+	exiting = 1;
+}
+
+/* fentry/fexit if possible, kprobes otherwise, nothing if *func* is gone */
+static void set_submit_hooks(const char *func, const char *mod,
+			     struct bpf_program *fentry, struct bpf_program *fexit,
+			     struct bpf_program *kprobe, struct bpf_program *kretprobe)
+{
+	if (fentry_can_attach(func, NULL) || fentry_can_attach(func, mod)) {
+		bpf_program__set_autoload(kprobe, false);
+		bpf_program__set_autoload(kretprobe, false);
+		return;
+	}
+
+	bpf_program__set_autoload(fentry, false);
+	bpf_program__set_autoload(fexit, false);
+	if (!kprobe_exists(func)) {
+		bpf_program__set_autoload(kprobe, false);
+		bpf_program__set_autoload(kretprobe, false);
+	}
+}
+
+static __u64 ksym_addr(struct ksyms *ksyms, const char *name)
+{
+	const struct ksym *ksym = ksyms__get_symbol(ksyms, name);
+
+	return ksym ? ksym->addr : 0;
+}
+
+struct layer {
+	__u32 top_dev;
+	__u32 dev;
+	__u32 depth;
+	struct hist hists[NR_KINDS];
+};
+
+static int sort_layer(const void *obj1, const void *obj2)
+{
+	const struct layer *l1 = obj1, *l2 = obj2;
+
+	if (l1->top_dev != l2->top_dev)
+		return l1->top_dev < l2->top_dev ? -1 : 1;
+	if (l1->depth != l2->depth)
+		return l1->depth < l2->depth ? -1 : 1;
+	if (l1->dev != l2->dev)
+		return l1->dev < l2->dev ? -1 : 1;
+	return 0;
+}
+
+static struct layer *get_layer(struct layer *layers, int *n,
+			       const struct layer_key *key)
+{
+	int i;
+
+	for (i = 0; i < *n; i++) {
+		if (layers[i].top_dev == key->top_dev && layers[i].dev == key->dev &&
+		    layers[i].depth == key->depth)
+			return &layers[i];
+	}
+
+	memset(&layers[i], 0, sizeof(layers[i]));
+	layers[i].top_dev = key->top_dev;
+	layers[i].dev = key->dev;
+	layers[i].depth = key->depth;
+	(*n)++;
+	return &layers[i];
+}
+
+static const char *dev_name(struct partitions *partitions, __u32 dev,
+			    char *buf, size_t size)
+{
+	const struct partition *partition = partitions__get_by_dev(partitions, dev);
+
+	if (partition)
+		return partition->name;
+	snprintf(buf, size, "%u:%u", dev >> MINORBITS, dev & MINORMASK);
+	return buf;
+}
+
+static double hist_avg(const struct hist *hist)
+{
+	return hist->count ? (double)hist->total / hist->count : 0.0;
+}
+
+static void print_summary(struct partitions *partitions,
+			  const struct layer *layers, int n)
+{
+	const struct hist *total, *pre, *post;
+	char top[16], disk[16], pre_avg[16], post_avg[16];
+	int i;
+
+	printf("%-10s %5s %-10s %8s %10s %10s %10s %10s %7s\n", "TOP", "DEPTH",
+	       "DISK", "COUNT", "AVG", "P99", "PRE_AVG", "POST_AVG", "SPLITS");
+	for (i = 0; i < n; i++) {
+		total = &layers[i].hists[LAYER_TOTAL];
+		pre = &layers[i].hists[LAYER_PRE];
+		post = &layers[i].hists[LAYER_POST];
+
+		/* bios with nothing below are the time spent in the device */
+		strcpy(pre_avg, "-");
+		strcpy(post_avg, "-");
+		if (pre->count)
+			snprintf(pre_avg, sizeof(pre_avg), "%.1f", hist_avg(pre));
+		if (post->count)
+			snprintf(post_avg, sizeof(post_avg), "%.1f", hist_avg(post));
+
+		printf("%-10s %5u %-10s %8llu %10.1f %10llu %10s %10s %7llu\n",
+		       layers[i].depth ? "" :
+		       dev_name(partitions, layers[i].top_dev, top, sizeof(top)),
+		       layers[i].depth,
+		       dev_name(partitions, layers[i].dev, disk, sizeof(disk)),
+		       total->count, hist_avg(total),
+		       log2_hist_percentile((unsigned int *)total->slots, MAX_SLOTS, 99),
+		       pre_avg, post_avg, total->splits);
+	}
+}
+
+static void print_hists(struct partitions *partitions,
+			struct layer *layers, int n)
+{
+	static const char *titles[NR_KINDS] = {
+		[LAYER_TOTAL] = "queued to completed",
+		[LAYER_PRE] = "queued to first bio sent below",
+		[LAYER_POST] = "last bio below completed to completed",
+	};
+	const char *units = env.milliseconds ? "msecs" : "usecs";
+	char top[16], disk[16];
+	int i, kind;
+
+	for (i = 0; i < n; i++) {
+		printf("\ntop = %s depth = %u disk = %s\n",
+		       dev_name(partitions, layers[i].top_dev, top, sizeof(top)),
+		       layers[i].depth,
+		       dev_name(partitions, layers[i].dev, disk, sizeof(disk)));
+		for (kind = 0; kind < NR_KINDS; kind++) {
+			if (!layers[i].hists[kind].count)
+				continue;
+			printf("%s, %llu bios\n", titles[kind],
+			       layers[i].hists[kind].count);
+			print_log2_hist(layers[i].hists[kind].slots, MAX_SLOTS, units);
+		}
+	}
+}
+
+static int print_layers(int fd, struct partitions *partitions)
+{
+	static struct layer_key keys[MAX_ROWS];
+	static struct layer layers[MAX_ROWS];
+	struct hist values[nr_cpus];
+	struct layer_key *prev = NULL;
+	struct layer *layer;
+	struct hist *h;
+	int i, cpu, n = 0, nr_layers = 0;
+
+	while (n < MAX_ROWS && !bpf_map_get_next_key(fd, prev, &keys[n])) {
+		prev = &keys[n];
+		n++;
+	}
+
+	for (i = 0; i < n; i++) {
+		if (bpf_map_lookup_elem(fd, &keys[i], values))
+			continue;
+		bpf_map_delete_elem(fd, &keys[i]);
+		if (keys[i].kind >= NR_KINDS)
+			continue;
+
+		layer = get_layer(layers, &nr_layers, &keys[i]);
+		h = &layer->hists[keys[i].kind];
+		for (cpu = 0; cpu < nr_cpus; cpu++) {
+			h->count += values[cpu].count;
+			h->total += values[cpu].total;
+			h->splits += values[cpu].splits;
+		}
+		percpu_sum_u32(h->slots, values[0].slots, MAX_SLOTS,
+			       sizeof(values[0]) / sizeof(__u32), nr_cpus);
+	}
+
+	qsort(layers, nr_layers, sizeof(*layers), sort_layer);
+
+	if (env.hists)
+		print_hists(partitions, layers, nr_layers);
+	else
+		print_summary(partitions, layers, nr_layers);
+
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	LIBBPF_OPTS(bpf_object_open_opts, open_opts);
+	static const struct argp argp = {
+		.options = opts,
+		.parser = parse_arg,
+		.doc = argp_program_doc,
+	};
+	struct partitions *partitions = NULL;
+	const struct partition *partition;
+	struct ksyms *ksyms = NULL;
+	struct biolayers_bpf *obj;
+	char ts[32];
+	int err;
+
+	err = argp_parse(&argp, argc, argv, 0, NULL, NULL);
+	if (err)
+		return err;
+
+	if (!bpf_is_root())
+		return 1;
+
+	libbpf_set_print(libbpf_print_fn);
+
+	nr_cpus = libbpf_num_possible_cpus();
+	if (nr_cpus < 0) {
+		warning("Failed to get # of possible cpus: '%s'!\n",
+			strerror(-nr_cpus));
+		return 1;
+	}
+
+	err = ensure_core_btf(&open_opts);
+	if (err) {
+		warning("Failed to fetch necessary BTF for CO-RE: %s\n",
+			strerror(-err));
+		return 1;
+	}
+
+	obj = biolayers_bpf__open_opts(&open_opts);
+	if (!obj) {
+		warning("Failed to open BPF object\n");
+		return 1;
+	}
+
+	partitions = partitions__load();
+	if (!partitions) {
+		warning("Failed to load partitions info\n");
+		err = 1;
+		goto cleanup;
+	}
+
+	if (env.disk) {
+		partition = partitions__get_by_name(partitions, env.disk);
+		if (!partition) {
+			warning("Invalid partition name: %s not exist\n", env.disk);
+			err = 1;
+			goto cleanup;
+		}
+		obj->rodata->filter_dev = true;
+		obj->rodata->targ_dev = partition->dev;
+	}
+
+	obj->rodata->targ_ms = env.milliseconds;
+
+	ksyms = ksyms__load();
+	if (!ksyms) {
+		warning("Failed to load kallsyms\n");
+		err = 1;
+		goto cleanup;
+	}
+	obj->rodata->crypt_endio = ksym_addr(ksyms, "crypt_endio");
+	obj->rodata->raid1_end_read = ksym_addr(ksyms, "raid1_end_read_request");
+	obj->rodata->raid1_end_write = ksym_addr(ksyms, "raid1_end_write_request");
+	obj->rodata->raid10_end_read = ksym_addr(ksyms, "raid10_end_read_request");
+	obj->rodata->raid10_end_write = ksym_addr(ksyms, "raid10_end_write_request");
+
+	if (probe_tp_btf("block_bio_queue")) {
+		bpf_program__set_autoload(obj->progs.block_bio_queue_raw, false);
+		bpf_program__set_autoload(obj->progs.block_bio_remap_raw, false);
+		bpf_program__set_autoload(obj->progs.block_split_raw, false);
+		bpf_program__set_autoload(obj->progs.block_bio_complete_raw, false);
+	} else {
+		bpf_program__set_autoload(obj->progs.block_bio_queue_btf, false);
+		bpf_program__set_autoload(obj->progs.block_bio_remap_btf, false);
+		bpf_program__set_autoload(obj->progs.block_split_btf, false);
+		bpf_program__set_autoload(obj->progs.block_bio_complete_btf, false);
+	}
+
+	set_submit_hooks("dm_submit_bio", "dm_mod", obj->progs.dm_submit_bio,
+			 obj->progs.dm_submit_bio_exit, obj->progs.kprobe_dm_submit_bio,
+			 obj->progs.kretprobe_dm_submit_bio);
+	set_submit_hooks("md_submit_bio", "md_mod", obj->progs.md_submit_bio,
+			 obj->progs.md_submit_bio_exit, obj->progs.kprobe_md_submit_bio,
+			 obj->progs.kretprobe_md_submit_bio);
+
+	err = biolayers_bpf__load(obj);
+	if (err) {
+		warning("Failed to load BPF object: %d\n", err);
+		goto cleanup;
+	}
+
+	err = biolayers_bpf__attach(obj);
+	if (err) {
+		warning("Failed to attach BPF programs: %d\n", err);
+		goto cleanup;
+	}
+
+	signal(SIGINT, sig_handler);
+
+	printf("Tracing block I/O through device stacks... Hit Ctrl-C to end.\n");
+
+	/* Main loop */
+	for (;;) {
+		sleep(env.interval);
+		printf("\n");
+
+		if (env.timestamp) {
+			strftime_now(ts, sizeof(ts), "%H:%M:%S");
+			printf("%-8s\n", ts);
+		}
+
+		err = print_layers(bpf_map__fd(obj->maps.hists), partitions);
+		if (err)
+			break;
+
+		if (exiting || --env.times == 0)
+			break;
+	}
+
+cleanup:
+	biolayers_bpf__destroy(obj);
+	ksyms__free(ksyms);
+	partitions__free(partitions);
+	cleanup_core_btf(&open_opts);
+
+	return err != 0;
+}
@@ -0,0 +1,35 @@
+// SPDX-License-Identifier: (LGPL-2.1 OR BSD-2-Clause)
+#ifndef __BIOLAYERS_H
+#define __BIOLAYERS_H
+
+#define DISK_NAME_LEN	32
+#define MAX_SLOTS	27
+#define MAX_DEPTH	8
+
+#define MINORBITS	20
+#define MINORMASK	((1U << MINORBITS) - 1)
+#define MKDEV(ma, mi)	(((ma) << MINORBITS) | (mi))
+
+enum layer_kind {
+	LAYER_TOTAL,	/* queued to completed */
+	LAYER_PRE,	/* queued to the first bio sent to the layer below */
+	LAYER_POST,	/* last bio of the layer below completed to completed */
+	NR_KINDS,
+};
+
+/* a layer of the stack under a top-level device */
+struct layer_key {
+	__u32 top_dev;
+	__u32 dev;
+	__u32 depth;
+	__u32 kind;
+};
+
+struct hist {
+	__u64 count;
+	__u64 total;
+	__u64 splits;	/* LAYER_TOTAL only */
+	__u32 slots[MAX_SLOTS];
+};
+
+#endif /* __BIOLAYERS_H */
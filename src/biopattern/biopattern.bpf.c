@@ -4,6 +4,7 @@
 #include <bpf/bpf_helpers.h>
 #include <bpf/bpf_tracing.h>
 #include "biopattern.h"
+#include "bits.bpf.h"
 #include "maps.bpf.h"
 #include "core_fixes.bpf.h"
 
@@ -12,6 +13,9 @@ const volatile __u32 target_dev = 0;
 
 extern __u32 LINUX_KERNEL_VERSION __kconfig;
 
+/* too large for the BPF stack with the histograms */
+static const struct counter zero;
+
 struct {
 	__uint(type, BPF_MAP_TYPE_HASH);
 	__uint(max_entries, 64);
@@ -19,11 +23,87 @@ struct {
 	__type(value, struct counter);
 } counters SEC(".maps");
 
+/* next sector of each stream, to tell sequential from random I/O */
+struct {
+	__uint(type, BPF_MAP_TYPE_LRU_HASH);
+	__uint(max_entries, 10240);
+	__type(key, struct stream_key);
+	__type(value, u64);
+} streams SEC(".maps");
+
+/* in sectors, filled by user space for the LBA heatmap */
+struct {
+	__uint(type, BPF_MAP_TYPE_HASH);
+	__uint(max_entries, 256);
+	__type(key, u32);
+	__type(value, u64);
+} disk_sizes SEC(".maps");
+
+/*
+ * Bios are queued in the context of the submitting thread, so a disk
+ * read by several sequential streams at once isn't seen as random.
+ */
+SEC("tracepoint/block/block_bio_queue")
+int handle__block_bio_queue(void *args)
+{
+	struct counter *counterp;
+	struct stream_key skey = {};
+	sector_t sector;
+	u32 nr_sector;
+	u64 *nextp;
+	u32 dev;
+
+	if (has_block_bio_queue_class()) {
+		struct trace_event_raw_block_bio_queue___x *ctx = args;
+
+		sector = BPF_CORE_READ(ctx, sector);
+		nr_sector = BPF_CORE_READ(ctx, nr_sector);
+		dev = BPF_CORE_READ(ctx, dev);
+	} else {
+		struct trace_event_raw_block_bio___x *ctx = args;
+
+		sector = BPF_CORE_READ(ctx, sector);
+		nr_sector = BPF_CORE_READ(ctx, nr_sector);
+		dev = BPF_CORE_READ(ctx, dev);
+	}
+
+	/* flushes and discards without data */
+	if (!nr_sector)
+		return 0;
+	if (filter_dev && target_dev != dev)
+		return 0;
+
+	skey.dev = dev;
+	skey.pid = (u32)bpf_get_current_pid_tgid();
+	nextp = bpf_map_lookup_elem(&streams, &skey);
+
+	/* the first bio of a stream has nothing to follow, it counts as random */
+	counterp = bpf_map_lookup_or_try_init(&counters, &dev, &zero);
+	if (counterp) {
+		if (nextp && *nextp == sector)
+			__sync_fetch_and_add(&counterp->sequential, 1);
+		else
+			__sync_fetch_and_add(&counterp->random, 1);
+		__sync_fetch_and_add(&counterp->bytes, nr_sector << 9);
+	}
+
+	if (nextp) {
+		*nextp = sector + nr_sector;
+	} else {
+		u64 next = sector + nr_sector;
+
+		bpf_map_update_elem(&streams, &skey, &next, BPF_ANY);
+	}
+	return 0;
+}
+
+/* Seeks are what the device does, in the order requests complete. */
 SEC("tracepoint/block/block_rq_complete")
 int handle__block_rq_complete(void *args)
 {
-	struct counter *counterp, zero = {};
+	struct counter *counterp;
 	sector_t sector;
+	u64 dist, slot, *sizep;
 	u32 nr_sector;
 	u32 dev;
 
@@ -41,6 +121,8 @@ int handle__block_rq_complete(void *args)
 		dev = BPF_CORE_READ(ctx, dev);
 	}
 
+	if (!nr_sector)
+		return 0;
 	if (filter_dev && target_dev != dev)
 		return 0;
 
@@ -48,14 +130,24 @@ int handle__block_rq_complete(void *args)
 	if (!counterp)
 		return 0;
 	if (counterp->last_sector) {
-		if (counterp->last_sector == sector)
-			__sync_fetch_and_add(&counterp->sequential, 1);
-		else
-			__sync_fetch_and_add(&counterp->random, 1);
-		__sync_fetch_and_add(&counterp->bytes, nr_sector << 9);
+		dist = sector > counterp->last_sector ?
+		       sector - counterp->last_sector :
+		       counterp->last_sector - sector;
+		slot = log2l(dist);
+		if (slot >= MAX_SLOTS)
+			slot = MAX_SLOTS - 1;
+		__sync_fetch_and_add(&counterp->seek_slots[slot], 1);
 	}
 	counterp->last_sector = sector + nr_sector;
+
+	sizep = bpf_map_lookup_elem(&disk_sizes, &dev);
+	if (sizep && *sizep) {
+		slot = sector * LBA_BUCKETS / *sizep;
+		if (slot >= LBA_BUCKETS)
+			slot = LBA_BUCKETS - 1;
+		__sync_fetch_and_add(&counterp->lba_slots[slot], 1);
+	}
 	return 0;
 }
 
-char LICENSE[] SEC("license") = "GPL";
\ No newline at end of file
+char LICENSE[] SEC("license") = "GPL";
@@ -9,6 +9,8 @@ static struct env {
 	char *disk;
 	time_t interval;
 	bool timestamp;
+	bool seeks;
+	bool heatmap;
 	bool verbose;
 	int times;
 } env = {
@@ -23,17 +25,21 @@ const char *argp_program_bug_address = "Jackie Liu <liuyun01@kylinos.cn>";
 const char argp_program_doc[] =
 "Show block device I/O pattern.\n"
 "\n"
-"USAGE: biopattern [--help] [-T] [-d DISK] [interval] [count]\n"
+"USAGE: biopattern [--help] [-T] [-S] [-H] [-d DISK] [interval] [count]\n"
 "\n"
 "EXAMPLES:\n"
 "    biopattern              # show block I/O pattern\n"
 "    biopattern 1 10         # print 1 second summaries, 10 times\n"
 "    biopattern -T 1         # 1s summaries with timestamps\n"
-"    biopattern -d sdc       # trace sdc only\n";
+"    biopattern -d sdc       # trace sdc only\n"
+"    biopattern -S 5         # also seek distance histograms every 5s\n"
+"    biopattern -H -d sdc 1  # LBA heatmap of sdc, one row per second\n";
 
 static const struct argp_option opts[] = {
 	{ "timestamp", 'T', NULL, 0, "Include timestamp on output" },
 	{ "disk", 'd', "DISK", 0, "Trace this disk only" },
+	{ "seeks", 'S', NULL, 0, "Print seek distance histograms" },
+	{ "heatmap", 'H', NULL, 0, "Print an LBA heatmap row per disk instead" },
 	{ "verbose", 'v', NULL, 0, "Verbose debug output" },
 	{ NULL, 'h', NULL, OPTION_HIDDEN, "Show the full help" },
 	{}
@@ -60,6 +66,12 @@ static error_t parse_arg(int key, char *arg, struct argp_state *state)
 	case 'T':
 		env.timestamp = true;
 		break;
+	case 'S':
+		env.seeks = true;
+		break;
+	case 'H':
+		env.heatmap = true;
+		break;
 	case ARGP_KEY_ARG:
 		errno = 0;
 		if (pos_args == 0) {
@@ -99,48 +111,135 @@ static void sig_handler(int sig)
 	exiting = 1;
 }
 
+/* sizes of all disks and partitions from /proc/partitions, in sectors */
+static int load_disk_sizes(struct bpf_map *disk_sizes)
+{
+	int fd = bpf_map__fd(disk_sizes);
+	unsigned int major, minor;
+	unsigned long long blocks;
+	char buf[256], name[64];
+	__u64 sectors;
+	__u32 dev;
+	FILE *f;
+
+	f = fopen("/proc/partitions", "r");
+	if (!f)
+		return -errno;
+
+	while (fgets(buf, sizeof(buf), f)) {
+		if (sscanf(buf, "%u %u %llu %63s", &major, &minor, &blocks, name) != 4)
+			continue;
+		/* in 1K blocks */
+		dev = MKDEV(major, minor);
+		sectors = blocks * 2;
+		bpf_map_update_elem(fd, &dev, &sectors, BPF_ANY);
+	}
+
+	fclose(f);
+	return 0;
+}
+
+static void print_heatmap_header(void)
+{
+	int i;
+
+	printf("Column i counts I/O at [i/%d, (i+1)/%d) of the disk, "
+	       "shade is log2(count): %s\n", LBA_BUCKETS, LBA_BUCKETS,
+	       HEATMAP_SHADES + 1);
+	if (env.timestamp)
+		printf("%-9s ", "TIME");
+	printf("%-7s  ", "DISK");
+	for (i = 0; i < LBA_BUCKETS; i++)
+		printf("%c", i % 10 ? ' ' : '0' + i / 10);
+	printf("  %s\n", "COUNT");
+}
+
+static void print_heatmap_row(const char *name, const struct counter *counter)
+{
+	printf("%-7s ", name);
+	print_heatmap_cells(counter->lba_slots, LBA_BUCKETS);
+}
+
+static bool has_seeks(const struct counter *counter)
+{
+	int i;
+
+	for (i = 0; i < MAX_SLOTS; i++) {
+		if (counter->seek_slots[i])
+			return true;
+	}
+	return false;
+}
+
 static int print_map(struct bpf_map *counters, struct partitions *partitions)
 {
+	static struct counter counters_buf[64];
+	static __u32 keys[64];
 	__u32 total, lookup_key = -1, next_key;
 	int err, fd = bpf_map__fd(counters);
 	const struct partition *partition;
-	struct counter counter;
+	const char *name;
+	struct counter *counter;
+	int i, n = 0;
+	char ts[32];
 
-	while (!bpf_map_get_next_key(fd, &lookup_key, &next_key)) {
-		err = bpf_map_lookup_elem(fd, &next_key, &counter);
+	while (n < 64 && !bpf_map_get_next_key(fd, &lookup_key, &next_key)) {
+		err = bpf_map_lookup_elem(fd, &next_key, &counters_buf[n]);
 		if (err < 0) {
 			warning("Failed to lookup counters: %d\n", err);
 			return -1;
 		}
-
+		keys[n++] = next_key;
 		lookup_key = next_key;
-		total = counter.sequential + counter.random;
-		if (!total)
-			continue;
-		if (env.timestamp) {
-			char ts[32];
-
-			strftime_now(ts, sizeof(ts), "%H:%M:%S");
-			printf("%-9s ", ts);
-		}
-		partition = partitions__get_by_dev(partitions, next_key);
-		printf("%-7s %5ld %5ld %8d %10lld\n",
-		       partition ? partition->name : "Unknown",
-		       counter.random * 100L / total,
-		       counter.sequential * 100L / total, total,
-		       counter.bytes / 1024);
 	}
 
-	lookup_key = -1;
-	while (!bpf_map_get_next_key(fd, &lookup_key, &next_key)) {
-		err = bpf_map_delete_elem(fd, &next_key);
+	/* only the disks read above, the others are reported next interval */
+	for (i = 0; i < n; i++) {
+		err = bpf_map_delete_elem(fd, &keys[i]);
 		if (err < 0) {
 			warning("Failed to cleanup counters: %d\n", err);
 			return -1;
 		}
-		lookup_key = next_key;
 	}
 
+	strftime_now(ts, sizeof(ts), "%H:%M:%S");
+	for (i = 0; i < n; i++) {
+		counter = &counters_buf[i];
+		partition = partitions__get_by_dev(partitions, keys[i]);
+		name = partition ? partition->name : "Unknown";
+
+		if (env.heatmap) {
+			if (env.timestamp)
+				printf("%-9s ", ts);
+			print_heatmap_row(name, counter);
+			continue;
+		}
+
+		total = counter->sequential + counter->random;
+		if (!total)
+			continue;
+		if (env.timestamp)
+			printf("%-9s ", ts);
+		printf("%-7s %5ld %5ld %8d %10lld\n", name,
+		       counter->random * 100L / total,
+		       counter->sequential * 100L / total, total,
+		       counter->bytes / 1024);
+	}
+
+	if (!env.seeks)
+		return 0;
+
+	for (i = 0; i < n; i++) {
+		counter = &counters_buf[i];
+		if (!has_seeks(counter))
+			continue;
+		partition = partitions__get_by_dev(partitions, keys[i]);
+		printf("\ndisk = %s seek distance\n",
+		       partition ? partition->name : "Unknown");
+		print_log2_hist(counter->seek_slots, MAX_SLOTS, "sectors");
+	}
+	printf("\n");
+
 	return 0;
 }
 
@@ -201,6 +300,14 @@ int main(int argc, char *argv[])
 		goto cleanup;
 	}
 
+	if (env.heatmap) {
+		err = load_disk_sizes(obj->maps.disk_sizes);
+		if (err) {
+			warning("Failed to load disk sizes: %s\n", strerror(-err));
+			goto cleanup;
+		}
+	}
+
 	err = biopattern_bpf__attach(obj);
 	if (err) {
 		warning("Failed to attach BPF programs\n");
@@ -211,9 +318,14 @@ int main(int argc, char *argv[])
 
 	printf("Tracing block device I/O requested seeks... Hit Ctrl-C to end.\n");
 
-	if (env.timestamp)
-		printf("%-9s ", "TIME");
-	printf("%-7s %5s %5s %8s %10s\n", "DISK", "%RND", "%SEQ", "COUNT", "KBYTES");
+	if (env.heatmap) {
+		print_heatmap_header();
+	} else {
+		if (env.timestamp)
+			printf("%-9s ", "TIME");
+		printf("%-7s %5s %5s %8s %10s\n", "DISK", "%RND", "%SEQ", "COUNT",
+		       "KBYTES");
+	}
 
 	while (1) {
 		sleep(env.interval);
@@ -3,12 +3,26 @@
 #define __BIOPATTERN_H
 
 #define DISK_NAME_LEN	12
+#define MAX_SLOTS	40	/* of seek distances, in sectors */
+#define LBA_BUCKETS	64	/* address ranges of the LBA heatmap */
+
+#define MINORBITS	20
+#define MINORMASK	((1U << MINORBITS) - 1)
+#define MKDEV(ma, mi)	(((ma) << MINORBITS) | (mi))
 
 struct counter {
 	__u64 last_sector;
 	__u64 bytes;
 	__u32 sequential;
 	__u32 random;
+	__u32 seek_slots[MAX_SLOTS];
+	__u32 lba_slots[LBA_BUCKETS];
+};
+
+/* an I/O stream: one thread submitting to one disk */
+struct stream_key {
+	__u32 dev;
+	__u32 pid;
 };
 
 #endif
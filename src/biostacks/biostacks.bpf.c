@@ -16,7 +16,8 @@ const volatile __u32 target_dev = 0;
 
 struct internal_rqinfo {
 	u64 start_ts;
-	struct rqinfo rqinfo;
+	u64 bytes;
+	struct stack_key key;
 };
 
 struct {
@@ -26,18 +27,25 @@ struct {
 	__type(value, struct internal_rqinfo);
 } rqinfos SEC(".maps");
 
+struct {
+	__uint(type, BPF_MAP_TYPE_STACK_TRACE);
+	__uint(max_entries, MAX_ENTRIES);
+	__uint(key_size, sizeof(u32));
+	__uint(value_size, MAX_STACK * sizeof(u64));
+} stackmap SEC(".maps");
+
 struct {
 	__uint(type, BPF_MAP_TYPE_HASH);
 	__uint(max_entries, MAX_ENTRIES);
-	__type(key, struct rqinfo);
+	__type(key, struct stack_key);
 	__type(value, struct hist);
 } hists SEC(".maps");
 
 static struct hist zero;
 
-static __always_inline int trace_start(void *ctx, struct request *rq, bool merge_bio)
+static __always_inline int trace_start(void *ctx, struct request *rq)
 {
-	struct internal_rqinfo *i_rqinfop = NULL, i_rqinfo = {};
+	struct internal_rqinfo i_rqinfo = {};
 	struct gendisk *disk = get_disk(rq);
 	u32 dev;
 
@@ -46,22 +54,17 @@ static __always_inline int trace_start(void *ctx, struct request *rq, bool merge
 	if (filter_dev && dev != target_dev)
 		return 0;
 
-	if (merge_bio)
-		i_rqinfop = bpf_map_lookup_elem(&rqinfos, &rq);
-	if (!i_rqinfop)
-		i_rqinfop = &i_rqinfo;
-
-	i_rqinfop->start_ts = bpf_ktime_get_ns();
-	i_rqinfop->rqinfo.pid = bpf_get_current_pid_tgid();
-	i_rqinfop->rqinfo.kern_stack_size =
-		bpf_get_stack(ctx, i_rqinfop->rqinfo.kern_stack,
-			      sizeof(i_rqinfop->rqinfo.kern_stack), 0);
-	bpf_get_current_comm(&i_rqinfop->rqinfo.comm,
-			     sizeof(i_rqinfop->rqinfo.comm));
-	i_rqinfop->rqinfo.dev = dev;
+	i_rqinfo.start_ts = bpf_ktime_get_ns();
+	i_rqinfo.bytes = BPF_CORE_READ(rq, __data_len);
+	i_rqinfo.key.tgid = bpf_get_current_pid_tgid() >> 32;
+	i_rqinfo.key.kern_stack_id = bpf_get_stackid(ctx, &stackmap, 0);
+	/* negative for kernel threads, such as writeback */
+	i_rqinfo.key.user_stack_id = bpf_get_stackid(ctx, &stackmap,
+						     BPF_F_USER_STACK);
+	bpf_get_current_comm(&i_rqinfo.key.comm, sizeof(i_rqinfo.key.comm));
+	i_rqinfo.key.dev = dev;
 
-	if (i_rqinfop == &i_rqinfo)
-		bpf_map_update_elem(&rqinfos, &rq, i_rqinfop, BPF_ANY);
+	bpf_map_update_elem(&rqinfos, &rq, &i_rqinfo, BPF_ANY);
 
 	return 0;
 }
@@ -69,19 +72,29 @@ static __always_inline int trace_start(void *ctx, struct request *rq, bool merge
 SEC("fentry/blk_account_io_start")
 int BPF_PROG(blk_account_io_start, struct request *rq)
 {
-	return trace_start(ctx, rq, false);
+	return trace_start(ctx, rq);
 }
 
 SEC("kprobe/blk_account_io_start")
 int BPF_KPROBE(kprobe_blk_account_io_start, struct request *rq)
 {
-	return trace_start(ctx, rq, false);
+	return trace_start(ctx, rq);
 }
 
+/*
+ * The request grew by a bio, it's still charged to the stack that
+ * started it.
+ */
 SEC("kprobe/blk_account_io_merge_bio")
-int BPF_PROG(blk_account_io_merge_bio, struct request *rq)
+int BPF_KPROBE(blk_account_io_merge_bio, struct request *rq)
 {
-	return trace_start(ctx, rq, true);
+	struct internal_rqinfo *i_rqinfop;
+
+	i_rqinfop = bpf_map_lookup_elem(&rqinfos, &rq);
+	if (i_rqinfop)
+		i_rqinfop->bytes = BPF_CORE_READ(rq, __data_len);
+
+	return 0;
 }
 
 static __always_inline int probe_blk_account_io_done(struct request *rq)
@@ -99,7 +112,7 @@ static __always_inline int probe_blk_account_io_done(struct request *rq)
 	if (delta < 0)
 		goto cleanup;
 
-	histp = bpf_map_lookup_or_try_init(&hists, &i_rqinfop->rqinfo, &zero);
+	histp = bpf_map_lookup_or_try_init(&hists, &i_rqinfop->key, &zero);
 	if (!histp)
 		goto cleanup;
 
@@ -111,6 +124,9 @@ static __always_inline int probe_blk_account_io_done(struct request *rq)
 	if (slot >= MAX_SLOTS)
 		slot = MAX_SLOTS - 1;
 	__sync_fetch_and_add(&histp->slots[slot], 1);
+	__sync_fetch_and_add(&histp->count, 1);
+	__sync_fetch_and_add(&histp->bytes, i_rqinfop->bytes);
+	__sync_fetch_and_add(&histp->total, delta);
 
 cleanup:
 	bpf_map_delete_elem(&rqinfos, &rq);
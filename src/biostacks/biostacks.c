@@ -8,6 +8,7 @@ static struct env {
 	char *disk;
 	int duration;
 	bool milliseconds;
+	bool folded;
 	bool verbose;
 } env = {
 	.duration = -1,
@@ -18,16 +19,20 @@ const char *argp_program_bug_address = "Jackie Liu <liuyun01@kylinos.cn>";
 const char argp_program_doc[] =
 "Tracing block I/O with init stacks.\n"
 "\n"
-"USAGE: biostacks [--help] [-d DISK] [-m] [duration]\n"
+"USAGE: biostacks [--help] [-d DISK] [-m] [-f] [duration]\n"
 "\n"
 "EXAMPLES:\n"
 "    biostacks              # trace block I/O with init stacks.\n"
 "    biostacks 1            # trace for 1 seconds only\n"
-"    biostacks -d sdc       # trace sdc only\n";
+"    biostacks -d sdc       # trace sdc only\n"
+"    biostacks -f 30 > out.folded\n"
+"                           # folded stacks weighted by I/O latency, for\n"
+"                           # flamegraph.pl\n";
 
 static const struct argp_option opts[] = {
 	{ "disk", 'd', "DISK", 0, "Trace this disk only" },
 	{ "milliseconds", 'm', NULL, 0, "Millisecond histogram" },
+	{ "folded", 'f', NULL, 0, "Output folded stacks weighted by total latency" },
 	{ "verbose", 'v', NULL, 0, "Verbose debug output" },
 	{ NULL, 'h', NULL, OPTION_HIDDEN, "Show the full help" },
 	{}
@@ -47,6 +52,9 @@ static error_t parse_arg(int key, char *arg, struct argp_state *state)
 	case 'm':
 		env.milliseconds = true;
 		break;
+	case 'f':
+		env.folded = true;
+		break;
 	case 'd':
 		env.disk = arg;
 		if (strlen(arg) + 1 > DISK_NAME_LEN) {
@@ -85,37 +93,110 @@ static int libbpf_print_fn(enum libbpf_print_level level, const char *format,
 static void sig_handler(int sig)
 {}
 
-static void print_map(struct ksyms *ksyms, struct partitions *partitions, int fd)
+static int stack_depth(const unsigned long *ip)
+{
+	int n = 0;
+
+	while (n < MAX_STACK && ip[n])
+		n++;
+	return n;
+}
+
+static const char *ksym_name(struct ksyms *ksyms, unsigned long addr)
+{
+	const struct ksym *ksym = ksyms__map_addr(ksyms, addr);
+
+	return ksym ? ksym->name : "[unknown]";
+}
+
+static const char *usym_name(const struct syms *syms, unsigned long addr)
+{
+	const struct sym *sym = syms ? syms__map_addr(syms, addr) : NULL;
+
+	return sym ? sym->name : "[unknown]";
+}
+
+/* disk;comm;user frames;kernel frames latency, outermost frames first */
+static void print_folded(struct ksyms *ksyms, struct syms_cache *syms_cache,
+			 const char *disk, const struct stack_key *key,
+			 const struct hist *hist, int sfd, unsigned long *ip)
+{
+	const struct syms *syms;
+	int i;
+
+	printf("%s;%s", disk, key->comm);
+	if (key->user_stack_id >= 0 &&
+	    !bpf_map_lookup_elem(sfd, &key->user_stack_id, ip)) {
+		syms = syms_cache__get_syms(syms_cache, key->tgid);
+		for (i = stack_depth(ip) - 1; i >= 0; i--)
+			printf(";%s", usym_name(syms, ip[i]));
+	}
+	if (key->kern_stack_id >= 0 &&
+	    !bpf_map_lookup_elem(sfd, &key->kern_stack_id, ip)) {
+		for (i = stack_depth(ip) - 1; i >= 0; i--)
+			printf(";%s", ksym_name(ksyms, ip[i]));
+	}
+	printf(" %llu\n", hist->total);
+}
+
+static void print_stacks(struct ksyms *ksyms, struct syms_cache *syms_cache,
+			 const char *disk, const struct stack_key *key,
+			 struct hist *hist, int sfd, unsigned long *ip)
 {
 	const char *units = env.milliseconds ? "msecs" : "usecs";
-	struct rqinfo lookup_key = {}, next_key;
+	const struct syms *syms;
+	int i, n;
+
+	printf("%-14.14s %-6d %-7s\n", key->comm, key->tgid, disk);
+	if (key->kern_stack_id < 0 ||
+	    bpf_map_lookup_elem(sfd, &key->kern_stack_id, ip)) {
+		printf("    [Missed Kernel Stack]\n");
+	} else {
+		n = stack_depth(ip);
+		for (i = 0; i < n; i++)
+			printf("    %s\n", ksym_name(ksyms, ip[i]));
+	}
+	if (key->user_stack_id >= 0 &&
+	    !bpf_map_lookup_elem(sfd, &key->user_stack_id, ip)) {
+		syms = syms_cache__get_syms(syms_cache, key->tgid);
+		n = stack_depth(ip);
+		for (i = 0; i < n; i++)
+			printf("    %s\n", usym_name(syms, ip[i]));
+	}
+	printf("%llu I/O, %llu kbytes, %llu %s total\n", hist->count,
+	       hist->bytes / 1024, hist->total, units);
+	print_log2_hist(hist->slots, MAX_SLOTS, units);
+	printf("\n");
+}
+
+static void print_map(struct ksyms *ksyms, struct syms_cache *syms_cache,
+		      struct partitions *partitions, struct biostacks_bpf *obj)
+{
+	int fd = bpf_map__fd(obj->maps.hists);
+	int sfd = bpf_map__fd(obj->maps.stackmap);
+	struct stack_key lookup_key = {}, next_key;
 	const struct partition *partition;
-	const struct ksym *ksym;
-	int num_stack, i, err;
+	unsigned long ip[MAX_STACK];
+	const char *disk;
 	struct hist hist;
+	int err;
 
 	while (!bpf_map_get_next_key(fd, &lookup_key, &next_key)) {
+		lookup_key = next_key;
 		err = bpf_map_lookup_elem(fd, &next_key, &hist);
 		if (err < 0) {
 			warning("Failed to lookup hist: %d\n", err);
 			return;
 		}
 		partition = partitions__get_by_dev(partitions, next_key.dev);
-		printf("%-14.14s %-6d %-7s\n",
-			next_key.comm, next_key.pid,
-			partition ? partition->name : "Unknown");
-		num_stack = next_key.kern_stack_size /
-				sizeof(next_key.kern_stack[0]);
-		for (i = 0; i < num_stack; i++) {
-			ksym = ksyms__map_addr(ksyms, next_key.kern_stack[i]);
-			printf("%s\n", ksym ? ksym->name : "Unknown");
-		}
-		print_log2_hist(hist.slots, MAX_SLOTS, units);
-		printf("\n");
-		lookup_key = next_key;
-	}
+		disk = partition ? partition->name : "Unknown";
 
-	return;
+		memset(ip, 0, sizeof(ip));
+		if (env.folded)
+			print_folded(ksyms, syms_cache, disk, &next_key, &hist, sfd, ip);
+		else
+			print_stacks(ksyms, syms_cache, disk, &next_key, &hist, sfd, ip);
+	}
 }
 
 int main(int argc, char *argv[])
@@ -128,6 +209,7 @@ int main(int argc, char *argv[])
 		.doc = argp_program_doc,
 	};
 
+	struct syms_cache *syms_cache = NULL;
 	struct ksyms *ksyms = NULL;
 	struct biostacks_bpf *obj;
 	int err;
@@ -187,6 +269,12 @@ int main(int argc, char *argv[])
 		goto cleanup;
 	}
 
+	syms_cache = syms_cache__new(0);
+	if (!syms_cache) {
+		warning("Failed to create syms_cache\n");
+		goto cleanup;
+	}
+
 	if (!ksyms__get_symbol(ksyms, "blk_account_io_merge_bio"))
 		bpf_program__set_autoload(obj->progs.blk_account_io_merge_bio, false);
 
@@ -204,13 +292,15 @@ int main(int argc, char *argv[])
 
 	signal(SIGINT, sig_handler);
 
-	printf("Tracing block I/O with init stacks. Hit Ctrl-C to end.\n");
+	if (!env.folded)
+		printf("Tracing block I/O with init stacks. Hit Ctrl-C to end.\n");
 	sleep(env.duration);
-	print_map(ksyms, partitions, bpf_map__fd(obj->maps.hists));
+	print_map(ksyms, syms_cache, partitions, obj);
 
 cleanup:
 	biostacks_bpf__destroy(obj);
 	ksyms__free(ksyms);
+	syms_cache__free(syms_cache);
 	partitions__free(partitions);
 
 	return err != 0;
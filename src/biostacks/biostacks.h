@@ -5,23 +5,25 @@
 #define DISK_NAME_LEN	32
 #define TASK_COMM_LEN	16
 #define MAX_SLOTS	20
-#define MAX_STACK	20
+#define MAX_STACK	127
 
 #define MINORBITS	20
 #define MINORMASK	((1U << MINORBITS) - 1)
 #define MKDEV(ma, mi)	(((ma) << MINORBITS) | (mi))
 
-struct rqinfo {
-	__u32 pid;
-	int kern_stack_size;
-	__u64 kern_stack[MAX_STACK];
-	char comm[TASK_COMM_LEN];
+struct stack_key {
+	__u32 tgid;
+	__s32 kern_stack_id;
+	__s32 user_stack_id;
 	__u32 dev;
+	char comm[TASK_COMM_LEN];
 };
 
 struct hist {
+	__u64 count;
+	__u64 bytes;
+	__u64 total;	/* latency, in the histogram units */
 	__u32 slots[MAX_SLOTS];
 };
 
 #endif
- 
\ No newline at end of file
@@ -9,96 +9,184 @@
 
 #define MAX_ENTRIES	10240
 
-struct {
-	__uint(type, BPF_MAP_TYPE_HASH);
-	__uint(max_entries, MAX_ENTRIES);
-	__type(key, struct request *);
-	__type(value, struct start_req_t);
-} start SEC(".maps");
+extern __u32 LINUX_KERNEL_VERSION __kconfig;
+
+/* who submitted a request and when it was issued, in one record */
+struct req_t {
+	u64 ts;
+	struct info_t key;
+};
 
 struct {
 	__uint(type, BPF_MAP_TYPE_HASH);
 	__uint(max_entries, MAX_ENTRIES);
 	__type(key, struct request *);
-	__type(value, struct who_t);
-} whobyreq SEC(".maps");
+	__type(value, struct req_t);
+} reqs SEC(".maps");
 
 struct {
-	__uint(type, BPF_MAP_TYPE_HASH);
+	__uint(type, BPF_MAP_TYPE_PERCPU_HASH);
 	__uint(max_entries, MAX_ENTRIES);
 	__type(key, struct info_t);
 	__type(value, struct val_t);
 } counts SEC(".maps");
 
-SEC("kprobe")
-int BPF_KPROBE(blk_account_io_start, struct request *req)
+/* comm of each key, read once when the key first shows up */
+struct {
+	__uint(type, BPF_MAP_TYPE_LRU_HASH);
+	__uint(max_entries, MAX_ENTRIES);
+	__type(key, struct info_t);
+	__type(value, char[TASK_COMM_LEN]);
+} comms SEC(".maps");
+
+static const struct val_t zero;
+
+/*
+ * Requests that go through an I/O scheduler are seen at insert, in the
+ * context of the submitter, the others only at issue. The first of the
+ * two to see a request attributes it, the comm is only read when the key
+ * is new.
+ */
+static int trace_rq_start(struct request *rq, bool issue)
 {
-	struct who_t who = {};
+	struct req_t *reqp, req = {};
+	char comm[TASK_COMM_LEN];
+	struct gendisk *disk;
 
-	/* cache PID and comm by request */
-	bpf_get_current_comm(&who.name, sizeof(who.name));
-	who.pid = bpf_get_current_pid_tgid() >> 32;
-	bpf_map_update_elem(&whobyreq, &req, &who, BPF_ANY);
+	reqp = bpf_map_lookup_elem(&reqs, &rq);
+	if (reqp) {
+		if (issue)
+			reqp->ts = bpf_ktime_get_ns();
+		return 0;
+	}
+
+	disk = get_disk(rq);
+	req.key.cgroup_id = bpf_get_current_cgroup_id();
+	req.key.pid = bpf_get_current_pid_tgid() >> 32;
+	req.key.major = BPF_CORE_READ(disk, major);
+	req.key.minor = BPF_CORE_READ(disk, first_minor);
+	req.key.rwflag = (BPF_CORE_READ(rq, cmd_flags) & REQ_OP_MASK) == REQ_OP_WRITE;
+	if (issue)
+		req.ts = bpf_ktime_get_ns();
+
+	if (!bpf_map_lookup_elem(&comms, &req.key)) {
+		bpf_get_current_comm(&comm, sizeof(comm));
+		bpf_map_update_elem(&comms, &req.key, &comm, BPF_ANY);
+	}
 
+	bpf_map_update_elem(&reqs, &rq, &req, BPF_ANY);
 	return 0;
 }
 
-SEC("kprobe/blk_mq_start_request")
-int BPF_KPROBE(blk_mq_start_request, struct request *req)
+static int handle_block_rq_insert(__u64 *ctx)
 {
-	/* time block I/O */
-	struct start_req_t start_req;
-
-	start_req.ts = bpf_ktime_get_ns();
-	start_req.data_len = BPF_CORE_READ(req, __data_len);
-	bpf_map_update_elem(&start, &req, &start_req, BPF_ANY);
+	/*
+	 * commit a54895fs (v5.11-rc1) changed tracepoint argument list from
+	 * TP_PROTO(struct request_queue *q, struct request *rq) to
+	 * TP_PROTO(struct request *rq)
+	 */
+	if (LINUX_KERNEL_VERSION < KERNEL_VERSION(5, 11, 0))
+		return trace_rq_start((void *)ctx[1], false);
+	else
+		return trace_rq_start((void *)ctx[0], false);
+}
 
-	return 0;
+static int handle_block_rq_issue(__u64 *ctx)
+{
+	if (LINUX_KERNEL_VERSION < KERNEL_VERSION(5, 11, 0))
+		return trace_rq_start((void *)ctx[1], true);
+	else
+		return trace_rq_start((void *)ctx[0], true);
 }
 
-SEC("kprobe")
-int BPF_KPROBE(blk_account_io_done, struct request *req, u64 now)
+static int handle_block_rq_complete(struct request *rq, unsigned int nr_bytes)
 {
-	struct val_t *valp, zero = {};
-	struct info_t info = {};
-	struct start_req_t *startp;
-	unsigned int cmd_flags;
-	struct gendisk *disk;
-	struct who_t *whop;
-	u64 delta_us;
+	struct val_t *valp;
+	struct req_t *reqp;
 
-	/* fetch timestamp and calculate delta */
-	startp = bpf_map_lookup_elem(&start, &req);
-	if (!startp)
+	reqp = bpf_map_lookup_elem(&reqs, &rq);
+	if (!reqp)
 		return 0;	/* missed tracing issue */
+	if (!reqp->ts)
+		goto cleanup;
 
-	delta_us = (bpf_ktime_get_ns() - startp->ts) / 1000;
-
-	/* setup info_t key */
-	cmd_flags = BPF_CORE_READ(req, cmd_flags);
-	disk = get_disk(req);
-	info.major = BPF_CORE_READ(disk, major);
-	info.minor = BPF_CORE_READ(disk, first_minor);
-	info.rwflag = !!((cmd_flags & REQ_OP_MASK) == REQ_OP_WRITE);
-
-	whop = bpf_map_lookup_elem(&whobyreq, &req);
-	if (whop) {
-		info.pid = whop->pid;
-		__builtin_memcpy(&info.name, whop->name, sizeof(info.name));
-	}
-
-	valp = bpf_map_lookup_or_try_init(&counts, &info, &zero);
+	valp = bpf_map_lookup_or_try_init(&counts, &reqp->key, &zero);
 	if (valp) {
-		/* save stats */
-		valp->us += delta_us;
-		valp->bytes += startp->data_len;
+		valp->us += (bpf_ktime_get_ns() - reqp->ts) / 1000;
+		valp->bytes += nr_bytes;
 		valp->io++;
 	}
 
-	bpf_map_delete_elem(&start, &req);
-	bpf_map_delete_elem(&whobyreq, &req);
+cleanup:
+	bpf_map_delete_elem(&reqs, &rq);
+	return 0;
+}
+
+/*
+ * A request merged into another one in the I/O scheduler never completes,
+ * drop its record so that a new request reusing its memory isn't taken for
+ * it and charged to the wrong process.
+ */
+static int handle_block_rq_merge(__u64 *ctx)
+{
+	struct request *rq;
 
+	if (LINUX_KERNEL_VERSION < KERNEL_VERSION(5, 11, 0))
+		rq = (void *)ctx[1];
+	else
+		rq = (void *)ctx[0];
+	bpf_map_delete_elem(&reqs, &rq);
 	return 0;
 }
 
+SEC("tp_btf/block_rq_insert")
+int BPF_PROG(block_rq_insert_btf)
+{
+	return handle_block_rq_insert(ctx);
+}
+
+SEC("tp_btf/block_rq_issue")
+int BPF_PROG(block_rq_issue_btf)
+{
+	return handle_block_rq_issue(ctx);
+}
+
+SEC("tp_btf/block_rq_complete")
+int BPF_PROG(block_rq_complete_btf, struct request *rq, int error,
+	     unsigned int nr_bytes)
+{
+	return handle_block_rq_complete(rq, nr_bytes);
+}
+
+SEC("tp_btf/block_rq_merge")
+int BPF_PROG(block_rq_merge_btf)
+{
+	return handle_block_rq_merge(ctx);
+}
+
+SEC("raw_tp/block_rq_insert")
+int BPF_PROG(block_rq_insert_raw)
+{
+	return handle_block_rq_insert(ctx);
+}
+
+SEC("raw_tp/block_rq_issue")
+int BPF_PROG(block_rq_issue_raw)
+{
+	return handle_block_rq_issue(ctx);
+}
+
+SEC("raw_tp/block_rq_complete")
+int BPF_PROG(block_rq_complete_raw, struct request *rq, int error,
+	     unsigned int nr_bytes)
+{
+	return handle_block_rq_complete(rq, nr_bytes);
+}
+
+SEC("raw_tp/block_rq_merge")
+int BPF_PROG(block_rq_merge_raw)
+{
+	return handle_block_rq_merge(ctx);
+}
+
 char LICENSE[] SEC("license") = "GPL";
@@ -4,6 +4,8 @@
 #include "biotop.h"
 #include "biotop.skel.h"
 #include "trace_helpers.h"
+#include "top_helpers.h"
+#include "cgroup_helpers.h"
 #include "compat.h"
 
 #define OUTPUT_ROWS_LIMIT	10240
@@ -59,10 +61,15 @@ void free_vector(struct vector vector)
 
 struct vector disks = {};
 
+static struct cgroup_cache *cgroup_cache;
+static int comms_fd;
+
 static volatile sig_atomic_t exiting;
 
 static struct env {
 	bool	clear_screen;
+	bool	cumulative;
+	bool	json;
 	int	output_rows;
 	int	sort_by;
 	int	interval;
@@ -80,16 +87,21 @@ static struct env {
 const char *argp_program_version = "biotop 0.1";
 const char *argp_program_bug_address = "Jackie Liu <liuyun01@kylinos.cn>";
 const char argp_program_doc[] =
-"Trace file reads/writes by process.\n"
+"Trace block device I/O by process and cgroup.\n"
 "\n"
-"USAGE: biotop [-h] [interval] [count]\n"
+"USAGE: biotop [-h] [-c] [-j] [--cumulative] [interval] [count]\n"
 "\n"
 "EXAMPLES:\n"
 "    biotop            # file I/O top, refresh every 1s\n"
-"    biotop 5 10       # 5s summaries, 10 times\n";
+"    biotop 5 10       # 5s summaries, 10 times\n"
+"    biotop -j 1 10    # 10 one second summaries as JSON lines\n";
+
+#define OPT_CUMULATIVE	1	/* --cumulative */
 
 static const struct argp_option opts[] = {
 	{ "noclear", 'c', NULL, 0, "Don't clear the screen" },
+	{ "json", 'j', NULL, 0, "Print each interval as a JSON object" },
+	{ "cumulative", OPT_CUMULATIVE, NULL, 0, "Show totals since start instead of per interval" },
 	{ "sort", 's', "SORT", 0, "Sort columns, default all [all, io, bytes, time]" },
 	{ "rows", 'r', "ROWS", 0, "Maximum rows to print, default 20" },
 	{ "verbose", 'v', NULL, 0, "Verbose debug output" },
@@ -105,6 +117,12 @@ static error_t parse_arg(int key, char *arg, struct argp_state *state)
 	case 'c':
 		env.clear_screen = false;
 		break;
+	case 'j':
+		env.json = true;
+		break;
+	case OPT_CUMULATIVE:
+		env.cumulative = true;
+		break;
 	case 's':
 		if (!strcmp(arg, "all")) {
 			env.sort_by = ALL;
@@ -174,28 +192,31 @@ static void sig_handler(int sig)
 	exiting = 1;
 }
 
-struct data_t {
-	struct info_t key;
-	struct val_t value;
-};
-
-static int sort_column(const void *obj1, const void *obj2)
+static void merge_val(void *sum, const void *cpu_value)
 {
-	struct data_t *d1 = (struct data_t *)obj1;
-	struct data_t *d2 = (struct data_t *)obj2;
+	struct val_t *s = sum;
+	const struct val_t *v = cpu_value;
 
-	struct val_t *s1 = &d1->value;
-	struct val_t *s2 = &d2->value;
+	s->bytes += v->bytes;
+	s->us += v->us;
+	s->io += v->io;
+}
+
+static int sort_column(const void *k1, const void *v1,
+		       const void *k2, const void *v2)
+{
+	const struct val_t *s1 = v1;
+	const struct val_t *s2 = v2;
 
 	if (env.sort_by == IO)
-		return s2->io - s1->io;
+		return top_cmp_u64(s1->io, s2->io);
 	else if (env.sort_by == BYTES)
-		return s2->bytes - s1->bytes;
+		return top_cmp_u64(s1->bytes, s2->bytes);
 	else if (env.sort_by == TIME)
-		return s2->us - s1->us;
+		return top_cmp_u64(s1->us, s2->us);
 	else
-		return (s2->io + s2->bytes + s2->us)
-			- (s1->io + s1->bytes + s1->us);
+		return top_cmp_u64(s1->io + s1->bytes + s1->us,
+				   s2->io + s2->bytes + s2->us);
 }
 
 static void parse_disk_stat(void)
@@ -252,97 +273,67 @@ static char *search_disk_name(int major, int minor)
 	return "";
 }
 
-static int print_stat(struct biotop_bpf *obj)
+static int print_stat(struct top *top, struct biotop_bpf *obj)
 {
-	FILE *fp;
-	struct info_t *prev_key = NULL;
-	static struct data_t datas[OUTPUT_ROWS_LIMIT];
-	int err = 0, rows = 0;
-	int fd = bpf_map__fd(obj->maps.counts);
-
-	fp = fopen("/proc/loadavg", "r");
-	if (fp) {
-		char ts[16], buf[256] = {};
-		int n;
-
-		strftime_now(ts, sizeof(ts), "%H:%M:%S");
-
-		n = fread(buf, 1, sizeof(buf), fp);
-		if (n)
-			printf("%8s loadavg: %s\n", ts, buf);
-		fclose(fp);
-	}
-
-	printf("%-7s %-16s %1s %-3s %-3s %-8s %5s %7s %6s\n",
-	       "PID", "COMM", "D", "MAJ", "MIN", "DISK", "I/O", "Kbytes", "AVGms");
+	int rows;
 
-	while (1) {
-		err = bpf_map_get_next_key(fd, prev_key, &datas[rows].key);
-		if (err) {
-			if (errno == ENOENT) {
-				err = 0;
-				break;
-			}
-			warning("bpf_map_get_next_key failed: %s\n", strerror(errno));
-			return err;
-		}
-		prev_key = &datas[rows].key;
-
-		err = bpf_map_lookup_elem(fd, &datas[rows].key, &datas[rows].value);
-		if (err) {
-			warning("bpf_map_lookup_elem failed: %s\n", strerror(errno));
-			return err;
-		}
-
-		rows++;
+	rows = top__collect(top, bpf_map__fd(obj->maps.counts));
+	if (rows < 0) {
+		warning("Failed to read counts: %s\n", strerror(-rows));
+		return rows;
 	}
 
-	qsort(datas, rows, sizeof(struct data_t), sort_column);
-	rows = rows < env.output_rows ? rows : env.output_rows;
+	top__begin(top, true);
+
+	if (!top__json(top))
+		printf("%-7s %-16s %1s %-3s %-3s %-8s %5s %7s %6s %s\n",
+		       "PID", "COMM", "D", "MAJ", "MIN", "DISK", "I/O", "Kbytes", "AVGms",
+		       "CGROUP");
 
 	for (int i = 0; i < rows; i++) {
-		int major, minor;
-		struct info_t *key = &datas[i].key;
-		struct val_t *value = &datas[i].value;
+		const struct info_t *key = top__key(top, i);
+		const struct val_t *value = top__value(top, i);
+		const char *disk = search_disk_name(key->major, key->minor);
+		const char *cgroup = NULL;
+		char comm[TASK_COMM_LEN + 1] = {};
+		char cgroup_id[32];
 		float avg_ms = 0;
 
+		bpf_map_lookup_elem(comms_fd, key, comm);
+		if (cgroup_cache)
+			cgroup = cgroup_cache__get_path(cgroup_cache, key->cgroup_id);
+		if (!cgroup) {
+			snprintf(cgroup_id, sizeof(cgroup_id), "%llu", key->cgroup_id);
+			cgroup = cgroup_id;
+		}
+
 		/* To avoid floating point exception. */
 		if (value->io)
 			avg_ms = ((float)value->us) / 1000 / value->io;
 
-		major = key->major;
-		minor = key->minor;
-
-		printf("%-7d %-16s %1s %-3d %-3d %-8s %5d %7lld %6.2f\n",
-		       key->pid, key->name, key->rwflag ? "W" : "R",
-		       major, minor, search_disk_name(major, minor),
-		       value->io, value->bytes / 1024, avg_ms);
-	}
-
-	printf("\n");
-	prev_key = NULL;
-
-	while (1) {
-		struct info_t key;
-
-		err = bpf_map_get_next_key(fd, prev_key, &key);
-		if (err) {
-			if (errno == ENOENT) {
-				err = 0;
-				break;
-			}
-			warning("bpf_map_get_next_key failed: %s\n", strerror(errno));
-			return err;
-		}
-		err = bpf_map_delete_elem(fd, &key);
-		if (err) {
-			warning("bpf_map_delete_elem failed: %s\n", strerror(errno));
-			return err;
+		if (top__json(top)) {
+			top__json_row(top);
+			top__json_u64(top, "pid", key->pid);
+			top__json_str(top, "comm", comm);
+			top__json_str(top, "dir", key->rwflag ? "W" : "R");
+			top__json_u64(top, "major", key->major);
+			top__json_u64(top, "minor", key->minor);
+			top__json_str(top, "disk", disk);
+			top__json_u64(top, "io", value->io);
+			top__json_u64(top, "kbytes", value->bytes / 1024);
+			top__json_double(top, "avg_ms", avg_ms);
+			top__json_str(top, "cgroup", cgroup);
+			continue;
 		}
-		prev_key = &key;
+
+		printf("%-7d %-16s %1s %-3d %-3d %-8s %5d %7lld %6.2f %s\n",
+		       key->pid, comm, key->rwflag ? "W" : "R",
+		       key->major, key->minor, disk,
+		       value->io, value->bytes / 1024, avg_ms, cgroup);
 	}
 
-	return err;
+	top__end(top);
+	return 0;
 }
 
 int main(int argc, char *argv[])
@@ -352,8 +343,14 @@ int main(int argc, char *argv[])
 		.parser = parse_arg,
 		.doc = argp_program_doc,
 	};
+	struct top_opts top_opts = {
+		.key_size = sizeof(struct info_t),
+		.value_size = sizeof(struct val_t),
+		.cmp = sort_column,
+		.merge = merge_val,
+	};
 	struct biotop_bpf *obj;
-	struct ksyms *ksyms;
+	struct top *top = NULL;
 	int err;
 
 	err = argp_parse(&argp, argc, argv, 0, NULL, NULL);
@@ -373,11 +370,21 @@ int main(int argc, char *argv[])
 
 	parse_disk_stat();
 
-	ksyms = ksyms__load();
-	if (!ksyms) {
-		err = -ENOMEM;
-		warning("Failed to load kallsyms\n");
-		goto cleanup;
+	if (probe_tp_btf("block_rq_insert")) {
+		bpf_program__set_autoload(obj->progs.block_rq_insert_raw, false);
+		bpf_program__set_autoload(obj->progs.block_rq_issue_raw, false);
+		bpf_program__set_autoload(obj->progs.block_rq_complete_raw, false);
+		bpf_program__set_autoload(obj->progs.block_rq_merge_raw, false);
+	} else {
+		bpf_program__set_autoload(obj->progs.block_rq_insert_btf, false);
+		bpf_program__set_autoload(obj->progs.block_rq_issue_btf, false);
+		bpf_program__set_autoload(obj->progs.block_rq_complete_btf, false);
+		bpf_program__set_autoload(obj->progs.block_rq_merge_btf, false);
+	}
+	/* block_rq_merge is missing on older kernels */
+	if (!tracepoint_exists("block", "block_rq_merge")) {
+		bpf_program__set_autoload(obj->progs.block_rq_merge_btf, false);
+		bpf_program__set_autoload(obj->progs.block_rq_merge_raw, false);
 	}
 
 	err = biotop_bpf__load(obj);
@@ -386,33 +393,10 @@ int main(int argc, char *argv[])
 		goto cleanup;
 	}
 
-	if (ksyms__get_symbol(ksyms, "__blk_account_io_start"))
-		obj->links.blk_account_io_start =
-			bpf_program__attach_kprobe(obj->progs.blk_account_io_start,
-						   false, "__blk_account_io_start");
-	else
-		obj->links.blk_account_io_start =
-			bpf_program__attach_kprobe(obj->progs.blk_account_io_start,
-						   false, "blk_account_io_start");
-
-	if (!obj->links.blk_account_io_start) {
-		warning("Failed to load attach blk_account_io_start\n");
-		goto cleanup;
-	}
-
-	if (ksyms__get_symbol(ksyms, "__blk_account_io_done"))
-		obj->links.blk_account_io_done =
-			bpf_program__attach_kprobe(obj->progs.blk_account_io_done,
-						   false, "__blk_account_io_done");
-	else
-		obj->links.blk_account_io_done =
-			bpf_program__attach_kprobe(obj->progs.blk_account_io_done,
-						   false, "blk_account_io_done");
-
-	if (!obj->links.blk_account_io_done) {
-		warning("Failed to load attach blk_account_io_done");
-		goto cleanup;
-	}
+	comms_fd = bpf_map__fd(obj->maps.comms);
+	cgroup_cache = cgroup_cache__new(NULL);
+	if (!cgroup_cache)
+		warning("Failed to find cgroup2 mount, printing cgroup ids\n");
 
 	err = biotop_bpf__attach(obj);
 	if (err) {
@@ -420,6 +404,18 @@ int main(int argc, char *argv[])
 		goto cleanup;
 	}
 
+	top_opts.max_entries = bpf_map__max_entries(obj->maps.counts);
+	top_opts.rows = env.output_rows;
+	top_opts.cumulative = env.cumulative;
+	top_opts.clear_screen = env.clear_screen;
+	top_opts.json = env.json;
+	top = top__new(&top_opts);
+	if (!top) {
+		err = -errno;
+		warning("Failed to create top: %s\n", strerror(errno));
+		goto cleanup;
+	}
+
 	if (signal(SIGINT, sig_handler) == SIG_ERR) {
 		warning("Can't set signal handler: %s\n", strerror(errno));
 		err =  1;
@@ -429,13 +425,7 @@ int main(int argc, char *argv[])
 	while (1) {
 		sleep(env.interval);
 
-		if (env.clear_screen) {
-			err = system("clear");
-			if (err)
-				goto cleanup;
-		}
-
-		err = print_stat(obj);
+		err = print_stat(top, obj);
 		if (err)
 			goto cleanup;
 
@@ -444,7 +434,8 @@ int main(int argc, char *argv[])
 	}
 
 cleanup:
-	ksyms__free(ksyms);
+	top__free(top);
+	cgroup_cache__free(cgroup_cache);
 	free_vector(disks);
 	biotop_bpf__destroy(obj);
 
@@ -7,28 +7,16 @@
 
 #define TASK_COMM_LEN	16
 
-/* For saving the timestamp and __data_len of each request */
-struct start_req_t {
-	__u64	ts;
-	__u64	data_len;
-};
-
-/* For saving process info by request */
-struct who_t {
-	pid_t	pid;
-	char	name[TASK_COMM_LEN];
-};
-
 /* the key of the output summary */
 struct info_t {
+	__u64	cgroup_id;
 	pid_t	pid;
 	int	rwflag;
 	int	major;
 	int	minor;
-	char	name[TASK_COMM_LEN];
 };
 
-/* the value of the output summary */
+/* the value of the output summary, per CPU */
 struct val_t {
 	__u64	bytes;
 	__u64	us;
@@ -11,16 +11,25 @@
 const volatile char target_comm[TASK_COMM_LEN] = {};
 const volatile bool filter_dev = false;
 const volatile __u32 target_dev = 0;
+const volatile bool target_per_cgroup = false;
 
 extern __u32 LINUX_KERNEL_VERSION __kconfig;
 
 struct {
-	__uint(type, BPF_MAP_TYPE_HASH);
+	__uint(type, BPF_MAP_TYPE_PERCPU_HASH);
 	__uint(max_entries, 10240);
 	__type(key, struct hist_key);
 	__type(value, struct hist);
 } hists SEC(".maps");
 
+/* comm of each process, read once when it first shows up */
+struct {
+	__uint(type, BPF_MAP_TYPE_LRU_HASH);
+	__uint(max_entries, 10240);
+	__type(key, u32);
+	__type(value, char[TASK_COMM_LEN]);
+} comms SEC(".maps");
+
 static struct hist zero;
 
 static __always_inline bool comm_allowed(const char *comm)
@@ -33,34 +42,69 @@ static __always_inline bool comm_allowed(const char *comm)
 	return true;
 }
 
+static __always_inline char rq_op(struct request *rq)
+{
+	switch (BPF_CORE_READ(rq, cmd_flags) & REQ_OP_MASK) {
+	case REQ_OP_READ:
+		return 'R';
+	case REQ_OP_WRITE:
+		return 'W';
+	case REQ_OP_FLUSH:
+		return 'F';
+	case REQ_OP_DISCARD:
+		return 'D';
+	default:
+		return 'O';
+	}
+}
+
 static __always_inline int trace_rq_issue(struct request *rq)
 {
-	struct hist_key hkey;
+	struct gendisk *disk = get_disk(rq);
+	char comm[TASK_COMM_LEN];
+	struct hist_key hkey = {};
 	struct hist *histp;
-	u64 slot;
+	u64 slot, offset;
+	u32 len;
 
-	if (filter_dev) {
-		struct gendisk *disk = get_disk(rq);
-		u32 dev;
-
-		dev = disk ? MKDEV(BPF_CORE_READ(disk, major),
-				   BPF_CORE_READ(disk, first_minor)) : 0;
-		if (target_dev != dev)
-			return 0;
-	}
+	hkey.dev = disk ? MKDEV(BPF_CORE_READ(disk, major),
+				BPF_CORE_READ(disk, first_minor)) : 0;
+	if (filter_dev && target_dev != hkey.dev)
+		return 0;
 
-	bpf_get_current_comm(&hkey.comm, sizeof(hkey.comm));
-	if (!comm_allowed(hkey.comm))
+	bpf_get_current_comm(&comm, sizeof(comm));
+	if (!comm_allowed(comm))
 		return 0;
 
+	if (target_per_cgroup) {
+		hkey.cgroup_id = bpf_get_current_cgroup_id();
+	} else {
+		hkey.tgid = bpf_get_current_pid_tgid() >> 32;
+		if (!bpf_map_lookup_elem(&comms, &hkey.tgid))
+			bpf_map_update_elem(&comms, &hkey.tgid, &comm, BPF_ANY);
+	}
+	hkey.op = rq_op(rq);
+
 	histp = bpf_map_lookup_or_try_init(&hists, &hkey, &zero);
 	if (!histp)
 		return 0;
 
-	slot = log2l(BPF_CORE_READ(rq, __data_len) / 1024);
+	len = BPF_CORE_READ(rq, __data_len);
+	slot = log2l(len / 1024);
 	if (slot >= MAX_SLOTS)
 		slot = MAX_SLOTS - 1;
-	__sync_fetch_and_add(&histp->slots[slot], 1);
+	histp->slots[slot]++;
+	histp->count++;
+	histp->bytes += len;
+	if (!len)
+		return 0;
+
+	/* the largest power of two the byte offset is a multiple of */
+	offset = BPF_CORE_READ(rq, __sector) << 9;
+	slot = offset ? log2l(offset & -offset) : ALIGN_SLOTS - 1;
+	if (slot >= ALIGN_SLOTS)
+		slot = ALIGN_SLOTS - 1;
+	histp->align_slots[slot]++;
 
 	return 0;
 }
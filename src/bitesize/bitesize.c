@@ -3,6 +3,10 @@
 #include "bitesize.h"
 #include "bitesize.skel.h"
 #include "trace_helpers.h"
+#include "map_helpers.h"
+#include "cgroup_helpers.h"
+
+#define MAX_ROWS	1024
 
 struct argument {
 	char *disk;
@@ -10,29 +14,38 @@ struct argument {
 	int comm_len;
 	time_t interval;
 	bool timestamp;
+	bool per_cgroup;
+	bool align;
 	int times;
 };
 
 static volatile bool verbose = false;
 static volatile sig_atomic_t exiting;
+static struct partitions *partitions;
+static struct cgroup_cache *cgroup_cache;
+static int nr_cpus;
 
 const char *argp_program_version = "bitesize 0.1";
 const char *argp_program_bug_address = "Jackie Liu <liuyun01@kylinos.cn>";
 const char argp_program_doc[] =
 "Summarize block device I/O size as a histogram.\n"
 "\n"
-"USAGE: bitesize [--help] [-T] [-c COMM] [-d DISK] [interval] [count]\n"
+"USAGE: bitesize [--help] [-T] [-C] [-A] [-c COMM] [-d DISK] [interval] [count]\n"
 "\n"
 "EXAMPLES:\n"
 "    bitesize              # summarize block I/O latency as a histogram\n"
 "    bitesize 1 10         # print 1 second summaries, 10 times\n"
 "    bitesize -T 1         # 1s summaries with timestamps\n"
-"    bitesize -c fio       # trace fio only\n";
+"    bitesize -c fio       # trace fio only\n"
+"    bitesize -C           # per cgroup instead of per process\n"
+"    bitesize -A -d sdc    # also show the offset alignment of I/O to sdc\n";
 
 static const struct argp_option opts[] = {
 	{ "timestamp", 'T', NULL, 0, "Include timestamp on output" },
 	{ "comm", 'c', "COMM", 0, "Trace this comm only" },
 	{ "disk", 'd', "DISK", 0, "Trace this disk only" },
+	{ "cgroups", 'C', NULL, 0, "Aggregate per cgroup instead of per process" },
+	{ "align", 'A', NULL, 0, "Print offset alignment histograms too" },
 	{ "verbose", 'v', NULL, 0, "Verbose debug output" },
 	{ NULL, 'h', NULL, OPTION_HIDDEN, "Show the full help" },
 	{}
@@ -65,6 +78,12 @@ static error_t parse_arg(int key, char *arg, struct argp_state *state)
 	case 'T':
 		argument->timestamp = true;
 		break;
+	case 'C':
+		argument->per_cgroup = true;
+		break;
+	case 'A':
+		argument->align = true;
+		break;
 	case ARGP_KEY_ARG:
 		errno = 0;
 		if (pos_args == 0) {
@@ -105,31 +124,109 @@ static void sig_handler(int sig)
 	exiting = 1;
 }
 
-static int print_log2_hists(int fd)
-{
-	struct hist_key lookup_key = {}, next_key;
+struct row {
+	struct hist_key key;
 	struct hist hist;
-	int err;
+};
+
+static int sort_bytes(const void *obj1, const void *obj2)
+{
+	const struct row *r1 = obj1, *r2 = obj2;
+
+	if (r1->hist.bytes == r2->hist.bytes)
+		return 0;
+	return r1->hist.bytes < r2->hist.bytes ? 1 : -1;
+}
+
+/* offsets that are a multiple of 512, 1K, ... 512K, and of 1M or more */
+static void print_align_hist(const __u32 *slots)
+{
+	static const char *units[] = { "", "K", "M" };
+	__u32 max_val = 0;
+	char label[16];
+	int i, stars;
+
+	for (i = 9; i < ALIGN_SLOTS; i++)
+		max_val = max(max_val, slots[i]);
+	if (!max_val)
+		return;
+
+	printf("%10s : %-10s |%-40s|\n", "alignment", "count", "distribution");
+	for (i = 9; i < ALIGN_SLOTS; i++) {
+		snprintf(label, sizeof(label), "%s%d%s",
+			 i == ALIGN_SLOTS - 1 ? ">=" : "", 1 << (i % 10),
+			 units[i / 10]);
+		stars = (__u64)slots[i] * 40 / max_val;
+		printf("%10s : %-10u |%-40.*s|\n", label, slots[i], stars,
+		       "****************************************");
+	}
+}
+
+static int print_log2_hists(struct bitesize_bpf *obj, struct argument *argument)
+{
+	static struct row rows[MAX_ROWS];
+	int fd = bpf_map__fd(obj->maps.hists);
+	int comms_fd = bpf_map__fd(obj->maps.comms);
+	struct hist values[nr_cpus];
+	struct hist_key *prev = NULL, key;
+	const struct partition *partition;
+	char comm[TASK_COMM_LEN];
+	const char *cgroup;
+	int i, j, cpu, n = 0;
+
+	while (n < MAX_ROWS && !bpf_map_get_next_key(fd, prev, &key)) {
+		rows[n].key = key;
+		prev = &rows[n].key;
+		n++;
+	}
+
+	for (i = 0, j = 0; i < n; i++) {
+		struct hist *h = &rows[j].hist;
+
+		key = rows[i].key;
+		if (bpf_map_lookup_elem(fd, &key, values))
+			continue;
+		bpf_map_delete_elem(fd, &key);
 
-	while (!bpf_map_get_next_key(fd, &lookup_key, &next_key)) {
-		err = bpf_map_lookup_elem(fd, &next_key, &hist);
-		if (err < 0) {
-			warning("Failed to lookup hist: %d\n", err);
-			return -1;
+		memset(h, 0, sizeof(*h));
+		rows[j].key = key;
+		for (cpu = 0; cpu < nr_cpus; cpu++) {
+			h->count += values[cpu].count;
+			h->bytes += values[cpu].bytes;
 		}
-		printf("\nProcess Name = %s\n", next_key.comm);
-		print_log2_hist(hist.slots, MAX_SLOTS, "Kbytes");
-		lookup_key = next_key;
+		percpu_sum_u32(h->slots, values[0].slots, MAX_SLOTS,
+			       sizeof(values[0]) / sizeof(__u32), nr_cpus);
+		percpu_sum_u32(h->align_slots, values[0].align_slots, ALIGN_SLOTS,
+			       sizeof(values[0]) / sizeof(__u32), nr_cpus);
+		j++;
 	}
 
-	memset(lookup_key.comm, '?', sizeof(lookup_key.comm));
-	while (!bpf_map_get_next_key(fd, &lookup_key, &next_key)) {
-		err = bpf_map_delete_elem(fd, &next_key);
-		if (err < 0) {
-			warning("Failed to cleanup hist : %d\n", err);
-			return -1;
+	qsort(rows, j, sizeof(*rows), sort_bytes);
+
+	for (i = 0; i < j; i++) {
+		key = rows[i].key;
+		partition = partitions__get_by_dev(partitions, key.dev);
+
+		if (argument->per_cgroup) {
+			cgroup = cgroup_cache ?
+				 cgroup_cache__get_path(cgroup_cache, key.cgroup_id) :
+				 NULL;
+			if (cgroup)
+				printf("\ncgroup = %s", cgroup);
+			else
+				printf("\ncgroup = %llu", key.cgroup_id);
+		} else {
+			if (bpf_map_lookup_elem(comms_fd, &key.tgid, comm))
+				strcpy(comm, "?");
+			printf("\nProcess Name = %s pid = %u", comm, key.tgid);
 		}
-		lookup_key = next_key;
+		printf(" disk = %s op = %c\n",
+		       partition ? partition->name : "Unknown", key.op);
+		printf("%llu I/O, %llu Kbytes\n", rows[i].hist.count,
+		       rows[i].hist.bytes / 1024);
+		print_log2_hist(rows[i].hist.slots, MAX_SLOTS, "Kbytes");
+		if (argument->align)
+			print_align_hist(rows[i].hist.align_slots);
 	}
 
 	return 0;
@@ -137,7 +234,6 @@ static int print_log2_hists(int fd)
 
 int main(int argc, char *argv[])
 {
-	struct partitions *partitions = NULL;
 	const struct partition *partition;
 	struct argument argument = {
 		.interval = 99999999,
@@ -160,6 +256,13 @@ int main(int argc, char *argv[])
 
 	libbpf_set_print(libbpf_print_fn);
 
+	nr_cpus = libbpf_num_possible_cpus();
+	if (nr_cpus < 0) {
+		warning("Failed to get # of possible cpus: '%s'!\n",
+			strerror(-nr_cpus));
+		return 1;
+	}
+
 	obj = bitesize_bpf__open();
 	if (!obj) {
 		warning("Failed to load partitions info\n");
@@ -188,6 +291,13 @@ int main(int argc, char *argv[])
 		obj->rodata->filter_dev = true;
 		obj->rodata->target_dev = partition->dev;
 	}
+	obj->rodata->target_per_cgroup = argument.per_cgroup;
+
+	if (argument.per_cgroup) {
+		cgroup_cache = cgroup_cache__new(NULL);
+		if (!cgroup_cache)
+			warning("Failed to read cgroup paths, showing ids\n");
+	}
 
 	err = bitesize_bpf__load(obj);
 	if (err) {
@@ -210,11 +320,11 @@ int main(int argc, char *argv[])
 		if (argument.timestamp) {
 			char ts[32];
 
-			strftime_now(ts, sizeof(ts), "%H:%H:%S");
+			strftime_now(ts, sizeof(ts), "%H:%M:%S");
 			printf("%-8s\n", ts);
 		}
 
-		err = print_log2_hists(bpf_map__fd(obj->maps.hists));
+		err = print_log2_hists(obj, &argument);
 		if (err < 0)
 			break;
 
@@ -225,6 +335,7 @@ int main(int argc, char *argv[])
 cleanup:
 	bitesize_bpf__destroy(obj);
 	partitions__free(partitions);
+	cgroup_cache__free(cgroup_cache);
 
 	return err != 0;
 }
@@ -5,17 +5,30 @@
 #define TASK_COMM_LEN	16
 #define DISK_NAME_LEN	32
 #define MAX_SLOTS	20
+#define ALIGN_SLOTS	21	/* log2 of the offset alignment, up to 1M */
+
+/* kernel macros, not in BTF */
+#define REQ_OP_BITS	8
+#define REQ_OP_MASK	((1 << REQ_OP_BITS) - 1)
 
 #define MINORBITS	20
 #define MINORMASK	((1U << MINORBITS) - 1)
 #define MKDEV(ma, mi)	(((ma) << MINORBITS) | (mi))
 
+/* either tgid or cgroup_id is set */
 struct hist_key {
-	char comm[TASK_COMM_LEN];
+	__u64 cgroup_id;
+	__u32 tgid;
+	__u32 dev;
+	char op;	/* R, W, F(lush), D(iscard) or O(ther) */
+	char pad[7];
 };
 
 struct hist {
+	__u64 count;
+	__u64 bytes;
 	__u32 slots[MAX_SLOTS];
+	__u32 align_slots[ALIGN_SLOTS];
 };
 
 #endif
@@ -0,0 +1,291 @@
+// SPDX-License-Identifier: GPL-2.0
+#include "vmlinux.h"
+#include <bpf/bpf_helpers.h>
+#include <bpf/bpf_core_read.h>
+#include <bpf/bpf_tracing.h>
+#include "blkqdepth.h"
+#include "bits.bpf.h"
+#include "maps.bpf.h"
+#include "core_fixes.bpf.h"
+
+#define MAX_ENTRIES	10240
+#define MAX_QUEUES	1024
+
+const volatile bool target_ms = false;
+const volatile bool filter_dev = false;
+const volatile __u32 target_dev = 0;
+
+extern __u32 LINUX_KERNEL_VERSION __kconfig;
+
+struct req_t {
+	u64 ts;			/* of insert, 0 if issued directly */
+	struct queue_key key;
+	bool issued;
+};
+
+struct {
+	__uint(type, BPF_MAP_TYPE_HASH);
+	__uint(max_entries, MAX_ENTRIES);
+	__type(key, struct request *);
+	__type(value, struct req_t);
+} reqs SEC(".maps");
+
+/* live counts, never drained */
+struct {
+	__uint(type, BPF_MAP_TYPE_HASH);
+	__uint(max_entries, MAX_QUEUES);
+	__type(key, struct queue_key);
+	__type(value, struct queue_state);
+} queues SEC(".maps");
+
+struct {
+	__uint(type, BPF_MAP_TYPE_PERCPU_HASH);
+	__uint(max_entries, MAX_QUEUES);
+	__type(key, struct queue_key);
+	__type(value, struct lat_hist);
+} lat_hists SEC(".maps");
+
+/* only written by the sampler, which runs on a single CPU */
+struct {
+	__uint(type, BPF_MAP_TYPE_HASH);
+	__uint(max_entries, MAX_QUEUES);
+	__type(key, struct queue_key);
+	__type(value, struct depth_hist);
+} depth_hists SEC(".maps");
+
+static const struct queue_state zero_state;
+static const struct lat_hist zero_lat;
+static const struct depth_hist zero_depth;
+
+static bool get_queue_key(struct request *rq, struct queue_key *key)
+{
+	struct gendisk *disk = get_disk(rq);
+
+	if (!disk)
+		return false;
+	key->dev = MKDEV(BPF_CORE_READ(disk, major),
+			 BPF_CORE_READ(disk, first_minor));
+	if (filter_dev && key->dev != target_dev)
+		return false;
+	key->hctx = BPF_CORE_READ(rq, mq_hctx, queue_num);
+	return true;
+}
+
+static struct queue_state *get_state(const struct queue_key *key)
+{
+	return bpf_map_lookup_or_try_init(&queues, key, &zero_state);
+}
+
+static int trace_rq_insert(struct request *rq)
+{
+	struct queue_state *statep;
+	struct req_t req = {};
+
+	if (!get_queue_key(rq, &req.key))
+		return 0;
+	statep = get_state(&req.key);
+	if (!statep)
+		return 0;
+
+	req.ts = bpf_ktime_get_ns();
+	if (bpf_map_update_elem(&reqs, &rq, &req, BPF_ANY))
+		return 0;
+	__sync_fetch_and_add(&statep->queued, 1);
+	return 0;
+}
+
+static int trace_rq_issue(struct request *rq)
+{
+	struct queue_state *statep;
+	struct lat_hist *histp;
+	struct req_t *reqp, req = {};
+	s64 delta;
+	u64 slot;
+
+	/* issued without going through insert, e.g. no I/O scheduler */
+	reqp = bpf_map_lookup_elem(&reqs, &rq);
+	if (!reqp) {
+		if (!get_queue_key(rq, &req.key))
+			return 0;
+		req.issued = true;
+		statep = get_state(&req.key);
+		if (!statep || bpf_map_update_elem(&reqs, &rq, &req, BPF_ANY))
+			return 0;
+		__sync_fetch_and_add(&statep->inflight, 1);
+		return 0;
+	}
+	if (reqp->issued)
+		return 0;
+
+	reqp->issued = true;
+	statep = bpf_map_lookup_elem(&queues, &reqp->key);
+	if (statep) {
+		__sync_fetch_and_add(&statep->queued, -1);
+		__sync_fetch_and_add(&statep->inflight, 1);
+	}
+
+	delta = (s64)(bpf_ktime_get_ns() - reqp->ts);
+	if (delta < 0)
+		return 0;
+	histp = bpf_map_lookup_or_try_init(&lat_hists, &reqp->key, &zero_lat);
+	if (!histp)
+		return 0;
+
+	delta /= target_ms ? 1000000U : 1000U;
+	slot = log2l(delta);
+	if (slot >= MAX_SLOTS)
+		slot = MAX_SLOTS - 1;
+	histp->slots[slot]++;
+	histp->count++;
+	histp->total += delta;
+	return 0;
+}
+
+/*
+ * completed, given back to the queue to be inserted again, or merged into
+ * another request in the I/O scheduler
+ */
+static int trace_rq_done(struct request *rq)
+{
+	struct queue_state *statep;
+	struct req_t *reqp;
+
+	reqp = bpf_map_lookup_elem(&reqs, &rq);
+	if (!reqp)
+		return 0;
+
+	statep = bpf_map_lookup_elem(&queues, &reqp->key);
+	if (statep) {
+		if (reqp->issued)
+			__sync_fetch_and_add(&statep->inflight, -1);
+		else
+			__sync_fetch_and_add(&statep->queued, -1);
+	}
+
+	bpf_map_delete_elem(&reqs, &rq);
+	return 0;
+}
+
+/*
+ * commit a54895fa057c ("block: remove the request_queue to argument
+ * request based tracepoints") (v5.11-rc1) changed the argument list from
+ * TP_PROTO(struct request_queue *q, struct request *rq) to
+ * TP_PROTO(struct request *rq)
+ */
+static struct request *rq_arg(__u64 *ctx)
+{
+	if (LINUX_KERNEL_VERSION < KERNEL_VERSION(5, 11, 0))
+		return (void *)ctx[1];
+	return (void *)ctx[0];
+}
+
+SEC("tp_btf/block_rq_insert")
+int BPF_PROG(block_rq_insert_btf)
+{
+	return trace_rq_insert(rq_arg(ctx));
+}
+
+SEC("tp_btf/block_rq_issue")
+int BPF_PROG(block_rq_issue_btf)
+{
+	return trace_rq_issue(rq_arg(ctx));
+}
+
+SEC("tp_btf/block_rq_requeue")
+int BPF_PROG(block_rq_requeue_btf)
+{
+	return trace_rq_done(rq_arg(ctx));
+}
+
+SEC("tp_btf/block_rq_complete")
+int BPF_PROG(block_rq_complete_btf, struct request *rq)
+{
+	return trace_rq_done(rq);
+}
+
+SEC("tp_btf/block_rq_merge")
+int BPF_PROG(block_rq_merge_btf)
+{
+	return trace_rq_done(rq_arg(ctx));
+}
+
+SEC("raw_tp/block_rq_insert")
+int BPF_PROG(block_rq_insert_raw)
+{
+	return trace_rq_insert(rq_arg(ctx));
+}
+
+SEC("raw_tp/block_rq_issue")
+int BPF_PROG(block_rq_issue_raw)
+{
+	return trace_rq_issue(rq_arg(ctx));
+}
+
+SEC("raw_tp/block_rq_requeue")
+int BPF_PROG(block_rq_requeue_raw)
+{
+	return trace_rq_done(rq_arg(ctx));
+}
+
+SEC("raw_tp/block_rq_complete")
+int BPF_PROG(block_rq_complete_raw, struct request *rq)
+{
+	return trace_rq_done(rq);
+}
+
+SEC("raw_tp/block_rq_merge")
+int BPF_PROG(block_rq_merge_raw)
+{
+	return trace_rq_done(rq_arg(ctx));
+}
+
+static long sample_queue(struct bpf_map *map, struct queue_key *key,
+			 struct queue_state *state, void *ctx)
+{
+	struct depth_hist *histp;
+	s64 queued, inflight;
+	u64 slot;
+
+	histp = bpf_map_lookup_or_try_init(&depth_hists, key, &zero_depth);
+	if (!histp)
+		return 0;
+
+	queued = state->queued;
+	inflight = state->inflight;
+	/* requests already in flight when tracing started aren't counted */
+	if (queued < 0)
+		queued = 0;
+	if (inflight < 0)
+		inflight = 0;
+
+	histp->samples++;
+	histp->queued_total += queued;
+	histp->inflight_total += inflight;
+	if (queued > histp->queued_max)
+		histp->queued_max = queued;
+	if (inflight > histp->inflight_max)
+		histp->inflight_max = inflight;
+
+	slot = log2l(queued);
+	if (slot >= DEPTH_SLOTS)
+		slot = DEPTH_SLOTS - 1;
+	histp->queued[slot]++;
+	slot = log2l(inflight);
+	if (slot >= DEPTH_SLOTS)
+		slot = DEPTH_SLOTS - 1;
+	histp->inflight[slot]++;
+	return 0;
+}
+
+/*
+ * Runs at a fixed rate on one CPU and samples the depth of every queue,
+ * so idle queues are sampled at depth 0 as often as busy ones.
+ */
+SEC("perf_event")
+int do_sample(struct bpf_perf_event_data *ctx)
+{
+	bpf_for_each_map_elem(&queues, sample_queue, NULL, 0);
+	return 0;
+}
+
+char LICENSE[] SEC("license") = "GPL";
@@ -0,0 +1,405 @@
+// SPDX-License-Identifier: (LGPL-2.1 OR BSD-2-Clause)
+#include "commons.h"
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include "blkqdepth.h"
+#include "blkqdepth.skel.h"
+#include "btf_helpers.h"
+#include "trace_helpers.h"
+#include "map_helpers.h"
+
+#define MAX_ROWS	1024
+
+static struct env {
+	char *disk;
+	bool milliseconds;
+	bool summary;
+	bool timestamp;
+	int freq;
+	time_t interval;
+	int times;
+	bool verbose;
+} env = {
+	.freq = 99,
+	.interval = 99999999,
+	.times = 99999999,
+};
+
+static volatile sig_atomic_t exiting;
+static int nr_cpus;
+
+const char *argp_program_version = "blkqdepth 0.1";
+const char *argp_program_bug_address = "Jackie Liu <liuyun01@kylinos.cn>";
+const char argp_program_doc[] =
+"Summarize blk-mq hardware queue depths and dispatch latency.\n"
+"\n"
+"USAGE: blkqdepth [--help] [-T] [-m] [-s] [-f FREQUENCY] [-d DISK]\n"
+"                 [interval] [count]\n"
+"\n"
+"EXAMPLES:\n"
+"    blkqdepth              # depth and insert->issue histograms per queue\n"
+"    blkqdepth 1 10         # print 1 second summaries, 10 times\n"
+"    blkqdepth -s 1         # one line per queue every second\n"
+"    blkqdepth -d nvme0n1   # trace nvme0n1 only\n"
+"    blkqdepth -f 999       # sample depths at 999Hz\n";
+
+static const struct argp_option opts[] = {
+	{ "disk", 'd', "DISK", 0, "Trace this disk only" },
+	{ "frequency", 'f', "FREQUENCY", 0, "Sample depths with a certain frequency" },
+	{ "milliseconds", 'm', NULL, 0, "Millisecond histograms" },
+	{ "summary", 's', NULL, 0, "Print a summary line per queue instead" },
+	{ "timestamp", 'T', NULL, 0, "Include timestamp on output" },
+	{ "verbose", 'v', NULL, 0, "Verbose debug output" },
+	{ NULL, 'h', NULL, OPTION_HIDDEN, "Show the full help" },
+	{},
+};
+
+static error_t parse_arg(int key, char *arg, struct argp_state *state)
+{
+	static int pos_args;
+
+	switch (key) {
+	case 'h':
+		argp_state_help(state, stderr, ARGP_HELP_STD_HELP);
+		break;
+	case 'v':
+		env.verbose = true;
+		break;
+	case 'd':
+		env.disk = arg;
+		if (strlen(arg) + 1 > DISK_NAME_LEN) {
+			warning("Invalid disk name: too long\n");
+			argp_usage(state);
+		}
+		break;
+	case 'f':
+		env.freq = argp_parse_long(key, arg, state);
+		if (env.freq <= 0) {
+			warning("Invalid freq (in hz): %s\n", arg);
+			argp_usage(state);
+		}
+		break;
+	case 'm':
+		env.milliseconds = true;
+		break;
+	case 's':
+		env.summary = true;
+		break;
+	case 'T':
+		env.timestamp = true;
+		break;
+	case ARGP_KEY_ARG:
+		errno = 0;
+		if (pos_args == 0) {
+			env.interval = strtol(arg, NULL, 10);
+			if (errno || env.interval <= 0) {
+				warning("Invalid interval\n");
+				argp_usage(state);
+			}
+		} else if (pos_args == 1) {
+			env.times = strtol(arg, NULL, 10);
+			if (errno || env.times <= 0) {
+				warning("Invalid times\n");
+				argp_usage(state);
+			}
+		} else {
+			warning("Unrecognized positional argument: %s\n", arg);
+			argp_usage(state);
+		}
+		pos_args++;
+		break;
+	default:
+		return ARGP_ERR_UNKNOWN;
+	}
+	return 0;
+}
+
+static int libbpf_print_fn(enum libbpf_print_level level, const char *format,
+			   va_list args)
+{
+	if (level == LIBBPF_DEBUG && !env.verbose)
+		return 0;
+	return vfprintf(stderr, format, args);
+}
+
+static void sig_handler(int sig)
+{
+	exiting = 1;
+}
+
+/*
+ * The sampler walks every queue, so it only runs on the first online CPU:
+ * more CPUs would only sample the same counts again.
+ */
+static struct bpf_link *attach_perf_event(int freq, struct bpf_program *prog)
+{
+	struct perf_event_attr attr = {
+		.type = PERF_TYPE_SOFTWARE,
+		.freq = 1,
+		.sample_period = freq,
+		.config = PERF_COUNT_SW_CPU_CLOCK,
+	};
+	struct bpf_link *link;
+	int cpu, fd;
+
+	for (cpu = 0; cpu < nr_cpus; cpu++) {
+		fd = syscall(__NR_perf_event_open, &attr, -1, cpu, -1, 0);
+		if (fd < 0) {
+			/* Ignore CPU that is offline */
+			if (errno == ENODEV)
+				continue;
+			warning("Failed to init perf sampling: %s\n", strerror(errno));
+			return NULL;
+		}
+
+		link = bpf_program__attach_perf_event(prog, fd);
+		if (!link) {
+			warning("Failed to attach perf event on cpu#%d!\n", cpu);
+			close(fd);
+		}
+		return link;
+	}
+
+	warning("No online CPU to sample on\n");
+	return NULL;
+}
+
+struct row {
+	struct queue_key key;
+	struct lat_hist lat;
+	struct depth_hist depth;
+};
+
+static int sort_key(const void *obj1, const void *obj2)
+{
+	const struct row *r1 = obj1, *r2 = obj2;
+
+	if (r1->key.dev != r2->key.dev)
+		return r1->key.dev < r2->key.dev ? -1 : 1;
+	if (r1->key.hctx != r2->key.hctx)
+		return r1->key.hctx < r2->key.hctx ? -1 : 1;
+	return 0;
+}
+
+static void print_summary_header(void)
+{
+	printf("%-10s %4s %8s %8s %8s %8s %8s %8s %8s\n", "DISK", "HCTX",
+	       "IOS", "DISP_AVG", "DISP_P99", "INF_AVG", "INF_MAX",
+	       "Q_AVG", "Q_MAX");
+}
+
+static void print_summary(const char *disk, struct row *r)
+{
+	__u64 samples = max(r->depth.samples, 1ULL);
+
+	printf("%-10s %4u %8llu %8.1f %8llu %8.1f %8u %8.1f %8u\n",
+	       disk, r->key.hctx, r->lat.count,
+	       (double)r->lat.total / max(r->lat.count, 1ULL),
+	       log2_hist_percentile(r->lat.slots, MAX_SLOTS, 99),
+	       (double)r->depth.inflight_total / samples,
+	       r->depth.inflight_max,
+	       (double)r->depth.queued_total / samples,
+	       r->depth.queued_max);
+}
+
+static void print_hists(const char *disk, struct row *r)
+{
+	const char *units = env.milliseconds ? "msecs" : "usecs";
+
+	printf("\ndisk = %s hctx = %u\n", disk, r->key.hctx);
+	printf("in flight, %llu samples\n", r->depth.samples);
+	print_log2_hist(r->depth.inflight, DEPTH_SLOTS, "depth");
+	if (r->depth.queued_max) {
+		printf("queued in the I/O scheduler\n");
+		print_log2_hist(r->depth.queued, DEPTH_SLOTS, "depth");
+	}
+	if (r->lat.count) {
+		printf("insert to issue latency, %llu requests\n", r->lat.count);
+		print_log2_hist(r->lat.slots, MAX_SLOTS, units);
+	}
+}
+
+static int print_queues(struct blkqdepth_bpf *obj, struct partitions *partitions)
+{
+	static struct row rows[MAX_ROWS];
+	int qfd = bpf_map__fd(obj->maps.queues);
+	int lfd = bpf_map__fd(obj->maps.lat_hists);
+	int dfd = bpf_map__fd(obj->maps.depth_hists);
+	struct lat_hist values[nr_cpus];
+	struct queue_key *prev = NULL;
+	const struct partition *partition;
+	const char *disk;
+	int i, cpu, n = 0;
+
+	/* queues are never removed, walking them doesn't need to restart */
+	while (n < MAX_ROWS && !bpf_map_get_next_key(qfd, prev, &rows[n].key)) {
+		prev = &rows[n].key;
+		n++;
+	}
+
+	for (i = 0; i < n; i++) {
+		struct row *r = &rows[i];
+
+		memset(&r->lat, 0, sizeof(r->lat));
+		if (!bpf_map_lookup_elem(lfd, &r->key, values)) {
+			bpf_map_delete_elem(lfd, &r->key);
+			for (cpu = 0; cpu < nr_cpus; cpu++) {
+				r->lat.count += values[cpu].count;
+				r->lat.total += values[cpu].total;
+			}
+			percpu_sum_u32(r->lat.slots, values[0].slots, MAX_SLOTS,
+				       sizeof(values[0]) / sizeof(__u32), nr_cpus);
+		}
+
+		memset(&r->depth, 0, sizeof(r->depth));
+		if (!bpf_map_lookup_elem(dfd, &r->key, &r->depth))
+			bpf_map_delete_elem(dfd, &r->key);
+	}
+
+	qsort(rows, n, sizeof(*rows), sort_key);
+
+	if (env.summary)
+		print_summary_header();
+	for (i = 0; i < n; i++) {
+		partition = partitions__get_by_dev(partitions, rows[i].key.dev);
+		disk = partition ? partition->name : "Unknown";
+		if (env.summary)
+			print_summary(disk, &rows[i]);
+		else
+			print_hists(disk, &rows[i]);
+	}
+
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	LIBBPF_OPTS(bpf_object_open_opts, open_opts);
+	static const struct argp argp = {
+		.options = opts,
+		.parser = parse_arg,
+		.doc = argp_program_doc,
+	};
+	struct partitions *partitions = NULL;
+	const struct partition *partition;
+	struct bpf_link *sample_link = NULL;
+	struct blkqdepth_bpf *obj;
+	char ts[32];
+	int err;
+
+	err = argp_parse(&argp, argc, argv, 0, NULL, NULL);
+	if (err)
+		return err;
+
+	if (!bpf_is_root())
+		return 1;
+
+	libbpf_set_print(libbpf_print_fn);
+
+	nr_cpus = libbpf_num_possible_cpus();
+	if (nr_cpus < 0) {
+		warning("Failed to get # of possible cpus: '%s'!\n",
+			strerror(-nr_cpus));
+		return 1;
+	}
+
+	err = ensure_core_btf(&open_opts);
+	if (err) {
+		warning("Failed to fetch necessary BTF for CO-RE: %s\n",
+			strerror(-err));
+		return 1;
+	}
+
+	obj = blkqdepth_bpf__open_opts(&open_opts);
+	if (!obj) {
+		warning("Failed to open BPF object\n");
+		return 1;
+	}
+
+	partitions = partitions__load();
+	if (!partitions) {
+		warning("Failed to load partitions info\n");
+		err = 1;
+		goto cleanup;
+	}
+
+	if (env.disk) {
+		partition = partitions__get_by_name(partitions, env.disk);
+		if (!partition) {
+			warning("Invalid partition name: %s not exist\n", env.disk);
+			err = 1;
+			goto cleanup;
+		}
+		obj->rodata->filter_dev = true;
+		obj->rodata->target_dev = partition->dev;
+	}
+
+	obj->rodata->target_ms = env.milliseconds;
+
+	if (probe_tp_btf("block_rq_insert")) {
+		bpf_program__set_autoload(obj->progs.block_rq_insert_raw, false);
+		bpf_program__set_autoload(obj->progs.block_rq_issue_raw, false);
+		bpf_program__set_autoload(obj->progs.block_rq_requeue_raw, false);
+		bpf_program__set_autoload(obj->progs.block_rq_complete_raw, false);
+		bpf_program__set_autoload(obj->progs.block_rq_merge_raw, false);
+	} else {
+		bpf_program__set_autoload(obj->progs.block_rq_insert_btf, false);
+		bpf_program__set_autoload(obj->progs.block_rq_issue_btf, false);
+		bpf_program__set_autoload(obj->progs.block_rq_requeue_btf, false);
+		bpf_program__set_autoload(obj->progs.block_rq_complete_btf, false);
+		bpf_program__set_autoload(obj->progs.block_rq_merge_btf, false);
+	}
+	/* block_rq_merge is missing on older kernels */
+	if (!tracepoint_exists("block", "block_rq_merge")) {
+		bpf_program__set_autoload(obj->progs.block_rq_merge_btf, false);
+		bpf_program__set_autoload(obj->progs.block_rq_merge_raw, false);
+	}
+
+	err = blkqdepth_bpf__load(obj);
+	if (err) {
+		warning("Failed to load BPF object: %d\n", err);
+		goto cleanup;
+	}
+
+	err = blkqdepth_bpf__attach(obj);
+	if (err) {
+		warning("Failed to attach BPF programs: %d\n", err);
+		goto cleanup;
+	}
+
+	sample_link = attach_perf_event(env.freq, obj->progs.do_sample);
+	if (!sample_link) {
+		err = 1;
+		goto cleanup;
+	}
+
+	signal(SIGINT, sig_handler);
+
+	printf("Tracing blk-mq hardware queues... Hit Ctrl-C to end.\n");
+
+	/* Main loop */
+	for (;;) {
+		sleep(env.interval);
+		printf("\n");
+
+		if (env.timestamp) {
+			strftime_now(ts, sizeof(ts), "%H:%M:%S");
+			printf("%-8s\n", ts);
+		}
+
+		err = print_queues(obj, partitions);
+		if (err)
+			break;
+
+		if (exiting || --env.times == 0)
+			break;
+	}
+
+cleanup:
+	bpf_link__destroy(sample_link);
+	blkqdepth_bpf__destroy(obj);
+	partitions__free(partitions);
+	cleanup_core_btf(&open_opts);
+
+	return err != 0;
+}
@@ -0,0 +1,43 @@
+// SPDX-License-Identifier: (LGPL-2.1 OR BSD-2-Clause)
+#ifndef __BLKQDEPTH_H
+#define __BLKQDEPTH_H
+
+#define DISK_NAME_LEN	32
+#define MAX_SLOTS	27
+#define DEPTH_SLOTS	17	/* log2, depths from 65536 share the last slot */
+
+#define MINORBITS	20
+#define MINORMASK	((1U << MINORBITS) - 1)
+#define MKDEV(ma, mi)	(((ma) << MINORBITS) | (mi))
+
+/* a blk-mq hardware queue */
+struct queue_key {
+	__u32 dev;
+	__u32 hctx;
+};
+
+/* requests inserted and not issued yet, and issued and not completed */
+struct queue_state {
+	__s64 queued;
+	__s64 inflight;
+};
+
+/* insert to issue latency */
+struct lat_hist {
+	__u64 count;
+	__u64 total;
+	__u32 slots[MAX_SLOTS];
+};
+
+/* depths seen by the sampler, exact totals and maximums besides the slots */
+struct depth_hist {
+	__u64 samples;
+	__u64 queued_total;
+	__u64 inflight_total;
+	__u32 queued_max;
+	__u32 inflight_max;
+	__u32 queued[DEPTH_SLOTS];
+	__u32 inflight[DEPTH_SLOTS];
+};
+
+#endif /* __BLKQDEPTH_H */
@@ -0,0 +1,193 @@
+// SPDX-License-Identifier: GPL-2.0
+#include "vmlinux.h"
+#include <bpf/bpf_helpers.h>
+#include <bpf/bpf_core_read.h>
+#include <bpf/bpf_tracing.h>
+#include "cfsthrottle.h"
+#include "bits.bpf.h"
+#include "maps.bpf.h"
+#include "core_fixes.bpf.h"
+
+/* depth of nested groups walked to find a runnable task */
+#define MAX_DEPTH	8
+
+const volatile bool targ_ms = false;
+const volatile bool targ_tasks = false;
+
+/* throttled cfs_rq -> throttle time */
+struct {
+	__uint(type, BPF_MAP_TYPE_HASH);
+	__uint(max_entries, MAX_ENTRIES);
+	__type(key, u64);
+	__type(value, u64);
+} start SEC(".maps");
+
+/* kprobe fallback only, thread in throttle_cfs_rq() -> its cfs_rq */
+struct {
+	__uint(type, BPF_MAP_TYPE_HASH);
+	__uint(max_entries, MAX_ENTRIES);
+	__type(key, u32);
+	__type(value, u64);
+} args SEC(".maps");
+
+struct {
+	__uint(type, BPF_MAP_TYPE_PERCPU_HASH);
+	__uint(max_entries, MAX_ENTRIES);
+	__type(key, u64);
+	__type(value, struct cg_stat);
+} cg_stats SEC(".maps");
+
+struct {
+	__uint(type, BPF_MAP_TYPE_PERCPU_HASH);
+	__uint(max_entries, MAX_ENTRIES);
+	__type(key, struct task_key);
+	__type(value, struct task_stat);
+} task_stats SEC(".maps");
+
+static const struct cg_stat zero_cg;
+static const struct task_stat zero_task;
+
+static __always_inline u64 cfs_rq_cgroup_id(struct cfs_rq *cfs_rq)
+{
+	return get_kernfs_node_id(BPF_CORE_READ(cfs_rq, tg, css.cgroup, kn));
+}
+
+/* the running entity of a cfs_rq, or the next one to run */
+static __always_inline struct sched_entity *pick_entity(struct cfs_rq *cfs_rq)
+{
+	struct sched_entity *se = BPF_CORE_READ(cfs_rq, curr);
+	struct rb_node *node;
+
+	if (se)
+		return se;
+	node = BPF_CORE_READ(cfs_rq, tasks_timeline.rb_leftmost);
+	if (!node)
+		return NULL;
+	return (void *)node - bpf_core_field_offset(struct sched_entity, run_node);
+}
+
+/*
+ * Charge the throttle to the task that was running in the group, or that
+ * would have run next, descending into child groups until a task entity.
+ */
+static __always_inline void account_task(u64 cgroup_id, struct cfs_rq *cfs_rq)
+{
+	struct task_key key = { .cgroup_id = cgroup_id };
+	struct sched_entity *se = pick_entity(cfs_rq);
+	struct task_struct *task;
+	struct task_stat *stat;
+	struct cfs_rq *my_q;
+
+	for (int i = 0; i < MAX_DEPTH && se; i++) {
+		my_q = BPF_CORE_READ(se, my_q);
+		if (my_q) {
+			se = pick_entity(my_q);
+			continue;
+		}
+
+		task = (void *)se - bpf_core_field_offset(struct task_struct, se);
+		key.pid = BPF_CORE_READ(task, pid);
+		stat = bpf_map_lookup_or_try_init(&task_stats, &key, &zero_task);
+		if (!stat)
+			return;
+		stat->throttles++;
+		if (!stat->comm[0])
+			BPF_CORE_READ_STR_INTO(&stat->comm, task, comm);
+		return;
+	}
+}
+
+static __always_inline int throttle_exit(struct cfs_rq *cfs_rq)
+{
+	u64 cgroup_id, ts, rq = (u64)cfs_rq;
+	struct cg_stat *stat;
+
+	/* on recent kernels throttle_cfs_rq() may find runtime and bail out */
+	if (!BPF_CORE_READ(cfs_rq, throttled))
+		return 0;
+
+	ts = bpf_ktime_get_ns();
+	bpf_map_update_elem(&start, &rq, &ts, BPF_ANY);
+
+	cgroup_id = cfs_rq_cgroup_id(cfs_rq);
+	stat = bpf_map_lookup_or_try_init(&cg_stats, &cgroup_id, &zero_cg);
+	if (!stat)
+		return 0;
+	stat->throttles++;
+	stat->queued += get_cfs_rq_nr_queued(cfs_rq);
+
+	if (targ_tasks)
+		account_task(cgroup_id, cfs_rq);
+	return 0;
+}
+
+static __always_inline int unthrottle_entry(struct cfs_rq *cfs_rq)
+{
+	u64 cgroup_id, delta, slot, rq = (u64)cfs_rq;
+	struct cg_stat *stat;
+	u64 *tsp;
+
+	tsp = bpf_map_lookup_elem(&start, &rq);
+	if (!tsp)
+		return 0;
+	delta = bpf_ktime_get_ns() - *tsp;
+	bpf_map_delete_elem(&start, &rq);
+
+	cgroup_id = cfs_rq_cgroup_id(cfs_rq);
+	stat = bpf_map_lookup_or_try_init(&cg_stats, &cgroup_id, &zero_cg);
+	if (!stat)
+		return 0;
+	stat->unthrottles++;
+	stat->throttled_ns += delta;
+
+	delta /= targ_ms ? 1000000U : 1000U;
+	slot = log2l(delta);
+	if (slot >= MAX_SLOTS)
+		slot = MAX_SLOTS - 1;
+	stat->slots[slot]++;
+	return 0;
+}
+
+SEC("fexit/throttle_cfs_rq")
+int BPF_PROG(fexit_throttle_cfs_rq, struct cfs_rq *cfs_rq)
+{
+	return throttle_exit(cfs_rq);
+}
+
+SEC("fentry/unthrottle_cfs_rq")
+int BPF_PROG(fentry_unthrottle_cfs_rq, struct cfs_rq *cfs_rq)
+{
+	return unthrottle_entry(cfs_rq);
+}
+
+SEC("kprobe/throttle_cfs_rq")
+int BPF_KPROBE(kprobe_throttle_cfs_rq, struct cfs_rq *cfs_rq)
+{
+	u32 tid = (u32)bpf_get_current_pid_tgid();
+	u64 rq = (u64)cfs_rq;
+
+	bpf_map_update_elem(&args, &tid, &rq, BPF_ANY);
+	return 0;
+}
+
+SEC("kretprobe/throttle_cfs_rq")
+int BPF_KRETPROBE(kretprobe_throttle_cfs_rq)
+{
+	u32 tid = (u32)bpf_get_current_pid_tgid();
+	u64 *rq;
+
+	rq = bpf_map_lookup_elem(&args, &tid);
+	if (!rq)
+		return 0;
+	throttle_exit((struct cfs_rq *)*rq);
+	bpf_map_delete_elem(&args, &tid);
+	return 0;
+}
+
+SEC("kprobe/unthrottle_cfs_rq")
+int BPF_KPROBE(kprobe_unthrottle_cfs_rq, struct cfs_rq *cfs_rq)
+{
+	return unthrottle_entry(cfs_rq);
+}
+
+char LICENSE[] SEC("license") = "GPL";
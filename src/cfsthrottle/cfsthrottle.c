@@ -0,0 +1,393 @@
+// SPDX-License-Identifier: (LGPL-2.1 OR BSD-2-Clause)
+#include "commons.h"
+#include "cfsthrottle.h"
+#include "cfsthrottle.skel.h"
+#include "btf_helpers.h"
+#include "trace_helpers.h"
+#include "map_helpers.h"
+#include "cgroup_helpers.h"
+
+#define MAX_ROWS	20
+#define MAX_TASKS	3
+
+struct env {
+	bool milliseconds;
+	bool distributed;
+	bool tasks;
+	time_t interval;
+	int times;
+	bool timestamp;
+	bool verbose;
+} env = {
+	.interval = 99999999,
+	.times = 99999999,
+};
+
+static volatile sig_atomic_t exiting;
+static struct cgroup_cache *cgroup_cache;
+static int nr_cpus;
+
+const char *argp_program_version = "cfsthrottle 0.1";
+const char *argp_program_bug_address = "Jackie Liu <liuyun01@kylinos.cn>";
+const char argp_program_doc[] =
+"Summarize CFS bandwidth throttling per cgroup.\n"
+"\n"
+"USAGE: cfsthrottle [--help] [-T] [-m] [-d] [-t] [interval] [count]\n"
+"\n"
+"Each CPU's runqueue of a group is throttled separately, so THROTTLES\n"
+"counts per-CPU throttles and THROTTLED is the CPU time spent throttled.\n"
+"\n"
+"EXAMPLES:\n"
+"    cfsthrottle         # summarize throttling until Ctrl-C\n"
+"    cfsthrottle 1 10    # print 1 second summaries, 10 times\n"
+"    cfsthrottle -d      # show throttled durations as histograms\n"
+"    cfsthrottle -t 5    # 5s summaries with the tasks that got throttled\n"
+"    cfsthrottle -mT 1   # millisecond histograms and timestamps\n";
+
+static const struct argp_option opts[] = {
+	{ "milliseconds", 'm', NULL, 0, "Millisecond histograms" },
+	{ "distributed", 'd', NULL, 0, "Show throttled durations as histograms" },
+	{ "tasks", 't', NULL, 0, "Show the tasks runnable when throttled" },
+	{ "timestamp", 'T', NULL, 0, "Include timestamp on output" },
+	{ "verbose", 'v', NULL, 0, "Verbose debug output" },
+	{ NULL, 'h', NULL, OPTION_HIDDEN, "Show the full help" },
+	{},
+};
+
+static error_t parse_arg(int key, char *arg, struct argp_state *state)
+{
+	static int pos_args;
+
+	switch (key) {
+	case 'h':
+		argp_state_help(state, stderr, ARGP_HELP_STD_HELP);
+		break;
+	case 'v':
+		env.verbose = true;
+		break;
+	case 'm':
+		env.milliseconds = true;
+		break;
+	case 'd':
+		env.distributed = true;
+		break;
+	case 't':
+		env.tasks = true;
+		break;
+	case 'T':
+		env.timestamp = true;
+		break;
+	case ARGP_KEY_ARG:
+		errno = 0;
+		if (pos_args == 0) {
+			env.interval = strtol(arg, NULL, 10);
+			if (errno || env.interval <= 0) {
+				warning("Invalid interval\n");
+				argp_usage(state);
+			}
+		} else if (pos_args == 1) {
+			env.times = strtol(arg, NULL, 10);
+			if (errno || env.times <= 0) {
+				warning("Invalid times\n");
+				argp_usage(state);
+			}
+		} else {
+			warning("Unrecognized positional argument: %s\n", arg);
+			argp_usage(state);
+		}
+		pos_args++;
+		break;
+	default:
+		return ARGP_ERR_UNKNOWN;
+	}
+	return 0;
+}
+
+static int libbpf_print_fn(enum libbpf_print_level level, const char *format, va_list args)
+{
+	if (level == LIBBPF_DEBUG && !env.verbose)
+		return 0;
+	return vfprintf(stderr, format, args);
+}
+
+static void sig_handler(int sig)
+{
+	exiting = 1;
+}
+
+struct cg_row {
+	__u64 cgroup_id;
+	struct cg_stat stat;
+};
+
+struct task_row {
+	struct task_key key;
+	struct task_stat stat;
+};
+
+static struct cg_row cg_rows[MAX_ENTRIES];
+static struct task_row task_rows[MAX_ENTRIES];
+static int nr_cg_rows, nr_task_rows;
+
+static int sort_throttled(const void *obj1, const void *obj2)
+{
+	const struct cg_row *r1 = obj1, *r2 = obj2;
+
+	if (r1->stat.throttled_ns == r2->stat.throttled_ns)
+		return 0;
+	return r1->stat.throttled_ns < r2->stat.throttled_ns ? 1 : -1;
+}
+
+static int sort_task_throttles(const void *obj1, const void *obj2)
+{
+	const struct task_row *r1 = obj1, *r2 = obj2;
+
+	if (r1->stat.throttles == r2->stat.throttles)
+		return 0;
+	return r1->stat.throttles < r2->stat.throttles ? 1 : -1;
+}
+
+static int read_cg_stats(int fd)
+{
+	struct cg_stat values[nr_cpus];
+	__u64 *prev = NULL, key;
+	int i, cpu, n = 0;
+
+	while (n < MAX_ENTRIES && !bpf_map_get_next_key(fd, prev, &key)) {
+		cg_rows[n].cgroup_id = key;
+		prev = &cg_rows[n].cgroup_id;
+		n++;
+	}
+
+	nr_cg_rows = 0;
+	for (i = 0; i < n; i++) {
+		struct cg_row *r = &cg_rows[nr_cg_rows];
+
+		key = cg_rows[i].cgroup_id;
+		if (bpf_map_lookup_elem(fd, &key, values))
+			continue;
+		bpf_map_delete_elem(fd, &key);
+
+		memset(r, 0, sizeof(*r));
+		r->cgroup_id = key;
+		for (cpu = 0; cpu < nr_cpus; cpu++) {
+			r->stat.throttles += values[cpu].throttles;
+			r->stat.unthrottles += values[cpu].unthrottles;
+			r->stat.throttled_ns += values[cpu].throttled_ns;
+			r->stat.queued += values[cpu].queued;
+		}
+		percpu_sum_u32(r->stat.slots, values[0].slots, MAX_SLOTS,
+			       sizeof(values[0]) / sizeof(__u32), nr_cpus);
+		nr_cg_rows++;
+	}
+
+	qsort(cg_rows, nr_cg_rows, sizeof(*cg_rows), sort_throttled);
+	return 0;
+}
+
+static int read_task_stats(int fd)
+{
+	struct task_stat values[nr_cpus];
+	struct task_key *prev = NULL, key;
+	int i, cpu, n = 0;
+
+	while (n < MAX_ENTRIES && !bpf_map_get_next_key(fd, prev, &key)) {
+		task_rows[n].key = key;
+		prev = &task_rows[n].key;
+		n++;
+	}
+
+	nr_task_rows = 0;
+	for (i = 0; i < n; i++) {
+		struct task_row *r = &task_rows[nr_task_rows];
+
+		key = task_rows[i].key;
+		if (bpf_map_lookup_elem(fd, &key, values))
+			continue;
+		bpf_map_delete_elem(fd, &key);
+
+		memset(r, 0, sizeof(*r));
+		r->key = key;
+		for (cpu = 0; cpu < nr_cpus; cpu++) {
+			r->stat.throttles += values[cpu].throttles;
+			if (values[cpu].comm[0])
+				memcpy(r->stat.comm, values[cpu].comm, sizeof(r->stat.comm));
+		}
+		nr_task_rows++;
+	}
+
+	qsort(task_rows, nr_task_rows, sizeof(*task_rows), sort_task_throttles);
+	return 0;
+}
+
+static void print_cgroup_name(__u64 cgroup_id, int width)
+{
+	const char *path = cgroup_cache ?
+			   cgroup_cache__get_path(cgroup_cache, cgroup_id) : NULL;
+
+	if (path)
+		printf("%-*s", width, path);
+	else
+		printf("%-*llu", width, cgroup_id);
+}
+
+/* the tasks list is sorted, so print the first MAX_TASKS of the group */
+static void print_tasks(__u64 cgroup_id)
+{
+	int i, n = 0;
+
+	for (i = 0; i < nr_task_rows && n < MAX_TASKS; i++) {
+		if (task_rows[i].key.cgroup_id != cgroup_id)
+			continue;
+		printf("    %-7u %-16s %llu\n", task_rows[i].key.pid,
+		       task_rows[i].stat.comm, task_rows[i].stat.throttles);
+		n++;
+	}
+}
+
+static int print_stats(struct cfsthrottle_bpf *obj)
+{
+	const char *units = env.milliseconds ? "msecs" : "usecs";
+	struct cg_row *r;
+	__u64 n;
+	int i;
+
+	read_cg_stats(bpf_map__fd(obj->maps.cg_stats));
+	if (env.tasks)
+		read_task_stats(bpf_map__fd(obj->maps.task_stats));
+
+	if (!env.distributed)
+		printf("%-40s %9s %13s %10s %10s %7s\n", "CGROUP", "THROTTLES",
+		       "THROTTLED(ms)", "AVG(us)", env.milliseconds ? "P99(ms)" : "P99(us)",
+		       "QUEUED");
+
+	for (i = 0; i < nr_cg_rows && i < MAX_ROWS; i++) {
+		r = &cg_rows[i];
+		n = max(r->stat.unthrottles, 1ULL);
+
+		if (env.distributed) {
+			printf("\ncgroup = ");
+			print_cgroup_name(r->cgroup_id, 0);
+			printf(", %llu throttles\n", r->stat.throttles);
+			print_log2_hist(r->stat.slots, MAX_SLOTS, units);
+		} else {
+			print_cgroup_name(r->cgroup_id, 40);
+			printf(" %9llu %13.1f %10.1f %10llu %7.1f\n",
+			       r->stat.throttles, r->stat.throttled_ns / 1e6,
+			       r->stat.throttled_ns / 1e3 / n,
+			       log2_hist_percentile(r->stat.slots, MAX_SLOTS, 99),
+			       (double)r->stat.queued / max(r->stat.throttles, 1ULL));
+		}
+
+		if (env.tasks) {
+			if (env.distributed)
+				printf("    %-7s %-16s %s\n", "PID", "COMM", "THROTTLES");
+			print_tasks(r->cgroup_id);
+		}
+	}
+
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	LIBBPF_OPTS(bpf_object_open_opts, open_opts);
+	static const struct argp argp = {
+		.options = opts,
+		.parser = parse_arg,
+		.doc = argp_program_doc,
+	};
+	struct cfsthrottle_bpf *obj;
+	char ts[32];
+	int err;
+
+	err = argp_parse(&argp, argc, argv, 0, NULL, NULL);
+	if (err)
+		return err;
+
+	if (!bpf_is_root())
+		return 1;
+
+	libbpf_set_print(libbpf_print_fn);
+
+	nr_cpus = libbpf_num_possible_cpus();
+	if (nr_cpus < 0) {
+		warning("Failed to get # of possible cpus: '%s'!\n",
+			strerror(-nr_cpus));
+		return 1;
+	}
+
+	err = ensure_core_btf(&open_opts);
+	if (err) {
+		warning("Failed to fetch necessary BTF for CO-RE: %s\n", strerror(-err));
+		return 1;
+	}
+
+	obj = cfsthrottle_bpf__open_opts(&open_opts);
+	if (!obj) {
+		warning("Failed to open BPF object\n");
+		return 1;
+	}
+
+	if (fentry_can_attach("throttle_cfs_rq", NULL) &&
+	    fentry_can_attach("unthrottle_cfs_rq", NULL)) {
+		bpf_program__set_autoload(obj->progs.kprobe_throttle_cfs_rq, false);
+		bpf_program__set_autoload(obj->progs.kretprobe_throttle_cfs_rq, false);
+		bpf_program__set_autoload(obj->progs.kprobe_unthrottle_cfs_rq, false);
+		bpf_map__set_max_entries(obj->maps.args, 1);
+	} else {
+		bpf_program__set_autoload(obj->progs.fexit_throttle_cfs_rq, false);
+		bpf_program__set_autoload(obj->progs.fentry_unthrottle_cfs_rq, false);
+	}
+
+	obj->rodata->targ_ms = env.milliseconds;
+	obj->rodata->targ_tasks = env.tasks;
+
+	if (!env.tasks)
+		bpf_map__set_max_entries(obj->maps.task_stats, 1);
+
+	err = cfsthrottle_bpf__load(obj);
+	if (err) {
+		warning("Failed to load BPF object: %d\n", err);
+		goto cleanup;
+	}
+
+	cgroup_cache = cgroup_cache__new(NULL);
+	if (!cgroup_cache)
+		warning("Failed to find cgroup2 mount, printing cgroup ids\n");
+
+	err = cfsthrottle_bpf__attach(obj);
+	if (err) {
+		warning("Failed to attach BPF programs: %d\n", err);
+		goto cleanup;
+	}
+
+	signal(SIGINT, sig_handler);
+
+	printf("Tracing CFS bandwidth throttling... Hit Ctrl-C to end.\n");
+
+	/* Main loop */
+	for (;;) {
+		sleep(env.interval);
+		printf("\n");
+
+		if (env.timestamp) {
+			strftime_now(ts, sizeof(ts), "%H:%M:%S");
+			printf("%-8s\n", ts);
+		}
+
+		err = print_stats(obj);
+		if (err)
+			break;
+
+		if (exiting || --env.times == 0)
+			break;
+	}
+
+cleanup:
+	cfsthrottle_bpf__destroy(obj);
+	cgroup_cache__free(cgroup_cache);
+	cleanup_core_btf(&open_opts);
+
+	return err != 0;
+}
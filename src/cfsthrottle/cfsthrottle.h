@@ -0,0 +1,34 @@
+// SPDX-License-Identifier: (LGPL-2.1 OR BSD-2-Clause)
+#ifndef __CFSTHROTTLE_H
+#define __CFSTHROTTLE_H
+
+#define TASK_COMM_LEN	16
+#define MAX_SLOTS	27
+#define MAX_ENTRIES	10240
+
+/*
+ * Per-CPU value keyed by cgroup id. Bandwidth control throttles the cfs_rq
+ * of a group on each CPU separately, so these count cfs_rq throttles and
+ * CPU time spent throttled, not wall time.
+ */
+struct cg_stat {
+	__u64 throttles;
+	__u64 unthrottles;
+	__u64 throttled_ns;
+	__u64 queued;		/* sum of tasks queued in the group at throttle */
+	__u32 slots[MAX_SLOTS];	/* throttled duration, usecs (msecs with -m) */
+};
+
+struct task_key {
+	__u64 cgroup_id;
+	__u32 pid;
+	__u32 pad;
+};
+
+/* a task that was runnable in a group when it got throttled */
+struct task_stat {
+	__u64 throttles;
+	char comm[TASK_COMM_LEN];
+};
+
+#endif /* __CFSTHROTTLE_H */
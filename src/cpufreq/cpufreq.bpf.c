@@ -5,12 +5,84 @@
 #include <bpf/bpf_tracing.h>
 #include "cpufreq.h"
 #include "maps.bpf.h"
+#include "core_fixes.bpf.h"
 
 __u32 freqs_mhz[MAX_CPU_NR] = {};
 static struct hist zero;
 struct hist syswide = {};
 bool filter_memcg = false;
 
+const volatile bool accounting = false;
+const volatile bool target_per_cgroup = false;
+/* per CPU frequency under which run time counts as throttled */
+__u32 low_mhz[MAX_CPU_NR] = {};
+struct cpu_state cpus[MAX_CPU_NR] = {};
+static const struct acct_value zero_acct;
+
+struct {
+	__uint(type, BPF_MAP_TYPE_PERCPU_HASH);
+	__uint(max_entries, MAX_ACCT_ENTRIES);
+	__type(key, struct acct_key);
+	__type(value, struct acct_value);
+} accts SEC(".maps");
+
+/*
+ * Charge the task running on *cpu* for the time since the last switch or
+ * frequency change there, at the frequency in effect during that time.
+ * A frequency change is usually reported from another CPU of the same
+ * policy, so updates of a CPU's state may race, which at worst charges a
+ * short stretch of time twice.
+ */
+static __always_inline void charge(u32 cpu, u64 now)
+{
+	struct cpu_state *s = &cpus[cpu];
+	struct acct_key key = {};
+	struct acct_value *val;
+	u64 delta;
+
+	if (!s->ts || !s->pid || now <= s->ts)
+		goto out;
+
+	if (target_per_cgroup)
+		key.cgroup_id = s->cgroup_id;
+	else
+		key.tgid = s->tgid;
+
+	val = bpf_map_lookup_or_try_init(&accts, &key, &zero_acct);
+	if (!val)
+		goto out;
+
+	delta = now - s->ts;
+	val->run_ns += delta;
+	val->mhz_ns += delta * freqs_mhz[cpu];
+	if (freqs_mhz[cpu] < low_mhz[cpu])
+		val->low_ns += delta;
+	if (!target_per_cgroup)
+		__builtin_memcpy(val->comm, s->comm, sizeof(val->comm));
+out:
+	s->ts = now;
+}
+
+static __always_inline int acct_switch(struct task_struct *next)
+{
+	u32 cpu = bpf_get_smp_processor_id();
+	struct cpu_state *s;
+
+	if (cpu >= MAX_CPU_NR)
+		return 0;
+
+	charge(cpu, bpf_ktime_get_ns());
+
+	s = &cpus[cpu];
+	s->pid = BPF_CORE_READ(next, pid);
+	s->tgid = BPF_CORE_READ(next, tgid);
+	if (target_per_cgroup)
+		s->cgroup_id = get_task_cgroup_id(next);
+	else
+		BPF_CORE_READ_STR_INTO(&s->comm, next, group_leader, comm);
+	return 0;
+}
+
 struct {
 	__uint(type, BPF_MAP_TYPE_CGROUP_ARRAY);
 	__type(key, u32);
@@ -33,6 +105,9 @@ static __always_inline int probe_cpu_frequency(unsigned int state, unsigned int
 	if (cpu_id >= MAX_CPU_NR)
 		return 0;
 
+	/* close the time slice at the old frequency */
+	if (accounting)
+		charge(cpu_id, bpf_ktime_get_ns());
 	freqs_mhz[cpu_id] = state / 1000;
 	return 0;
 }
@@ -50,6 +125,20 @@ int BPF_PROG(cpu_frequency_raw, unsigned int state, unsigned int cpu_id)
 	return probe_cpu_frequency(state, cpu_id);
 }
 
+SEC("tp_btf/sched_switch")
+int BPF_PROG(sched_switch_btf, bool preempt, struct task_struct *prev,
+	     struct task_struct *next)
+{
+	return acct_switch(next);
+}
+
+SEC("raw_tp/sched_switch")
+int BPF_PROG(sched_switch_raw, bool preempt, struct task_struct *prev,
+	     struct task_struct *next)
+{
+	return acct_switch(next);
+}
+
 SEC("perf_event")
 int do_sample(struct bpf_perf_event_data *ctx)
 {
@@ -3,6 +3,7 @@
 #include "cpufreq.h"
 #include "cpufreq.skel.h"
 #include "trace_helpers.h"
+#include "cgroup_helpers.h"
 #include <linux/perf_event.h>
 #include <sys/syscall.h>
 
@@ -12,28 +13,47 @@ static struct env {
 	int duration;
 	char *cgroupspath;
 	bool cg;
+	bool accounting;
+	bool per_cgroup;
+	int low_pct;
+	int interval;
 } env = {
 	.duration = -1,
 	.freq = 99,
+	.low_pct = 80,
+	.interval = 1,
 };
 
+static volatile sig_atomic_t exiting;
+static struct cgroup_cache *cgroup_cache;
+
 const char *argp_program_version = "cpufreq 0.1";
 const char *argp_program_bug_address = "Jackie Liu <liuyun01@kylinos.cn>";
 const char argp_program_doc[] =
 "Sampling CPU freq system-wide & by process. Ctrl-C to end.\n"
 "\n"
 "USAGE: cpufreq [--help] [-d DURATION] [-f FREQUENCY] [-c CG]\n"
+"       cpufreq -a [-C] [-l PCT] [-i INTERVAL] [-d DURATION]\n"
 "\n"
 "EXAMPLES:\n"
 "    cpufreq         # sample CPU freq at 99HZ (default)\n"
 "    cpufreq -d 5    # sample for 5 seconds only\n"
 "    cpufreq -c CG   # Trace process under cgroupsPath CG\n"
-"    cpufreq -f 199  # sample CPU freq at 199HZ\n";
+"    cpufreq -f 199  # sample CPU freq at 199HZ\n"
+"    cpufreq -a      # GHz-seconds per process, every second\n"
+"    cpufreq -aC -i 10   # GHz-seconds per cgroup, every 10 seconds\n"
+"    cpufreq -a -l 50    # count time below 50% of the max frequency\n";
 
 static const struct argp_option opts[] = {
 	{ "duration", 'd', "DURATION", 0, "Duration to sample in seconds" },
 	{ "frequency", 'f', "FREQUENCY", 0, "Sample with a certain frequency" },
 	{ "cgroup", 'c', "/sys/fs/cgroup/unified", 0, "Trace process in cgroup path" },
+	{ "accounting", 'a', NULL, 0,
+	  "Account run time weighted by frequency (GHz-seconds) instead of sampling" },
+	{ "cgroups", 'C', NULL, 0, "Account per cgroup instead of per process (with -a)" },
+	{ "low", 'l', "PCT", 0,
+	  "Count run time below PCT% of the max frequency (with -a, default 80)" },
+	{ "interval", 'i', "INTERVAL", 0, "Print interval in seconds (with -a, default 1)" },
 	{ "verbose", 'v', NULL, 0, "Verbose debug output" },
 	{ NULL, 'h', NULL, OPTION_HIDDEN, "Show the full help" },
 	{}
@@ -60,6 +80,36 @@ static error_t parse_arg(int key, char *arg, struct argp_state *state)
 		env.cgroupspath = arg;
 		env.cg = true;
 		break;
+	case 'a':
+		env.accounting = true;
+		break;
+	case 'C':
+		env.per_cgroup = true;
+		break;
+	case 'l':
+		env.low_pct = argp_parse_long(key, arg, state);
+		if (env.low_pct <= 0 || env.low_pct > 100) {
+			warning("Invalid percentage: %s\n", arg);
+			argp_usage(state);
+		}
+		break;
+	case 'i':
+		env.interval = argp_parse_long(key, arg, state);
+		if (env.interval <= 0) {
+			warning("Invalid interval: %s\n", arg);
+			argp_usage(state);
+		}
+		break;
+	case ARGP_KEY_END:
+		if (env.accounting && env.cg) {
+			warning("-c can't be used with -a, use -C instead\n");
+			argp_usage(state);
+		}
+		if (!env.accounting && env.per_cgroup) {
+			warning("-C requires -a\n");
+			argp_usage(state);
+		}
+		break;
 	case 'f':
 		errno = 0;
 		env.freq = strtol(arg, NULL, 10);
@@ -118,7 +168,9 @@ static int libbpf_print_fn(enum libbpf_print_level level, const char *format,
 }
 
 static void sig_handler(int sig)
-{}
+{
+	exiting = 1;
+}
 
 static int init_freqs_mhz(__u32 *freqs_mhz, int nr_cpus)
 {
@@ -155,6 +207,124 @@ static int init_freqs_mhz(__u32 *freqs_mhz, int nr_cpus)
 	return 0;
 }
 
+static int init_low_mhz(__u32 *low_mhz, int nr_cpus)
+{
+	char path[80];
+	__u32 max_khz;
+	FILE *f;
+
+	for (int i = 0; i < nr_cpus; i++) {
+		snprintf(path, sizeof(path),
+			 "/sys/devices/system/cpu/cpu%d/cpufreq/cpuinfo_max_freq",
+			 i);
+
+		f = fopen(path, "r");
+		if (!f) {
+			warning("Failed to open '%s': %s\n", path,
+				strerror(errno));
+			return -1;
+		}
+
+		if (fscanf(f, "%u\n", &max_khz) != 1) {
+			warning("Failed to parse '%s': %s\n", path,
+				strerror(errno));
+			fclose(f);
+			return -1;
+		}
+
+		low_mhz[i] = (__u64)max_khz * env.low_pct / 100 / 1000;
+		fclose(f);
+	}
+
+	return 0;
+}
+
+struct acct_row {
+	struct acct_key key;
+	struct acct_value val;
+};
+
+static int sort_mhz_ns(const void *obj1, const void *obj2)
+{
+	const struct acct_row *r1 = obj1, *r2 = obj2;
+
+	if (r1->val.mhz_ns == r2->val.mhz_ns)
+		return 0;
+	return r1->val.mhz_ns < r2->val.mhz_ns ? 1 : -1;
+}
+
+/*
+ * Time is charged at context switches and frequency changes, so a task
+ * running across the end of an interval shows up in the next one.
+ */
+static int print_accounting(int fd)
+{
+	static struct acct_row rows[MAX_ACCT_ENTRIES];
+	struct acct_value values[nr_cpus];
+	struct acct_key *prev = NULL, key;
+	const struct acct_row *r;
+	const char *path;
+	char ts[32];
+	int i, j, n = 0, cpu;
+
+	while (n < MAX_ACCT_ENTRIES && !bpf_map_get_next_key(fd, prev, &key)) {
+		rows[n].key = key;
+		prev = &rows[n].key;
+		n++;
+	}
+
+	for (i = 0, j = 0; i < n; i++) {
+		key = rows[i].key;
+		if (bpf_map_lookup_elem(fd, &key, values))
+			continue;
+		bpf_map_delete_elem(fd, &key);
+
+		memset(&rows[j].val, 0, sizeof(rows[j].val));
+		rows[j].key = key;
+		for (cpu = 0; cpu < nr_cpus; cpu++) {
+			rows[j].val.run_ns += values[cpu].run_ns;
+			rows[j].val.mhz_ns += values[cpu].mhz_ns;
+			rows[j].val.low_ns += values[cpu].low_ns;
+			if (values[cpu].comm[0])
+				memcpy(rows[j].val.comm, values[cpu].comm,
+				       sizeof(rows[j].val.comm));
+		}
+		j++;
+	}
+
+	qsort(rows, j, sizeof(*rows), sort_mhz_ns);
+
+	printf("\n%-8s\n", strftime_now(ts, sizeof(ts), "%H:%M:%S"));
+	if (env.per_cgroup)
+		printf("%-32s", "CGROUP");
+	else
+		printf("%-8s %-16s", "PID", "COMM");
+	printf(" %10s %10s %9s %10s %6s\n", "RUN(ms)", "GHZ-S", "AVG(MHz)",
+	       "LOW(ms)", "LOW%");
+
+	for (i = 0; i < j; i++) {
+		r = &rows[i];
+		if (env.per_cgroup) {
+			path = cgroup_cache ?
+			       cgroup_cache__get_path(cgroup_cache, r->key.cgroup_id) : NULL;
+			if (path)
+				printf("%-32s", path);
+			else
+				printf("%-32llu", r->key.cgroup_id);
+		} else {
+			printf("%-8u %-16s", r->key.tgid, r->val.comm);
+		}
+		/* MHz * ns = 1e-3 cycles, GHz * s = 1e9 cycles */
+		printf(" %10.2f %10.3f %9llu %10.2f %5.1f%%\n",
+		       r->val.run_ns / 1e6, r->val.mhz_ns / 1e12,
+		       r->val.run_ns ? r->val.mhz_ns / r->val.run_ns : 0,
+		       r->val.low_ns / 1e6,
+		       r->val.run_ns ? 100.0 * r->val.low_ns / r->val.run_ns : 0.0);
+	}
+
+	return 0;
+}
+
 static void print_linear_hists(struct bpf_map *hists,
 			       struct cpufreq_bpf__bss *bss)
 {
@@ -223,6 +393,15 @@ int main(int argc, char *argv[])
 	else
 		bpf_program__set_autoload(obj->progs.cpu_frequency, false);
 
+	obj->rodata->accounting = env.accounting;
+	obj->rodata->target_per_cgroup = env.per_cgroup;
+	if (!env.accounting || probe_tp_btf("sched_switch"))
+		bpf_program__set_autoload(obj->progs.sched_switch_raw, false);
+	if (!env.accounting || !probe_tp_btf("sched_switch"))
+		bpf_program__set_autoload(obj->progs.sched_switch_btf, false);
+	if (!env.accounting)
+		bpf_map__set_max_entries(obj->maps.accts, 1);
+
 	err = cpufreq_bpf__load(obj);
 	if (err) {
 		warning("Failed to load BPF object\n");
@@ -258,9 +437,20 @@ int main(int argc, char *argv[])
 		}
 	}
 
-	err = open_and_attach_perf_event(env.freq, obj->progs.do_sample, links);
-	if (err)
-		goto cleanup;
+	if (env.accounting) {
+		err = init_low_mhz(obj->bss->low_mhz, nr_cpus);
+		if (err)
+			goto cleanup;
+		if (env.per_cgroup) {
+			cgroup_cache = cgroup_cache__new(NULL);
+			if (!cgroup_cache)
+				warning("Failed to find cgroup2 mount, printing cgroup ids\n");
+		}
+	} else {
+		err = open_and_attach_perf_event(env.freq, obj->progs.do_sample, links);
+		if (err)
+			goto cleanup;
+	}
 
 	err = cpufreq_bpf__attach(obj);
 	if (err) {
@@ -268,10 +458,25 @@ int main(int argc, char *argv[])
 		goto cleanup;
 	}
 
-	printf("Sampling CPU freq system-wide & by process. Ctrl-C to end.\n");
-
 	signal(SIGINT, sig_handler);
 
+	if (env.accounting) {
+		printf("Accounting frequency weighted run time, low mark %d%% of "
+		       "max. Ctrl-C to end.\n", env.low_pct);
+		for (int elapsed = 0; !exiting; ) {
+			sleep(env.interval);
+			err = print_accounting(bpf_map__fd(obj->maps.accts));
+			if (err)
+				break;
+			elapsed += env.interval;
+			if (env.duration > 0 && elapsed >= env.duration)
+				break;
+		}
+		goto cleanup;
+	}
+
+	printf("Sampling CPU freq system-wide & by process. Ctrl-C to end.\n");
+
 	/*
 	 * we'll get sleep interrupted when someone process Ctrl-C (which will
 	 * be "handled" with noop by sig_handler).
@@ -285,6 +490,7 @@ cleanup:
 	for (int i = 0; i < nr_cpus; i++)
 		bpf_link__destroy(links[i]);
 	cpufreq_bpf__destroy(obj);
+	cgroup_cache__free(cgroup_cache);
 	if (cgfd > 0)
 		close(cgfd);
 
@@ -16,4 +16,30 @@ struct hist {
 	__u32 slots[MAX_SLOTS];
 };
 
+/* accounting mode */
+#define MAX_ACCT_ENTRIES	10240
+#define CACHELINE_SIZE		64
+
+struct acct_key {
+	__u64 cgroup_id;	/* 0 unless accounting per cgroup */
+	__u32 tgid;		/* 0 when accounting per cgroup */
+	__u32 pad;
+};
+
+struct acct_value {
+	__u64 run_ns;
+	__u64 mhz_ns;		/* frequency integrated over run time */
+	__u64 low_ns;		/* run time below the low frequency mark */
+	char comm[TASK_COMM_LEN];
+};
+
+/* what runs on a CPU since when */
+struct cpu_state {
+	__u64 ts;
+	__u64 cgroup_id;
+	__u32 tgid;
+	__u32 pid;
+	char comm[TASK_COMM_LEN];
+} __attribute__((aligned(CACHELINE_SIZE)));
+
 #endif
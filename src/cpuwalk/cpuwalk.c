@@ -96,16 +96,17 @@ static void sig_handler(int sig)
 	exiting = 1;
 }
 
-static struct hist zero;
-
 static void print_hist(struct cpuwalk_bpf__bss *bss)
 {
-	struct hist hist = bss->hist;
+	unsigned int slots[MAX_CPU_NR] = {};
 
 	printf("\n");
 
-	bss->hist = zero;
-	print_linear_hist(hist.slots, MAX_CPU_NR, 0, 1, "cpuwalk");
+	for (int i = 0; i < nr_cpus; i++) {
+		slots[i] = bss->counts[i].samples;
+		bss->counts[i].samples = 0;
+	}
+	print_linear_hist(slots, MAX_CPU_NR, 0, 1, "cpuwalk");
 }
 
 int main(int argc, char *argv[])
@@ -3,9 +3,14 @@
 #define __CPUWALK_H
 
 #define MAX_CPU_NR	256
+#define CACHELINE_SIZE	64
 
-struct hist {
-	__u32 slots[MAX_CPU_NR];
-};
+/*
+ * Each CPU only ever increments its own counter, padded to a cache line so
+ * that sampling interrupts on different CPUs never share one.
+ */
+struct cpu_count {
+	__u64 samples;
+} __attribute__((aligned(CACHELINE_SIZE)));
 
 #endif
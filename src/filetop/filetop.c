@@ -4,6 +4,7 @@
 #include "filetop.skel.h"
 #include "btf_helpers.h"
 #include "trace_helpers.h"
+#include "top_helpers.h"
 
 #define OUTPUT_ROWS_LIMIT	10240
 
@@ -22,6 +23,8 @@ static volatile int sort_by = ALL;
 struct argument {
 	pid_t target_pid;
 	bool clear_screen;
+	bool cumulative;
+	bool json;
 	bool regular_file_only;
 	int output_rows;
 	int interval;
@@ -33,16 +36,21 @@ const char *argp_program_bug_address = "Jackie Liu <liuyun01@kylinos.cn>";
 const char argp_program_doc[] =
 "Trace file reads/writes by process.\n"
 "\n"
-"USAGE: filetop [-h] [-p PID] [interval] [count]\n"
+"USAGE: filetop [-h] [-p PID] [-C] [-j] [--cumulative] [interval] [count]\n"
 "\n"
 "EXAMPLES:\n"
 "    filetop            # file I/O top, refresh every 1s\n"
 "    filetop -p 1216    # only trace PID 1216\n"
-"    filetop 5 10       # 5s summaries, 10 times\n";
+"    filetop 5 10       # 5s summaries, 10 times\n"
+"    filetop -j 1 10    # 10 one second summaries as JSON lines\n";
+
+#define OPT_CUMULATIVE	1	/* --cumulative */
 
 static const struct argp_option opts[] = {
 	{ "pid", 'p', "PID", 0, "Process ID to trace" },
 	{ "noclear", 'C', NULL, 0, "Don't clear the screen" },
+	{ "json", 'j', NULL, 0, "Print each interval as a JSON object" },
+	{ "cumulative", OPT_CUMULATIVE, NULL, 0, "Show totals since start instead of per interval" },
 	{ "all", 'a', NULL, 0, "Include special files" },
 	{ "sort", 's', "SORT", 0, "Sort columns, default all [all, reads, writes, rbytes, wbytes]" },
 	{ "rows", 'r', "ROWS", 0, "Maximum rows to print, default 20" },
@@ -64,6 +72,12 @@ static error_t parse_arg(int key, char *arg, struct argp_state *state)
 	case 'C':
 		argument->clear_screen = false;
 		break;
+	case 'j':
+		argument->json = true;
+		break;
+	case OPT_CUMULATIVE:
+		argument->cumulative = true;
+		break;
 	case 'a':
 		argument->regular_file_only = false;
 		break;
@@ -138,80 +152,68 @@ static void sig_handler(int sig)
 	exiting = 1;
 }
 
-static int sort_column(const void *obj1, const void *obj2)
+static int sort_column(const void *k1, const void *v1,
+		       const void *k2, const void *v2)
 {
-	struct file_stat *s1 = (struct file_stat *)obj1;
-	struct file_stat *s2 = (struct file_stat *)obj2;
+	const struct file_stat *s1 = v1;
+	const struct file_stat *s2 = v2;
 
 	if (sort_by == READS) {
-		return s2->reads - s1->reads;
+		return top_cmp_u64(s1->reads, s2->reads);
 	} else if (sort_by == WRITES) {
-		return s2->writes - s1->writes;
+		return top_cmp_u64(s1->writes, s2->writes);
 	} else if (sort_by == RBYTES) {
-		return s2->read_bytes - s1->read_bytes;
+		return top_cmp_u64(s1->read_bytes, s2->read_bytes);
 	} else if (sort_by == WBYTES) {
-		return s2->write_bytes - s1->write_bytes;
+		return top_cmp_u64(s1->write_bytes, s2->write_bytes);
 	} else {
-		return (s2->reads + s2->writes + s2->read_bytes + s2->write_bytes) -
-			(s1->reads + s1->writes + s1->read_bytes + s1->write_bytes);
+		return top_cmp_u64(s1->reads + s1->writes + s1->read_bytes + s1->write_bytes,
+				   s2->reads + s2->writes + s2->read_bytes + s2->write_bytes);
 	}
 }
 
-static int print_stat(struct filetop_bpf *obj, struct argument *argument)
+static int print_stat(struct top *top, struct filetop_bpf *obj)
 {
-	FILE *f;
-	int err = 0;
-	struct file_id key, *prev_key = NULL;
-	static struct file_stat values[OUTPUT_ROWS_LIMIT];
-	int fd = bpf_map__fd(obj->maps.entries);
-	int rows = 0;
-
-	f = fopen("/proc/loadavg", "r");
-	if (f) {
-		char ts[32], buf[256] = {};
-
-		strftime_now(ts, sizeof(ts), "%H:%M:%S");
-
-		if (fread(buf, 1, sizeof(buf), f))
-			printf("%8s loadavg: %s\n", ts, buf);
-		fclose(f);
-	}
-
-	printf("%-7s %-16s %-6s %-6s %-7s %-7s %1s %s\n",
-	       "TID", "COMM", "READS", "WRITES", "R_Kb", "W_Kb", "T", "FILE");
+	int rows;
 
-	while (!bpf_map_get_next_key(fd, prev_key, &key)) {
-		err = bpf_map_lookup_elem(fd, &key, &values[rows++]);
-		if (err) {
-			warning("bpf_map_lookup_elem failed: %s\n", strerror(errno));
-			return err;
-		}
-		prev_key = &key;
+	rows = top__collect(top, bpf_map__fd(obj->maps.entries));
+	if (rows < 0) {
+		warning("Failed to read entries: %s\n", strerror(-rows));
+		return rows;
 	}
 
-	qsort(values, rows, sizeof(struct file_stat), sort_column);
-	rows = min(rows, argument->output_rows);
-
-	for (int i = 0; i < rows; i++) {
-		printf("%-7d %-16s %-6lld %-6lld %-7lld %-7lld %c %s\n",
-		       values[i].tid, values[i].comm, values[i].reads, values[i].writes,
-		       values[i].read_bytes / 1024, values[i].write_bytes / 1024,
-		       values[i].type, values[i].filename);
-	}
+	top__begin(top, true);
 
-	printf("\n");
-	prev_key = NULL;
+	if (!top__json(top))
+		printf("%-7s %-16s %-6s %-6s %-7s %-7s %1s %s\n",
+		       "TID", "COMM", "READS", "WRITES", "R_Kb", "W_Kb", "T", "FILE");
 
-	while (!bpf_map_get_next_key(fd, prev_key, &key)) {
-		err = bpf_map_delete_elem(fd, &key);
-		if (err) {
-			warning("bpf_map_lookup_elem failed: %s\n", strerror(errno));
-			return err;
+	for (int i = 0; i < rows; i++) {
+		const struct file_stat *value = top__value(top, i);
+
+		if (top__json(top)) {
+			char type[2] = { value->type };
+
+			top__json_row(top);
+			top__json_u64(top, "tid", value->tid);
+			top__json_str(top, "comm", value->comm);
+			top__json_u64(top, "reads", value->reads);
+			top__json_u64(top, "writes", value->writes);
+			top__json_u64(top, "read_kb", value->read_bytes / 1024);
+			top__json_u64(top, "write_kb", value->write_bytes / 1024);
+			top__json_str(top, "type", type);
+			top__json_str(top, "file", value->filename);
+			continue;
 		}
-		prev_key = &key;
+
+		printf("%-7d %-16s %-6lld %-6lld %-7lld %-7lld %c %s\n",
+		       value->tid, value->comm, value->reads, value->writes,
+		       value->read_bytes / 1024, value->write_bytes / 1024,
+		       value->type, value->filename);
 	}
 
-	return err;
+	top__end(top);
+	return 0;
 }
 
 int main(int argc, char *argv[])
@@ -229,7 +231,13 @@ int main(int argc, char *argv[])
 		.doc = argp_program_doc,
 	};
 	LIBBPF_OPTS(bpf_object_open_opts, open_opts);
+	struct top_opts top_opts = {
+		.key_size = sizeof(struct file_id),
+		.value_size = sizeof(struct file_stat),
+		.cmp = sort_column,
+	};
 	struct filetop_bpf *obj;
+	struct top *top = NULL;
 	int err;
 
 	err = argp_parse(&argp, argc, argv, 0, NULL, &argument);
@@ -268,6 +276,18 @@ int main(int argc, char *argv[])
 		goto cleanup;
 	}
 
+	top_opts.max_entries = bpf_map__max_entries(obj->maps.entries);
+	top_opts.rows = argument.output_rows;
+	top_opts.cumulative = argument.cumulative;
+	top_opts.clear_screen = argument.clear_screen;
+	top_opts.json = argument.json;
+	top = top__new(&top_opts);
+	if (!top) {
+		err = -errno;
+		warning("Failed to create top: %s\n", strerror(errno));
+		goto cleanup;
+	}
+
 	if (signal(SIGINT, sig_handler) == SIG_ERR) {
 		warning("Can't set signal handler: %s\n", strerror(errno));
 		err = 1;
@@ -277,13 +297,7 @@ int main(int argc, char *argv[])
 	while (1) {
 		sleep(argument.interval);
 
-		if (argument.clear_screen){
-			err = system("clear");
-			if (err)
-				goto cleanup;
-		}
-
-		err = print_stat(obj, &argument);
+		err = print_stat(top, obj);
 		if (err)
 			goto cleanup;
 
@@ -292,6 +306,7 @@ int main(int argc, char *argv[])
 	}
 
 cleanup:
+	top__free(top);
 	filetop_bpf__destroy(obj);
 	cleanup_core_btf(&open_opts);
 
@@ -8,12 +8,11 @@
 #include "bits.bpf.h"
 #include "maps.bpf.h"
 
-#define MAX_ENTRIES	256
-
 const volatile bool filter_memcg = false;
 const volatile bool target_dist = false;
 const volatile bool target_ns = false;
 const volatile bool do_count = false;
+const volatile bool target_matrix = false;
 
 struct {
 	__uint(type, BPF_MAP_TYPE_CGROUP_ARRAY);
@@ -36,7 +35,32 @@ struct {
 	__type(value, info_t);
 } infos SEC(".maps");
 
+struct {
+	__uint(type, BPF_MAP_TYPE_PERCPU_HASH);
+	__uint(max_entries, MAX_ENTRIES);
+	__type(key, u32);
+	__type(value, irq_cpu_t);
+} irq_cpu SEC(".maps");
+
 static info_t zero;
+static const irq_cpu_t zero_irq_cpu;
+
+/* time of each irq on each CPU, the per-CPU map is the CPU dimension */
+static int account_irq_cpu(u32 irq, struct irqaction *action, u64 delta)
+{
+	irq_cpu_t *val;
+
+	val = bpf_map_lookup_or_try_init(&irq_cpu, &irq, &zero_irq_cpu);
+	if (!val)
+		return 0;
+
+	val->time_ns += delta;
+	val->count++;
+	if (!val->name[0])
+		bpf_probe_read_kernel_str(&val->name, sizeof(val->name),
+					  BPF_CORE_READ(action, name));
+	return 0;
+}
 
 static int handle_entry(int irq, struct irqaction *action)
 {
@@ -78,6 +102,8 @@ static int handle_exit(int irq, struct irqaction *action)
 		return 0;
 
 	delta = bpf_ktime_get_ns() - *tsp;
+	if (target_matrix)
+		return account_irq_cpu(irq, action, delta);
 	if (!target_ns)
 		delta /= 1000U;
 
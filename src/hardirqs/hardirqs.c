@@ -4,9 +4,12 @@
 #include "hardirqs.skel.h"
 #include "trace_helpers.h"
 
+#define MAX_ROWS	10
+
 struct env {
 	bool count;
 	bool distributed;
+	bool matrix;
 	bool nanoseconds;
 	time_t interval;
 	int times;
@@ -20,24 +23,28 @@ struct env {
 };
 
 static volatile sig_atomic_t exiting;
+/* start of the current interval in -M mode */
+static unsigned long long interval_start;
 
 const char *argp_program_version = "hardirqs 0.1";
 const char *argp_program_bug_address = "Jackie Liu <liuyun01@kylinos.cn>";
 const char argp_program_doc[] =
 "Summarize hard irq event time as histograms.\n"
 "\n"
-"USAGE: hardirqs [--help] [-T] [-N] [-d] [interval] [count] [-c CG]\n"
+"USAGE: hardirqs [--help] [-T] [-N] [-d] [-M] [interval] [count] [-c CG]\n"
 "\n"
 "EXAMPLES:\n"
 "    hardirqs            # sum hard irq event time\n"
 "    hardirqs -d         # show hard irq event time as histograms\n"
 "    hardirqs 1 10       # print 1 second summaries, 10 times\n"
 "    hardirqs -c CG      # Trace process under cgroupsPath CG\n"
-"    hardirqs -NT 1      # 1s summaries, nanoseconds, and timestamps\n";
+"    hardirqs -NT 1      # 1s summaries, nanoseconds, and timestamps\n"
+"    hardirqs -M 1       # per CPU spread of each irq vs its smp_affinity\n";
 
 static const struct argp_option opts[] = {
 	{ "count", 'C', NULL, 0, "Show event counts instead of timing" },
 	{ "distributed", 'd', NULL, 0, "Show distributions as histograms" },
+	{ "cpu-matrix", 'M', NULL, 0, "Show how irq time is spread over CPUs" },
 	{ "cgroup", 'c', "/sys/fs/cgroup/unified", 0, "Trace process in cgroup path" },
 	{ "timestamp", 'T', NULL, 0, "Include timestamp on output" },
 	{ "nanoseconds", 'N', NULL, 0, "Output in nanoseconds" },
@@ -60,6 +67,9 @@ static error_t parse_arg(int key, char *arg, struct argp_state *state)
 	case 'd':
 		env.distributed = true;
 		break;
+	case 'M':
+		env.matrix = true;
+		break;
 	case 'C':
 		env.count = true;
 		break;
@@ -153,6 +163,147 @@ static int print_map(struct bpf_map *map)
 	return 0;
 }
 
+/* number of CPUs in a list like "0-3,8", 0 if it can't be read */
+static int read_cpulist(const char *path, char *buf, size_t size)
+{
+	int nr = 0, first, last, n;
+	const char *p;
+	FILE *f;
+
+	buf[0] = '\0';
+	f = fopen(path, "r");
+	if (!f)
+		return 0;
+	if (!fgets(buf, size, f)) {
+		fclose(f);
+		return 0;
+	}
+	fclose(f);
+	buf[strcspn(buf, "\n")] = '\0';
+
+	for (p = buf; *p; p += n) {
+		if (sscanf(p, "%d%n", &first, &n) != 1)
+			break;
+		last = first;
+		if (p[n] == '-') {
+			p += n + 1;
+			if (sscanf(p, "%d%n", &last, &n) != 1)
+				break;
+		}
+		nr += last - first + 1;
+		if (p[n] == ',')
+			n++;
+	}
+
+	return nr;
+}
+
+struct irq_row {
+	__u32 irq;
+	char name[32];
+	__u64 total_ns;
+	__u64 top_ns;
+	int top_cpu;
+	int nr_cpus;	/* CPUs with more than 1% of the irq's time */
+};
+
+static int sort_top_ns(const void *obj1, const void *obj2)
+{
+	const struct irq_row *r1 = obj1, *r2 = obj2;
+
+	if (r1->top_ns == r2->top_ns)
+		return 0;
+	return r1->top_ns < r2->top_ns ? 1 : -1;
+}
+
+/*
+ * Irqs are ranked by the time their busiest CPU spent in them, which puts
+ * the vectors that pin a single CPU first. An irq is flagged as skewed when
+ * one CPU takes most of its time while its affinity allows more.
+ */
+static int print_matrix(struct bpf_map *map)
+{
+	static struct irq_row rows[MAX_ENTRIES];
+	int nr_cpus = libbpf_num_possible_cpus();
+	irq_cpu_t values[nr_cpus];
+	__u64 cpu_ns[nr_cpus], elapsed;
+	__u32 keys[MAX_ENTRIES], *prev = NULL;
+	char affinity[256], effective[256], path[64];
+	unsigned long long now = get_ktime_ns();
+	int i, cpu, n = 0, nr_rows = 0, allowed, order[nr_cpus], tmp;
+	struct irq_row *r;
+	int fd = bpf_map__fd(map);
+
+	elapsed = now - interval_start;
+	interval_start = now;
+	memset(cpu_ns, 0, sizeof(cpu_ns));
+
+	while (n < MAX_ENTRIES && !bpf_map_get_next_key(fd, prev, &keys[n])) {
+		prev = &keys[n];
+		n++;
+	}
+
+	for (i = 0; i < n; i++) {
+		if (bpf_map_lookup_elem(fd, &keys[i], values))
+			continue;
+		bpf_map_delete_elem(fd, &keys[i]);
+
+		r = &rows[nr_rows++];
+		memset(r, 0, sizeof(*r));
+		r->irq = keys[i];
+		for (cpu = 0; cpu < nr_cpus; cpu++) {
+			r->total_ns += values[cpu].time_ns;
+			cpu_ns[cpu] += values[cpu].time_ns;
+			if (values[cpu].time_ns > r->top_ns) {
+				r->top_ns = values[cpu].time_ns;
+				r->top_cpu = cpu;
+			}
+			if (values[cpu].name[0])
+				memcpy(r->name, values[cpu].name, sizeof(r->name));
+		}
+		for (cpu = 0; cpu < nr_cpus; cpu++)
+			if (values[cpu].time_ns * 100 > r->total_ns)
+				r->nr_cpus++;
+	}
+
+	qsort(rows, nr_rows, sizeof(*rows), sort_top_ns);
+
+	printf("%-5s %-20s %10s %5s %8s %6s %-16s %-16s\n", "IRQ", "NAME",
+	       "TOTAL(us)", "CPUS", "TOP-CPU", "TOP%", "AFFINITY", "EFFECTIVE");
+	for (i = 0; i < nr_rows && i < MAX_ROWS; i++) {
+		r = &rows[i];
+		snprintf(path, sizeof(path), "/proc/irq/%u/smp_affinity_list", r->irq);
+		allowed = read_cpulist(path, affinity, sizeof(affinity));
+		snprintf(path, sizeof(path), "/proc/irq/%u/effective_affinity_list",
+			 r->irq);
+		read_cpulist(path, effective, sizeof(effective));
+
+		printf("%-5u %-20s %10llu %5d %8d %5.1f%% %-16s %-16s%s\n",
+		       r->irq, r->name, r->total_ns / 1000, r->nr_cpus,
+		       r->top_cpu, 100.0 * r->top_ns / max(r->total_ns, 1ULL),
+		       affinity[0] ? affinity : "-", effective[0] ? effective : "-",
+		       allowed > 1 && r->top_ns * 2 > r->total_ns ? " SKEW" : "");
+	}
+
+	/* CPUs by share of time in hard irq context */
+	for (cpu = 0; cpu < nr_cpus; cpu++)
+		order[cpu] = cpu;
+	for (i = 0; i < nr_cpus; i++)
+		for (cpu = i + 1; cpu < nr_cpus; cpu++)
+			if (cpu_ns[order[cpu]] > cpu_ns[order[i]]) {
+				tmp = order[i];
+				order[i] = order[cpu];
+				order[cpu] = tmp;
+			}
+
+	printf("\n%-8s %8s\n", "CPU", "HARDIRQ%");
+	for (i = 0; i < nr_cpus && i < MAX_ROWS && cpu_ns[order[i]]; i++)
+		printf("%-8d %7.2f%%\n", order[i],
+		       100.0 * cpu_ns[order[i]] / max(elapsed, 1ULL));
+
+	return 0;
+}
+
 int main(int argc, char *argv[])
 {
 	static const struct argp argp = {
@@ -179,6 +330,11 @@ int main(int argc, char *argv[])
 		return 1;
 	}
 
+	if (env.matrix && (env.count || env.distributed)) {
+		warning("cpu-matrix can't be used with count or distributed.\n");
+		return 1;
+	}
+
 	libbpf_set_print(libbpf_print_fn);
 
 	bpf_obj = hardirqs_bpf__open();
@@ -206,8 +362,12 @@ int main(int argc, char *argv[])
 	if (!env.count) {
 		bpf_obj->rodata->target_dist = env.distributed;
 		bpf_obj->rodata->target_ns = env.nanoseconds;
+		bpf_obj->rodata->target_matrix = env.matrix;
 	}
 
+	if (!env.matrix)
+		bpf_map__set_max_entries(bpf_obj->maps.irq_cpu, 1);
+
 	err = hardirqs_bpf__load(bpf_obj);
 	if (err) {
 		warning("failed to load BPF object: %d\n", err);
@@ -237,6 +397,8 @@ int main(int argc, char *argv[])
 
 	signal(SIGINT, sig_handler);
 
+	interval_start = get_ktime_ns();
+
 	if (env.count)
 		printf("Tracing hard irq events... Hit Ctrl-C to end.\n");
 	else
@@ -252,7 +414,10 @@ int main(int argc, char *argv[])
 			printf("%-8s\n", ts);
 		}
 
-		err = print_map(bpf_obj->maps.infos);
+		if (env.matrix)
+			err = print_matrix(bpf_obj->maps.irq_cpu);
+		else
+			err = print_map(bpf_obj->maps.infos);
 		if (err)
 			break;
 
@@ -3,6 +3,7 @@
 #define __HARDIRQS_H
 
 #define MAX_SLOTS	20
+#define MAX_ENTRIES	256
 
 typedef struct {
 	char name[32];
@@ -13,4 +14,11 @@ typedef struct {
 	__u32 slots[MAX_SLOTS];
 } info_t;
 
+/* CPU matrix mode, per-CPU value keyed by irq number */
+typedef struct {
+	__u64 time_ns;
+	__u64 count;
+	char name[32];
+} irq_cpu_t;
+
 #endif
@@ -0,0 +1,24 @@
+/* SPDX-License-Identifier: (LGPL-2.1 OR BSD-2-Clause) */
+#ifndef __CGROUP_HELPERS_H
+#define __CGROUP_HELPERS_H
+
+#include <linux/types.h>
+
+struct cgroup_cache;
+
+/*
+ * Map cgroup v2 ids (as returned by bpf_get_current_cgroup_id()) to cgroup
+ * paths relative to the cgroup2 mount. The hierarchy is walked once on
+ * creation and rescanned lazily, at most once per second, when an unknown
+ * id shows up, so that new containers are picked up without paying a
+ * directory walk for every lookup.
+ *
+ * *root* is the cgroup2 mount point, if NULL it is detected from
+ * /sys/fs/cgroup/unified and /sys/fs/cgroup. Returns NULL with errno set
+ * if no cgroup2 mount is found or the first walk fails.
+ */
+struct cgroup_cache *cgroup_cache__new(const char *root);
+void cgroup_cache__free(struct cgroup_cache *cache);
+const char *cgroup_cache__get_path(struct cgroup_cache *cache, __u64 cgroup_id);
+
+#endif /* __CGROUP_HELPERS_H */
@@ -92,6 +92,33 @@ static __always_inline bool has_block_rq_completion()
 	return false;
 }
 
+/**
+ * Before v5.11 tracepoint block_bio_queue had its own event class, so the
+ * kernel BTF has a `struct trace_event_raw_block_bio_queue`. Since then it
+ * shares `struct trace_event_raw_block_bio` with the bio merge tracepoints.
+ * Both start with the same fields.
+ */
+struct trace_event_raw_block_bio_queue___x {
+	dev_t dev;
+	sector_t sector;
+	unsigned int nr_sector;
+} __attribute__((preserve_access_index));
+
+struct trace_event_raw_block_bio___x {
+	dev_t dev;
+	sector_t sector;
+	unsigned int nr_sector;
+} __attribute__((preserve_access_index));
+
+static __always_inline bool has_block_bio_queue_class()
+{
+#if __has_builtin(__builtin_preserve_type_info)
+	return bpf_core_type_exists(struct trace_event_raw_block_bio_queue___x);
+#else
+	return LINUX_KERNEL_VERSION < KERNEL_VERSION(5, 11, 0);
+#endif
+}
+
 /**
  * commit d152c682f03c ("block: add an explicit ->disk backpointer to the
  * request_queue") and commit f3fa33acca9f ("block: remove the ->rq_disk
@@ -120,6 +147,33 @@ static __always_inline struct gendisk *get_disk(void *request)
 	return BPF_CORE_READ(r, q, disk);
 }
 
+/**
+ * commit 309dca309fc3 ("block: store a block_device pointer in struct bio")
+ * replaced `bi_disk` and `bi_partno` of `struct bio` with `bi_bdev`.
+ * see:
+ *     https://github.com/torvalds/linux/commit/309dca309fc3
+ */
+struct bio___x {
+	struct block_device *bi_bdev;
+	struct gendisk *bi_disk;
+	u8 bi_partno;
+} __attribute__((preserve_access_index));
+
+static __always_inline u32 get_bio_dev(void *bio)
+{
+	struct bio___x *b = bio;
+	struct gendisk *disk;
+
+	if (bpf_core_field_exists(b->bi_bdev))
+		return BPF_CORE_READ(b, bi_bdev, bd_dev);
+
+	disk = BPF_CORE_READ(b, bi_disk);
+	if (!disk)
+		return 0;
+	return (BPF_CORE_READ(disk, major) << 20) |
+	       (BPF_CORE_READ(disk, first_minor) + BPF_CORE_READ(b, bi_partno));
+}
+
 /**
  * commit 6521f8917082("namei: prepare for idmapped mounts") add `struct
  * user_namespace *mnt_userns` as vfs_create() and vfs_unlink() first argument.
@@ -283,4 +337,82 @@ static __always_inline bool has_kmem_alloc_node()
 	return false;
 }
 
+/**
+ * commit bcf9033e5449 ("sched: move CPU field back into thread_info if
+ * THREAD_INFO_IN_TASK=y") and its predecessors moved the CPU a task runs
+ * on between task_struct::cpu and thread_info::cpu
+ */
+struct thread_info___o {
+	__u32 cpu;
+} __attribute__((preserve_access_index));
+
+struct task_struct___cpu {
+	struct thread_info___o thread_info;
+	unsigned int cpu;
+} __attribute__((preserve_access_index));
+
+static __always_inline __u32 get_task_cpu(void *task)
+{
+	struct task_struct___cpu *t = task;
+
+	if (bpf_core_field_exists(t->cpu))
+		return BPF_CORE_READ(t, cpu);
+	return BPF_CORE_READ(t, thread_info.cpu);
+}
+
+/**
+ * commit 67c0496e87d1 ("kernfs: convert kernfs_node->id from union
+ * kernfs_node_id to u64") turns kernfs_node::id into a plain u64, older
+ * kernels keep the same 64 bits in the id member of a union.
+ */
+union kernfs_node_id___o {
+	struct {
+		__u32 ino;
+		__u32 generation;
+	};
+	__u64 id;
+};
+
+struct kernfs_node___o {
+	union kernfs_node_id___o id;
+} __attribute__((preserve_access_index));
+
+static __always_inline __u64 get_kernfs_node_id(struct kernfs_node *kn)
+{
+	if (bpf_core_type_exists(union kernfs_node_id___o))
+		return BPF_CORE_READ((struct kernfs_node___o *)kn, id.id);
+	return BPF_CORE_READ(kn, id);
+}
+
+/*
+ * Return the cgroup v2 id of *task*, the same value that
+ * bpf_get_current_cgroup_id() returns for the current task.
+ */
+static __always_inline __u64 get_task_cgroup_id(struct task_struct *task)
+{
+	return get_kernfs_node_id(BPF_CORE_READ(task, cgroups, dfl_cgrp, kn));
+}
+
+/**
+ * commit "sched/fair: Rename h_nr_running into h_nr_queued" (v6.14)
+ * renames cfs_rq::h_nr_running, the number of tasks queued in the
+ * hierarchy below a cfs_rq, to cfs_rq::h_nr_queued
+ */
+struct cfs_rq___o {
+	unsigned int h_nr_running;
+} __attribute__((preserve_access_index));
+
+struct cfs_rq___x {
+	unsigned int h_nr_queued;
+} __attribute__((preserve_access_index));
+
+static __always_inline __u32 get_cfs_rq_nr_queued(void *cfs_rq)
+{
+	struct cfs_rq___x *c = cfs_rq;
+
+	if (bpf_core_field_exists(c->h_nr_queued))
+		return BPF_CORE_READ(c, h_nr_queued);
+	return BPF_CORE_READ((struct cfs_rq___o *)cfs_rq, h_nr_running);
+}
+
 #endif /* __CORE_FIXES_BPF_H */
@@ -8,4 +8,21 @@
 int dump_hash(int map_fd, void *keys, __u32 key_size,
 	      void *values, __u32 value_size, __u32 *count, void *invalid_key);
 
+/*
+ * Reduce per-CPU copies of an array of *nr* counters into *sum*. The copy of
+ * CPU i starts at values + i * stride (in elements), which is the layout of
+ * a per-CPU map value (stride = value size rounded up to 8 bytes) as well as
+ * of a .bss array indexed by CPU.
+ */
+void percpu_sum_u64(__u64 *sum, const __u64 *values, int nr, size_t stride,
+		    int nr_cpus);
+void percpu_sum_u32(__u32 *sum, const __u32 *values, int nr, size_t stride,
+		    int nr_cpus);
+
+/*
+ * Look up *key* in a per-CPU map whose value is an array of *nr* __u64
+ * counters and store the sum over all possible CPUs in *sum*.
+ */
+int lookup_percpu_sum_u64(int map_fd, const void *key, __u64 *sum, int nr);
+
 #endif /* __MAP_HELPERS_H */
@@ -6,7 +6,8 @@
 
 void init_syscall_names(void);
 void free_syscall_names(void);
-void list_syscalls(void);
+int list_syscalls(void);
 void syscall_name(unsigned n, char *buf, size_t size);
+int syscall_number(const char *name);
 
 #endif /* __SYSCALL_HELPERS_H */
@@ -0,0 +1,66 @@
+/* SPDX-License-Identifier: (LGPL-2.1 OR BSD-2-Clause) */
+#ifndef __TOP_HELPERS_H
+#define __TOP_HELPERS_H
+
+#include <stdbool.h>
+#include <linux/types.h>
+
+/*
+ * Shared engine of the *top tools. Every interval the tool drains its hash
+ * map with top__collect(), which keeps the best *rows* entries according to
+ * *cmp* in a bounded heap instead of sorting the whole map, then prints the
+ * ranked rows between top__begin() and top__end().
+ *
+ * Screen clearing uses ANSI sequences and the whole screen is written out
+ * in one go at top__end(). With *json* set nothing is cleared and every
+ * interval is one JSON object on its own line:
+ *
+ *   {"time": "12:00:01", "loadavg": "...", "rows": [{...}, ...]}
+ *
+ * where the tool fills the row objects with the top__json_*() helpers.
+ */
+
+/* negative if (k1, v1) ranks before (k2, v2) */
+typedef int (*top_cmp_fn)(const void *k1, const void *v1,
+			  const void *k2, const void *v2);
+/* add the copy of a per-CPU value of one CPU to *sum* */
+typedef void (*top_merge_fn)(void *sum, const void *cpu_value);
+
+struct top_opts {
+	__u32 key_size;
+	__u32 value_size;
+	__u32 max_entries;	/* of the map */
+	int rows;		/* entries kept per interval */
+	top_cmp_fn cmp;
+	top_merge_fn merge;	/* set for per-CPU maps */
+	bool cumulative;	/* don't drain the map, show totals since start */
+	bool clear_screen;
+	bool json;
+};
+
+struct top;
+
+struct top *top__new(const struct top_opts *opts);
+void top__free(struct top *top);
+
+/* Returns the number of ranked rows, or a negative error. */
+int top__collect(struct top *top, int map_fd);
+const void *top__key(const struct top *top, int row);
+const void *top__value(const struct top *top, int row);
+
+/* Clear the screen or open the JSON object, with the loadavg line if asked. */
+void top__begin(struct top *top, bool loadavg);
+void top__end(struct top *top);
+
+bool top__json(const struct top *top);
+void top__json_row(struct top *top);
+void top__json_str(struct top *top, const char *name, const char *val);
+void top__json_u64(struct top *top, const char *name, unsigned long long val);
+void top__json_double(struct top *top, const char *name, double val);
+
+static inline int top_cmp_u64(unsigned long long a, unsigned long long b)
+{
+	return (a < b) - (a > b);
+}
+
+#endif /* __TOP_HELPERS_H */
@@ -62,6 +62,21 @@ partitions__get_by_name(const struct partitions *partitions, const char *name);
 void print_log2_hist(unsigned int *vals, int vals_size, const char *val_type);
 void print_linear_hist(unsigned int *vals, int vals_size, unsigned int base,
 		unsigned int step, const char *val_type);
+/*
+ * Estimate the *percentile* (0-100) of a log2 histogram as printed by
+ * print_log2_hist(), returns the upper bound of the slot it falls into.
+ */
+unsigned long long log2_hist_percentile(unsigned int *vals, int vals_size,
+					double percentile);
+
+/* shades of print_heatmap_cells(), from 0 to 256 and more */
+#define HEATMAP_SHADES	" .:-=+*#%@"
+
+/*
+ * Print *vals* as one heatmap row, one character per value shaded by its
+ * log2, between bars and followed by the total count and a newline.
+ */
+void print_heatmap_cells(const unsigned int *vals, int vals_size);
 
 unsigned long long get_ktime_ns(void);
 
@@ -0,0 +1,293 @@
+// SPDX-License-Identifier: GPL-2.0
+#include "vmlinux.h"
+#include <bpf/bpf_helpers.h>
+#include <bpf/bpf_core_read.h>
+#include <bpf/bpf_tracing.h>
+#include "iouringlat.h"
+#include "bits.bpf.h"
+#include "maps.bpf.h"
+
+#ifndef IORING_CQE_F_MORE
+#define IORING_CQE_F_MORE	(1U << 1)
+#endif
+
+/* same bit in the SQE flags and the request flags of the tracepoints */
+#ifndef IOSQE_CQE_SKIP_SUCCESS
+#define IOSQE_CQE_SKIP_SUCCESS	(1U << 6)
+#endif
+
+const volatile bool targ_ms = false;
+const volatile bool targ_per_ring = false;
+const volatile pid_t targ_tgid = 0;
+
+/*
+ * The io_uring tracepoints gained and lost arguments over time, but the
+ * fields used here kept their names. io_uring_submit_sqe was renamed to
+ * io_uring_submit_req in v6.1.
+ */
+struct trace_event_raw_io_uring_submit_req___x {
+	void *ctx;
+	void *req;
+	unsigned long long user_data;
+	u8 opcode;
+	unsigned long long flags;
+} __attribute__((preserve_access_index));
+
+struct trace_event_raw_io_uring_submit_sqe___x {
+	void *ctx;
+	void *req;
+	unsigned long long user_data;
+	u8 opcode;
+	unsigned long long flags;
+} __attribute__((preserve_access_index));
+
+struct trace_event_raw_io_uring_complete___x {
+	void *ctx;
+	void *req;
+	unsigned long long user_data;
+	unsigned int cflags;
+} __attribute__((preserve_access_index));
+
+struct trace_event_raw_io_uring_queue_async_work___x {
+	void *ctx;
+	void *req;
+} __attribute__((preserve_access_index));
+
+struct io_uring___x {
+	u32 head;
+	u32 tail;
+} __attribute__((preserve_access_index));
+
+struct io_rings___x {
+	struct io_uring___x sq;
+	struct io_uring___x cq;
+} __attribute__((preserve_access_index));
+
+struct io_ring_ctx___x {
+	struct io_rings___x *rings;
+} __attribute__((preserve_access_index));
+
+/* a submitted request, by ring and request, or user_data on old kernels */
+struct req_key {
+	u64 ring;
+	u64 id;
+};
+
+struct req_info {
+	u64 ts;
+	u32 opcode;
+	bool async;
+};
+
+struct {
+	__uint(type, BPF_MAP_TYPE_HASH);
+	__uint(max_entries, MAX_ENTRIES);
+	__type(key, struct req_key);
+	__type(value, struct req_info);
+} reqs SEC(".maps");
+
+struct {
+	__uint(type, BPF_MAP_TYPE_PERCPU_HASH);
+	__uint(max_entries, MAX_ENTRIES);
+	__type(key, struct hist_key);
+	__type(value, struct hist);
+} hists SEC(".maps");
+
+/* requests submitted and not completed, never drained */
+struct {
+	__uint(type, BPF_MAP_TYPE_LRU_HASH);
+	__uint(max_entries, 1024);
+	__type(key, u64);
+	__type(value, s64);
+} ring_inflight SEC(".maps");
+
+/* kept across intervals, user space only clears the counters */
+struct {
+	__uint(type, BPF_MAP_TYPE_LRU_HASH);
+	__uint(max_entries, 1024);
+	__type(key, u64);
+	__type(value, struct ring_stat);
+} ring_stats SEC(".maps");
+
+static const struct hist zero_hist;
+static const s64 zero_inflight;
+
+/* Without a request pointer at completion, user_data is all there is. */
+static __always_inline bool key_by_req(void)
+{
+	struct trace_event_raw_io_uring_complete___x *c = NULL;
+
+	return bpf_core_field_exists(c->req);
+}
+
+static struct ring_stat *get_ring_stat(u64 ring)
+{
+	struct ring_stat *statp, stat = {};
+
+	statp = bpf_map_lookup_elem(&ring_stats, &ring);
+	if (statp)
+		return statp;
+
+	stat.pid = bpf_get_current_pid_tgid() >> 32;
+	bpf_get_current_comm(&stat.comm, sizeof(stat.comm));
+	bpf_map_update_elem(&ring_stats, &ring, &stat, BPF_NOEXIST);
+	return bpf_map_lookup_elem(&ring_stats, &ring);
+}
+
+/*
+ * Requests with IOSQE_CQE_SKIP_SUCCESS only post a CQE if they fail, they
+ * are not tracked, only counted in the ring submissions.
+ */
+static int trace_submit(void *ring, void *req, u64 user_data, u8 opcode,
+			u64 flags)
+{
+	struct io_ring_ctx___x *ctx = ring;
+	struct req_key key = {};
+	struct req_info info = {};
+	struct ring_stat *statp;
+	bool track = !(flags & IOSQE_CQE_SKIP_SUCCESS);
+	u32 sq_depth;
+	s64 *inflightp, inflight = 0;
+
+	if (targ_tgid && targ_tgid != bpf_get_current_pid_tgid() >> 32)
+		return 0;
+
+	key.ring = (u64)ring;
+	key.id = key_by_req() ? (u64)req : user_data;
+	info.ts = bpf_ktime_get_ns();
+	info.opcode = opcode;
+
+	/* a user_data reused before its completion was seen */
+	if (track && bpf_map_update_elem(&reqs, &key, &info, BPF_NOEXIST)) {
+		bpf_map_update_elem(&reqs, &key, &info, BPF_EXIST);
+		return 0;
+	}
+
+	inflightp = bpf_map_lookup_or_try_init(&ring_inflight, &key.ring, &zero_inflight);
+	if (inflightp)
+		inflight = track ? __sync_fetch_and_add(inflightp, 1) + 1 : *inflightp;
+
+	statp = get_ring_stat(key.ring);
+	if (!statp)
+		return 0;
+
+	sq_depth = BPF_CORE_READ(ctx, rings, sq.tail) - BPF_CORE_READ(ctx, rings, sq.head);
+	__sync_fetch_and_add(&statp->submits, 1);
+	__sync_fetch_and_add(&statp->inflight_sum, inflight);
+	__sync_fetch_and_add(&statp->sq_sum, sq_depth);
+	if (inflight > statp->inflight_max)
+		statp->inflight_max = inflight;
+	if (sq_depth > statp->sq_max)
+		statp->sq_max = sq_depth;
+	return 0;
+}
+
+SEC("tracepoint/io_uring/io_uring_submit_req")
+int handle__io_uring_submit_req(struct trace_event_raw_io_uring_submit_req___x *ctx)
+{
+	return trace_submit(BPF_CORE_READ(ctx, ctx), BPF_CORE_READ(ctx, req),
+			    BPF_CORE_READ(ctx, user_data), BPF_CORE_READ(ctx, opcode),
+			    ctx->flags);
+}
+
+SEC("tracepoint/io_uring/io_uring_submit_sqe")
+int handle__io_uring_submit_sqe(struct trace_event_raw_io_uring_submit_sqe___x *ctx)
+{
+	void *req = NULL;
+	u64 flags = 0;
+
+	if (bpf_core_field_exists(ctx->req))
+		req = BPF_CORE_READ(ctx, req);
+	/* a direct load, its size is adjusted to the u8/u32 of the kernel */
+	if (bpf_core_field_exists(ctx->flags))
+		flags = ctx->flags;
+	return trace_submit(BPF_CORE_READ(ctx, ctx), req,
+			    BPF_CORE_READ(ctx, user_data), BPF_CORE_READ(ctx, opcode),
+			    flags);
+}
+
+SEC("tracepoint/io_uring/io_uring_queue_async_work")
+int handle__io_uring_queue_async_work(struct trace_event_raw_io_uring_queue_async_work___x *ctx)
+{
+	struct req_key key = {};
+	struct req_info *infop;
+
+	if (!key_by_req())
+		return 0;
+
+	key.ring = (u64)BPF_CORE_READ(ctx, ctx);
+	key.id = (u64)BPF_CORE_READ(ctx, req);
+	infop = bpf_map_lookup_elem(&reqs, &key);
+	if (infop)
+		infop->async = true;
+	return 0;
+}
+
+SEC("tracepoint/io_uring/io_uring_complete")
+int handle__io_uring_complete(struct trace_event_raw_io_uring_complete___x *ctx)
+{
+	struct io_ring_ctx___x *ring = BPF_CORE_READ(ctx, ctx);
+	struct hist_key hkey = {};
+	struct req_key key = {};
+	struct req_info *infop;
+	struct ring_stat *statp;
+	struct hist *histp;
+	s64 *inflightp, delta;
+	u32 cq_depth;
+	u64 slot;
+
+	key.ring = (u64)ring;
+	if (key_by_req())
+		key.id = (u64)BPF_CORE_READ(ctx, req);
+	else
+		key.id = BPF_CORE_READ(ctx, user_data);
+	infop = bpf_map_lookup_elem(&reqs, &key);
+	if (!infop)
+		return 0;
+
+	/* multishot requests are measured to their last completion */
+	if (bpf_core_field_exists(ctx->cflags) &&
+	    BPF_CORE_READ(ctx, cflags) & IORING_CQE_F_MORE)
+		return 0;
+
+	delta = (s64)(bpf_ktime_get_ns() - infop->ts);
+	if (delta < 0)
+		goto cleanup;
+
+	hkey.ring = targ_per_ring ? key.ring : 0;
+	hkey.opcode = infop->opcode;
+	histp = bpf_map_lookup_or_try_init(&hists, &hkey, &zero_hist);
+	if (!histp)
+		goto cleanup;
+
+	delta /= targ_ms ? 1000000U : 1000U;
+	slot = log2l(delta);
+	if (slot >= MAX_SLOTS)
+		slot = MAX_SLOTS - 1;
+	histp->slots[slot]++;
+	histp->count++;
+	histp->total += delta;
+	if (infop->async)
+		histp->async++;
+
+cleanup:
+	inflightp = bpf_map_lookup_elem(&ring_inflight, &key.ring);
+	if (inflightp)
+		__sync_fetch_and_add(inflightp, -1);
+
+	/* not created here, completions may run in any context */
+	statp = bpf_map_lookup_elem(&ring_stats, &key.ring);
+	if (statp) {
+		cq_depth = BPF_CORE_READ(ring, rings, cq.tail) -
+			   BPF_CORE_READ(ring, rings, cq.head);
+		__sync_fetch_and_add(&statp->completes, 1);
+		__sync_fetch_and_add(&statp->cq_sum, cq_depth);
+		if (cq_depth > statp->cq_max)
+			statp->cq_max = cq_depth;
+	}
+
+	bpf_map_delete_elem(&reqs, &key);
+	return 0;
+}
+
+char LICENSE[] SEC("license") = "GPL";
@@ -0,0 +1,413 @@
+// SPDX-License-Identifier: (LGPL-2.1 OR BSD-2-Clause)
+#include "commons.h"
+#include "iouringlat.h"
+#include "iouringlat.skel.h"
+#include "btf_helpers.h"
+#include "trace_helpers.h"
+#include "map_helpers.h"
+
+#define MAX_ROWS	1024
+
+static struct env {
+	pid_t pid;
+	bool milliseconds;
+	bool per_ring;
+	bool summary;
+	time_t interval;
+	int times;
+	bool timestamp;
+	bool verbose;
+} env = {
+	.interval = 99999999,
+	.times = 99999999,
+};
+
+static volatile sig_atomic_t exiting;
+static int nr_cpus;
+
+const char *argp_program_version = "iouringlat 0.1";
+const char *argp_program_bug_address = "Jackie Liu <liuyun01@kylinos.cn>";
+const char argp_program_doc[] =
+"Summarize io_uring request latency, async punts and ring depths.\n"
+"\n"
+"USAGE: iouringlat [--help] [-T] [-m] [-s] [-R] [-p PID] [interval] [count]\n"
+"\n"
+"EXAMPLES:\n"
+"    iouringlat              # submit->complete histograms per opcode\n"
+"    iouringlat 1 10         # print 1 second summaries, 10 times\n"
+"    iouringlat -s 1         # one line per opcode with percentiles\n"
+"    iouringlat -R           # histograms per ring and opcode\n"
+"    iouringlat -p 185       # trace PID 185 only\n";
+
+static const struct argp_option opts[] = {
+	{ "pid", 'p', "PID", 0, "Trace this PID only" },
+	{ "milliseconds", 'm', NULL, 0, "Millisecond histograms" },
+	{ "per-ring", 'R', NULL, 0, "Aggregate per ring as well as per opcode" },
+	{ "summary", 's', NULL, 0, "Print a summary table instead of histograms" },
+	{ "timestamp", 'T', NULL, 0, "Include timestamp on output" },
+	{ "verbose", 'v', NULL, 0, "Verbose debug output" },
+	{ NULL, 'h', NULL, OPTION_HIDDEN, "Show the full help" },
+	{},
+};
+
+static error_t parse_arg(int key, char *arg, struct argp_state *state)
+{
+	static int pos_args;
+
+	switch (key) {
+	case 'h':
+		argp_state_help(state, stderr, ARGP_HELP_STD_HELP);
+		break;
+	case 'v':
+		env.verbose = true;
+		break;
+	case 'p':
+		env.pid = argp_parse_pid(key, arg, state);
+		break;
+	case 'm':
+		env.milliseconds = true;
+		break;
+	case 'R':
+		env.per_ring = true;
+		break;
+	case 's':
+		env.summary = true;
+		break;
+	case 'T':
+		env.timestamp = true;
+		break;
+	case ARGP_KEY_ARG:
+		errno = 0;
+		if (pos_args == 0) {
+			env.interval = strtol(arg, NULL, 10);
+			if (errno || env.interval <= 0) {
+				warning("Invalid interval\n");
+				argp_usage(state);
+			}
+		} else if (pos_args == 1) {
+			env.times = strtol(arg, NULL, 10);
+			if (errno || env.times <= 0) {
+				warning("Invalid times\n");
+				argp_usage(state);
+			}
+		} else {
+			warning("Unrecognized positional argument: %s\n", arg);
+			argp_usage(state);
+		}
+		pos_args++;
+		break;
+	default:
+		return ARGP_ERR_UNKNOWN;
+	}
+	return 0;
+}
+
+static int libbpf_print_fn(enum libbpf_print_level level, const char *format,
+			   va_list args)
+{
+	if (level == LIBBPF_DEBUG && !env.verbose)
+		return 0;
+	return vfprintf(stderr, format, args);
+}
+
+static void sig_handler(int sig)
+{
+	exiting = 1;
+}
+
+/* IORING_OP_*, in uapi order */
+static const char *op_names[] = {
+	"NOP", "READV", "WRITEV", "FSYNC", "READ_FIXED", "WRITE_FIXED",
+	"POLL_ADD", "POLL_REMOVE", "SYNC_FILE_RANGE", "SENDMSG", "RECVMSG",
+	"TIMEOUT", "TIMEOUT_REMOVE", "ACCEPT", "ASYNC_CANCEL", "LINK_TIMEOUT",
+	"CONNECT", "FALLOCATE", "OPENAT", "CLOSE", "FILES_UPDATE", "STATX",
+	"READ", "WRITE", "FADVISE", "MADVISE", "SEND", "RECV", "OPENAT2",
+	"EPOLL_CTL", "SPLICE", "PROVIDE_BUFFERS", "REMOVE_BUFFERS", "TEE",
+	"SHUTDOWN", "RENAMEAT", "UNLINKAT", "MKDIRAT", "SYMLINKAT", "LINKAT",
+	"MSG_RING", "FSETXATTR", "SETXATTR", "FGETXATTR", "GETXATTR", "SOCKET",
+	"URING_CMD", "SEND_ZC", "SENDMSG_ZC", "READ_MULTISHOT", "WAITID",
+	"FUTEX_WAIT", "FUTEX_WAKE", "FUTEX_WAITV", "FIXED_FD_INSTALL",
+	"FTRUNCATE", "BIND", "LISTEN",
+};
+
+static const char *op_name(__u32 opcode, char *buf, size_t size)
+{
+	if (opcode < ARRAY_SIZE(op_names))
+		return op_names[opcode];
+	snprintf(buf, size, "OP_%u", opcode);
+	return buf;
+}
+
+struct hist_row {
+	struct hist_key key;
+	struct hist hist;
+};
+
+struct ring_row {
+	__u64 ring;
+	struct ring_stat stat;
+};
+
+static int sort_count(const void *obj1, const void *obj2)
+{
+	const struct hist_row *r1 = obj1, *r2 = obj2;
+
+	if (r1->hist.count == r2->hist.count)
+		return 0;
+	return r1->hist.count < r2->hist.count ? 1 : -1;
+}
+
+static int sort_submits(const void *obj1, const void *obj2)
+{
+	const struct ring_row *r1 = obj1, *r2 = obj2;
+
+	if (r1->stat.submits == r2->stat.submits)
+		return 0;
+	return r1->stat.submits < r2->stat.submits ? 1 : -1;
+}
+
+static int read_hists(int fd, struct hist_row *rows)
+{
+	struct hist values[nr_cpus];
+	struct hist_key *prev = NULL, key;
+	int i, j, cpu, n = 0;
+
+	while (n < MAX_ROWS && !bpf_map_get_next_key(fd, prev, &key)) {
+		rows[n].key = key;
+		prev = &rows[n].key;
+		n++;
+	}
+
+	for (i = 0, j = 0; i < n; i++) {
+		struct hist *h = &rows[j].hist;
+
+		key = rows[i].key;
+		if (bpf_map_lookup_elem(fd, &key, values))
+			continue;
+		bpf_map_delete_elem(fd, &key);
+
+		memset(h, 0, sizeof(*h));
+		rows[j].key = key;
+		for (cpu = 0; cpu < nr_cpus; cpu++) {
+			h->count += values[cpu].count;
+			h->async += values[cpu].async;
+			h->total += values[cpu].total;
+		}
+		percpu_sum_u32(h->slots, values[0].slots, MAX_SLOTS,
+			       sizeof(values[0]) / sizeof(__u32), nr_cpus);
+		j++;
+	}
+
+	qsort(rows, j, sizeof(*rows), sort_count);
+	return j;
+}
+
+/*
+ * Rings stay in the map, so that those only completing requests in an
+ * interval keep being sampled: clear their counters, keep pid and comm.
+ */
+static int read_rings(int fd, struct ring_row *rows)
+{
+	struct ring_stat zero;
+	__u64 *prev = NULL, ring;
+	int i, j, n = 0;
+
+	while (n < MAX_ROWS && !bpf_map_get_next_key(fd, prev, &ring)) {
+		rows[n].ring = ring;
+		prev = &rows[n].ring;
+		n++;
+	}
+
+	for (i = 0, j = 0; i < n; i++) {
+		ring = rows[i].ring;
+		if (bpf_map_lookup_elem(fd, &ring, &rows[j].stat))
+			continue;
+		if (!rows[j].stat.submits && !rows[j].stat.completes)
+			continue;
+		memset(&zero, 0, sizeof(zero));
+		zero.pid = rows[j].stat.pid;
+		memcpy(zero.comm, rows[j].stat.comm, sizeof(zero.comm));
+		bpf_map_update_elem(fd, &ring, &zero, BPF_EXIST);
+		rows[j].ring = ring;
+		j++;
+	}
+
+	qsort(rows, j, sizeof(*rows), sort_submits);
+	return j;
+}
+
+static void print_hist_summary(const struct hist_row *rows, int n)
+{
+	__u64 count;
+	char buf[16];
+	int i;
+
+	printf("%-16s ", "OP");
+	if (env.per_ring)
+		printf("%-18s ", "RING");
+	printf("%10s %7s %10s %10s\n", "COUNT", "ASYNC%", "AVG", "P99");
+
+	for (i = 0; i < n; i++) {
+		count = max(rows[i].hist.count, 1ULL);
+		printf("%-16s ", op_name(rows[i].key.opcode, buf, sizeof(buf)));
+		if (env.per_ring)
+			printf("0x%-16llx ", rows[i].key.ring);
+		printf("%10llu %7.2f %10.1f %10llu\n", rows[i].hist.count,
+		       100.0 * rows[i].hist.async / count,
+		       (double)rows[i].hist.total / count,
+		       log2_hist_percentile((unsigned int *)rows[i].hist.slots,
+					    MAX_SLOTS, 99));
+	}
+}
+
+static void print_hists(struct hist_row *rows, int n)
+{
+	const char *units = env.milliseconds ? "msecs" : "usecs";
+	char buf[16];
+	int i;
+
+	for (i = 0; i < n; i++) {
+		printf("\nop = %s", op_name(rows[i].key.opcode, buf, sizeof(buf)));
+		if (env.per_ring)
+			printf(" ring = 0x%llx", rows[i].key.ring);
+		printf("\n%llu requests, %llu punted to io-wq\n",
+		       rows[i].hist.count, rows[i].hist.async);
+		print_log2_hist(rows[i].hist.slots, MAX_SLOTS, units);
+	}
+}
+
+static void print_rings(const struct ring_row *rows, int n)
+{
+	const struct ring_stat *s;
+	__u64 submits, completes;
+	int i;
+
+	printf("\n%-18s %-7s %-16s %8s %8s %8s %8s %8s %8s %8s\n", "RING",
+	       "PID", "COMM", "SUBMITS", "INF_AVG", "INF_MAX", "SQ_AVG",
+	       "SQ_MAX", "CQ_AVG", "CQ_MAX");
+	for (i = 0; i < n; i++) {
+		s = &rows[i].stat;
+		submits = max(s->submits, 1ULL);
+		completes = max(s->completes, 1ULL);
+		printf("0x%-16llx %-7u %-16s %8llu %8.1f %8u %8.1f %8u %8.1f %8u\n",
+		       rows[i].ring, s->pid, s->comm, s->submits,
+		       (double)s->inflight_sum / submits, s->inflight_max,
+		       (double)s->sq_sum / submits, s->sq_max,
+		       (double)s->cq_sum / completes, s->cq_max);
+	}
+}
+
+static int print_stats(struct iouringlat_bpf *obj)
+{
+	static struct hist_row hist_rows[MAX_ROWS];
+	static struct ring_row ring_rows[MAX_ROWS];
+	int n;
+
+	n = read_hists(bpf_map__fd(obj->maps.hists), hist_rows);
+	if (env.summary)
+		print_hist_summary(hist_rows, n);
+	else
+		print_hists(hist_rows, n);
+
+	n = read_rings(bpf_map__fd(obj->maps.ring_stats), ring_rows);
+	if (n)
+		print_rings(ring_rows, n);
+
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	LIBBPF_OPTS(bpf_object_open_opts, open_opts);
+	static const struct argp argp = {
+		.options = opts,
+		.parser = parse_arg,
+		.doc = argp_program_doc,
+	};
+	struct iouringlat_bpf *obj;
+	char ts[32];
+	int err;
+
+	err = argp_parse(&argp, argc, argv, 0, NULL, NULL);
+	if (err)
+		return err;
+
+	if (!bpf_is_root())
+		return 1;
+
+	libbpf_set_print(libbpf_print_fn);
+
+	nr_cpus = libbpf_num_possible_cpus();
+	if (nr_cpus < 0) {
+		warning("Failed to get # of possible cpus: '%s'!\n",
+			strerror(-nr_cpus));
+		return 1;
+	}
+
+	err = ensure_core_btf(&open_opts);
+	if (err) {
+		warning("Failed to fetch necessary BTF for CO-RE: %s\n",
+			strerror(-err));
+		return 1;
+	}
+
+	obj = iouringlat_bpf__open_opts(&open_opts);
+	if (!obj) {
+		warning("Failed to open BPF object\n");
+		return 1;
+	}
+
+	if (tracepoint_exists("io_uring", "io_uring_submit_req")) {
+		bpf_program__set_autoload(obj->progs.handle__io_uring_submit_sqe, false);
+	} else if (tracepoint_exists("io_uring", "io_uring_submit_sqe")) {
+		bpf_program__set_autoload(obj->progs.handle__io_uring_submit_req, false);
+	} else {
+		warning("io_uring tracepoints are not available\n");
+		err = 1;
+		goto cleanup;
+	}
+
+	obj->rodata->targ_ms = env.milliseconds;
+	obj->rodata->targ_per_ring = env.per_ring;
+	obj->rodata->targ_tgid = env.pid;
+
+	err = iouringlat_bpf__load(obj);
+	if (err) {
+		warning("Failed to load BPF object: %d\n", err);
+		goto cleanup;
+	}
+
+	err = iouringlat_bpf__attach(obj);
+	if (err) {
+		warning("Failed to attach BPF programs: %d\n", err);
+		goto cleanup;
+	}
+
+	signal(SIGINT, sig_handler);
+
+	printf("Tracing io_uring requests... Hit Ctrl-C to end.\n");
+
+	/* Main loop */
+	for (;;) {
+		sleep(env.interval);
+		printf("\n");
+
+		if (env.timestamp) {
+			strftime_now(ts, sizeof(ts), "%H:%M:%S");
+			printf("%-8s\n", ts);
+		}
+
+		err = print_stats(obj);
+		if (err)
+			break;
+
+		if (exiting || --env.times == 0)
+			break;
+	}
+
+cleanup:
+	iouringlat_bpf__destroy(obj);
+	cleanup_core_btf(&open_opts);
+
+	return err != 0;
+}
@@ -0,0 +1,36 @@
+// SPDX-License-Identifier: (LGPL-2.1 OR BSD-2-Clause)
+#ifndef __IOURINGLAT_H
+#define __IOURINGLAT_H
+
+#define TASK_COMM_LEN	16
+#define MAX_SLOTS	27
+#define MAX_ENTRIES	10240
+
+struct hist_key {
+	__u64 ring;	/* struct io_ring_ctx *, 0 unless per ring */
+	__u32 opcode;
+	__u32 pad;
+};
+
+struct hist {
+	__u64 count;
+	__u64 async;	/* punted to io-wq rather than completed inline */
+	__u64 total;
+	__u32 slots[MAX_SLOTS];
+};
+
+/* sampled at each submission and completion of a ring */
+struct ring_stat {
+	__u64 submits;
+	__u64 completes;
+	__u64 inflight_sum;
+	__u64 sq_sum;
+	__u64 cq_sum;
+	__u32 inflight_max;
+	__u32 sq_max;
+	__u32 cq_max;
+	__u32 pid;
+	char comm[TASK_COMM_LEN];
+};
+
+#endif /* __IOURINGLAT_H */
@@ -0,0 +1,225 @@
+// SPDX-License-Identifier: (LGPL-2.1 OR BSD-2-Clause)
+/*
+ * Standalone liburing program submitting a known mix of requests, to check
+ * iouringlat against. Not part of the tool, build it with:
+ *
+ *   cc -O2 -o iouringlat_driver iouringlat_driver.c -luring
+ *
+ * Every round submits one batch of BATCH requests with a single
+ * io_uring_submit() and only reaps the completions once all of them are
+ * in, then wakes a multishot poll once:
+ *
+ *   READ    BATCH / 2      4K reads of a file that is in the page cache,
+ *                          completed inline
+ *   WRITE   BATCH / 4      4K buffered writes with IOSQE_ASYNC, punted to
+ *                          io-wq
+ *   NOP     the rest
+ *   POLL_ADD               one multishot poll on an eventfd, posting a CQE
+ *                          flagged IORING_CQE_F_MORE every round, removed
+ *                          at the end with one POLL_REMOVE
+ *
+ * Run iouringlat on this process and compare, e.g. with the defaults:
+ *
+ *   ./iouringlat_driver -r 1000 & ./iouringlat -s -p $! 10 1
+ *
+ * - COUNT per opcode is rounds * the share above, POLL_ADD and POLL_REMOVE
+ *   count 1 each, only once the driver exits: a multishot request is
+ *   measured to its last completion.
+ * - ASYNC% is 100 for WRITE and about 0 for READ and NOP.
+ * - In the ring line, SQ_MAX and INF_MAX are about BATCH, CQ_MAX is about
+ *   BATCH + 1 as the batch and the poll CQE pile up before being reaped.
+ */
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <poll.h>
+#include <liburing.h>
+
+#define BLOCK_SIZE	4096
+#define MAX_BATCH	256
+#define POLL_DATA	(~0ULL)
+
+static char bufs[MAX_BATCH][BLOCK_SIZE] __attribute__((aligned(BLOCK_SIZE)));
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"USAGE: %s [-r ROUNDS] [-b BATCH] [-f FILE]\n"
+		"    -r ROUNDS   batches to submit, default 100\n"
+		"    -b BATCH    requests per batch, 4 to %d, default 16\n"
+		"    -f FILE     scratch file, default ./iouringlat_driver.dat\n",
+		prog, MAX_BATCH);
+	exit(1);
+}
+
+static struct io_uring_sqe *get_sqe(struct io_uring *ring)
+{
+	struct io_uring_sqe *sqe = io_uring_get_sqe(ring);
+
+	if (!sqe) {
+		fprintf(stderr, "SQ ring full\n");
+		exit(1);
+	}
+	return sqe;
+}
+
+/* wait for *want* completions of the batch, plus the poll ones in between */
+static int reap(struct io_uring *ring, int want, bool *poll_done)
+{
+	struct io_uring_cqe *cqe;
+	unsigned int head, seen;
+	int err;
+
+	while (want > 0) {
+		err = io_uring_wait_cqe_nr(ring, &cqe, want);
+		if (err) {
+			fprintf(stderr, "io_uring_wait_cqe_nr: %s\n", strerror(-err));
+			return err;
+		}
+
+		seen = 0;
+		io_uring_for_each_cqe(ring, head, cqe) {
+			seen++;
+			if (cqe->user_data == POLL_DATA) {
+				if (!(cqe->flags & IORING_CQE_F_MORE))
+					*poll_done = true;
+				continue;
+			}
+			if (cqe->res < 0)
+				fprintf(stderr, "request %llu: %s\n", cqe->user_data,
+					strerror(-cqe->res));
+			want--;
+		}
+		io_uring_cq_advance(ring, seen);
+	}
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	const char *path = "./iouringlat_driver.dat";
+	int rounds = 100, batch = 16;
+	int i, opt, fd, efd, err, nr_reads, nr_writes;
+	struct io_uring_sqe *sqe;
+	bool poll_done = false;
+	struct io_uring ring;
+	__u64 val = 1;
+
+	while ((opt = getopt(argc, argv, "r:b:f:")) != -1) {
+		switch (opt) {
+		case 'r':
+			rounds = atoi(optarg);
+			break;
+		case 'b':
+			batch = atoi(optarg);
+			break;
+		case 'f':
+			path = optarg;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (rounds <= 0 || batch < 4 || batch > MAX_BATCH)
+		usage(argv[0]);
+
+	nr_reads = batch / 2;
+	nr_writes = batch / 4;
+
+	fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+	if (fd < 0) {
+		perror("open");
+		return 1;
+	}
+	/* fill the file so that the reads hit the page cache */
+	for (i = 0; i < nr_reads + nr_writes; i++) {
+		memset(bufs[i], 'a' + i % 26, BLOCK_SIZE);
+		if (pwrite(fd, bufs[i], BLOCK_SIZE, (off_t)i * BLOCK_SIZE) != BLOCK_SIZE) {
+			perror("pwrite");
+			return 1;
+		}
+	}
+
+	efd = eventfd(0, EFD_NONBLOCK);
+	if (efd < 0) {
+		perror("eventfd");
+		return 1;
+	}
+
+	/* room for a whole batch and the poll CQEs that come with it */
+	err = io_uring_queue_init(MAX_BATCH * 2, &ring, 0);
+	if (err) {
+		fprintf(stderr, "io_uring_queue_init: %s\n", strerror(-err));
+		return 1;
+	}
+
+	sqe = get_sqe(&ring);
+	io_uring_prep_poll_multishot(sqe, efd, POLLIN);
+	io_uring_sqe_set_data64(sqe, POLL_DATA);
+	io_uring_submit(&ring);
+
+	printf("pid %d: %d rounds of %d READ, %d WRITE (IOSQE_ASYNC), %d NOP\n",
+	       getpid(), rounds, nr_reads, nr_writes, batch - nr_reads - nr_writes);
+
+	for (int r = 0; r < rounds; r++) {
+		for (i = 0; i < batch; i++) {
+			sqe = get_sqe(&ring);
+			if (i < nr_reads) {
+				io_uring_prep_read(sqe, fd, bufs[i], BLOCK_SIZE,
+						   (__u64)i * BLOCK_SIZE);
+			} else if (i < nr_reads + nr_writes) {
+				io_uring_prep_write(sqe, fd, bufs[i], BLOCK_SIZE,
+						    (__u64)i * BLOCK_SIZE);
+				sqe->flags |= IOSQE_ASYNC;
+			} else {
+				io_uring_prep_nop(sqe);
+			}
+			io_uring_sqe_set_data64(sqe, i);
+		}
+
+		err = io_uring_submit(&ring);
+		if (err != batch) {
+			fprintf(stderr, "io_uring_submit: %s\n",
+				err < 0 ? strerror(-err) : "short submit");
+			return 1;
+		}
+
+		/* one more CQE of the multishot poll */
+		if (write(efd, &val, sizeof(val)) != sizeof(val))
+			perror("write eventfd");
+
+		if (reap(&ring, batch, &poll_done))
+			return 1;
+		/* drain the counter, keeping it from saturating */
+		if (read(efd, &val, sizeof(val)) != sizeof(val))
+			perror("read eventfd");
+		val = 1;
+	}
+
+	/* the final poll CQE, without IORING_CQE_F_MORE, ends the request */
+	sqe = get_sqe(&ring);
+	io_uring_prep_poll_remove(sqe, POLL_DATA);
+	io_uring_sqe_set_data64(sqe, 0);
+	io_uring_submit(&ring);
+	if (reap(&ring, 1, &poll_done))
+		return 1;
+	while (!poll_done) {
+		struct io_uring_cqe *cqe;
+
+		if (io_uring_wait_cqe(&ring, &cqe))
+			break;
+		if (cqe->user_data == POLL_DATA && !(cqe->flags & IORING_CQE_F_MORE))
+			poll_done = true;
+		io_uring_cqe_seen(&ring, cqe);
+	}
+
+	io_uring_queue_exit(&ring);
+	close(efd);
+	close(fd);
+	unlink(path);
+	return 0;
+}
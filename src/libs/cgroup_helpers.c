@@ -0,0 +1,205 @@
+// SPDX-License-Identifier: (LGPL-2.1 OR BSD-2-Clause)
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <time.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/vfs.h>
+
+#include "cgroup_helpers.h"
+
+#ifndef CGROUP2_SUPER_MAGIC
+#define CGROUP2_SUPER_MAGIC	0x63677270
+#endif
+
+#define RESCAN_INTERVAL_NS	1000000000ULL
+
+struct cgroup_entry {
+	__u64 id;
+	char *path;
+};
+
+struct cgroup_cache {
+	char root[PATH_MAX];
+	size_t root_len;
+	struct cgroup_entry *entries;
+	size_t nr;
+	size_t cap;
+	unsigned long long last_scan;
+};
+
+static unsigned long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static bool is_cgroup2(const char *path)
+{
+	struct statfs fs;
+
+	return !statfs(path, &fs) && fs.f_type == CGROUP2_SUPER_MAGIC;
+}
+
+static int entry_cmp(const void *p1, const void *p2)
+{
+	const struct cgroup_entry *e1 = p1, *e2 = p2;
+
+	if (e1->id == e2->id)
+		return 0;
+	return e1->id < e2->id ? -1 : 1;
+}
+
+static int cgroup_cache__add(struct cgroup_cache *cache, __u64 id,
+			     const char *path)
+{
+	struct cgroup_entry *tmp;
+
+	if (cache->nr == cache->cap) {
+		cache->cap = cache->cap ? cache->cap * 2 : 64;
+		tmp = realloc(cache->entries, cache->cap * sizeof(*tmp));
+		if (!tmp)
+			return -ENOMEM;
+		cache->entries = tmp;
+	}
+
+	/* the root cgroup is reported as "/" */
+	tmp = &cache->entries[cache->nr];
+	tmp->path = strdup(path[cache->root_len] ? path + cache->root_len : "/");
+	if (!tmp->path)
+		return -ENOMEM;
+	tmp->id = id;
+	cache->nr++;
+	return 0;
+}
+
+static int cgroup_cache__walk(struct cgroup_cache *cache, char *path,
+			      size_t len)
+{
+	struct dirent *dent;
+	struct stat st;
+	DIR *dir;
+	int err;
+
+	/*
+	 * on cgroup2 the inode number of a cgroup directory is its id; a
+	 * child removed while scanning is skipped, any other error fails
+	 */
+	if (stat(path, &st))
+		return errno == ENOENT && len > cache->root_len ? 0 : -errno;
+	err = cgroup_cache__add(cache, st.st_ino, path);
+	if (err)
+		return err;
+
+	dir = opendir(path);
+	if (!dir)
+		return errno == ENOENT && len > cache->root_len ? 0 : -errno;
+
+	while ((dent = readdir(dir))) {
+		if (dent->d_type != DT_DIR || !strcmp(dent->d_name, ".") ||
+		    !strcmp(dent->d_name, ".."))
+			continue;
+		if (len + strlen(dent->d_name) + 2 > PATH_MAX)
+			continue;
+		snprintf(path + len, PATH_MAX - len, "/%s", dent->d_name);
+		err = cgroup_cache__walk(cache, path, strlen(path));
+		path[len] = '\0';
+		if (err)
+			break;
+	}
+
+	closedir(dir);
+	return err;
+}
+
+static int cgroup_cache__scan(struct cgroup_cache *cache)
+{
+	char path[PATH_MAX];
+	size_t i;
+	int err;
+
+	for (i = 0; i < cache->nr; i++)
+		free(cache->entries[i].path);
+	cache->nr = 0;
+
+	strcpy(path, cache->root);
+	err = cgroup_cache__walk(cache, path, cache->root_len);
+	cache->last_scan = now_ns();
+	if (err)
+		return err;
+
+	qsort(cache->entries, cache->nr, sizeof(*cache->entries), entry_cmp);
+	return 0;
+}
+
+struct cgroup_cache *cgroup_cache__new(const char *root)
+{
+	struct cgroup_cache *cache;
+	int err;
+
+	if (!root) {
+		if (is_cgroup2("/sys/fs/cgroup/unified"))
+			root = "/sys/fs/cgroup/unified";
+		else if (is_cgroup2("/sys/fs/cgroup"))
+			root = "/sys/fs/cgroup";
+		else {
+			errno = ENOENT;
+			return NULL;
+		}
+	}
+
+	cache = calloc(1, sizeof(*cache));
+	if (!cache)
+		return NULL;
+
+	snprintf(cache->root, sizeof(cache->root), "%s", root);
+	cache->root_len = strlen(cache->root);
+	while (cache->root_len > 1 && cache->root[cache->root_len - 1] == '/')
+		cache->root[--cache->root_len] = '\0';
+
+	err = cgroup_cache__scan(cache);
+	if (err) {
+		cgroup_cache__free(cache);
+		errno = -err;
+		return NULL;
+	}
+
+	return cache;
+}
+
+void cgroup_cache__free(struct cgroup_cache *cache)
+{
+	size_t i;
+
+	if (!cache)
+		return;
+
+	for (i = 0; i < cache->nr; i++)
+		free(cache->entries[i].path);
+	free(cache->entries);
+	free(cache);
+}
+
+const char *cgroup_cache__get_path(struct cgroup_cache *cache, __u64 cgroup_id)
+{
+	struct cgroup_entry key = { .id = cgroup_id }, *entry;
+
+	entry = bsearch(&key, cache->entries, cache->nr, sizeof(key), entry_cmp);
+	if (entry)
+		return entry->path;
+
+	/* a new cgroup may have been created since the last walk */
+	if (now_ns() - cache->last_scan < RESCAN_INTERVAL_NS)
+		return NULL;
+	if (cgroup_cache__scan(cache))
+		return NULL;
+
+	entry = bsearch(&key, cache->entries, cache->nr, sizeof(key), entry_cmp);
+	return entry ? entry->path : NULL;
+}
@@ -0,0 +1,80 @@
+#!/bin/sh
+# SPDX-License-Identifier: (LGPL-2.1 OR BSD-2-Clause)
+#
+# Generate a compiled-in syscall number -> name table from the kernel uapi
+# headers, so that tools do not have to run ausyscall(8) at startup.
+#
+# usage: gen_syscall_table.sh <x86_64|arm64> [include dir...] > syscall_table_<arch>.h
+#
+# CC may be set to the (cross) compiler whose preprocessor should be used.
+# Additional include directories are searched before the system ones, e.g.
+# the uapi headers installed by "make headers_install ARCH=arm64".
+
+set -e
+
+ARCH=$1
+shift || true
+
+CC=${CC:-cc}
+INCLUDES=
+for dir in "$@"; do
+	INCLUDES="$INCLUDES -I$dir"
+done
+
+case "$ARCH" in
+x86_64)
+	HEADER="asm/unistd_64.h"
+	DEFINES=
+	;;
+arm64)
+	# arch/arm64/include/uapi/asm/unistd.h is a thin wrapper around the
+	# generic table, include that directly so a x86 host can generate it
+	HEADER="asm-generic/unistd.h"
+	DEFINES="-D__BITS_PER_LONG=64 -D__ARCH_WANT_RENAMEAT \
+		 -D__ARCH_WANT_NEW_STAT -D__ARCH_WANT_SET_GET_RLIMIT \
+		 -D__ARCH_WANT_TIME32_SYSCALLS -D__ARCH_WANT_SYS_CLONE3 \
+		 -D__ARCH_WANT_MEMFD_SECRET"
+	;;
+*)
+	echo "unsupported architecture: $ARCH" >&2
+	exit 1
+	;;
+esac
+
+TMP=$(mktemp -d)
+trap 'rm -rf "$TMP"' EXIT
+
+# collect every __NR_<name> macro, then let the preprocessor resolve the
+# numbers (the generic table defines some of them through __NR3264_*)
+echo "#include <$HEADER>" > "$TMP/in.c"
+$CC -E -dM $DEFINES $INCLUDES "$TMP/in.c" |
+	awk '$1 == "#define" && $2 ~ /^__NR_/ && $2 != "__NR_syscalls" &&
+		$2 != "__NR_arch_specific_syscall" {
+		print substr($2, 6) }' | sort -u > "$TMP/names"
+
+{
+	echo "#include <$HEADER>"
+	while read -r name; do
+		echo "SYSCALL_ENTRY __NR_$name $name"
+	done < "$TMP/names"
+} > "$TMP/nr.c"
+
+GUARD=$(echo "__SYSCALL_TABLE_${ARCH}_H" | tr 'a-z' 'A-Z')
+
+echo "/* SPDX-License-Identifier: (LGPL-2.1 OR BSD-2-Clause) */"
+echo "/* Generated by gen_syscall_table.sh from <$HEADER>, do not edit. */"
+echo "#ifndef $GUARD"
+echo "#define $GUARD"
+echo
+echo "static const char *syscall_names_$ARCH[] = {"
+$CC -E -P $DEFINES $INCLUDES "$TMP/nr.c" |
+	awk '$1 == "SYSCALL_ENTRY" {
+		nr = $0; sub(/^SYSCALL_ENTRY /, "", nr); sub(/ [^ ]+$/, "", nr)
+		gsub(/[() ]/, "", nr)
+		if (nr ~ /^[0-9]+$/)
+			printf("%d %s\n", nr, $NF)
+	}' | sort -n -k1,1 -u |
+	awk '{ printf("\t[%d] = \"%s\",\n", $1, $2) }'
+echo "};"
+echo
+echo "#endif /* $GUARD */"
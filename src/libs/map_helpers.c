@@ -3,6 +3,8 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <errno.h>
+#include <string.h>
+#include <bpf/libbpf.h>
 
 #include "map_helpers.h"
 
@@ -102,3 +104,62 @@ int dump_hash(int map_fd,
 	return dump_hash_iter(map_fd, keys, key_size,
 			      values, value_size, count, invalid_key);
 }
+
+/*
+ * The inner loops run over contiguous counters with no aliasing between
+ * source and destination, so the compiler turns them into vector adds.
+ */
+void percpu_sum_u64(__u64 *__restrict sum, const __u64 *__restrict values,
+		    int nr, size_t stride, int nr_cpus)
+{
+	int cpu, i;
+
+	memset(sum, 0, nr * sizeof(*sum));
+	for (cpu = 0; cpu < nr_cpus; cpu++, values += stride)
+		for (i = 0; i < nr; i++)
+			sum[i] += values[i];
+}
+
+void percpu_sum_u32(__u32 *__restrict sum, const __u32 *__restrict values,
+		    int nr, size_t stride, int nr_cpus)
+{
+	int cpu, i;
+
+	memset(sum, 0, nr * sizeof(*sum));
+	for (cpu = 0; cpu < nr_cpus; cpu++, values += stride)
+		for (i = 0; i < nr; i++)
+			sum[i] += values[i];
+}
+
+int lookup_percpu_sum_u64(int map_fd, const void *key, __u64 *sum, int nr)
+{
+	static __u64 *values;
+	static size_t values_size;
+	int nr_cpus, err;
+	size_t size;
+
+	nr_cpus = libbpf_num_possible_cpus();
+	if (nr_cpus < 0) {
+		errno = -nr_cpus;
+		return -1;
+	}
+
+	size = (size_t)nr_cpus * nr * sizeof(*values);
+	if (size > values_size) {
+		__u64 *tmp = realloc(values, size);
+
+		if (!tmp) {
+			errno = ENOMEM;
+			return -1;
+		}
+		values = tmp;
+		values_size = size;
+	}
+
+	err = bpf_map_lookup_elem(map_fd, key, values);
+	if (err)
+		return -1;
+
+	percpu_sum_u64(sum, values, nr, nr, nr_cpus);
+	return 0;
+}
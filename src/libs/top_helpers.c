@@ -0,0 +1,382 @@
+// SPDX-License-Identifier: (LGPL-2.1 OR BSD-2-Clause)
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <bpf/bpf.h>
+#include <bpf/libbpf.h>
+
+#include "top_helpers.h"
+
+/* home, then erase to the end of the screen */
+#define CLEAR_SCREEN	"\033[H\033[J"
+
+static bool batch_map_ops = true; /* hope for the best */
+
+struct top {
+	struct top_opts opts;
+	char *keys;
+	char *values;
+	char *percpu_values;	/* as read from a per-CPU map */
+	size_t percpu_size;	/* of one entry of percpu_values */
+	int nr_cpus;
+	int *heap;	/* worst kept entry at the root */
+	int *order;	/* ranked entries */
+	int nr_rows;
+	int nr_fields;	/* of the current JSON row */
+	char *stdout_buf;
+};
+
+struct top *top__new(const struct top_opts *opts)
+{
+	struct top *top;
+
+	if (!opts->key_size || !opts->value_size || !opts->max_entries ||
+	    opts->rows <= 0 || !opts->cmp) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	top = calloc(1, sizeof(*top));
+	if (!top)
+		return NULL;
+
+	top->opts = *opts;
+	top->keys = calloc(opts->max_entries, opts->key_size);
+	top->values = calloc(opts->max_entries, opts->value_size);
+	if (opts->merge) {
+		top->nr_cpus = libbpf_num_possible_cpus();
+		if (top->nr_cpus < 0) {
+			errno = -top->nr_cpus;
+			top__free(top);
+			return NULL;
+		}
+		/* the kernel rounds each CPU's copy up to 8 bytes */
+		top->percpu_size = (size_t)top->nr_cpus *
+				   ((opts->value_size + 7) & ~7UL);
+		top->percpu_values = calloc(opts->max_entries, top->percpu_size);
+		if (!top->percpu_values) {
+			top__free(top);
+			errno = ENOMEM;
+			return NULL;
+		}
+	}
+	top->heap = calloc(opts->rows, sizeof(*top->heap));
+	top->order = calloc(opts->rows, sizeof(*top->order));
+	if (!top->keys || !top->values || !top->heap || !top->order) {
+		top__free(top);
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	/* write each screen in one go rather than line by line */
+	if (opts->clear_screen && !opts->json && isatty(STDOUT_FILENO)) {
+		top->stdout_buf = malloc(1 << 16);
+		if (top->stdout_buf)
+			setvbuf(stdout, top->stdout_buf, _IOFBF, 1 << 16);
+	}
+
+	return top;
+}
+
+void top__free(struct top *top)
+{
+	if (!top)
+		return;
+
+	if (top->stdout_buf) {
+		fflush(stdout);
+		setvbuf(stdout, NULL, _IOLBF, 0);
+		free(top->stdout_buf);
+	}
+	free(top->keys);
+	free(top->values);
+	free(top->percpu_values);
+	free(top->heap);
+	free(top->order);
+	free(top);
+}
+
+static void *key_at(const struct top *top, int i)
+{
+	return top->keys + (size_t)i * top->opts.key_size;
+}
+
+static void *value_at(const struct top *top, int i)
+{
+	return top->values + (size_t)i * top->opts.value_size;
+}
+
+/* where map values are read into */
+static void *read_value_at(const struct top *top, int i)
+{
+	if (top->opts.merge)
+		return top->percpu_values + (size_t)i * top->percpu_size;
+	return value_at(top, i);
+}
+
+static void merge_percpu(struct top *top, __u32 count)
+{
+	size_t stride = top->percpu_size / top->nr_cpus;
+	const char *cpu_value;
+	__u32 i;
+	int cpu;
+
+	for (i = 0; i < count; i++) {
+		memset(value_at(top, i), 0, top->opts.value_size);
+		cpu_value = read_value_at(top, i);
+		for (cpu = 0; cpu < top->nr_cpus; cpu++, cpu_value += stride)
+			top->opts.merge(value_at(top, i), cpu_value);
+	}
+}
+
+static int cmp_entries(const struct top *top, int a, int b)
+{
+	return top->opts.cmp(key_at(top, a), value_at(top, a),
+			     key_at(top, b), value_at(top, b));
+}
+
+static int read_batch(struct top *top, int fd, __u32 *count)
+{
+	void *in = NULL, *out;
+	__u32 n, n_read = 0;
+	int err = 0;
+
+	while (n_read < top->opts.max_entries && !err) {
+		n = top->opts.max_entries - n_read;
+		if (top->opts.cumulative)
+			err = bpf_map_lookup_batch(fd, &in, &out,
+						   key_at(top, n_read),
+						   read_value_at(top, n_read), &n, NULL);
+		else
+			err = bpf_map_lookup_and_delete_batch(fd, &in, &out,
+							      key_at(top, n_read),
+							      read_value_at(top, n_read),
+							      &n, NULL);
+		if (err && errno != ENOENT)
+			return -1;
+		n_read += n;
+		in = out;
+	}
+
+	*count = n_read;
+	return 0;
+}
+
+static int read_iter(struct top *top, int fd, __u32 *count)
+{
+	void *prev = NULL;
+	__u32 n = 0, i;
+
+	while (n < top->opts.max_entries &&
+	       !bpf_map_get_next_key(fd, prev, key_at(top, n))) {
+		prev = key_at(top, n);
+		n++;
+	}
+
+	for (i = 0; i < n; i++) {
+		if (bpf_map_lookup_elem(fd, key_at(top, i), read_value_at(top, i)))
+			return -1;
+	}
+
+	/* deleting while walking would restart the walk from the first key */
+	if (!top->opts.cumulative) {
+		for (i = 0; i < n; i++)
+			bpf_map_delete_elem(fd, key_at(top, i));
+	}
+
+	*count = n;
+	return 0;
+}
+
+static void sift_down(struct top *top, int n, int i)
+{
+	int child, tmp;
+
+	for (;;) {
+		child = 2 * i + 1;
+		if (child >= n)
+			break;
+		if (child + 1 < n &&
+		    cmp_entries(top, top->heap[child + 1], top->heap[child]) > 0)
+			child++;
+		if (cmp_entries(top, top->heap[child], top->heap[i]) <= 0)
+			break;
+		tmp = top->heap[i];
+		top->heap[i] = top->heap[child];
+		top->heap[child] = tmp;
+		i = child;
+	}
+}
+
+static void sift_up(struct top *top, int i)
+{
+	int parent, tmp;
+
+	while (i > 0) {
+		parent = (i - 1) / 2;
+		if (cmp_entries(top, top->heap[i], top->heap[parent]) <= 0)
+			break;
+		tmp = top->heap[i];
+		top->heap[i] = top->heap[parent];
+		top->heap[parent] = tmp;
+		i = parent;
+	}
+}
+
+int top__collect(struct top *top, int map_fd)
+{
+	__u32 count = 0, i;
+	int err = -1, n = 0;
+
+	if (batch_map_ops) {
+		err = read_batch(top, map_fd, &count);
+		/* assume batch operations are not supported, try non-batch mode */
+		if (err && (errno == EINVAL || errno == ENOTSUP || errno == 524))
+			batch_map_ops = false;
+		else if (err)
+			return -errno;
+	}
+	if (!batch_map_ops) {
+		err = read_iter(top, map_fd, &count);
+		if (err)
+			return -errno;
+	}
+
+	if (top->opts.merge)
+		merge_percpu(top, count);
+
+	/* O(N log K): keep the K best entries, worst of them at the root */
+	for (i = 0; i < count; i++) {
+		if (n < top->opts.rows) {
+			top->heap[n] = i;
+			sift_up(top, n++);
+		} else if (cmp_entries(top, i, top->heap[0]) < 0) {
+			top->heap[0] = i;
+			sift_down(top, n, 0);
+		}
+	}
+
+	/* popping the worst entry first fills the ranking from the end */
+	top->nr_rows = n;
+	while (n > 0) {
+		top->order[n - 1] = top->heap[0];
+		top->heap[0] = top->heap[--n];
+		sift_down(top, n, 0);
+	}
+
+	return top->nr_rows;
+}
+
+const void *top__key(const struct top *top, int row)
+{
+	return key_at(top, top->order[row]);
+}
+
+const void *top__value(const struct top *top, int row)
+{
+	return value_at(top, top->order[row]);
+}
+
+static void print_json_string(const char *s)
+{
+	putchar('"');
+	for (; *s; s++) {
+		if (*s == '"' || *s == '\\')
+			printf("\\%c", *s);
+		else if ((unsigned char)*s < 0x20)
+			printf("\\u%04x", *s);
+		else
+			putchar(*s);
+	}
+	putchar('"');
+}
+
+void top__begin(struct top *top, bool loadavg)
+{
+	char ts[32], buf[256] = {};
+	struct tm *tm;
+	time_t t;
+	FILE *f;
+
+	time(&t);
+	tm = localtime(&t);
+	strftime(ts, sizeof(ts), "%H:%M:%S", tm);
+
+	if (loadavg) {
+		f = fopen("/proc/loadavg", "r");
+		if (f) {
+			if (!fread(buf, 1, sizeof(buf) - 1, f))
+				buf[0] = '\0';
+			fclose(f);
+		}
+	}
+
+	if (top->opts.json) {
+		printf("{\"time\": \"%s\"", ts);
+		if (buf[0]) {
+			buf[strcspn(buf, "\n")] = '\0';
+			printf(", \"loadavg\": ");
+			print_json_string(buf);
+		}
+		printf(", \"rows\": [");
+		top->nr_fields = -1;
+		return;
+	}
+
+	if (top->opts.clear_screen)
+		fputs(CLEAR_SCREEN, stdout);
+	if (buf[0])
+		printf("%8s loadavg: %s\n", ts, buf);
+}
+
+void top__end(struct top *top)
+{
+	if (top->opts.json) {
+		if (top->nr_fields >= 0)
+			putchar('}');
+		printf("]}\n");
+	} else {
+		printf("\n");
+	}
+	fflush(stdout);
+}
+
+bool top__json(const struct top *top)
+{
+	return top->opts.json;
+}
+
+void top__json_row(struct top *top)
+{
+	if (top->nr_fields >= 0)
+		printf("}, ");
+	putchar('{');
+	top->nr_fields = 0;
+}
+
+static void json_name(struct top *top, const char *name)
+{
+	printf("%s\"%s\": ", top->nr_fields++ ? ", " : "", name);
+}
+
+void top__json_str(struct top *top, const char *name, const char *val)
+{
+	json_name(top, name);
+	print_json_string(val);
+}
+
+void top__json_u64(struct top *top, const char *name, unsigned long long val)
+{
+	json_name(top, name);
+	printf("%llu", val);
+}
+
+void top__json_double(struct top *top, const char *name, double val)
+{
+	json_name(top, name);
+	printf("%.2f", val);
+}
@@ -801,3 +801,48 @@ static struct dso *syms__find_dso(const struct syms *syms, unsigned long addr,
 
 	return NULL;
 }
+
+unsigned long long log2_hist_percentile(unsigned int *vals, int vals_size,
+					double percentile)
+{
+	unsigned long long total = 0, sum = 0, target;
+	double want;
+	int i;
+
+	for (i = 0; i < vals_size; i++)
+		total += vals[i];
+	if (!total)
+		return 0;
+
+	want = total * percentile / 100.0;
+	target = want;
+	if (target < want || !target)
+		target++;
+
+	for (i = 0; i < vals_size; i++) {
+		sum += vals[i];
+		if (sum >= target)
+			break;
+	}
+	if (i == vals_size)
+		i--;
+
+	return (1ULL << (i + 1)) - 1;
+}
+
+void print_heatmap_cells(const unsigned int *vals, int vals_size)
+{
+	static const char shades[] = HEATMAP_SHADES;
+	unsigned long long total = 0;
+	int i, level;
+
+	putchar('|');
+	for (i = 0; i < vals_size; i++) {
+		/* 1 -> '.', 2-3 -> ':', ... 256 and more -> '@' */
+		for (level = 0; level < 9 && vals[i] >> level; level++)
+			;
+		putchar(shades[level]);
+		total += vals[i];
+	}
+	printf("| %llu\n", total);
+}
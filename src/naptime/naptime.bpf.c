@@ -5,6 +5,236 @@
 #include <bpf/bpf_tracing.h>
 #include "naptime.h"
 #include "compat.bpf.h"
+#include "maps.bpf.h"
+#include "bits.bpf.h"
+
+#define NSEC_PER_SEC 1000000000ULL
+
+extern int CONFIG_HZ __kconfig __weak;
+
+/* timer being armed -> where its expirations are accounted */
+struct
+{
+    __uint(type, BPF_MAP_TYPE_LRU_HASH);
+    __uint(max_entries, MAX_ENTRIES);
+    __type(key, u64);
+    __type(value, struct timer_key);
+} armed SEC(".maps");
+
+struct
+{
+    __uint(type, BPF_MAP_TYPE_PERCPU_HASH);
+    __uint(max_entries, MAX_ENTRIES);
+    __type(key, struct timer_key);
+    __type(value, struct timer_stat);
+} timer_stats SEC(".maps");
+
+/* callback in progress on this CPU, one slot per timer type */
+struct running
+{
+    struct timer_key key;
+    u64 ts;
+};
+
+struct
+{
+    __uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+    __uint(max_entries, 2);
+    __type(key, u32);
+    __type(value, struct running);
+} running SEC(".maps");
+
+static const struct timer_stat zero_stat;
+
+static __always_inline u64 jiffies_to_ns(s64 jiffies)
+{
+    int hz = CONFIG_HZ ? CONFIG_HZ : 250;
+
+    return jiffies > 0 ? jiffies * (NSEC_PER_SEC / hz) : 0;
+}
+
+static __always_inline int
+timer_armed(u64 timer, u64 function, u8 type, u64 interval_ns, u64 slack_ns)
+{
+    struct timer_key key = {};
+    struct timer_stat *stat;
+    u64 slot;
+
+    key.function = function;
+    key.tgid = bpf_get_current_pid_tgid() >> 32;
+    key.type = type;
+    slot = log2l(interval_ns / 1000);
+    key.slot = slot < MAX_INTERVAL_SLOTS ? slot : MAX_INTERVAL_SLOTS - 1;
+
+    stat = bpf_map_lookup_or_try_init(&timer_stats, &key, &zero_stat);
+    if (!stat)
+        return 0;
+    stat->starts++;
+    stat->slack_ns += slack_ns;
+    if (!stat->comm[0])
+        bpf_get_current_comm(&stat->comm, sizeof(stat->comm));
+
+    bpf_map_update_elem(&armed, &timer, &key, BPF_ANY);
+    return 0;
+}
+
+static __always_inline int timer_expire_entry(u64 timer, u32 type, u64 late_ns)
+{
+    struct timer_key *key;
+    struct timer_stat *stat;
+    struct running *r;
+
+    r = bpf_map_lookup_elem(&running, &type);
+    if (!r)
+        return 0;
+    r->ts = 0;
+
+    /* timers armed before we started are not accounted */
+    key = bpf_map_lookup_elem(&armed, &timer);
+    if (!key)
+        return 0;
+
+    stat = bpf_map_lookup_elem(&timer_stats, key);
+    if (!stat)
+        stat = bpf_map_lookup_or_try_init(&timer_stats, key, &zero_stat);
+    if (!stat)
+        return 0;
+    stat->expires++;
+    stat->late_ns += late_ns;
+
+    r->key = *key;
+    r->ts = bpf_ktime_get_ns();
+    return 0;
+}
+
+static __always_inline int timer_expire_exit(u32 type)
+{
+    struct timer_stat *stat;
+    struct running *r;
+
+    r = bpf_map_lookup_elem(&running, &type);
+    if (!r || !r->ts)
+        return 0;
+
+    stat = bpf_map_lookup_elem(&timer_stats, &r->key);
+    if (stat)
+        stat->run_ns += bpf_ktime_get_ns() - r->ts;
+    r->ts = 0;
+    return 0;
+}
+
+/*
+ * hrtimer expiry times are in the clock of their base, this assumes
+ * CLOCK_MONOTONIC, which is what nearly all of them (and timerfds
+ * created with it) use. Others only skew the interval bucket.
+ */
+static __always_inline int handle_hrtimer_start(struct hrtimer *hrtimer)
+{
+    s64 soft = BPF_CORE_READ(hrtimer, _softexpires);
+    s64 hard = BPF_CORE_READ(hrtimer, node.expires);
+    s64 now = bpf_ktime_get_ns();
+
+    return timer_armed((u64)hrtimer, (u64)BPF_CORE_READ(hrtimer, function),
+                       TIMER_HRTIMER, soft > now ? soft - now : 0,
+                       hard > soft ? hard - soft : 0);
+}
+
+static __always_inline int handle_hrtimer_expire_entry(struct hrtimer *hrtimer)
+{
+    s64 soft = BPF_CORE_READ(hrtimer, _softexpires);
+    s64 now = bpf_ktime_get_ns();
+
+    return timer_expire_entry((u64)hrtimer, TIMER_HRTIMER,
+                              now > soft ? now - soft : 0);
+}
+
+static __always_inline int handle_timer_start(struct timer_list *timer)
+{
+    s64 expires = BPF_CORE_READ(timer, expires);
+
+    return timer_armed((u64)timer, (u64)BPF_CORE_READ(timer, function),
+                       TIMER_WHEEL, jiffies_to_ns(expires - bpf_jiffies64()), 0);
+}
+
+static __always_inline int handle_timer_expire_entry(struct timer_list *timer)
+{
+    s64 expires = BPF_CORE_READ(timer, expires);
+
+    return timer_expire_entry((u64)timer, TIMER_WHEEL,
+                              jiffies_to_ns(bpf_jiffies64() - expires));
+}
+
+SEC("tp_btf/hrtimer_start")
+int BPF_PROG(hrtimer_start_btf, struct hrtimer *hrtimer)
+{
+    return handle_hrtimer_start(hrtimer);
+}
+
+SEC("tp_btf/hrtimer_expire_entry")
+int BPF_PROG(hrtimer_expire_entry_btf, struct hrtimer *hrtimer)
+{
+    return handle_hrtimer_expire_entry(hrtimer);
+}
+
+SEC("tp_btf/hrtimer_expire_exit")
+int BPF_PROG(hrtimer_expire_exit_btf, struct hrtimer *hrtimer)
+{
+    return timer_expire_exit(TIMER_HRTIMER);
+}
+
+SEC("tp_btf/timer_start")
+int BPF_PROG(timer_start_btf, struct timer_list *timer)
+{
+    return handle_timer_start(timer);
+}
+
+SEC("tp_btf/timer_expire_entry")
+int BPF_PROG(timer_expire_entry_btf, struct timer_list *timer)
+{
+    return handle_timer_expire_entry(timer);
+}
+
+SEC("tp_btf/timer_expire_exit")
+int BPF_PROG(timer_expire_exit_btf, struct timer_list *timer)
+{
+    return timer_expire_exit(TIMER_WHEEL);
+}
+
+SEC("raw_tp/hrtimer_start")
+int BPF_PROG(hrtimer_start_raw, struct hrtimer *hrtimer)
+{
+    return handle_hrtimer_start(hrtimer);
+}
+
+SEC("raw_tp/hrtimer_expire_entry")
+int BPF_PROG(hrtimer_expire_entry_raw, struct hrtimer *hrtimer)
+{
+    return handle_hrtimer_expire_entry(hrtimer);
+}
+
+SEC("raw_tp/hrtimer_expire_exit")
+int BPF_PROG(hrtimer_expire_exit_raw, struct hrtimer *hrtimer)
+{
+    return timer_expire_exit(TIMER_HRTIMER);
+}
+
+SEC("raw_tp/timer_start")
+int BPF_PROG(timer_start_raw, struct timer_list *timer)
+{
+    return handle_timer_start(timer);
+}
+
+SEC("raw_tp/timer_expire_entry")
+int BPF_PROG(timer_expire_entry_raw, struct timer_list *timer)
+{
+    return handle_timer_expire_entry(timer);
+}
+
+SEC("raw_tp/timer_expire_exit")
+int BPF_PROG(timer_expire_exit_raw, struct timer_list *timer)
+{
+    return timer_expire_exit(TIMER_WHEEL);
+}
 
 SEC("tracepoint/syscalls/sys_enter_nanosleep")
 int tracepoint__sys_enter_nanosleep(struct trace_event_raw_sys_enter *ctx)
@@ -3,22 +3,35 @@
 #include "naptime.h"
 #include "naptime.skel.h"
 #include "btf_helpers.h"
+#include "trace_helpers.h"
 #include "compat.h"
 
+#define MAX_ROWS 20
+
 static volatile sig_atomic_t exiting;
 static bool verbose = false;
 static bool timestamp = false;
+static bool timerstat = false;
+static time_t interval = 1;
+static int nr_cpus;
+static struct ksyms *ksyms;
 
 const char *argp_program_version = "naptime 0.1";
 const char *argp_program_bug_address = "Jackie Liu <liuyun01@kylinos.cn>";
 const char argp_program_doc[] =
     "Show voluntary sleep calls.\n"
     "\n"
-    "USAGE:    naptime [-v] [-T]\n";
+    "USAGE:    naptime [-v] [-T] [-t [interval]]\n"
+    "\n"
+    "EXAMPLES:\n"
+    "    naptime           # trace nanosleep calls\n"
+    "    naptime -t        # timer expirations per process and callback, 1s summaries\n"
+    "    naptime -t 5      # same, 5 second summaries\n";
 
 static const struct argp_option opts[] = {
     {"verbose", 'v', NULL, 0, "Verbose debug output"},
     {"timestamp", 'T', NULL, 0, "Include timestamp on output"},
+    {"timerstat", 't', NULL, 0, "Summarize hrtimer and timer wheel expirations"},
     {NULL, 'h', NULL, 0, "Show the full help"},
     {}};
 
@@ -48,6 +61,22 @@ static error_t parse_arg(int key, char *arg, struct argp_state *state)
     case 'T':
         timestamp = true;
         break;
+    case 't':
+        timerstat = true;
+        break;
+    case ARGP_KEY_ARG:
+        if (!timerstat || state->arg_num > 0)
+        {
+            warning("Unrecognized positional argument: %s\n", arg);
+            argp_usage(state);
+        }
+        interval = argp_parse_long(key, arg, state);
+        if (interval <= 0)
+        {
+            warning("Invalid interval: %s\n", arg);
+            argp_usage(state);
+        }
+        break;
     default:
         return ARGP_ERR_UNKNOWN;
     }
@@ -77,6 +106,151 @@ static void handle_lost_events(void *ctx, int cpu, __u64 lost_cnt)
     warning("Lost %llu event on CPU #%d!\n", lost_cnt, cpu);
 }
 
+struct timer_row
+{
+    struct timer_key key;
+    struct timer_stat stat;
+};
+
+static int sort_expires(const void *a, const void *b)
+{
+    const struct timer_row *x = a, *y = b;
+
+    if (x->stat.expires != y->stat.expires)
+        return x->stat.expires < y->stat.expires ? 1 : -1;
+    if (x->stat.starts != y->stat.starts)
+        return x->stat.starts < y->stat.starts ? 1 : -1;
+    return 0;
+}
+
+static void print_timer_row(const struct timer_row *r, double secs)
+{
+    const struct ksym *ksym = ksyms__map_addr(ksyms, r->key.function);
+    unsigned long long lo = r->key.slot ? 1ULL << r->key.slot : 0;
+    unsigned long long hi = (1ULL << (r->key.slot + 1)) - 1;
+    char range[32], func[64];
+    __u64 n = r->stat.expires;
+
+    if (ksym)
+        snprintf(func, sizeof(func), "%s", ksym->name);
+    else
+        snprintf(func, sizeof(func), "0x%llx", r->key.function);
+    snprintf(range, sizeof(range), "%llu-%llu", lo, hi);
+
+    printf("%-7u %-16s %-7s %-28s %-14s %8.1f %8.1f ",
+           r->key.tgid, r->stat.comm,
+           r->key.type == TIMER_HRTIMER ? "hrtimer" : "timer",
+           func, range, n / secs, n ? r->stat.late_ns / 1000.0 / n : 0);
+    if (r->key.type == TIMER_HRTIMER && r->stat.starts)
+        printf("%9.1f ", r->stat.slack_ns / 1000.0 / r->stat.starts);
+    else
+        printf("%9s ", "-");
+    printf("%8.1f\n", n ? r->stat.run_ns / 1000.0 / n : 0);
+}
+
+static int print_timer_stats(int fd, double secs)
+{
+    static struct timer_row rows[MAX_ENTRIES];
+    struct timer_stat values[nr_cpus];
+    struct timer_key *prev = NULL, key;
+    int i, cpu, n = 0;
+
+    while (n < MAX_ENTRIES && !bpf_map_get_next_key(fd, prev, &key))
+    {
+        rows[n].key = key;
+        prev = &rows[n].key;
+        n++;
+    }
+
+    for (i = 0; i < n; i++)
+    {
+        struct timer_stat *s = &rows[i].stat;
+
+        memset(s, 0, sizeof(*s));
+        if (bpf_map_lookup_elem(fd, &rows[i].key, values))
+            continue;
+        bpf_map_delete_elem(fd, &rows[i].key);
+
+        for (cpu = 0; cpu < nr_cpus; cpu++)
+        {
+            s->starts += values[cpu].starts;
+            s->expires += values[cpu].expires;
+            s->late_ns += values[cpu].late_ns;
+            s->slack_ns += values[cpu].slack_ns;
+            s->run_ns += values[cpu].run_ns;
+            if (values[cpu].comm[0])
+                memcpy(s->comm, values[cpu].comm, sizeof(s->comm));
+        }
+    }
+
+    qsort(rows, n, sizeof(*rows), sort_expires);
+
+    if (timestamp)
+    {
+        char ts[32];
+
+        strftime_now(ts, sizeof(ts), "%H:%M:%S");
+        printf("%-8s\n", ts);
+    }
+    printf("%-7s %-16s %-7s %-28s %-14s %8s %8s %9s %8s\n",
+           "PID", "COMM", "TYPE", "FUNCTION", "INTERVAL(us)",
+           "EXP/s", "LATE(us)", "SLACK(us)", "RUN(us)");
+    for (i = 0; i < n && i < MAX_ROWS; i++)
+    {
+        if (!rows[i].stat.expires && !rows[i].stat.starts)
+            break;
+        print_timer_row(&rows[i], secs);
+    }
+    printf("\n");
+
+    return 0;
+}
+
+static void set_timer_autoload(struct naptime_bpf *obj)
+{
+    bool btf = timerstat && probe_tp_btf("hrtimer_start");
+    bool raw = timerstat && !btf;
+
+    bpf_program__set_autoload(obj->progs.hrtimer_start_btf, btf);
+    bpf_program__set_autoload(obj->progs.hrtimer_expire_entry_btf, btf);
+    bpf_program__set_autoload(obj->progs.hrtimer_expire_exit_btf, btf);
+    bpf_program__set_autoload(obj->progs.timer_start_btf, btf);
+    bpf_program__set_autoload(obj->progs.timer_expire_entry_btf, btf);
+    bpf_program__set_autoload(obj->progs.timer_expire_exit_btf, btf);
+    bpf_program__set_autoload(obj->progs.hrtimer_start_raw, raw);
+    bpf_program__set_autoload(obj->progs.hrtimer_expire_entry_raw, raw);
+    bpf_program__set_autoload(obj->progs.hrtimer_expire_exit_raw, raw);
+    bpf_program__set_autoload(obj->progs.timer_start_raw, raw);
+    bpf_program__set_autoload(obj->progs.timer_expire_entry_raw, raw);
+    bpf_program__set_autoload(obj->progs.timer_expire_exit_raw, raw);
+    bpf_program__set_autoload(obj->progs.tracepoint__sys_enter_nanosleep, !timerstat);
+
+    if (!timerstat)
+    {
+        bpf_map__set_max_entries(obj->maps.armed, 1);
+        bpf_map__set_max_entries(obj->maps.timer_stats, 1);
+    }
+}
+
+static int run_timerstat(struct naptime_bpf *obj)
+{
+    int fd = bpf_map__fd(obj->maps.timer_stats);
+    __u64 start = get_ktime_ns(), now;
+
+    printf("Tracing timer expirations... Hit Ctrl-C to end.\n");
+
+    while (!exiting)
+    {
+        sleep(interval);
+
+        now = get_ktime_ns();
+        print_timer_stats(fd, (now - start) / 1e9);
+        start = now;
+    }
+
+    return 0;
+}
+
 int main(int argc, char *argv[])
 {
     LIBBPF_OPTS(bpf_object_open_opts, open_opts);
@@ -100,6 +274,14 @@ int main(int argc, char *argv[])
 
     err = ensure_core_btf(&open_opts);
 
+    nr_cpus = libbpf_num_possible_cpus();
+    if (nr_cpus < 0)
+    {
+        warning("Failed to get # of possible cpus: '%s'!\n",
+                strerror(-nr_cpus));
+        return 1;
+    }
+
     obj = naptime_bpf__open_opts(&open_opts);
     if (!obj)
     {
@@ -107,6 +289,19 @@ int main(int argc, char *argv[])
         return 1;
     }
 
+    set_timer_autoload(obj);
+
+    if (timerstat)
+    {
+        ksyms = ksyms__load();
+        if (!ksyms)
+        {
+            warning("Failed to load kallsyms\n");
+            err = 1;
+            goto cleanup;
+        }
+    }
+
     buf = bpf_buffer__new(obj->maps.events, obj->maps.heap);
     if (!buf)
     {
@@ -136,6 +331,12 @@ int main(int argc, char *argv[])
         goto cleanup;
     }
 
+    if (timerstat)
+    {
+        err = run_timerstat(obj);
+        goto cleanup;
+    }
+
     err = bpf_buffer__open(buf, handle_event, handle_lost_events, NULL);
     if (err)
     {
@@ -163,7 +364,9 @@ int main(int argc, char *argv[])
     }
 
 cleanup:
+    bpf_buffer__free(buf);
     naptime_bpf__destroy(obj);
+    ksyms__free(ksyms);
     cleanup_core_btf(&open_opts);
 
     return err != 0;
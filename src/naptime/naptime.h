@@ -14,4 +14,33 @@ struct event
     long long tv_nsec;
 };
 
+/* timerstat mode */
+#define MAX_ENTRIES 10240
+#define MAX_INTERVAL_SLOTS 32
+
+enum timer_type
+{
+    TIMER_HRTIMER,
+    TIMER_WHEEL,
+};
+
+struct timer_key
+{
+    __u64 function;   /* callback address */
+    __u32 tgid;       /* process that armed the timer */
+    __u8 type;        /* enum timer_type */
+    __u8 slot;        /* log2 of the requested interval in usecs */
+    __u16 pad;
+};
+
+struct timer_stat
+{
+    __u64 starts;
+    __u64 expires;
+    __u64 late_ns;    /* sum of expiry time minus requested time */
+    __u64 slack_ns;   /* sum of requested slack, hrtimers only */
+    __u64 run_ns;     /* sum of callback run time */
+    char comm[TASK_COMM_LEN];
+};
+
 #endif
\ No newline at end of file
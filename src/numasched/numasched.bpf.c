@@ -3,13 +3,14 @@
 #include <bpf/bpf_helpers.h>
 #include <bpf/bpf_tracing.h>
 #include "numasched.h"
+#include "maps.bpf.h"
 
 struct
 {
     __uint(type, BPF_MAP_TYPE_HASH);
     __type(key, u32);
     __type(value, u32);
-    __uint(max_entries, 10240);
+    __uint(max_entries, MAX_ENTRIES);
 } numa_node_map SEC(".maps");
 
 struct
@@ -22,6 +23,42 @@ struct
 const volatile pid_t target_tgid = INVALID_PID;
 const volatile pid_t target_pid = INVALID_PID;
 
+/* last node of each task, stored as node + 1 so that 0 means unknown */
+struct
+{
+    __uint(type, BPF_MAP_TYPE_TASK_STORAGE);
+    __uint(map_flags, BPF_F_NO_PREALLOC);
+    __type(key, int);
+    __type(value, u32);
+} task_node SEC(".maps");
+
+/* from * MAX_NUMA_NODES + to -> number of moves */
+struct
+{
+    __uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+    __uint(max_entries, MAX_NUMA_NODES * MAX_NUMA_NODES);
+    __type(key, u32);
+    __type(value, u64);
+} node_matrix SEC(".maps");
+
+struct
+{
+    __uint(type, BPF_MAP_TYPE_PERCPU_HASH);
+    __uint(max_entries, MAX_ENTRIES);
+    __type(key, u32);
+    __type(value, struct tgid_stat);
+} tgid_stats SEC(".maps");
+
+struct
+{
+    __uint(type, BPF_MAP_TYPE_HASH);
+    __uint(max_entries, MAX_ENTRIES);
+    __type(key, u32);
+    __type(value, u64);
+} migrate_start SEC(".maps");
+
+static const struct tgid_stat zero_stat;
+
 static int handle_sched_switch(void *ctx, struct task_struct *prev,
                                struct task_struct *next)
 {
@@ -64,6 +101,131 @@ update:
     return 0;
 }
 
+/*
+ * Aggregation mode: no hash update and no event per context switch, only
+ * a task storage lookup, plus per-CPU counter updates when the node changed.
+ */
+static int handle_sched_switch_agg(void)
+{
+    struct task_struct *task = bpf_get_current_task_btf();
+    u64 id = bpf_get_current_pid_tgid();
+    pid_t tgid = id >> 32;
+    pid_t pid = (pid_t)id;
+    u32 numa_id = bpf_get_numa_node_id();
+    struct tgid_stat *stat;
+    u32 *last, idx;
+    u64 *count;
+
+    if (tgid == 0)
+        return 0;
+
+    if (target_tgid != INVALID_PID && target_tgid != tgid)
+        return 0;
+
+    if (target_pid != INVALID_PID && target_pid != pid)
+        return 0;
+
+    last = bpf_task_storage_get(&task_node, task, 0,
+                                BPF_LOCAL_STORAGE_GET_F_CREATE);
+    if (!last || *last == numa_id + 1)
+        return 0;
+
+    if (*last && *last <= MAX_NUMA_NODES && numa_id < MAX_NUMA_NODES)
+    {
+        idx = (*last - 1) * MAX_NUMA_NODES + numa_id;
+        count = bpf_map_lookup_elem(&node_matrix, &idx);
+        if (count)
+            *count += 1;
+
+        idx = tgid;
+        stat = bpf_map_lookup_or_try_init(&tgid_stats, &idx, &zero_stat);
+        if (stat)
+            stat->node_moves++;
+    }
+
+    *last = numa_id + 1;
+    return 0;
+}
+
+static int migrate_entry(void)
+{
+    u64 id = bpf_get_current_pid_tgid();
+    pid_t tgid = id >> 32;
+    u32 pid = (u32)id;
+    u64 ts;
+
+    if (target_tgid != INVALID_PID && target_tgid != tgid)
+        return 0;
+
+    ts = bpf_ktime_get_ns();
+    bpf_map_update_elem(&migrate_start, &pid, &ts, BPF_ANY);
+    return 0;
+}
+
+static int migrate_exit(void)
+{
+    u64 id = bpf_get_current_pid_tgid();
+    u32 tgid = id >> 32;
+    u32 pid = (u32)id;
+    struct tgid_stat *stat;
+    u64 *tsp;
+    s64 delta;
+
+    tsp = bpf_map_lookup_elem(&migrate_start, &pid);
+    if (!tsp)
+        return 0;
+
+    delta = (s64)(bpf_ktime_get_ns() - *tsp);
+    bpf_map_delete_elem(&migrate_start, &pid);
+    if (delta < 0)
+        return 0;
+
+    stat = bpf_map_lookup_or_try_init(&tgid_stats, &tgid, &zero_stat);
+    if (!stat)
+        return 0;
+    stat->page_migrations++;
+    stat->migrate_ns += delta;
+    return 0;
+}
+
+SEC("tp_btf/sched_switch")
+int BPF_PROG(sched_switch_agg_btf, int preempt, struct task_struct *prev,
+             struct task_struct *next)
+{
+    return handle_sched_switch_agg();
+}
+
+SEC("raw_tp/sched_switch")
+int BPF_PROG(sched_switch_agg_raw, int preempt, struct task_struct *prev,
+             struct task_struct *next)
+{
+    return handle_sched_switch_agg();
+}
+
+SEC("fentry/migrate_misplaced_page")
+int BPF_PROG(fentry_migrate_misplaced_page)
+{
+    return migrate_entry();
+}
+
+SEC("fexit/migrate_misplaced_page")
+int BPF_PROG(fexit_migrate_misplaced_page)
+{
+    return migrate_exit();
+}
+
+SEC("kprobe/migrate_misplaced_page")
+int BPF_KPROBE(kprobe_migrate_misplaced_page)
+{
+    return migrate_entry();
+}
+
+SEC("kretprobe/migrate_misplaced_page")
+int BPF_KRETPROBE(kretprobe_migrate_misplaced_page)
+{
+    return migrate_exit();
+}
+
 SEC("tp_btf/sched_switch")
 int BPF_PROG(sched_switch_btf, int preempt, struct task_struct *prev,
              struct task_struct *next)
@@ -14,9 +14,15 @@ static struct env
     char *comm;
     pid_t pid;
     pid_t tid;
+    bool aggregate;
+    bool migrate_cost;
+    int interval;
+    int times;
 } env = {
     .pid = INVALID_PID,
     .tid = INVALID_PID,
+    .interval = 1,
+    .times = 99999999,
 };
 
 const char *argp_program_version = "numasched 0.1";
@@ -24,7 +30,7 @@ const char *argp_program_bug_address = "Jackie Liu <liuyun01@kylinos.cn>";
 const char argp_program_doc[] =
     "Trace task NUMA switch\n"
     "\n"
-    "USAGE: numasched [-p PID] [-t TID] [-c COMM]\n"
+    "USAGE: numasched [-p PID] [-t TID] [-c COMM] [-a] [-m] [interval] [count]\n"
     "\n"
     "EXAMPLES:\n"
     "    ./numasched             # Trace all numa node switch\n"
@@ -32,6 +38,9 @@ const char argp_program_doc[] =
     "    ./numasched -t 1234     # Trace thread id 1234 only\n"
     "    ./numasched -c comm     # Trace this comm only\n"
     "    ./numasched -T          # Include timestamp\n"
+    "    ./numasched -a          # Print node->node matrix and per-process moves\n"
+    "    ./numasched -a 5 10     # Aggregate every 5 seconds, 10 times\n"
+    "    ./numasched -am         # Also account migrate_misplaced_page() cost\n"
     "    ./numasched -v          # Verbose debug output\n";
 
 static const struct argp_option opts[] = {
@@ -40,6 +49,8 @@ static const struct argp_option opts[] = {
     {"pid", 'p', "PID", 0, "Trace this PID only"},
     {"tid", 't', "TID", 0, "Trace this TID only"},
     {"comm", 'c', "COMM", 0, "Trace this comm only"},
+    {"aggregate", 'a', NULL, 0, "Aggregate in kernel, print a summary per interval"},
+    {"migrate-cost", 'm', NULL, 0, "Account page migration time per process (with -a)"},
     {NULL, 'h', NULL, OPTION_HIDDEN, "Show the full help"},
     {},
 };
@@ -72,6 +83,50 @@ static error_t parse_arg(int key, char *arg, struct argp_state *state)
     case 'c':
         env.comm = arg;
         break;
+    case 'a':
+        env.aggregate = true;
+        break;
+    case 'm':
+        env.migrate_cost = true;
+        break;
+    case ARGP_KEY_ARG:
+        errno = 0;
+        if (state->arg_num == 0)
+        {
+            env.interval = strtol(arg, NULL, 10);
+            if (errno || env.interval <= 0)
+            {
+                warning("Invalid interval: %s\n", arg);
+                argp_usage(state);
+            }
+        }
+        else if (state->arg_num == 1)
+        {
+            env.times = strtol(arg, NULL, 10);
+            if (errno || env.times <= 0)
+            {
+                warning("Invalid times: %s\n", arg);
+                argp_usage(state);
+            }
+        }
+        else
+        {
+            warning("Unrecognized positional argument: %s\n", arg);
+            argp_usage(state);
+        }
+        break;
+    case ARGP_KEY_END:
+        if (env.migrate_cost && !env.aggregate)
+        {
+            warning("-m requires -a\n");
+            argp_usage(state);
+        }
+        if (state->arg_num && !env.aggregate)
+        {
+            warning("interval and count require -a\n");
+            argp_usage(state);
+        }
+        break;
     default:
         return ARGP_ERR_UNKNOWN;
     }
@@ -117,6 +172,143 @@ static void handle_lost_events(void *ctx, int cpu, __u64 lost_cnt)
     warning("Lost %llu events on cpu #%d!\n", lost_cnt, cpu);
 }
 
+static void read_comm(__u32 tgid, char *comm, size_t size)
+{
+    char path[64];
+    FILE *f;
+
+    snprintf(path, sizeof(path), "/proc/%u/comm", tgid);
+    f = fopen(path, "r");
+    if (!f || !fgets(comm, size, f))
+        snprintf(comm, size, "[exited]");
+    else
+        comm[strcspn(comm, "\n")] = '\0';
+
+    if (f)
+        fclose(f);
+}
+
+static int print_matrix(int fd, int nr_nodes, int nr_cpus)
+{
+    __u64 values[nr_cpus], zero[nr_cpus];
+    __u64 total, moves = 0;
+    __u32 from, to, idx;
+    int i, err;
+
+    memset(zero, 0, sizeof(zero));
+
+    printf("NUMA node migrations (rows: from, columns: to)\n%-6s", "");
+    for (to = 0; to < nr_nodes; to++)
+        printf(" %10s%-2u", "N", to);
+    printf("\n");
+
+    for (from = 0; from < nr_nodes; from++)
+    {
+        printf("N%-5u", from);
+        for (to = 0; to < nr_nodes; to++)
+        {
+            idx = from * MAX_NUMA_NODES + to;
+            err = bpf_map_lookup_elem(fd, &idx, values);
+            if (err < 0)
+            {
+                warning("Failed to lookup matrix: %d\n", err);
+                return -1;
+            }
+
+            for (total = 0, i = 0; i < nr_cpus; i++)
+                total += values[i];
+            moves += total;
+
+            if (from == to)
+                printf(" %12s", "-");
+            else
+                printf(" %12llu", total);
+
+            bpf_map_update_elem(fd, &idx, zero, BPF_ANY);
+        }
+        printf("\n");
+    }
+    printf("Total moves: %llu\n\n", moves);
+
+    return 0;
+}
+
+static int print_tgid_stats(int fd, int nr_cpus)
+{
+    struct tgid_stat values[nr_cpus], stat;
+    __u32 keys[MAX_ENTRIES], *prev = NULL, key;
+    char comm[TASK_COMM_LEN];
+    int i, j, n = 0, err;
+
+    while (n < MAX_ENTRIES && !bpf_map_get_next_key(fd, prev, &keys[n]))
+    {
+        prev = &keys[n];
+        n++;
+    }
+
+    if (env.migrate_cost)
+        printf("%-10s %-16s %10s %12s %14s\n", "PID", "COMM", "MOVES",
+               "MIGRATIONS", "MIGRATE_MS");
+    else
+        printf("%-10s %-16s %10s\n", "PID", "COMM", "MOVES");
+
+    for (i = 0; i < n; i++)
+    {
+        key = keys[i];
+        err = bpf_map_lookup_elem(fd, &key, values);
+        if (err < 0)
+            continue;
+
+        memset(&stat, 0, sizeof(stat));
+        for (j = 0; j < nr_cpus; j++)
+        {
+            stat.node_moves += values[j].node_moves;
+            stat.page_migrations += values[j].page_migrations;
+            stat.migrate_ns += values[j].migrate_ns;
+        }
+
+        read_comm(key, comm, sizeof(comm));
+        if (env.comm && strstr(comm, env.comm) == NULL)
+            continue;
+
+        if (env.migrate_cost)
+            printf("%-10u %-16s %10llu %12llu %14.3f\n", key, comm,
+                   stat.node_moves, stat.page_migrations,
+                   stat.migrate_ns / 1000000.0);
+        else
+            printf("%-10u %-16s %10llu\n", key, comm, stat.node_moves);
+    }
+
+    for (i = 0; i < n; i++)
+        bpf_map_delete_elem(fd, &keys[i]);
+
+    printf("\n");
+    return 0;
+}
+
+static int print_aggregate(struct numasched_bpf *obj)
+{
+    int nr_cpus = libbpf_num_possible_cpus();
+    int nr_nodes = numa_max_node() + 1;
+    char ts[32];
+
+    if (nr_cpus < 0)
+        return nr_cpus;
+    if (nr_nodes > MAX_NUMA_NODES)
+        nr_nodes = MAX_NUMA_NODES;
+
+    if (env.timestamp)
+    {
+        strftime_now(ts, sizeof(ts), "%H:%M:%S");
+        printf("%-8s\n", ts);
+    }
+
+    if (print_matrix(bpf_map__fd(obj->maps.node_matrix), nr_nodes, nr_cpus))
+        return -1;
+
+    return print_tgid_stats(bpf_map__fd(obj->maps.tgid_stats), nr_cpus);
+}
+
 int main(int argc, char *argv[])
 {
     static struct argp argp = {
@@ -156,9 +348,45 @@ int main(int argc, char *argv[])
     bpf_obj->rodata->target_pid = env.tid;
 
     if (probe_tp_btf("sched_switch"))
+    {
         bpf_program__set_autoload(bpf_obj->progs.sched_switch_raw, false);
+        bpf_program__set_autoload(bpf_obj->progs.sched_switch_agg_raw, false);
+    }
     else
+    {
         bpf_program__set_autoload(bpf_obj->progs.sched_switch_btf, false);
+        bpf_program__set_autoload(bpf_obj->progs.sched_switch_agg_btf, false);
+    }
+
+    if (env.aggregate)
+    {
+        bpf_program__set_autoload(bpf_obj->progs.sched_switch_raw, false);
+        bpf_program__set_autoload(bpf_obj->progs.sched_switch_btf, false);
+        bpf_map__set_max_entries(bpf_obj->maps.numa_node_map, 1);
+    }
+    else
+    {
+        bpf_program__set_autoload(bpf_obj->progs.sched_switch_agg_raw, false);
+        bpf_program__set_autoload(bpf_obj->progs.sched_switch_agg_btf, false);
+        /* task storage needs 5.11+, don't make the default mode depend on it */
+        bpf_map__set_autocreate(bpf_obj->maps.task_node, false);
+    }
+
+    if (env.migrate_cost && fentry_can_attach("migrate_misplaced_page", NULL))
+    {
+        bpf_program__set_autoload(bpf_obj->progs.kprobe_migrate_misplaced_page, false);
+        bpf_program__set_autoload(bpf_obj->progs.kretprobe_migrate_misplaced_page, false);
+    }
+    else
+    {
+        bpf_program__set_autoload(bpf_obj->progs.fentry_migrate_misplaced_page, false);
+        bpf_program__set_autoload(bpf_obj->progs.fexit_migrate_misplaced_page, false);
+        if (!env.migrate_cost)
+        {
+            bpf_program__set_autoload(bpf_obj->progs.kprobe_migrate_misplaced_page, false);
+            bpf_program__set_autoload(bpf_obj->progs.kretprobe_migrate_misplaced_page, false);
+        }
+    }
 
     err = numasched_bpf__load(bpf_obj);
     if (err)
@@ -174,6 +402,28 @@ int main(int argc, char *argv[])
         goto cleanup;
     }
 
+    if (env.aggregate)
+    {
+        if (signal(SIGINT, sig_handler) == SIG_ERR)
+        {
+            warning("Cann't set signal handler: %s\n", strerror(errno));
+            err = 1;
+            goto cleanup;
+        }
+
+        printf("Aggregating NUMA node switches... Hit Ctrl-C to end.\n");
+
+        while (!exiting && env.times--)
+        {
+            sleep(env.interval);
+            err = print_aggregate(bpf_obj);
+            if (err)
+                goto cleanup;
+        }
+
+        goto cleanup;
+    }
+
     if (env.timestamp)
         printf("%-9s", "TIME");
 
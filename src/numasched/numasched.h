@@ -4,6 +4,8 @@
 
 #define TASK_COMM_LEN 16
 #define INVALID_PID ((pid_t)-1)
+#define MAX_NUMA_NODES 16
+#define MAX_ENTRIES 10240
 
 struct event
 {
@@ -14,4 +16,12 @@ struct event
     char comm[TASK_COMM_LEN];
 };
 
+/* per-tgid totals of the aggregation mode */
+struct tgid_stat
+{
+    __u64 node_moves;      /* switched out on another node than last time */
+    __u64 page_migrations; /* migrate_misplaced_page() calls */
+    __u64 migrate_ns;      /* time spent in migrate_misplaced_page() */
+};
+
 #endif
\ No newline at end of file
@@ -6,17 +6,19 @@
 #include <asm/unistd.h>
 #include "runqlen.h"
 
-const volatile bool target_per_cpu = false;
 const volatile bool target_host = false;
+const volatile __u64 bucket_ns = 10000000;
 
 struct hist hists[MAX_CPU_NR] = {};
+struct rq_bucket buckets[MAX_CPU_NR][MAX_BUCKETS] = {};
 
 SEC("perf_event")
 int do_sample(struct bpf_perf_event_data *ctx)
 {
 	struct task_struct *task;
 	struct hist *hist;
-	u64 slot, cpu = 0;
+	u64 slot;
+	u32 cpu;
 
 	task = (struct task_struct *)bpf_get_current_task();
 	if (target_host)
@@ -31,19 +33,71 @@ int do_sample(struct bpf_perf_event_data *ctx)
 	if (slot > 0)
 		slot--;
 
-	if (target_per_cpu) {
-		cpu = bpf_get_smp_processor_id();
-		if (cpu >= MAX_CPU_NR)
-			return 0;
-	}
+	/*
+	 * Always count into the histogram of this CPU, user space sums them up
+	 * when a global histogram is wanted.
+	 */
+	cpu = bpf_get_smp_processor_id();
+	if (cpu >= MAX_CPU_NR)
+		return 0;
 
 	hist = &hists[cpu];
 	if (slot >= MAX_SLOTS)
 		slot = MAX_SLOTS - 1;
-	if (target_per_cpu)
-		hist->slots[slot]++;
-	else
-		__sync_fetch_and_add(&hist->slots[slot], 1);
+	hist->slots[slot]++;
+
+	return 0;
+}
+
+/*
+ * Imbalance mode: every CPU keeps its own ring of short time buckets with
+ * the peak and trough of its run queue, user space lines up the buckets of
+ * all CPUs to find skew that a whole-interval histogram would average away.
+ */
+SEC("perf_event")
+int do_sample_imbalance(struct bpf_perf_event_data *ctx)
+{
+	struct task_struct *task;
+	struct rq_bucket *b;
+	struct rq *rq;
+	u32 nr_running, rt, dl, queued;
+	u64 id;
+	u32 cpu;
+
+	cpu = bpf_get_smp_processor_id();
+	if (cpu >= MAX_CPU_NR)
+		return 0;
+
+	task = (struct task_struct *)bpf_get_current_task();
+	rq = BPF_CORE_READ(task, se.cfs_rq, rq);
+	nr_running = BPF_CORE_READ(rq, nr_running);
+	rt = BPF_CORE_READ(rq, rt.rt_nr_running);
+	dl = BPF_CORE_READ(rq, dl.dl_nr_running);
+	queued = nr_running > 0 ? nr_running - 1 : 0;
+
+	id = bpf_ktime_get_ns() / bucket_ns;
+	b = &buckets[cpu][id & (MAX_BUCKETS - 1)];
+	if (b->id != id) {
+		b->id = id;
+		b->samples = 0;
+		b->max_queued = 0;
+		b->min_queued = 0xffff;
+		b->max_rt = 0;
+		b->max_dl = 0;
+		b->idle = 0;
+	}
+
+	b->samples++;
+	if (queued > b->max_queued)
+		b->max_queued = queued;
+	if (queued < b->min_queued)
+		b->min_queued = queued;
+	if (rt > b->max_rt)
+		b->max_rt = rt;
+	if (dl > b->max_dl)
+		b->max_dl = dl;
+	if (nr_running == 0)
+		b->idle = 1;
 
 	return 0;
 }
@@ -5,6 +5,7 @@
 #include "runqlen.skel.h"
 #include "btf_helpers.h"
 #include "trace_helpers.h"
+#include "map_helpers.h"
 #include <sys/syscall.h>
 
 struct env {
@@ -12,6 +13,9 @@ struct env {
 	bool runqocc;
 	bool timestamp;
 	bool host;
+	bool imbalance;
+	bool heatmap;
+	int bucket_ms;
 	time_t interval;
 	int freq;
 	int times;
@@ -20,6 +24,7 @@ struct env {
 	.interval = 99999999,
 	.times = 99999999,
 	.freq = 99,
+	.bucket_ms = 10,
 };
 
 static volatile sig_atomic_t exiting;
@@ -29,7 +34,8 @@ const char *argp_program_bug_address = "Jackie Liu <liuyun01@kylinos.cn>";
 const char argp_program_doc[] =
 "Summarize scheduler run queue length as a histogram.\n"
 "\n"
-"USAGE: runqlen [--help] [-C] [-O] [-T] [-f FREQUENCY] [interval] [count]\n"
+"USAGE: runqlen [--help] [-C] [-O] [-T] [-I [-b MS] [-M]] [-f FREQUENCY]\n"
+"               [interval] [count]\n"
 "\n"
 "EXAMPLES:\n"
 "    runqlen         # summarize run queue length as a histogram\n"
@@ -38,7 +44,9 @@ const char argp_program_doc[] =
 "    runqlen -O      # report run queue occupancy\n"
 "    runqlen -C      # show each CPU separately\n"
 "    runqlen -H      # show nr_running from host's rq instead of cfs_rq\n"
-"    runqlen -f 199  # sample at 199HZ\n";
+"    runqlen -f 199  # sample at 199HZ\n"
+"    runqlen -I -f 999     # per second run queue spread across CPUs and LLCs\n"
+"    runqlen -IM -b 20 -f 999 # same with 20ms buckets and a per-CPU heatmap\n";
 
 
 static const struct argp_option opts[] = {
@@ -48,6 +56,9 @@ static const struct argp_option opts[] = {
 	{ "timestamp", 'T', NULL, 0, "Include timestamp on output" },
 	{ "verbose", 'v', NULL, 0, "Verbose output debug" },
 	{ "host", 'H', NULL, 0, "Report nr_running from host's rq" },
+	{ "imbalance", 'I', NULL, 0, "Report run queue imbalance between CPUs" },
+	{ "bucket", 'b', "MS", 0, "Time bucket width for -I (default 10ms)" },
+	{ "heatmap", 'M', NULL, 0, "Print a per-CPU run queue heatmap with -I" },
 	{ NULL, 'h', NULL, OPTION_HIDDEN, "Show the full help" },
 	{}
 };
@@ -75,6 +86,19 @@ static error_t parse_arg(int key, char *arg, struct argp_state *state)
 	case 'H':
 		env.host = true;
 		break;
+	case 'I':
+		env.imbalance = true;
+		break;
+	case 'M':
+		env.heatmap = true;
+		break;
+	case 'b':
+		env.bucket_ms = argp_parse_long(key, arg, state);
+		if (env.bucket_ms <= 0) {
+			warning("Invalid bucket width: %s\n", arg);
+			argp_usage(state);
+		}
+		break;
 	case 'f':
 		errno = 0;
 		env.freq = strtol(arg, NULL, 10);
@@ -103,6 +127,22 @@ static error_t parse_arg(int key, char *arg, struct argp_state *state)
 		}
 		pos_args++;
 		break;
+	case ARGP_KEY_END:
+		if (!env.imbalance)
+			break;
+		if (env.per_cpu || env.runqocc || env.host) {
+			warning("-I can't be used with -C, -O or -H\n");
+			argp_usage(state);
+		}
+		if (!pos_args)
+			env.interval = 1;
+		/* keep the ring twice as long as an interval */
+		if (env.interval * 1000 / env.bucket_ms > MAX_BUCKETS / 2) {
+			warning("Too many buckets per interval, at most %d\n",
+				MAX_BUCKETS / 2);
+			argp_usage(state);
+		}
+		break;
 	default:
 		return ARGP_ERR_UNKNOWN;
 	}
@@ -160,6 +200,21 @@ static void sig_handler(int sig)
 
 static struct hist zero;
 
+/* CPU *i* with -C, the sum of all CPUs otherwise */
+static void read_hist(struct runqlen_bpf__bss *bss, int i, struct hist *hist)
+{
+	if (env.per_cpu) {
+		*hist = bss->hists[i];
+		bss->hists[i] = zero;
+		return;
+	}
+
+	percpu_sum_u32(hist->slots, bss->hists[0].slots, MAX_SLOTS,
+		       sizeof(struct hist) / sizeof(__u32), nr_cpus);
+	for (i = 0; i < nr_cpus; i++)
+		bss->hists[i] = zero;
+}
+
 static void print_runq_occupancy(struct runqlen_bpf__bss *bss)
 {
 	int i = 0;
@@ -169,8 +224,7 @@ static void print_runq_occupancy(struct runqlen_bpf__bss *bss)
 		float runqocc;
 		struct hist hist;
 
-		hist = bss->hists[i];
-		bss->hists[i] = zero;
+		read_hist(bss, i, &hist);
 
 		for (int slot = 0; slot < MAX_SLOTS; slot++) {
 			__u64 val = hist.slots[slot];
@@ -196,8 +250,7 @@ static void print_linear_hists(struct runqlen_bpf__bss *bss)
 	int i = 0;
 
 	do {
-		hist = bss->hists[i];
-		bss->hists[i] = zero;
+		read_hist(bss, i, &hist);
 		if (env.per_cpu)
 			printf("cpu = %d\n", i);
 
@@ -205,6 +258,175 @@ static void print_linear_hists(struct runqlen_bpf__bss *bss)
 	} while (env.per_cpu && ++i < nr_cpus);
 }
 
+static int llc_of[MAX_CPU_NR];
+static int nr_llcs;
+
+/*
+ * Group CPUs by last level cache, using the first CPU sharing the highest
+ * level cache as the domain id. Everything is one domain if sysfs lacks
+ * cache information.
+ */
+static void read_llc_domains(void)
+{
+	int first[MAX_CPU_NR], domain_of_first[MAX_CPU_NR];
+	char path[128];
+	int cpu, idx, level, best, id;
+	FILE *f;
+
+	for (cpu = 0; cpu < MAX_CPU_NR; cpu++)
+		domain_of_first[cpu] = -1;
+
+	for (cpu = 0; cpu < nr_cpus; cpu++) {
+		first[cpu] = 0;
+		for (idx = 0, best = 0; ; idx++) {
+			snprintf(path, sizeof(path),
+				 "/sys/devices/system/cpu/cpu%d/cache/index%d/level",
+				 cpu, idx);
+			f = fopen(path, "r");
+			if (!f)
+				break;
+			if (fscanf(f, "%d", &level) != 1)
+				level = 0;
+			fclose(f);
+			if (level < best)
+				continue;
+
+			snprintf(path, sizeof(path),
+				 "/sys/devices/system/cpu/cpu%d/cache/index%d/shared_cpu_list",
+				 cpu, idx);
+			f = fopen(path, "r");
+			if (!f)
+				continue;
+			if (fscanf(f, "%d", &id) == 1 && id >= 0 && id < MAX_CPU_NR) {
+				first[cpu] = id;
+				best = level;
+			}
+			fclose(f);
+		}
+	}
+
+	for (cpu = 0; cpu < nr_cpus; cpu++) {
+		if (domain_of_first[first[cpu]] < 0)
+			domain_of_first[first[cpu]] = nr_llcs++;
+		llc_of[cpu] = domain_of_first[first[cpu]];
+	}
+}
+
+struct spread {
+	__u64 buckets;
+	__u64 sum;
+	__u32 max;
+};
+
+static void spread_add(struct spread *s, __u32 min, __u32 max)
+{
+	s->buckets++;
+	s->sum += max - min;
+	if (max - min > s->max)
+		s->max = max - min;
+}
+
+static void print_spread(const char *name, struct spread *s)
+{
+	printf("%-12s max %3u  avg %6.2f\n", name, s->max,
+	       s->buckets ? (double)s->sum / s->buckets : 0.0);
+}
+
+static char heat_char(const struct rq_bucket *b)
+{
+	if (b->max_queued == 0)
+		return b->idle ? ' ' : '.';
+	return b->max_queued < 10 ? '0' + b->max_queued : '+';
+}
+
+/*
+ * Walk the buckets completed since the last call. A bucket only counts when
+ * at least two CPUs sampled in it; the spread is the difference between the
+ * longest and the shortest peak queue length of those CPUs.
+ */
+static void print_imbalance(struct runqlen_bpf__bss *bss, __u64 *next_id)
+{
+	static char heat[MAX_CPU_NR][MAX_BUCKETS / 2 + 1];
+	__u32 llc_min[MAX_CPU_NR], llc_max[MAX_CPU_NR], llc_cnt[MAX_CPU_NR];
+	struct spread all = {}, llc[MAX_CPU_NR] = {};
+	__u64 id, now_id, idle_queued = 0;
+	__u32 q, lo, hi, max_rt = 0, max_dl = 0;
+	const struct rq_bucket *b;
+	bool idle, queued;
+	int cpu, l, n, col = 0;
+	char name[32];
+
+	now_id = get_ktime_ns() / (env.bucket_ms * 1000000ULL);
+	if (now_id - *next_id > MAX_BUCKETS / 2)
+		*next_id = now_id - MAX_BUCKETS / 2;
+
+	for (id = *next_id; id < now_id; id++, col++) {
+		lo = UINT_MAX;
+		hi = 0;
+		n = 0;
+		idle = queued = false;
+		memset(llc_cnt, 0, nr_llcs * sizeof(*llc_cnt));
+
+		for (cpu = 0; cpu < nr_cpus; cpu++) {
+			b = &bss->buckets[cpu][id & (MAX_BUCKETS - 1)];
+			if (b->id != id || !b->samples) {
+				heat[cpu][col] = '?';
+				continue;
+			}
+			heat[cpu][col] = heat_char(b);
+
+			n++;
+			q = b->max_queued;
+			lo = min(lo, q);
+			hi = max(hi, q);
+			max_rt = max(max_rt, (__u32)b->max_rt);
+			max_dl = max(max_dl, (__u32)b->max_dl);
+			idle |= b->idle;
+			queued |= b->min_queued > 0;
+
+			l = llc_of[cpu];
+			if (!llc_cnt[l]++) {
+				llc_min[l] = llc_max[l] = q;
+			} else {
+				llc_min[l] = min(llc_min[l], q);
+				llc_max[l] = max(llc_max[l], q);
+			}
+		}
+
+		if (n < 2)
+			continue;
+
+		spread_add(&all, lo, hi);
+		/* some CPU went idle while another never drained its queue */
+		if (idle && queued)
+			idle_queued++;
+		for (l = 0; l < nr_llcs; l++)
+			if (llc_cnt[l] >= 2)
+				spread_add(&llc[l], llc_min[l], llc_max[l]);
+	}
+	*next_id = now_id;
+
+	printf("buckets: %llu x %dms, max queued rt: %u, dl: %u\n",
+	       all.buckets, env.bucket_ms, max_rt, max_dl);
+	printf("idle CPU while another was queued: %.2f%% of the time\n",
+	       all.buckets ? 100.0 * idle_queued / all.buckets : 0.0);
+	printf("queue length spread across CPUs:\n");
+	print_spread("all", &all);
+	for (l = 0; nr_llcs > 1 && l < nr_llcs; l++) {
+		snprintf(name, sizeof(name), "LLC %d", l);
+		print_spread(name, &llc[l]);
+	}
+
+	if (!env.heatmap)
+		return;
+
+	printf("peak queued per %dms (' ' idle, '.' running, '+' >= 10, "
+	       "'?' no sample):\n", env.bucket_ms);
+	for (cpu = 0; cpu < nr_cpus; cpu++) {
+		heat[cpu][col] = '\0';
+		printf("CPU %-3d L%-2d |%s|\n", cpu, llc_of[cpu], heat[cpu]);
+	}
+}
 
 int main(int argc, char *argv[])
 {
@@ -217,6 +439,7 @@ int main(int argc, char *argv[])
 
 	struct bpf_link *links[MAX_CPU_NR] = {};
 	struct runqlen_bpf *bpf_obj;
+	__u64 next_id = 0;
 	int err;
 
 	err = argp_parse(&argp, argc, argv, 0, NULL, NULL);
@@ -255,8 +478,8 @@ int main(int argc, char *argv[])
 	}
 
 	/* Init global data (filtering options) */
-	bpf_obj->rodata->target_per_cpu = env.per_cpu;
 	bpf_obj->rodata->target_host = env.host;
+	bpf_obj->rodata->bucket_ns = env.bucket_ms * 1000000ULL;
 
 	err = runqlen_bpf__load(bpf_obj);
 	if (err) {
@@ -269,10 +492,17 @@ int main(int argc, char *argv[])
 		goto cleanup;
 	}
 
-	err = open_and_attach_perf_event(env.freq, bpf_obj->progs.do_sample, links);
+	err = open_and_attach_perf_event(env.freq, env.imbalance ?
+					 bpf_obj->progs.do_sample_imbalance :
+					 bpf_obj->progs.do_sample, links);
 	if (err)
 		goto cleanup;
 
+	if (env.imbalance) {
+		read_llc_domains();
+		next_id = get_ktime_ns() / (env.bucket_ms * 1000000ULL);
+	}
+
 	printf("Sampling run queue length... Hit Ctrl-C to end.\n");
 
 	signal(SIGINT, sig_handler);
@@ -288,7 +518,9 @@ int main(int argc, char *argv[])
 			printf("%-8s\n", ts);
 		}
 
-		if (env.runqocc)
+		if (env.imbalance)
+			print_imbalance(bpf_obj->bss, &next_id);
+		else if (env.runqocc)
 			print_runq_occupancy(bpf_obj->bss);
 		else
 			print_linear_hists(bpf_obj->bss);
@@ -4,9 +4,25 @@
 
 #define MAX_CPU_NR	256
 #define MAX_SLOTS	32
+#define CACHELINE_SIZE	64
 
+/* one per CPU, only ever written by its own CPU */
 struct hist {
 	__u32 slots[MAX_SLOTS];
+} __attribute__((aligned(CACHELINE_SIZE)));
+
+/* imbalance mode: per-CPU ring of fixed-width time buckets */
+#define MAX_BUCKETS	256
+
+struct rq_bucket {
+	__u64 id;		/* timestamp / bucket width */
+	__u32 samples;
+	__u16 max_queued;	/* runnable tasks of all classes, minus current */
+	__u16 min_queued;
+	__u16 max_rt;
+	__u16 max_dl;
+	__u8 idle;		/* sampled at least once with nothing running */
+	__u8 pad[3];
 };
 
 #endif
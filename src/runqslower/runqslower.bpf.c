@@ -5,14 +5,19 @@
 #include <bpf/bpf_helpers.h>
 #include <bpf/bpf_tracing.h>
 #include "core_fixes.bpf.h"
+#include "compat.bpf.h"
 #include "runqslower.h"
 
 #define TASK_RUNNING 0
-#define BPF_F_CURRENT_CPU 0xffffffffULL
+#define NSEC_PER_SEC 1000000000ULL
 
 const volatile __u64 min_us = 0;
 const volatile pid_t target_pid = 0;
 const volatile pid_t target_tgid = 0;
+const volatile bool cg_thresholds_set = false;
+const volatile bool prio_thresholds_set = false;
+const volatile bool kernel_stacks = false;
+const volatile __u64 event_cost_ns = 0;
 
 struct {
 	__uint(type, BPF_MAP_TYPE_HASH);
@@ -21,11 +26,41 @@ struct {
 	__type(value, u64);
 } start SEC(".maps");
 
+/* cgroup id -> min_us, takes precedence over the other thresholds */
 struct {
-	__uint(type, BPF_MAP_TYPE_PERF_EVENT_ARRAY);
+	__uint(type, BPF_MAP_TYPE_HASH);
+	__uint(max_entries, MAX_CG_THRESHOLDS);
+	__type(key, u64);
+	__type(value, u64);
+} cg_thresholds SEC(".maps");
+
+/* kernel prio -> min_us, 0 means use the global threshold */
+struct {
+	__uint(type, BPF_MAP_TYPE_ARRAY);
+	__uint(max_entries, MAX_PRIO);
+	__type(key, u32);
+	__type(value, u64);
+} prio_thresholds SEC(".maps");
+
+struct {
+	__uint(type, BPF_MAP_TYPE_STACK_TRACE);
 	__uint(key_size, sizeof(u32));
-	__uint(value_size, sizeof(u32));
-} events SEC(".maps");
+} stackmap SEC(".maps");
+
+struct {
+	__uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+	__uint(max_entries, 1);
+	__type(key, u32);
+	__type(value, struct rate_state);
+} rate SEC(".maps");
+
+/* events dropped by the rate limiter */
+struct {
+	__uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+	__uint(max_entries, 1);
+	__type(key, u32);
+	__type(value, u64);
+} dropped SEC(".maps");
 
 /* record enqueue timestamp */
 __always_inline
@@ -48,12 +83,68 @@ static int trace_enqueue(struct task_struct *p)
 }
 
 
+static __always_inline u64 threshold_us(struct task_struct *p)
+{
+	u64 cgroup_id, *val;
+	u32 prio;
+
+	if (cg_thresholds_set) {
+		cgroup_id = get_task_cgroup_id(p);
+		val = bpf_map_lookup_elem(&cg_thresholds, &cgroup_id);
+		if (val)
+			return *val;
+	}
+
+	if (prio_thresholds_set) {
+		prio = BPF_CORE_READ(p, prio);
+		val = bpf_map_lookup_elem(&prio_thresholds, &prio);
+		if (val && *val)
+			return *val;
+	}
+
+	return min_us;
+}
+
+/*
+ * Allow at most NSEC_PER_SEC / event_cost_ns events per second on each
+ * CPU, with bursts of up to one second worth of events.
+ */
+static __always_inline bool rate_limited(void)
+{
+	struct rate_state *state;
+	u64 now, budget, *cnt;
+	u32 zero = 0;
+
+	if (!event_cost_ns)
+		return false;
+
+	state = bpf_map_lookup_elem(&rate, &zero);
+	if (!state)
+		return false;
+
+	now = bpf_ktime_get_ns();
+	budget = state->budget + (now - state->last_ns);
+	if (budget > NSEC_PER_SEC)
+		budget = NSEC_PER_SEC;
+	state->last_ns = now;
+
+	if (budget < event_cost_ns) {
+		state->budget = budget;
+		cnt = bpf_map_lookup_elem(&dropped, &zero);
+		if (cnt)
+			*cnt += 1;
+		return true;
+	}
+
+	state->budget = budget - event_cost_ns;
+	return false;
+}
+
 __always_inline
 static int handle_switch(void *ctx, struct task_struct *prev, struct task_struct *next)
 {
-	struct runq_event event = {};
-
-	u64 *tsp, delta_us;
+	struct runq_event *event;
+	u64 *tsp, delta_us, thresh;
 	u32 pid;
 
 	/* treat like an enqueue event and store timestamp */
@@ -68,21 +159,35 @@ static int handle_switch(void *ctx, struct task_struct *prev, struct task_struct
 		return 0;
 
 	delta_us = (bpf_ktime_get_ns() - *tsp) / 1000;
+	bpf_map_delete_elem(&start, &pid);
+
 	/* not slow? return */
-	if (min_us && delta_us <= min_us)
+	thresh = threshold_us(next);
+	if (thresh && delta_us <= thresh)
 		return 0;
 
-	event.pid = pid;
-	event.prev_pid = BPF_CORE_READ(prev, pid);
-	event.delta_us = delta_us;
-	BPF_CORE_READ_STR_INTO(&event.task, next, comm);
-	BPF_CORE_READ_STR_INTO(&event.prev_task, prev, comm);
+	if (rate_limited())
+		return 0;
 
-	/* output */
-	bpf_perf_event_output(ctx, &events, BPF_F_CURRENT_CPU,
-			      &event, sizeof(event));
+	event = reserve_buf(sizeof(*event));
+	if (!event)
+		return 0;
 
-	bpf_map_delete_elem(&start, &pid);
+	event->pid = pid;
+	event->prev_pid = BPF_CORE_READ(prev, pid);
+	event->delta_us = delta_us;
+	event->prio = BPF_CORE_READ(next, prio);
+	event->prev_prio = BPF_CORE_READ(prev, prio);
+	event->cpu = bpf_get_smp_processor_id();
+	event->nr_running = BPF_CORE_READ(prev, se.cfs_rq, rq, nr_running);
+	/* still in the context of prev, the task that ran instead */
+	event->kernel_stack_id = kernel_stacks ?
+				 bpf_get_stackid(ctx, &stackmap, 0) : -1;
+	BPF_CORE_READ_STR_INTO(&event->task, next, comm);
+	BPF_CORE_READ_STR_INTO(&event->prev_task, prev, comm);
+
+	/* output */
+	submit_buf(ctx, event, sizeof(*event));
 	return 0;
 }
 
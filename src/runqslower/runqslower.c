@@ -3,45 +3,115 @@
 #include "runqslower.h"
 #include "runqslower.skel.h"
 #include "trace_helpers.h"
+#include "map_helpers.h"
+#include "compat.h"
+#include <sys/stat.h>
+
+#define OPT_PERF_MAX_STACK_DEPTH	1 /* --perf-max-stack-depth */
+#define OPT_STACK_STORAGE_SIZE		2 /* --stack-storage-size */
+
+#define MAX_THRESHOLDS	64
 
 static volatile sig_atomic_t exiting = 0;
 
+struct threshold {
+	__u64 key;	/* cgroup id or kernel prio */
+	__u64 min_us;
+};
+
 struct env {
 	pid_t pid;
 	pid_t tid;
 	__u64 min_us;
 	bool previous;
 	bool verbose;
+	bool kernel_stack;
+	int rate;
+	int perf_max_stack_depth;
+	int stack_storage_size;
+	struct threshold cg_thresholds[MAX_THRESHOLDS];
+	int nr_cg_thresholds;
+	struct threshold prio_thresholds[MAX_THRESHOLDS];
+	int nr_prio_thresholds;
 } env = {
 	.min_us = 1000,
+	.rate = 1000,
+	.perf_max_stack_depth = 127,
+	.stack_storage_size = 1024,
 };
 
+static struct ksyms *ksyms;
+static unsigned long *stack_ips;
+static int stackmap_fd;
+
 const char *argp_program_version = "runqslower 0.1";
 const char *argp_program_bug_address = "Jackie Liu <liuyun01@kylinos.cn>";
 const char argp_program_doc[] =
 "Trace high run queue latency.\n"
 "\n"
-"USAGE: runqslower [--help] [-p PID] [-t tid] [-P] [min_us]\n"
+"USAGE: runqslower [--help] [-p PID] [-t tid] [-P] [-K] [-R RATE]\n"
+"                  [-c CGROUP=US] [-r PRIO=US] [min_us]\n"
 "\n"
 "EXAMPLES:\n"
 "  runqslower         # trace latency higher than 10000 us (default)\n"
 "  runqslower 1000    # trace latency higher than 1000 us\n"
 "  runqslower -p 123  # trace pid 123 only\n"
 "  runqslower -t 123  # trace tid 123 (use for threads only)\n"
-"  runqslower -P      # also show previous task name and TID\n";
+"  runqslower -P      # also show previous task name and TID\n"
+"  runqslower -PK     # and the kernel stack of the previous task\n"
+"  runqslower -c /sys/fs/cgroup/db=200   # 200 us for tasks of this cgroup\n"
+"  runqslower -r 100=50000 -r 139=50000  # be lenient with nice 0 and 19\n"
+"  runqslower -R 0    # don't rate limit events\n"
+"\n"
+"PRIO is the kernel priority: 0-99 for real-time tasks, 100-139 for nice\n"
+"-20 to 19. A cgroup threshold wins over a priority one, which wins over\n"
+"min_us.\n";
 
 static const struct argp_option opts[] = {
 	{ "pid", 'p', "PID", 0, "Process ID to trace" },
 	{ "tid", 't', "TID", 0, "Thread ID to trace" },
 	{ "verbose", 'v', NULL, 0, "Verbose debug output" },
 	{ "previous", 'P', NULL, 0, "also show previous task name and TID" },
+	{ "kernel-stack", 'K', NULL, 0, "Show the kernel stack of the previous task" },
+	{ "cgroup-threshold", 'c', "CGROUP=US", 0,
+	  "Latency threshold for tasks in this cgroup v2 directory (repeatable)" },
+	{ "prio-threshold", 'r', "PRIO=US", 0,
+	  "Latency threshold for tasks of this kernel priority (repeatable)" },
+	{ "rate", 'R', "RATE", 0,
+	  "Max events per second per CPU, 0 for no limit (default 1000)" },
+	{ "perf-max-stack-depth", OPT_PERF_MAX_STACK_DEPTH, "PERF-MAX-STACK-DEPTH",
+	  0, "the limit for both kernel and user stack traces (default 127)" },
+	{ "stack-storage-size", OPT_STACK_STORAGE_SIZE, "STACK-STORAGE-SIZE", 0,
+	  "the number of unique stack traces that can be stored and displayed (default 1024)" },
 	{ "NULL", 'h', NULL, OPTION_HIDDEN, "Show the full help" },
 	{},
 };
 
+/* parse "WHAT=US", returns the WHAT part or NULL */
+static char *parse_threshold(char *arg, __u64 *min_us)
+{
+	char *eq = strrchr(arg, '=');
+	long long val;
+
+	if (!eq || eq == arg)
+		return NULL;
+
+	errno = 0;
+	val = strtoll(eq + 1, NULL, 10);
+	if (errno || val <= 0)
+		return NULL;
+
+	*eq = '\0';
+	*min_us = val;
+	return arg;
+}
+
 static error_t parse_args(int key, char *arg, struct argp_state *state)
 {
 	static int pos_args;
+	struct threshold *t;
+	struct stat st;
+	char *what;
 	int pid;
 	long long min_us;
 
@@ -55,6 +125,56 @@ static error_t parse_args(int key, char *arg, struct argp_state *state)
 	case 'P':
 		env.previous = true;
 		break;
+	case 'K':
+		env.kernel_stack = true;
+		break;
+	case 'R':
+		env.rate = argp_parse_long(key, arg, state);
+		break;
+	case 'c':
+		if (env.nr_cg_thresholds == MAX_THRESHOLDS) {
+			warning("Too many cgroup thresholds, max %d\n", MAX_THRESHOLDS);
+			argp_usage(state);
+		}
+		t = &env.cg_thresholds[env.nr_cg_thresholds];
+		what = parse_threshold(arg, &t->min_us);
+		if (!what) {
+			warning("Invalid cgroup threshold: %s\n", arg);
+			argp_usage(state);
+		}
+		/* on cgroup v2 the inode number of the directory is the id */
+		if (stat(what, &st)) {
+			warning("Failed to stat cgroup %s: %s\n", what, strerror(errno));
+			argp_usage(state);
+		}
+		t->key = st.st_ino;
+		env.nr_cg_thresholds++;
+		break;
+	case 'r':
+		if (env.nr_prio_thresholds == MAX_THRESHOLDS) {
+			warning("Too many priority thresholds, max %d\n", MAX_THRESHOLDS);
+			argp_usage(state);
+		}
+		t = &env.prio_thresholds[env.nr_prio_thresholds];
+		what = parse_threshold(arg, &t->min_us);
+		if (!what) {
+			warning("Invalid priority threshold: %s\n", arg);
+			argp_usage(state);
+		}
+		errno = 0;
+		t->key = strtoul(what, NULL, 10);
+		if (errno || t->key >= MAX_PRIO) {
+			warning("Invalid priority: %s\n", what);
+			argp_usage(state);
+		}
+		env.nr_prio_thresholds++;
+		break;
+	case OPT_PERF_MAX_STACK_DEPTH:
+		env.perf_max_stack_depth = argp_parse_long(key, arg, state);
+		break;
+	case OPT_STACK_STORAGE_SIZE:
+		env.stack_storage_size = argp_parse_long(key, arg, state);
+		break;
 	case 'p':
 		env.pid = argp_parse_pid(key, arg, state);
 		break;
@@ -100,16 +220,45 @@ static void sig_int(int signo)
 	exiting = 1;
 }
 
-void handle_event(void *ctx, int cpu, void *data, __u32 data_sz)
+static void print_kernel_stack(int stack_id)
+{
+	const struct ksym *ksym;
+	int i;
+
+	if (stack_id < 0)
+		return;
+	if (bpf_map_lookup_elem(stackmap_fd, &stack_id, stack_ips)) {
+		printf("    [Missed Kernel Stack]\n");
+		return;
+	}
+
+	for (i = 0; i < env.perf_max_stack_depth && stack_ips[i]; i++) {
+		ksym = ksyms__map_addr(ksyms, stack_ips[i]);
+		if (!env.verbose)
+			printf("    %s\n", ksym ? ksym->name : "[unknown]");
+		else if (ksym)
+			printf("    0x%lx %s+0x%lx\n", stack_ips[i], ksym->name,
+			       stack_ips[i] - ksym->addr);
+		else
+			printf("    0x%lx [unknown]\n", stack_ips[i]);
+	}
+}
+
+int handle_event(void *ctx, void *data, size_t data_sz)
 {
 	const struct runq_event *e = data;
 	char ts[32];
 
 	strftime_now(ts, sizeof(ts), "%H:%M:%S");
+	printf("%-8s %-16s %-6d %-14llu %-4d %-3u %-4u", ts, e->task, e->pid,
+	       e->delta_us, e->prio, e->cpu, e->nr_running);
 	if (env.previous)
-		printf("%-8s %-16s %-6d %-14llu %-16s %-6d\n", ts, e->task, e->pid, e->delta_us, e->prev_task, e->prev_pid);
-	else
-		printf("%-8s %-16s %-6d %-14llu\n", ts, e->task, e->pid, e->delta_us);
+		printf(" %-16s %-8d %-9d", e->prev_task, e->prev_pid, e->prev_prio);
+	printf("\n");
+
+	if (env.kernel_stack)
+		print_kernel_stack(e->kernel_stack_id);
+	return 0;
 }
 
 void handle_lost_events(void *ctx, int cpu, __u64 lost_cnt)
@@ -117,6 +266,29 @@ void handle_lost_events(void *ctx, int cpu, __u64 lost_cnt)
 	printf("Lost %llu events on CPU #%d!\n", lost_cnt, cpu);
 }
 
+static int setup_thresholds(struct runqslower_bpf *obj)
+{
+	int cg_fd = bpf_map__fd(obj->maps.cg_thresholds);
+	int prio_fd = bpf_map__fd(obj->maps.prio_thresholds);
+	__u32 prio;
+	int i;
+
+	for (i = 0; i < env.nr_cg_thresholds; i++) {
+		if (bpf_map_update_elem(cg_fd, &env.cg_thresholds[i].key,
+					&env.cg_thresholds[i].min_us, BPF_ANY))
+			return -errno;
+	}
+
+	for (i = 0; i < env.nr_prio_thresholds; i++) {
+		prio = env.prio_thresholds[i].key;
+		if (bpf_map_update_elem(prio_fd, &prio,
+					&env.prio_thresholds[i].min_us, BPF_ANY))
+			return -errno;
+	}
+
+	return 0;
+}
+
 int main(int argc, char *argv[])
 {
 	static const struct argp argp = {
@@ -124,8 +296,10 @@ int main(int argc, char *argv[])
 		.parser = parse_args,
 		.doc = argp_program_doc,
 	};
-	struct perf_buffer *pb = NULL;
+	struct bpf_buffer *buf = NULL;
 	struct runqslower_bpf *bpf_obj;
+	__u64 nr_dropped = 0;
+	__u32 zero = 0;
 	int err;
 
 	err = argp_parse(&argp, argc, argv, 0, NULL, NULL);
@@ -147,6 +321,23 @@ int main(int argc, char *argv[])
 	bpf_obj->rodata->target_pid = env.pid;
 	bpf_obj->rodata->target_tgid = env.tid;
 	bpf_obj->rodata->min_us = env.min_us;
+	bpf_obj->rodata->cg_thresholds_set = env.nr_cg_thresholds > 0;
+	bpf_obj->rodata->prio_thresholds_set = env.nr_prio_thresholds > 0;
+	bpf_obj->rodata->kernel_stacks = env.kernel_stack;
+	if (env.rate > 0)
+		bpf_obj->rodata->event_cost_ns = 1000000000ULL / env.rate;
+
+	bpf_map__set_value_size(bpf_obj->maps.stackmap,
+				env.perf_max_stack_depth * sizeof(unsigned long));
+	bpf_map__set_max_entries(bpf_obj->maps.stackmap,
+				 env.kernel_stack ? env.stack_storage_size : 1);
+
+	buf = bpf_buffer__new(bpf_obj->maps.events, bpf_obj->maps.heap);
+	if (!buf) {
+		err = -errno;
+		warning("failed to create ring/perf buffer: %d\n", err);
+		goto cleanup;
+	}
 
 	if (probe_tp_btf("sched_wakeup")) {
 		bpf_program__set_autoload(bpf_obj->progs.handle_sched_wakeup, false);
@@ -164,6 +355,23 @@ int main(int argc, char *argv[])
 		goto cleanup;
 	}
 
+	err = setup_thresholds(bpf_obj);
+	if (err) {
+		warning("failed to set up thresholds: %d\n", err);
+		goto cleanup;
+	}
+
+	if (env.kernel_stack) {
+		stackmap_fd = bpf_map__fd(bpf_obj->maps.stackmap);
+		stack_ips = calloc(env.perf_max_stack_depth, sizeof(*stack_ips));
+		ksyms = ksyms__load();
+		if (!stack_ips || !ksyms) {
+			warning("failed to load kallsyms\n");
+			err = 1;
+			goto cleanup;
+		}
+	}
+
 	err = runqslower_bpf__attach(bpf_obj);
 	if (err) {
 		warning("failed to attach BPF programs\n");
@@ -171,16 +379,15 @@ int main(int argc, char *argv[])
 	}
 
 	printf("Tracing run queue latency higher than %llu us\n", env.min_us);
+	printf("%-8s %-16s %-6s %-14s %-4s %-3s %-4s", "TIME", "COMM", "TID",
+	       "LAT(us)", "PRIO", "CPU", "RUNQ");
 	if (env.previous)
-		printf("%-8s %-16s %-6s %-14s %-16s %-6s\n", "TIME", "COMM", "TID", "LAT(us)", "PREV-COMM", "PREV-TID");
-	else
-		printf("%-8s %-16s %-6s %-14s\n", "TIME", "COMM", "PID", "LAT(us)");
+		printf(" %-16s %-8s %-9s", "PREV-COMM", "PREV-TID", "PREV-PRIO");
+	printf("\n");
 
-	pb = perf_buffer__new(bpf_map__fd(bpf_obj->maps.events), 64,
-			      handle_event, handle_lost_events, NULL, NULL);
-	if (!pb) {
-		err = -errno;
-		warning("failed to open perf buffer: %d\n", err);
+	err = bpf_buffer__open(buf, handle_event, handle_lost_events, NULL);
+	if (err) {
+		warning("failed to open ring/perf buffer: %d\n", err);
 		goto cleanup;
 	}
 
@@ -191,18 +398,26 @@ int main(int argc, char *argv[])
 	}
 
 	while (!exiting) {
-		err = perf_buffer__poll(pb, 100);
+		err = bpf_buffer__poll(buf, POLL_TIMEOUT_MS);
 		if (err < 0 && err != -EINTR) {
-			warning("error polling perf buffer: %s\n", strerror(-err));
+			warning("error polling ring/perf buffer: %s\n", strerror(-err));
 			goto cleanup;
 		}
 		/* reset err to return 0 if exiting */
 		err = 0;
 	}
 
+	if (env.rate > 0 &&
+	    !lookup_percpu_sum_u64(bpf_map__fd(bpf_obj->maps.dropped), &zero,
+				   &nr_dropped, 1) && nr_dropped)
+		printf("%llu events dropped by the rate limit of %d/s per CPU\n",
+		       nr_dropped, env.rate);
+
 cleanup:
-	perf_buffer__free(pb);
+	bpf_buffer__free(buf);
 	runqslower_bpf__destroy(bpf_obj);
+	ksyms__free(ksyms);
+	free(stack_ips);
 
 	return err != 0;
 }
\ No newline at end of file
@@ -3,6 +3,8 @@
 #define __RUNQSLOWER_H
 
 #define TASK_COMM_LEN 16
+#define MAX_PRIO 140
+#define MAX_CG_THRESHOLDS 1024
 
 struct runq_event {
 	char task[TASK_COMM_LEN];
@@ -10,6 +12,18 @@ struct runq_event {
 	__u64 delta_us;
 	pid_t pid;
 	pid_t prev_pid;
+	int prio;
+	int prev_prio;
+	__u32 cpu;
+	__u32 nr_running;	/* tasks on the CPU's run queue at switch time */
+	int kernel_stack_id;	/* of the previous task, -1 if not collected */
+	__u32 pad;
+};
+
+/* per-CPU token bucket, the budget is in ns of allowed event time */
+struct rate_state {
+	__u64 budget;
+	__u64 last_ns;
 };
 
 #endif
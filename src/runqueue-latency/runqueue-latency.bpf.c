@@ -9,6 +9,7 @@
 #include "core_fixes.bpf.h"
 
 #define MAX_ENTRIES	10240
+#define MAX_CG_ENTRIES	1024
 #define TASK_RUNNING	0
 
 const volatile bool filter_memcg = false;
@@ -16,6 +17,8 @@ const volatile bool target_per_process = false;
 const volatile bool target_per_thread = false;
 const volatile bool target_per_pidns = false;
 const volatile bool target_ms = false;
+const volatile bool target_per_cgroup = false;
+const volatile bool target_per_prio = false;
 const volatile pid_t target_tgid = 0;
 
 struct {
@@ -41,6 +44,15 @@ struct {
 	__type(value, struct hist);
 } hists SEC(".maps");
 
+static struct slots zero_slots;
+
+/* per-CPU, so that updates from all CPUs do not bounce one cache line */
+struct {
+	__uint(type, BPF_MAP_TYPE_PERCPU_HASH);
+	__uint(max_entries, MAX_CG_ENTRIES);
+	__type(key, struct cg_key);
+	__type(value, struct slots);
+} cg_hists SEC(".maps");
 
 static bool filter_memcg_fn(void)
 {
@@ -104,6 +116,32 @@ static int handle_switch(bool preempt, struct task_struct *prev, struct task_str
 	if (delta < 0)
 		goto cleanup;
 
+	if (target_ms)
+		delta /= 1000000U;
+	else
+		delta /= 1000U;
+
+	slot = log2l(delta);
+	if (slot >= MAX_SLOTS)
+		slot = MAX_SLOTS - 1;
+
+	if (target_per_cgroup || target_per_prio) {
+		struct cg_key key = {};
+		struct slots *slotsp;
+
+		if (target_per_cgroup)
+			key.cgroup_id = get_task_cgroup_id(next);
+		if (target_per_prio) {
+			key.policy = BPF_CORE_READ(next, policy);
+			key.prio = BPF_CORE_READ(next, prio);
+		}
+
+		slotsp = bpf_map_lookup_or_try_init(&cg_hists, &key, &zero_slots);
+		if (slotsp)
+			slotsp->slots[slot]++;
+		goto cleanup;
+	}
+
 	if (target_per_process)
 		hkey = BPF_CORE_READ(next, tgid);
 	else if (target_per_thread)
@@ -119,14 +157,6 @@ static int handle_switch(bool preempt, struct task_struct *prev, struct task_str
 
 	if (!histp->comm[0])
 		BPF_CORE_READ_STR_INTO(&histp->comm, next, comm);
-	if (target_ms)
-		delta /= 1000000U;
-	else
-		delta /= 1000U;
-
-	slot = log2l(delta);
-	if (slot >= MAX_SLOTS)
-		slot = MAX_SLOTS - 1;
 	__sync_fetch_and_add(&histp->slots[slot], 1);
 
 cleanup:
@@ -3,6 +3,13 @@
 #include "runqueue-latency.h"
 #include "runqueue-latency.skel.h"
 #include "trace_helpers.h"
+#include "cgroup_helpers.h"
+
+#include <sched.h>
+
+#ifndef SCHED_DEADLINE
+#define SCHED_DEADLINE	6
+#endif
 
 struct env {
 	time_t interval;
@@ -12,6 +19,8 @@ struct env {
 	bool per_process;
 	bool per_thread;
 	bool per_pidns;
+	bool per_cgroup;
+	bool per_prio;
 	bool timestamp;
 	bool verbose;
 	char *cgroupspath;
@@ -22,13 +31,14 @@ struct env {
 };
 
 static volatile sig_atomic_t exiting;
+static struct cgroup_cache *cgroup_cache;
 
 const char *argp_program_version = "runqueue-latency 0.1";
 const char *argp_program_bug_address = "Jackie Liu <liuyun01@kylinos.cn>";
 const char argp_program_doc[] =
 "Summarize run queue (scheduler) latency as a histogram.\n"
 "\n"
-"USAGE: runqlat [--help] [-T] [-m] [--pidnss] [-L] [-P] [-p PID] [interval] [count] [-c CG]\n"
+"USAGE: runqlat [--help] [-T] [-m] [--pidnss] [-L] [-P] [-C] [--prio] [-p PID] [interval] [count] [-c CG]\n"
 "\n"
 "EXAMPLES:\n"
 "    runqlat         # summarize run queue latency as a histogram\n"
@@ -36,9 +46,12 @@ const char argp_program_doc[] =
 "    runqlat -mT 1   # 1s summaries, milliseconds, and timestamps\n"
 "    runqlat -P      # show each PID separately\n"
 "    runqlat -p 185  # trace PID 185 only\n"
-"    runqlat -c CG   # Trace process under cgroupsPath CG\n";
+"    runqlat -c CG   # Trace process under cgroupsPath CG\n"
+"    runqlat -C      # show each cgroup separately, with p99\n"
+"    runqlat -C --prio  # show each cgroup and priority separately\n";
 
 #define OPT_PIDNSS	1 /* --pidnss */
+#define OPT_PRIO	2 /* --prio */
 
 static const struct argp_option opts[] = {
 	{ "timestamp", 'T', NULL, 0, "Include timestamp on output" },
@@ -46,6 +59,8 @@ static const struct argp_option opts[] = {
 	{ "pidnss", OPT_PIDNSS, NULL, 0, "Print a histogram per PID namespace" },
 	{ "pids", 'P', NULL, 0, "Print a histogram per process ID" },
 	{ "tids", 'L', NULL, 0, "Print a histogram per thread ID" },
+	{ "cgroups", 'C', NULL, 0, "Print a histogram per cgroup" },
+	{ "prio", OPT_PRIO, NULL, 0, "Print a histogram per scheduling policy and priority" },
 	{ "pid", 'p', "PID", 0, "Trace this PID only"},
 	{ "verbose", 'v', NULL, 0, "Verbose debug output" },
 	{ "cgroup", 'c', "/sys/fs/cgroup/unified", 0, "Trace process in cgroup path" },
@@ -79,6 +94,12 @@ static error_t parse_arg(int key, char *arg, struct argp_state *state)
 	case OPT_PIDNSS:
 		env.per_pidns = true;
 		break;
+	case 'C':
+		env.per_cgroup = true;
+		break;
+	case OPT_PRIO:
+		env.per_prio = true;
+		break;
 	case 'T':
 		env.timestamp = true;
 		break;
@@ -161,6 +182,90 @@ static int print_log2_hists(struct bpf_map *hists)
 	return 0;
 }
 
+static void print_prio(__u32 policy, __s32 prio)
+{
+	switch (policy) {
+	case SCHED_FIFO:
+	case SCHED_RR:
+		printf(" policy = %s rtprio = %d", policy == SCHED_FIFO ? "fifo" : "rr",
+		       99 - prio);
+		break;
+	case SCHED_DEADLINE:
+		printf(" policy = deadline");
+		break;
+	default:
+		printf(" policy = %s nice = %d",
+		       policy == SCHED_BATCH ? "batch" :
+		       policy == SCHED_IDLE ? "idle" : "normal", prio - 120);
+		break;
+	}
+}
+
+static int print_cg_hists(struct bpf_map *hists)
+{
+	const char *units = env.milliseconds ? "msecs" : "usecs";
+	int nr_cpus = libbpf_num_possible_cpus();
+	int err, fd = bpf_map__fd(hists);
+	struct cg_key *prev_key = NULL, key, next_key;
+	struct slots *percpu, total;
+	const char *path;
+	int i, cpu;
+
+	percpu = calloc(nr_cpus, sizeof(*percpu));
+	if (!percpu) {
+		warning("Failed to allocate per-CPU values\n");
+		return -1;
+	}
+
+	while (!bpf_map_get_next_key(fd, prev_key, &next_key)) {
+		err = bpf_map_lookup_elem(fd, &next_key, percpu);
+		if (err < 0) {
+			warning("Failed to lookup list: %d\n", err);
+			goto out;
+		}
+
+		memset(&total, 0, sizeof(total));
+		for (cpu = 0; cpu < nr_cpus; cpu++) {
+			for (i = 0; i < MAX_SLOTS; i++)
+				total.slots[i] += percpu[cpu].slots[i];
+		}
+
+		printf("\n");
+		if (env.per_cgroup) {
+			path = cgroup_cache ?
+			       cgroup_cache__get_path(cgroup_cache, next_key.cgroup_id) : NULL;
+			if (path)
+				printf("cgroup = %s", path);
+			else
+				printf("cgroup = %llu", next_key.cgroup_id);
+		}
+		if (env.per_prio)
+			print_prio(next_key.policy, next_key.prio);
+		printf(" p99 = %llu %s\n",
+		       log2_hist_percentile(total.slots, MAX_SLOTS, 99), units);
+		print_log2_hist(total.slots, MAX_SLOTS, units);
+
+		key = next_key;
+		prev_key = &key;
+	}
+
+	prev_key = NULL;
+	while (!bpf_map_get_next_key(fd, prev_key, &next_key)) {
+		err = bpf_map_delete_elem(fd, &next_key);
+		if (err < 0) {
+			warning("Failed to cleanup list : %d\n", err);
+			goto out;
+		}
+		key = next_key;
+		prev_key = &key;
+	}
+	err = 0;
+
+out:
+	free(percpu);
+	return err;
+}
+
 int main(int argc, char *argv[])
 {
 	static const struct argp argp = {
@@ -187,6 +292,11 @@ int main(int argc, char *argv[])
 		warning("pidnss, pids, tids cann't be used together.\n");
 		return 1;
 	}
+	if ((env.per_cgroup || env.per_prio) &&
+	    (env.per_thread || env.per_process || env.per_pidns)) {
+		warning("cgroups, prio cann't be used with pidnss, pids, tids.\n");
+		return 1;
+	}
 
 	libbpf_set_print(libbpf_print_fn);
 
@@ -203,6 +313,11 @@ int main(int argc, char *argv[])
 	bpf_obj->rodata->target_ms = env.milliseconds;
 	bpf_obj->rodata->target_tgid = env.pid;
 	bpf_obj->rodata->filter_memcg = env.cg;
+	bpf_obj->rodata->target_per_cgroup = env.per_cgroup;
+	bpf_obj->rodata->target_per_prio = env.per_prio;
+
+	if (!env.per_cgroup && !env.per_prio)
+		bpf_map__set_max_entries(bpf_obj->maps.cg_hists, 1);
 
 	if (probe_tp_btf("sched_wakeup")) {
 		bpf_program__set_autoload(bpf_obj->progs.sched_wakeup_raw, false);
@@ -235,6 +350,13 @@ int main(int argc, char *argv[])
 		}
 	}
 
+	if (env.per_cgroup) {
+		cgroup_cache = cgroup_cache__new(NULL);
+		if (!cgroup_cache)
+			warning("Failed to load cgroup paths, printing cgroup ids: %s\n",
+				strerror(errno));
+	}
+
 	err = runqueue_latency_bpf__attach(bpf_obj);
 	if (err) {
 		warning("Failed to attach BPF programs");
@@ -255,7 +377,10 @@ int main(int argc, char *argv[])
 			printf("%-8s\n", ts);
 		}
 
-		err = print_log2_hists(bpf_obj->maps.hists);
+		if (env.per_cgroup || env.per_prio)
+			err = print_cg_hists(bpf_obj->maps.cg_hists);
+		else
+			err = print_log2_hists(bpf_obj->maps.hists);
 		if (err)
 			break;
 
@@ -265,6 +390,7 @@ int main(int argc, char *argv[])
 
 cleanup:
 	runqueue_latency_bpf__destroy(bpf_obj);
+	cgroup_cache__free(cgroup_cache);
 	if (cgfd > 0)
 		close(cgfd);
 
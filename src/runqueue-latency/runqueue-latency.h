@@ -10,4 +10,15 @@ struct hist {
 	char comm[TASK_COMM_LEN];
 };
 
+/* key of the per-cgroup and/or per-priority histograms */
+struct cg_key {
+	__u64 cgroup_id;
+	__u32 policy;
+	__s32 prio;
+};
+
+struct slots {
+	__u32 slots[MAX_SLOTS];
+};
+
 #endif
@@ -0,0 +1,185 @@
+// SPDX-License-Identifier: GPL-2.0
+#include "vmlinux.h"
+#include <bpf/bpf_helpers.h>
+#include <bpf/bpf_core_read.h>
+#include <bpf/bpf_tracing.h>
+#include "schedtrace.h"
+#include "compat.bpf.h"
+#include "core_fixes.bpf.h"
+
+const volatile bool flight_recorder = false;
+const volatile __u32 ring_mask = 0;
+
+/* write position of each CPU in its part of the flight recorder ring */
+struct {
+	__uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+	__uint(max_entries, 1);
+	__type(key, u32);
+	__type(value, u64);
+} heads SEC(".maps");
+
+/* nr_cpus * (ring_mask + 1) records, sized by user space */
+struct {
+	__uint(type, BPF_MAP_TYPE_ARRAY);
+	__uint(map_flags, BPF_F_MMAPABLE);
+	__uint(max_entries, 1);
+	__type(key, u32);
+	__type(value, struct sched_record);
+} ring SEC(".maps");
+
+/*
+ * The flight recorder overwrites the oldest record of the current CPU, so
+ * there is no reserve/commit and no cross-CPU contention in that mode.
+ */
+static __always_inline struct sched_record *record_get(u32 cpu)
+{
+	u32 zero = 0, idx;
+	u64 *head;
+
+	if (!flight_recorder)
+		return reserve_buf(sizeof(struct sched_record));
+
+	head = bpf_map_lookup_elem(&heads, &zero);
+	if (!head)
+		return NULL;
+	idx = cpu * (ring_mask + 1) + (*head & ring_mask);
+	*head += 1;
+	return bpf_map_lookup_elem(&ring, &idx);
+}
+
+static __always_inline void record_put(void *ctx, struct sched_record *r)
+{
+	if (!flight_recorder)
+		submit_buf(ctx, r, sizeof(*r));
+}
+
+static __always_inline int
+record_task(void *ctx, u8 type, struct task_struct *p, u32 arg, u32 cpu)
+{
+	struct sched_record *r;
+	u32 this_cpu = bpf_get_smp_processor_id();
+
+	r = record_get(this_cpu);
+	if (!r)
+		return 0;
+
+	r->ts = bpf_ktime_get_ns();
+	r->pid = BPF_CORE_READ(p, pid);
+	r->tgid = BPF_CORE_READ(p, tgid);
+	r->arg = arg;
+	r->cpu = cpu;
+	r->type = type;
+	r->state = 0;
+	BPF_CORE_READ_INTO(&r->comm, p, comm);
+
+	record_put(ctx, r);
+	return 0;
+}
+
+/*
+ * The state letter ps and perf show for prev, from the highest TASK_REPORT
+ * bit (bit values of 4.14 and later): the raw state, an unsigned int since
+ * 5.14, doesn't fit the record.
+ */
+static __always_inline char task_state_char(struct task_struct *p, bool preempt)
+{
+	long state = get_task_state(p);
+
+	if (preempt || !state)
+		return 'R';
+	if (state & 0x40)
+		return 'P';
+	if (state & 0x20)
+		return 'Z';
+	if (state & 0x10)
+		return 'X';
+	if (state & 0x8)
+		return 't';
+	if (state & 0x4)
+		return 'T';
+	if (state & 0x2)
+		return state & 0x400 ? 'I' : 'D';
+	if (state & 0x1)
+		return 'S';
+	return '?';
+}
+
+static __always_inline int
+handle_switch(void *ctx, bool preempt, struct task_struct *prev,
+	      struct task_struct *next)
+{
+	struct sched_record *r;
+	u32 cpu = bpf_get_smp_processor_id();
+
+	r = record_get(cpu);
+	if (!r)
+		return 0;
+
+	r->ts = bpf_ktime_get_ns();
+	r->pid = BPF_CORE_READ(prev, pid);
+	r->tgid = BPF_CORE_READ(next, tgid);
+	r->arg = BPF_CORE_READ(next, pid);
+	r->cpu = cpu;
+	r->type = SCHED_SWITCH;
+	r->state = task_state_char(prev, preempt);
+	BPF_CORE_READ_INTO(&r->comm, next, comm);
+
+	record_put(ctx, r);
+	return 0;
+}
+
+SEC("tp_btf/sched_switch")
+int BPF_PROG(sched_switch_btf, bool preempt, struct task_struct *prev,
+	     struct task_struct *next)
+{
+	return handle_switch(ctx, preempt, prev, next);
+}
+
+SEC("tp_btf/sched_wakeup")
+int BPF_PROG(sched_wakeup_btf, struct task_struct *p)
+{
+	return record_task(ctx, SCHED_WAKEUP, p, get_task_cpu(p),
+			   bpf_get_smp_processor_id());
+}
+
+SEC("tp_btf/sched_wakeup_new")
+int BPF_PROG(sched_wakeup_new_btf, struct task_struct *p)
+{
+	return record_task(ctx, SCHED_WAKEUP_NEW, p, get_task_cpu(p),
+			   bpf_get_smp_processor_id());
+}
+
+SEC("tp_btf/sched_migrate_task")
+int BPF_PROG(sched_migrate_task_btf, struct task_struct *p, int dest_cpu)
+{
+	return record_task(ctx, SCHED_MIGRATE, p, get_task_cpu(p), dest_cpu);
+}
+
+SEC("raw_tp/sched_switch")
+int BPF_PROG(sched_switch_raw, bool preempt, struct task_struct *prev,
+	     struct task_struct *next)
+{
+	return handle_switch(ctx, preempt, prev, next);
+}
+
+SEC("raw_tp/sched_wakeup")
+int BPF_PROG(sched_wakeup_raw, struct task_struct *p)
+{
+	return record_task(ctx, SCHED_WAKEUP, p, get_task_cpu(p),
+			   bpf_get_smp_processor_id());
+}
+
+SEC("raw_tp/sched_wakeup_new")
+int BPF_PROG(sched_wakeup_new_raw, struct task_struct *p)
+{
+	return record_task(ctx, SCHED_WAKEUP_NEW, p, get_task_cpu(p),
+			   bpf_get_smp_processor_id());
+}
+
+SEC("raw_tp/sched_migrate_task")
+int BPF_PROG(sched_migrate_task_raw, struct task_struct *p, int dest_cpu)
+{
+	return record_task(ctx, SCHED_MIGRATE, p, get_task_cpu(p), dest_cpu);
+}
+
+char LICENSE[] SEC("license") = "GPL";
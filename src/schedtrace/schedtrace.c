@@ -0,0 +1,459 @@
+// SPDX-License-Identifier: (LGPL-2.1 OR BSD-2-Clause)
+#include "commons.h"
+#include "schedtrace.h"
+#include "schedtrace.skel.h"
+#include "trace_helpers.h"
+#include "compat.h"
+
+#include <sys/mman.h>
+
+static volatile sig_atomic_t exiting;
+
+static struct env {
+	char *output;
+	char *convert;
+	bool flight_recorder;
+	__u32 entries;
+	int duration;
+	bool verbose;
+} env = {
+	.entries = 4096,
+};
+
+static FILE *out_file;
+static __u64 nr_records;
+
+const char *argp_program_version = "schedtrace 0.1";
+const char *argp_program_bug_address = "Jackie Liu <liuyun01@kylinos.cn>";
+const char argp_program_doc[] =
+"Record scheduler switch/wakeup/migrate events into a trace file.\n"
+"\n"
+"USAGE: schedtrace [--help] [-o FILE] [-F] [-e ENTRIES] [-d DURATION]\n"
+"       schedtrace -c FILE [-o JSON]\n"
+"\n"
+"EXAMPLES:\n"
+"    schedtrace -d 5              # stream 5 seconds into schedtrace.dat\n"
+"    schedtrace -F -e 65536       # keep the last 64k events per CPU, dump on Ctrl-C\n"
+"    schedtrace -c schedtrace.dat -o trace.json\n"
+"                                 # convert to Chrome JSON (chrome://tracing,\n"
+"                                 # ui.perfetto.dev)\n";
+
+static const struct argp_option opts[] = {
+	{ "output", 'o', "FILE", 0, "Output file (default schedtrace.dat, stdout when converting)" },
+	{ "flight-recorder", 'F', NULL, 0, "Overwrite per-CPU rings, dump them at exit" },
+	{ "entries", 'e', "ENTRIES", 0, "Flight recorder entries per CPU (default 4096)" },
+	{ "duration", 'd', "DURATION", 0, "Duration to trace (seconds)" },
+	{ "convert", 'c', "FILE", 0, "Convert a recorded FILE to Chrome JSON trace" },
+	{ "verbose", 'v', NULL, 0, "Verbose debug output" },
+	{ NULL, 'h', NULL, OPTION_HIDDEN, "Show the full help" },
+	{},
+};
+
+static error_t parse_arg(int key, char *arg, struct argp_state *state)
+{
+	switch (key) {
+	case 'h':
+		argp_state_help(state, stderr, ARGP_HELP_STD_HELP);
+		break;
+	case 'v':
+		env.verbose = true;
+		break;
+	case 'o':
+		env.output = arg;
+		break;
+	case 'F':
+		env.flight_recorder = true;
+		break;
+	case 'e':
+		env.entries = argp_parse_long(key, arg, state);
+		break;
+	case 'd':
+		env.duration = argp_parse_long(key, arg, state);
+		break;
+	case 'c':
+		env.convert = arg;
+		break;
+	default:
+		return ARGP_ERR_UNKNOWN;
+	}
+	return 0;
+}
+
+static int libbpf_print_fn(enum libbpf_print_level level, const char *format, va_list args)
+{
+	if (level == LIBBPF_DEBUG && !env.verbose)
+		return 0;
+
+	return vfprintf(stderr, format, args);
+}
+
+static void sig_handler(int sig)
+{
+	exiting = 1;
+}
+
+static int record_cmp(const void *p1, const void *p2)
+{
+	const struct sched_record *r1 = p1, *r2 = p2;
+
+	if (r1->ts == r2->ts)
+		return 0;
+	return r1->ts < r2->ts ? -1 : 1;
+}
+
+static int write_header(FILE *f, __u64 count)
+{
+	struct schedtrace_header hdr = {
+		.record_size = sizeof(struct sched_record),
+		.nr_cpus = libbpf_num_possible_cpus(),
+		.nr_records = count,
+	};
+
+	memcpy(hdr.magic, SCHEDTRACE_MAGIC, sizeof(hdr.magic));
+	if (fseek(f, 0, SEEK_SET) || fwrite(&hdr, sizeof(hdr), 1, f) != 1)
+		return -errno;
+	return fseek(f, 0, SEEK_END) ? -errno : 0;
+}
+
+static int handle_event(void *ctx, void *data, size_t data_sz)
+{
+	if (fwrite(data, sizeof(struct sched_record), 1, out_file) != 1) {
+		warning("Failed to write record: %s\n", strerror(errno));
+		exiting = 1;
+		return -errno;
+	}
+	nr_records++;
+	return 0;
+}
+
+static void handle_lost_events(void *ctx, int cpu, __u64 lost_cnt)
+{
+	warning("Lost %llu events on CPU #%d\n", lost_cnt, cpu);
+}
+
+/* copy the flight recorder rings out, oldest record first */
+static int dump_rings(struct schedtrace_bpf *obj, int nr_cpus)
+{
+	size_t nr = (size_t)nr_cpus * env.entries, i, n = 0;
+	size_t size = nr * sizeof(struct sched_record);
+	struct sched_record *ring, *recs;
+	int err = 0;
+
+	ring = mmap(NULL, size, PROT_READ, MAP_SHARED, bpf_map__fd(obj->maps.ring), 0);
+	if (ring == MAP_FAILED) {
+		warning("Failed to mmap flight recorder: %s\n", strerror(errno));
+		return -errno;
+	}
+
+	recs = calloc(nr, sizeof(*recs));
+	if (!recs) {
+		err = -ENOMEM;
+		goto out;
+	}
+
+	for (i = 0; i < nr; i++) {
+		if (ring[i].ts)
+			recs[n++] = ring[i];
+	}
+	qsort(recs, n, sizeof(*recs), record_cmp);
+
+	if (fwrite(recs, sizeof(*recs), n, out_file) != n) {
+		err = -errno;
+		warning("Failed to write records: %s\n", strerror(errno));
+	}
+	nr_records = n;
+	free(recs);
+out:
+	munmap(ring, size);
+	return err;
+}
+
+struct cpu_state {
+	__u64 start;
+	__u32 pid;
+	__u32 tgid;
+	char comm[TASK_COMM_LEN];
+};
+
+static void json_comm(FILE *f, const char *comm)
+{
+	int i;
+
+	for (i = 0; i < TASK_COMM_LEN && comm[i]; i++) {
+		if (comm[i] == '"' || comm[i] == '\\')
+			fputc('\\', f);
+		fputc((unsigned char)comm[i] < 0x20 ? '?' : comm[i], f);
+	}
+}
+
+/*
+ * Emit the Chrome trace event format: every CPU is a track of pid 0 and
+ * carries one complete ("X") slice per task run, wakeups and migrations
+ * are instant events on the CPU that recorded them.
+ */
+static int convert_trace(const char *path)
+{
+	struct schedtrace_header hdr;
+	struct sched_record *recs = NULL;
+	struct cpu_state *cpus = NULL;
+	size_t n = 0, cap = 0, i;
+	const char *sep = "";
+	FILE *in, *out = stdout;
+	int err = 0;
+
+	in = fopen(path, "r");
+	if (!in) {
+		warning("Failed to open %s: %s\n", path, strerror(errno));
+		return -errno;
+	}
+	if (fread(&hdr, sizeof(hdr), 1, in) != 1 ||
+	    memcmp(hdr.magic, SCHEDTRACE_MAGIC, sizeof(hdr.magic)) ||
+	    hdr.record_size != sizeof(struct sched_record)) {
+		warning("%s: not a schedtrace file\n", path);
+		err = -EINVAL;
+		goto out;
+	}
+
+	/* nr_records is 0 if recording was interrupted, read until EOF */
+	for (;;) {
+		if (n == cap) {
+			struct sched_record *tmp;
+
+			cap = cap ? cap * 2 : 65536;
+			tmp = libbpf_reallocarray(recs, cap, sizeof(*recs));
+			if (!tmp) {
+				err = -ENOMEM;
+				goto out;
+			}
+			recs = tmp;
+		}
+		if (fread(&recs[n], sizeof(*recs), 1, in) != 1)
+			break;
+		n++;
+	}
+	qsort(recs, n, sizeof(*recs), record_cmp);
+
+	cpus = calloc(hdr.nr_cpus, sizeof(*cpus));
+	if (!cpus) {
+		err = -ENOMEM;
+		goto out;
+	}
+
+	if (env.output) {
+		out = fopen(env.output, "w");
+		if (!out) {
+			err = -errno;
+			warning("Failed to open %s: %s\n", env.output, strerror(errno));
+			goto out;
+		}
+	}
+
+	fprintf(out, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+	fprintf(out, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":0,"
+		"\"args\":{\"name\":\"CPUs\"}}");
+	for (i = 0; i < hdr.nr_cpus; i++)
+		fprintf(out, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,"
+			"\"tid\":%zu,\"args\":{\"name\":\"CPU %zu\"}}", i, i);
+	sep = ",\n";
+
+	for (i = 0; i < n; i++) {
+		const struct sched_record *r = &recs[i];
+		struct cpu_state *c;
+		double ts = r->ts / 1000.0;
+
+		if (r->cpu >= hdr.nr_cpus)
+			continue;
+		c = &cpus[r->cpu];
+
+		switch (r->type) {
+		case SCHED_SWITCH:
+			if (c->start && c->pid) {
+				fprintf(out, "%s{\"name\":\"", sep);
+				json_comm(out, c->comm);
+				fprintf(out, "\",\"ph\":\"X\",\"pid\":0,\"tid\":%u,"
+					"\"ts\":%.3f,\"dur\":%.3f,"
+					"\"args\":{\"pid\":%u,\"tgid\":%u,"
+					"\"end_state\":\"%c\"}}",
+					r->cpu, c->start / 1000.0,
+					(r->ts - c->start) / 1000.0, c->pid,
+					c->tgid, r->state ? r->state : '?');
+			}
+			c->start = r->ts;
+			c->pid = r->arg;
+			c->tgid = r->tgid;
+			memcpy(c->comm, r->comm, TASK_COMM_LEN);
+			break;
+		case SCHED_WAKEUP:
+		case SCHED_WAKEUP_NEW:
+		case SCHED_MIGRATE:
+			fprintf(out, "%s{\"name\":\"%s ", sep,
+				r->type == SCHED_MIGRATE ? "migrate" :
+				r->type == SCHED_WAKEUP ? "wakeup" : "wakeup_new");
+			json_comm(out, r->comm);
+			fprintf(out, "\",\"ph\":\"i\",\"s\":\"t\",\"pid\":0,"
+				"\"tid\":%u,\"ts\":%.3f,\"args\":{\"pid\":%u,"
+				"\"tgid\":%u,\"%s\":%u}}",
+				r->cpu, ts, r->pid, r->tgid,
+				r->type == SCHED_MIGRATE ? "orig_cpu" : "target_cpu",
+				r->arg);
+			break;
+		}
+	}
+	fprintf(out, "\n]}\n");
+
+	if (out != stdout)
+		fclose(out);
+out:
+	free(cpus);
+	free(recs);
+	fclose(in);
+	return err;
+}
+
+static __u32 roundup_pow_of_two(__u32 v)
+{
+	__u32 r = 1;
+
+	while (r < v)
+		r <<= 1;
+	return r;
+}
+
+int main(int argc, char *argv[])
+{
+	static const struct argp argp = {
+		.options = opts,
+		.parser = parse_arg,
+		.doc = argp_program_doc,
+	};
+	struct bpf_buffer *buf = NULL;
+	struct schedtrace_bpf *obj;
+	int nr_cpus, err;
+
+	err = argp_parse(&argp, argc, argv, 0, NULL, NULL);
+	if (err)
+		return err;
+
+	if (env.convert)
+		return convert_trace(env.convert) != 0;
+
+	if (!bpf_is_root())
+		return 1;
+
+	libbpf_set_print(libbpf_print_fn);
+
+	nr_cpus = libbpf_num_possible_cpus();
+	if (nr_cpus < 0) {
+		warning("Failed to get # of possible cpus: %s\n", strerror(-nr_cpus));
+		return 1;
+	}
+
+	obj = schedtrace_bpf__open();
+	if (!obj) {
+		warning("Failed to open BPF object\n");
+		return 1;
+	}
+
+	if (env.flight_recorder) {
+		env.entries = roundup_pow_of_two(env.entries);
+		obj->rodata->flight_recorder = true;
+		obj->rodata->ring_mask = env.entries - 1;
+		bpf_map__set_max_entries(obj->maps.ring, nr_cpus * env.entries);
+	}
+
+	buf = bpf_buffer__new(obj->maps.events, obj->maps.heap);
+	if (!buf) {
+		err = -errno;
+		warning("Failed to create ring/perf buffer: %d\n", err);
+		goto cleanup;
+	}
+
+	if (probe_tp_btf("sched_switch")) {
+		bpf_program__set_autoload(obj->progs.sched_switch_raw, false);
+		bpf_program__set_autoload(obj->progs.sched_wakeup_raw, false);
+		bpf_program__set_autoload(obj->progs.sched_wakeup_new_raw, false);
+		bpf_program__set_autoload(obj->progs.sched_migrate_task_raw, false);
+	} else {
+		bpf_program__set_autoload(obj->progs.sched_switch_btf, false);
+		bpf_program__set_autoload(obj->progs.sched_wakeup_btf, false);
+		bpf_program__set_autoload(obj->progs.sched_wakeup_new_btf, false);
+		bpf_program__set_autoload(obj->progs.sched_migrate_task_btf, false);
+	}
+
+	err = schedtrace_bpf__load(obj);
+	if (err) {
+		warning("Failed to load BPF object: %d\n", err);
+		goto cleanup;
+	}
+
+	out_file = fopen(env.output ?: "schedtrace.dat", "w");
+	if (!out_file) {
+		err = -errno;
+		warning("Failed to open output file: %s\n", strerror(errno));
+		goto cleanup;
+	}
+	err = write_header(out_file, 0);
+	if (err) {
+		warning("Failed to write header: %s\n", strerror(-err));
+		goto cleanup;
+	}
+
+	if (!env.flight_recorder) {
+		err = bpf_buffer__open(buf, handle_event, handle_lost_events, NULL);
+		if (err) {
+			warning("Failed to open ring/perf buffer: %d\n", err);
+			goto cleanup;
+		}
+	}
+
+	err = schedtrace_bpf__attach(obj);
+	if (err) {
+		warning("Failed to attach BPF programs: %d\n", err);
+		goto cleanup;
+	}
+
+	if (signal(SIGINT, sig_handler) == SIG_ERR) {
+		err = 1;
+		warning("Can't set signal handler: %s\n", strerror(errno));
+		goto cleanup;
+	}
+
+	printf("Recording scheduler events to %s... Hit Ctrl-C to end.\n",
+	       env.output ?: "schedtrace.dat");
+
+	time_since_start();
+	while (!exiting) {
+		if (env.flight_recorder) {
+			usleep(POLL_TIMEOUT_MS * 1000);
+		} else {
+			err = bpf_buffer__poll(buf, POLL_TIMEOUT_MS);
+			if (err < 0 && err != -EINTR) {
+				warning("Error polling ring/perf buffer: %d\n", err);
+				goto cleanup;
+			}
+		}
+		/* reset err to return 0 if exiting */
+		err = 0;
+		if (env.duration && time_since_start() >= env.duration)
+			break;
+	}
+
+	/* stop recording before the rings are copied out */
+	schedtrace_bpf__detach(obj);
+	if (env.flight_recorder)
+		err = dump_rings(obj, nr_cpus);
+	else
+		bpf_buffer__poll(buf, 0);
+
+	if (!err)
+		err = write_header(out_file, nr_records);
+	printf("\n%llu records written\n", nr_records);
+
+cleanup:
+	if (out_file)
+		fclose(out_file);
+	bpf_buffer__free(buf);
+	schedtrace_bpf__destroy(obj);
+
+	return err != 0;
+}
@@ -0,0 +1,47 @@
+// SPDX-License-Identifier: (LGPL-2.1 OR BSD-2-Clause)
+#ifndef __SCHEDTRACE_H
+#define __SCHEDTRACE_H
+
+#define TASK_COMM_LEN	16
+
+enum sched_record_type {
+	SCHED_SWITCH = 1,
+	SCHED_WAKEUP,
+	SCHED_WAKEUP_NEW,
+	SCHED_MIGRATE,
+};
+
+/*
+ * One fixed-size record per scheduler event, written as is to the trace
+ * file. Field usage depends on the type:
+ *
+ *   switch:  pid = prev pid, arg = next pid, tgid/comm = next task,
+ *            cpu = CPU switching, state = prev task state letter,
+ *            'R' if preempted, 'S', 'D', 'I', ... otherwise
+ *   wakeup:  pid/tgid/comm = woken task, arg = target CPU,
+ *            cpu = CPU doing the wakeup
+ *   migrate: pid/tgid/comm = migrated task, arg = original CPU,
+ *            cpu = destination CPU
+ */
+struct sched_record {
+	__u64 ts;
+	__u32 pid;
+	__u32 tgid;
+	__u32 arg;
+	__u16 cpu;
+	__u8 type;
+	char state;
+	char comm[TASK_COMM_LEN];
+};
+
+#define SCHEDTRACE_MAGIC	"SCHEDTR2"
+
+/* trace file header, followed by nr_records records (0 while streaming) */
+struct schedtrace_header {
+	char magic[8];
+	__u32 record_size;
+	__u32 nr_cpus;
+	__u64 nr_records;
+};
+
+#endif
@@ -3,6 +3,7 @@
 #include "slabratetop.h"
 #include "slabratetop.skel.h"
 #include "trace_helpers.h"
+#include "top_helpers.h"
 
 #include <sys/param.h>
 
@@ -18,6 +19,8 @@ static volatile sig_atomic_t exiting;
 
 static pid_t target_pid = 0;
 static bool clear_screen = true;
+static bool cumulative = false;
+static bool json = false;
 static int output_rows = 20;
 static int sort_by = SORT_BY_CACHE_SIZE;
 static int interval = 1;
@@ -29,18 +32,23 @@ const char *argp_program_bug_address = "Jackie Liu <liuyun01@kylinos.cn>";
 const char argp_program_doc[] =
 "Trace slab kmem cache alloc by process.\n"
 "\n"
-"USAGE: slabratetop [-h] [-p PID] [interval] [count]\n"
+"USAGE: slabratetop [-h] [-p PID] [-C] [-j] [--cumulative] [interval] [count]\n"
 "\n"
 "EXAMPLES:\n"
 "    slabratetop            # slab rate top, refresh every 1s\n"
 "    slabratetop -p 181     # only trace PID 181\n"
 "    slabratetop -s count   # sort columns by count\n"
 "    slabratetop -r 100     # print 100 rows\n"
-"    slabratetop 5 10       # 5s summaries, 10 times\n";
+"    slabratetop 5 10       # 5s summaries, 10 times\n"
+"    slabratetop -j 1 10    # 10 one second summaries as JSON lines\n";
+
+#define OPT_CUMULATIVE	1	/* --cumulative */
 
 static const struct argp_option opts[] = {
 	{ "pid", 'p', "PID", 0, "Process ID to trace" },
 	{ "noclear", 'C', NULL, 0, "Don't clear the screen" },
+	{ "json", 'j', NULL, 0, "Print each interval as a JSON object" },
+	{ "cumulative", OPT_CUMULATIVE, NULL, 0, "Show totals since start instead of per interval" },
 	{ "sort", 's', "SORT", 0, "Sort columns, default size [name, count, size]" },
 	{ "rows", 'r', "ROWS", 0, "Maximum rows to print, default 20" },
 	{ "verbose", 'v', NULL, 0, "Verbose debug output" },
@@ -59,6 +67,12 @@ static error_t parse_arg(int key, char *arg, struct argp_state *state)
 	case 'C':
 		clear_screen = false;
 		break;
+	case 'j':
+		json = true;
+		break;
+	case OPT_CUMULATIVE:
+		cumulative = true;
+		break;
 	case 's':
 		if (!strcmp(arg, "name")) {
 			sort_by = SORT_BY_CACHE_NAME;
@@ -112,69 +126,53 @@ static void sig_handler(int sig)
 	exiting = 1;
 }
 
-static int sort_column(const void *obj1, const void *obj2)
+static int sort_column(const void *k1, const void *v1,
+		       const void *k2, const void *v2)
 {
-	struct slabrate_info *s1 = (struct slabrate_info *)obj1;
-	struct slabrate_info *s2 = (struct slabrate_info *)obj2;
+	const struct slabrate_info *s1 = v1;
+	const struct slabrate_info *s2 = v2;
 
 	if (sort_by == SORT_BY_CACHE_NAME) {
 		return strcasecmp(s1->name, s2->name);
 	} else if (sort_by == SORT_BY_CACHE_COUNT) {
-		return s2->count - s1->count;
+		return top_cmp_u64(s1->count, s2->count);
 	} else {
-		return s2->size - s1->size;
+		return top_cmp_u64(s1->size, s2->size);
 	}
 }
 
-static int print_stat(struct slabratetop_bpf *obj)
+static int print_stat(struct top *top, struct slabratetop_bpf *obj)
 {
-	FILE *f;
-	char *key, **prev_key = NULL;
-	static struct slabrate_info values[OUTPUT_ROWS_LIMIT];
-	int fd = bpf_map__fd(obj->maps.slab_entries);
-	int err = 0, rows = 0;
-
-	f = fopen("/proc/loadavg", "r");
-	if (f) {
-		char ts[32], buf[256];
-
-		strftime_now(ts, sizeof(ts), "%H:%M:%S");
-		if (fread(buf, 1, sizeof(buf), f))
-			printf("%8s loadavg: %s\n", ts, buf);
-		fclose(f);
-	}
+	int rows;
 
-	printf("%-32s %6s %10s\n", "CACHE", "ALLOCS", "BYTES");
-
-	while (!bpf_map_get_next_key(fd, prev_key, &key)) {
-		err = bpf_map_lookup_elem(fd, &key, &values[rows++]);
-		if (err) {
-			warning("bpf_map_lookup_elem failed: %s\n", strerror(errno));
-			return err;
-		}
-		prev_key = &key;
+	rows = top__collect(top, bpf_map__fd(obj->maps.slab_entries));
+	if (rows < 0) {
+		warning("Failed to read slab entries: %s\n", strerror(-rows));
+		return rows;
 	}
 
-	qsort(values, rows, sizeof(struct slabrate_info), sort_column);
-	rows = MIN(rows, output_rows);
+	top__begin(top, true);
 
-	for (int i = 0; i < rows; i++)
-		printf("%-32s %6lld %10lld\n",
-		       values[i].name, values[i].count, values[i].size);
+	if (!top__json(top))
+		printf("%-32s %6s %10s\n", "CACHE", "ALLOCS", "BYTES");
 
-	printf("\n");
-	prev_key = NULL;
+	for (int i = 0; i < rows; i++) {
+		const struct slabrate_info *value = top__value(top, i);
 
-	while (!bpf_map_get_next_key(fd, prev_key, &key)) {
-		err = bpf_map_delete_elem(fd, &key);
-		if (err) {
-			warning("bpf_map_delete_elem failed: %s\n", strerror(errno));
-			return err;
+		if (top__json(top)) {
+			top__json_row(top);
+			top__json_str(top, "cache", value->name);
+			top__json_u64(top, "allocs", value->count);
+			top__json_u64(top, "bytes", value->size);
+			continue;
 		}
-		prev_key = &key;
+
+		printf("%-32s %6lld %10lld\n",
+		       value->name, value->count, value->size);
 	}
 
-	return err;
+	top__end(top);
+	return 0;
 }
 
 int main(int argc, char *argv[])
@@ -184,7 +182,13 @@ int main(int argc, char *argv[])
 		.parser = parse_arg,
 		.doc = argp_program_doc,
 	};
+	struct top_opts top_opts = {
+		.key_size = sizeof(char *),
+		.value_size = sizeof(struct slabrate_info),
+		.cmp = sort_column,
+	};
 	struct slabratetop_bpf *obj;
+	struct top *top = NULL;
 	int err;
 
 	err = argp_parse(&argp, argc, argv, 0, NULL, NULL);
@@ -216,6 +220,18 @@ int main(int argc, char *argv[])
 		goto cleanup;
 	}
 
+	top_opts.max_entries = bpf_map__max_entries(obj->maps.slab_entries);
+	top_opts.rows = output_rows;
+	top_opts.cumulative = cumulative;
+	top_opts.clear_screen = clear_screen;
+	top_opts.json = json;
+	top = top__new(&top_opts);
+	if (!top) {
+		err = -errno;
+		warning("Failed to create top: %s\n", strerror(errno));
+		goto cleanup;
+	}
+
 	if (signal(SIGINT, sig_handler) == SIG_ERR) {
 		warning("Can't set signal handler: %s\n", strerror(errno));
 		err = 1;
@@ -225,13 +241,7 @@ int main(int argc, char *argv[])
 	while (1) {
 		sleep(interval);
 
-		if (clear_screen) {
-			err = system("clear");
-			if (err)
-				break;
-		}
-
-		err = print_stat(obj);
+		err = print_stat(top, obj);
 		if (err)
 			break;
 
@@ -240,6 +250,7 @@ int main(int argc, char *argv[])
 	}
 
 cleanup:
+	top__free(top);
 	slabratetop_bpf__destroy(obj);
 
 	return err != 0;
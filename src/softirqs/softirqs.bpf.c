@@ -9,6 +9,7 @@
 
 const volatile bool target_dist = false;
 const volatile bool target_ns = false;
+const volatile bool target_matrix = false;
 
 struct {
 	__uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
@@ -17,6 +18,14 @@ struct {
 	__type(value, u64);
 } start SEC(".maps");
 
+/* time of each vector on each CPU, the per-CPU map is the CPU dimension */
+struct {
+	__uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+	__uint(max_entries, NR_SOFTIRQS);
+	__type(key, u32);
+	__type(value, struct vec_cpu);
+} vec_cpus SEC(".maps");
+
 __u64 counts[NR_SOFTIRQS] = {};
 __u64 time[NR_SOFTIRQS] = {};
 struct hist hists[NR_SOFTIRQS] = {};
@@ -43,6 +52,17 @@ static int handle_exit(unsigned int vec_nr)
 		return 0;
 
 	delta = bpf_ktime_get_ns() - *tsp;
+	if (target_matrix) {
+		struct vec_cpu *val;
+
+		key = vec_nr;
+		val = bpf_map_lookup_elem(&vec_cpus, &key);
+		if (val) {
+			val->time_ns += delta;
+			val->count++;
+		}
+		return 0;
+	}
 	if (!target_ns)
 		delta /= 1000U;
 
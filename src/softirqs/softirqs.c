@@ -4,8 +4,11 @@
 #include "softirqs.skel.h"
 #include "trace_helpers.h"
 
+#define MAX_ROWS	10
+
 struct env {
 	bool distributed;
+	bool matrix;
 	bool nanoseconds;
 	bool count;
 	time_t interval;
@@ -19,22 +22,26 @@ struct env {
 };
 
 static volatile sig_atomic_t exiting;
+/* start of the current interval in -M mode */
+static unsigned long long interval_start;
 
 const char *argp_program_version = "softirqs 0.1";
 const char *argp_program_buf_address = "Jackie Liu <liuyun01@kylinos.cn>";
 const char argp_program_doc[] =
 "Summarize soft irq event time as histograms.\n"
 "\n"
-"USAGE: softirqs [--help] [-T] [-N] [-d] [interval] [count]\n"
+"USAGE: softirqs [--help] [-T] [-N] [-d] [-M] [interval] [count]\n"
 "\n"
 "EXAMPLES:\n"
 "  softirqs           # sum soft irq event time\n"
 "  softirqs -d        # show soft irq event time as histograms\n"
 "  softirqs 1 10      # print 1 second summaries, 10 times\n"
-"  softirqs -NT 1     # 1s summaries, nanoseconds, and timestamps\n";
+"  softirqs -NT 1     # 1s summaries, nanoseconds, and timestamps\n"
+"  softirqs -M 1      # per CPU spread of each vector, 1s summaries\n";
 
 static const struct argp_option opts[] = {
 	{ "distributed", 'd', NULL, 0, "Show distributions as histograms" },
+	{ "cpu-matrix", 'M', NULL, 0, "Show how softirq time is spread over CPUs" },
 	{ "timestamp", 'T', NULL, 0, "Include timestamp on output" },
 	{ "nanoseconds", 'N', NULL, 0, "Output in nanoseconds" },
 	{ "count", 'C', NULL, 0, "Show event counts with timing" },
@@ -57,6 +64,9 @@ static error_t parse_arg(int key, char *arg, struct argp_state *state)
 	case 'd':
 		env.distributed = true;
 		break;
+	case 'M':
+		env.matrix = true;
+		break;
 	case 'N':
 		env.nanoseconds = true;
 		break;
@@ -181,6 +191,99 @@ static int print_hist(struct softirqs_bpf__bss *bss)
 	return 0;
 }
 
+struct vec_row {
+	__u32 vec;
+	__u64 total_ns;
+	__u64 count;
+	__u64 top_ns;
+	int top_cpu;
+	int nr_cpus;	/* CPUs with more than 1% of the vector's time */
+};
+
+static int sort_top_ns(const void *obj1, const void *obj2)
+{
+	const struct vec_row *r1 = obj1, *r2 = obj2;
+
+	if (r1->top_ns == r2->top_ns)
+		return 0;
+	return r1->top_ns < r2->top_ns ? 1 : -1;
+}
+
+/*
+ * Vectors are ranked by the time their busiest CPU spent in them, and
+ * flagged as skewed when one CPU takes most of it. Softirqs run where
+ * they are raised, so a skewed net_rx usually means the NIC irqs (see
+ * hardirqs -M) or RPS steer everything to few CPUs.
+ */
+static int print_matrix(struct softirqs_bpf *obj)
+{
+	int fd = bpf_map__fd(obj->maps.vec_cpus);
+	int nr_cpus = libbpf_num_possible_cpus();
+	struct vec_cpu values[nr_cpus], zeros[nr_cpus];
+	struct vec_row rows[NR_SOFTIRQS], *r;
+	__u64 cpu_ns[nr_cpus], elapsed;
+	unsigned long long now = get_ktime_ns();
+	int i, cpu, tmp, order[nr_cpus];
+	__u32 vec;
+
+	elapsed = now - interval_start;
+	interval_start = now;
+	memset(cpu_ns, 0, sizeof(cpu_ns));
+	memset(zeros, 0, sizeof(zeros));
+
+	for (vec = 0; vec < NR_SOFTIRQS; vec++) {
+		r = &rows[vec];
+		memset(r, 0, sizeof(*r));
+		r->vec = vec;
+		if (bpf_map_lookup_elem(fd, &vec, values))
+			continue;
+		bpf_map_update_elem(fd, &vec, zeros, BPF_ANY);
+
+		for (cpu = 0; cpu < nr_cpus; cpu++) {
+			r->total_ns += values[cpu].time_ns;
+			r->count += values[cpu].count;
+			cpu_ns[cpu] += values[cpu].time_ns;
+			if (values[cpu].time_ns > r->top_ns) {
+				r->top_ns = values[cpu].time_ns;
+				r->top_cpu = cpu;
+			}
+		}
+		for (cpu = 0; cpu < nr_cpus; cpu++)
+			if (values[cpu].time_ns * 100 > r->total_ns)
+				r->nr_cpus++;
+	}
+
+	qsort(rows, NR_SOFTIRQS, sizeof(*rows), sort_top_ns);
+
+	printf("%-10s %10s %10s %5s %8s %6s\n", "SOFTIRQ", "TOTAL(us)",
+	       "COUNT", "CPUS", "TOP-CPU", "TOP%");
+	for (i = 0; i < NR_SOFTIRQS && rows[i].total_ns; i++) {
+		r = &rows[i];
+		printf("%-10s %10llu %10llu %5d %8d %5.1f%%%s\n",
+		       softirq_vec_names[r->vec], r->total_ns / 1000, r->count,
+		       r->nr_cpus, r->top_cpu, 100.0 * r->top_ns / r->total_ns,
+		       nr_cpus > 1 && r->top_ns * 2 > r->total_ns ? " SKEW" : "");
+	}
+
+	/* CPUs by share of time in softirq context */
+	for (cpu = 0; cpu < nr_cpus; cpu++)
+		order[cpu] = cpu;
+	for (i = 0; i < nr_cpus; i++)
+		for (cpu = i + 1; cpu < nr_cpus; cpu++)
+			if (cpu_ns[order[cpu]] > cpu_ns[order[i]]) {
+				tmp = order[i];
+				order[i] = order[cpu];
+				order[cpu] = tmp;
+			}
+
+	printf("\n%-8s %8s\n", "CPU", "SOFTIRQ%");
+	for (i = 0; i < nr_cpus && i < MAX_ROWS && cpu_ns[order[i]]; i++)
+		printf("%-8d %7.2f%%\n", order[i],
+		       100.0 * cpu_ns[order[i]] / max(elapsed, 1ULL));
+
+	return 0;
+}
+
 int main(int argc, char *argv[])
 {
 	static const struct argp argp = {
@@ -200,6 +303,11 @@ int main(int argc, char *argv[])
 	if (!bpf_is_root())
 		return 1;
 
+	if (env.matrix && env.distributed) {
+		warning("cpu-matrix can't be used with distributed.\n");
+		return 1;
+	}
+
 	libbpf_set_print(libbpf_print_fn);
 
 	bpf_obj = softirqs_bpf__open();
@@ -219,6 +327,7 @@ int main(int argc, char *argv[])
 	/* initialize global data (filtering options) */
 	bpf_obj->rodata->target_dist = env.distributed;
 	bpf_obj->rodata->target_ns = env.nanoseconds;
+	bpf_obj->rodata->target_matrix = env.matrix;
 
 	err = softirqs_bpf__load(bpf_obj);
 	if (err) {
@@ -240,6 +349,7 @@ int main(int argc, char *argv[])
 	signal(SIGINT, sig_handler);
 
 	printf("Tracing softirq event time... Hit Ctrl-C to end.\n");
+	interval_start = get_ktime_ns();
 
 	for (;;) {
 		sleep(env.interval);
@@ -250,7 +360,9 @@ int main(int argc, char *argv[])
 			printf("%-8s\n", ts);
 		}
 
-		if (!env.distributed)
+		if (env.matrix)
+			err = print_matrix(bpf_obj);
+		else if (!env.distributed)
 			err = print_count(bpf_obj->bss);
 		else
 			err = print_hist(bpf_obj->bss);
@@ -8,5 +8,11 @@ struct hist {
 	__u32 slots[MAX_SLOTS];
 };
 
+/* CPU matrix mode, per-CPU value indexed by vector */
+struct vec_cpu {
+	__u64 time_ns;
+	__u64 count;
+};
+
 #endif
 
@@ -4,6 +4,7 @@
 #include <bpf/bpf_tracing.h>
 #include <bpf/bpf_helpers.h>
 #include "syscount.h"
+#include "compat.bpf.h"
 #include "maps.bpf.h"
 
 const volatile bool filter_cg = false;
@@ -12,6 +13,13 @@ const volatile bool measure_latency = false;
 const volatile bool filter_failed = false;
 const volatile bool filter_errno = false;
 const volatile pid_t filter_pid = 0;
+const volatile bool capture_outliers = false;
+const volatile int nr_args = MAX_ARGS;
+
+struct syscall_start {
+	u64 ts;
+	u64 args[MAX_ARGS];
+};
 
 struct {
 	__uint(type, BPF_MAP_TYPE_CGROUP_ARRAY);
@@ -24,9 +32,22 @@ struct {
 	__uint(type, BPF_MAP_TYPE_HASH);
 	__uint(max_entries, MAX_ENTRIES);
 	__type(key, u32);
-	__type(value, u64);
+	__type(value, struct syscall_start);
 } start SEC(".maps");
 
+/* Per-syscall outlier threshold in ns, 0 means never report */
+struct {
+	__uint(type, BPF_MAP_TYPE_ARRAY);
+	__uint(max_entries, MAX_SYSCALLS);
+	__type(key, u32);
+	__type(value, u64);
+} thresholds SEC(".maps");
+
+struct {
+	__uint(type, BPF_MAP_TYPE_STACK_TRACE);
+	__uint(key_size, sizeof(u32));
+} stackmap SEC(".maps");
+
 struct {
 	__uint(type, BPF_MAP_TYPE_HASH);
 	__uint(max_entries, MAX_ENTRIES);
@@ -47,7 +68,7 @@ int sys_enter(struct trace_event_raw_sys_enter *args)
 	u64 id = bpf_get_current_pid_tgid();
 	pid_t pid = id >> 32;
 	u32 tid = id;
-	u64 ts;
+	struct syscall_start s = {};
 
 	if (!measure_latency)
 		return 0;
@@ -58,11 +79,47 @@ int sys_enter(struct trace_event_raw_sys_enter *args)
 	if (filter_pid && pid != filter_pid)
 		return 0;
 
-	ts = bpf_ktime_get_ns();
-	bpf_map_update_elem(&start, &tid, &ts, BPF_ANY);
+	/* the raw arguments are only needed for outlier reports */
+	if (capture_outliers) {
+		for (int i = 0; i < MAX_ARGS && i < nr_args; i++)
+			s.args[i] = args->args[i];
+	}
+
+	s.ts = bpf_ktime_get_ns();
+	bpf_map_update_elem(&start, &tid, &s, BPF_ANY);
 	return 0;
 }
 
+static __always_inline void
+report_outlier(void *ctx, struct syscall_start *s, u32 syscall_id,
+	       s64 ret, u64 lat, u64 id)
+{
+	struct outlier_event *e;
+	u64 *threshold;
+
+	threshold = bpf_map_lookup_elem(&thresholds, &syscall_id);
+	if (!threshold || !*threshold || lat < *threshold)
+		return;
+
+	e = reserve_buf(sizeof(*e));
+	if (!e)
+		return;
+
+	e->cgroup_id = bpf_get_current_cgroup_id();
+	e->lat_ns = lat;
+	for (int i = 0; i < MAX_ARGS; i++)
+		e->args[i] = i < nr_args ? s->args[i] : 0;
+	e->ret = ret;
+	e->pid = id >> 32;
+	e->tid = id;
+	e->syscall_id = syscall_id;
+	e->kernel_stack_id = bpf_get_stackid(ctx, &stackmap, 0);
+	e->user_stack_id = bpf_get_stackid(ctx, &stackmap, BPF_F_USER_STACK);
+	bpf_get_current_comm(&e->comm, sizeof(e->comm));
+
+	submit_buf(ctx, e, sizeof(*e));
+}
+
 SEC("tracepoint/raw_syscalls/sys_exit")
 int sys_exit(struct trace_event_raw_sys_exit *args)
 {
@@ -73,7 +130,8 @@ int sys_exit(struct trace_event_raw_sys_exit *args)
 	pid_t pid = id >> 32;
 	const struct data_t zero = {};
 	struct data_t *val;
-	u64 *start_ts, lat = 0;
+	struct syscall_start *s;
+	u64 lat = 0;
 	u32 tid = id;
 	u32 key;
 
@@ -89,10 +147,16 @@ int sys_exit(struct trace_event_raw_sys_exit *args)
 		return 0;
 
 	if (measure_latency) {
-		start_ts = bpf_map_lookup_and_delete_elem(&start, &tid);
-		if (!start_ts)
+		s = bpf_map_lookup_and_delete_elem(&start, &tid);
+		if (!s)
+			return 0;
+		lat = bpf_ktime_get_ns() - s->ts;
+
+		/* outlier mode reports single events instead of aggregates */
+		if (capture_outliers) {
+			report_outlier(args, s, args->id, args->ret, lat, id);
 			return 0;
-		lat = bpf_ktime_get_ns() - *start_ts;
+		}
 	}
 
 	key = count_by_process ? pid : args->id;
@@ -6,6 +6,9 @@
 #include "trace_helpers.h"
 #include "errno_helpers.h"
 #include "syscall_helpers.h"
+#include "compat.h"
+
+#define MAX_OUTLIER_SPECS	64
 
 /*
  * This structure extends data_t by adding a key item which should be sorted
@@ -30,7 +33,13 @@ const char argp_program_doc[] =
 "    syscount -P              # group statistics by pid, not by syscall\n"
 "    syscount -x -i 5         # count only failed syscalls\n"
 "    syscount -e ENOENT -i 5  # count only syscalls failed with a given errno\n"
-"    syscount -c CG           # Trace process under cgroupsPath CG\n";
+"    syscount -c CG           # Trace process under cgroupsPath CG\n"
+"    syscount -O 100000       # report single syscalls slower than 100 ms\n"
+"    syscount -O fsync=50000  # report only fsync calls slower than 50 ms\n";
+
+#define OPT_ARGS			1 /* --args */
+#define OPT_PERF_MAX_STACK_DEPTH	2 /* --perf-max-stack-depth */
+#define OPT_STACK_STORAGE_SIZE		3 /* --stack-storage-size */
 
 static const struct argp_option opts[] = {
 	{ "verbose", 'v', NULL, 0, "Verbose debug output" },
@@ -48,6 +57,14 @@ static const struct argp_option opts[] = {
 	{ "errno", 'e', "ERRNO", 0, "Trace only syscalls that return this error"
 				"(numeric or EPERM, etc.)" },
 	{ "list", 'l', NULL, 0, "Print list of recognized syscalls and exit" },
+	{ "outliers", 'O', "[SYSCALL=]USEC", 0, "Report single syscalls slower than"
+				" USEC, per syscall if SYSCALL is given (repeatable)" },
+	{ "args", OPT_ARGS, "N", 0, "Number of raw arguments to capture in"
+				" outlier reports (default 6)" },
+	{ "perf-max-stack-depth", OPT_PERF_MAX_STACK_DEPTH, "PERF-MAX-STACK-DEPTH",
+	  0, "The limit for both kernel and user stack traces (default 127)" },
+	{ "stack-storage-size", OPT_STACK_STORAGE_SIZE, "STACK-STORAGE-SIZE", 0,
+	  "The number of unique stack traces that can be stored (default 1024)" },
 	{ NULL, 'h', NULL, OPTION_HIDDEN, "Show the full help" },
 	{}
 };
@@ -66,10 +83,25 @@ static struct env {
 	pid_t pid;
 	char *cgroupspath;
 	bool cg;
+	bool outliers;
+	__u64 outlier_us;
+	char *outlier_specs[MAX_OUTLIER_SPECS];
+	int nr_outlier_specs;
+	int nr_args;
+	int perf_max_stack_depth;
+	int stack_storage_size;
 } env = {
 	.top = 10,
+	.nr_args = MAX_ARGS,
+	.perf_max_stack_depth = 127,
+	.stack_storage_size = 1024,
 };
 
+static struct ksyms *ksyms;
+static struct syms_cache *syms_cache;
+static unsigned long *stack_ips;
+static int stackmap_fd = -1;
+
 static inline __maybe_unused
 long argp_parse_long_range(int key, const char *arg, struct argp_state *state,
 			   long min, long max)
@@ -328,12 +360,163 @@ static error_t parse_arg(int key, char *arg, struct argp_state *state)
 	case 'l':
 		env.list_syscalls = true;
 		break;
+	case 'O':
+		env.outliers = true;
+		if (strchr(arg, '=')) {
+			if (env.nr_outlier_specs >= MAX_OUTLIER_SPECS) {
+				warning("Too many per-syscall thresholds\n");
+				argp_usage(state);
+			}
+			env.outlier_specs[env.nr_outlier_specs++] = arg;
+		} else {
+			env.outlier_us = safe_strtol(arg, 1, LONG_MAX / 1000, state);
+		}
+		break;
+	case OPT_ARGS:
+		env.nr_args = argp_parse_long_range(key, arg, state, 0, MAX_ARGS);
+		break;
+	case OPT_PERF_MAX_STACK_DEPTH:
+		env.perf_max_stack_depth = argp_parse_long(key, arg, state);
+		break;
+	case OPT_STACK_STORAGE_SIZE:
+		env.stack_storage_size = argp_parse_long(key, arg, state);
+		break;
 	default:
 		return ARGP_ERR_UNKNOWN;
 	}
 	return 0;
 }
 
+/*
+ * Fill the per-syscall threshold map: every syscall gets the default
+ * threshold (if any), then SYSCALL=USEC entries override single slots.
+ */
+static int setup_thresholds(int fd)
+{
+	__u64 ns = env.outlier_us * 1000;
+	char *spec, *sep, *end;
+	long us;
+	__u32 i;
+	int nr;
+
+	for (i = 0; ns && i < MAX_SYSCALLS; i++) {
+		if (bpf_map_update_elem(fd, &i, &ns, BPF_ANY))
+			return -errno;
+	}
+
+	for (i = 0; i < env.nr_outlier_specs; i++) {
+		spec = env.outlier_specs[i];
+		sep = strchr(spec, '=');
+		*sep = '\0';
+
+		errno = 0;
+		nr = strtol(spec, &end, 10);
+		if (errno || end == spec || *end != '\0')
+			nr = syscall_number(spec);
+		if (nr < 0 || nr >= MAX_SYSCALLS) {
+			warning("Unknown syscall: %s\n", spec);
+			return -EINVAL;
+		}
+
+		errno = 0;
+		us = strtol(sep + 1, &end, 10);
+		if (errno || end == sep + 1 || *end != '\0' || us <= 0 ||
+		    us > LONG_MAX / 1000) {
+			warning("Invalid threshold for %s: %s\n", spec, sep + 1);
+			return -EINVAL;
+		}
+
+		ns = us * 1000;
+		if (bpf_map_update_elem(fd, &nr, &ns, BPF_ANY))
+			return -errno;
+	}
+
+	return 0;
+}
+
+static void print_kernel_stack(int stack_id)
+{
+	const struct ksym *ksym;
+	int i;
+
+	if (stack_id < 0)
+		return;
+	if (bpf_map_lookup_elem(stackmap_fd, &stack_id, stack_ips)) {
+		printf("    [Missed Kernel Stack]\n");
+		return;
+	}
+
+	for (i = 0; i < env.perf_max_stack_depth && stack_ips[i]; i++) {
+		ksym = ksyms__map_addr(ksyms, stack_ips[i]);
+		if (!env.verbose)
+			printf("    %s\n", ksym ? ksym->name : "[unknown]");
+		else if (ksym)
+			printf("    0x%lx %s+0x%lx\n", stack_ips[i], ksym->name,
+			       stack_ips[i] - ksym->addr);
+		else
+			printf("    0x%lx [unknown]\n", stack_ips[i]);
+	}
+}
+
+static void print_user_stack(int stack_id, pid_t pid)
+{
+	const struct syms *syms;
+	const struct sym *sym;
+	int i;
+
+	if (stack_id < 0)
+		return;
+	if (bpf_map_lookup_elem(stackmap_fd, &stack_id, stack_ips)) {
+		printf("    [Missed User Stack]\n");
+		return;
+	}
+
+	syms = syms_cache__get_syms(syms_cache, pid);
+	for (i = 0; i < env.perf_max_stack_depth && stack_ips[i]; i++) {
+		sym = syms ? syms__map_addr(syms, stack_ips[i]) : NULL;
+		if (!env.verbose)
+			printf("    %s\n", sym ? sym->name : "[unknown]");
+		else if (sym)
+			printf("    0x%016lx %s+0x%lx\n", stack_ips[i], sym->name,
+			       sym->offset);
+		else
+			printf("    0x%016lx [unknown]\n", stack_ips[i]);
+	}
+}
+
+static int handle_outlier(void *ctx, void *data, size_t data_sz)
+{
+	const struct outlier_event *e = data;
+	double div = env.milliseconds ? 1000000.0 : 1000.0;
+	char name[2 * TASK_COMM_LEN];
+	char ts[32];
+	int i;
+
+	strftime_now(ts, sizeof(ts), "%H:%M:%S");
+	syscall_name(e->syscall_id, name, sizeof(name));
+
+	printf("%-8s %-7u %-7u %-16s %-16s %12.3lf %8lld %llu\n",
+	       ts, e->pid, e->tid, e->comm, name, e->lat_ns / div,
+	       e->ret, e->cgroup_id);
+
+	if (env.nr_args) {
+		printf("    args:");
+		for (i = 0; i < env.nr_args; i++)
+			printf(" 0x%llx", e->args[i]);
+		printf("\n");
+	}
+	print_kernel_stack(e->kernel_stack_id);
+	print_user_stack(e->user_stack_id, e->pid);
+	printf("\n");
+
+	return 0;
+}
+
+static void handle_lost_events(void *ctx, int cpu, __u64 lost_cnt)
+{
+	warning("Lost %llu events on CPU #%d\n", lost_cnt, cpu);
+}
+
 static volatile sig_atomic_t exiting;
 
 static void sig_handler(int sig)
@@ -352,6 +535,7 @@ int main(int argc, char *argv[])
 		.doc = argp_program_doc,
 	};
 	struct data_ext_t vals[MAX_ENTRIES];
+	struct bpf_buffer *buf = NULL;
 	struct syscount_bpf *obj;
 	int seconds = 0;
 	__u32 count;
@@ -399,6 +583,24 @@ int main(int argc, char *argv[])
 		obj->rodata->filter_errno = env.filter_errno;
 	if (env.cg)
 		obj->rodata->filter_cg = env.cg;
+	if (env.outliers) {
+		obj->rodata->measure_latency = true;
+		obj->rodata->capture_outliers = true;
+		obj->rodata->nr_args = env.nr_args;
+	}
+
+	/* the stack map is only populated in outlier mode */
+	bpf_map__set_value_size(obj->maps.stackmap,
+				env.perf_max_stack_depth * sizeof(unsigned long));
+	bpf_map__set_max_entries(obj->maps.stackmap,
+				 env.outliers ? env.stack_storage_size : 1);
+
+	buf = bpf_buffer__new(obj->maps.events, obj->maps.heap);
+	if (!buf) {
+		err = -errno;
+		warning("Failed to create ring/perf buffer: %d\n", err);
+		goto cleanup_obj;
+	}
 
 	err = syscount_bpf__load(obj);
 	if (err) {
@@ -421,13 +623,22 @@ int main(int argc, char *argv[])
 		}
 	}
 
+	if (env.outliers) {
+		err = setup_thresholds(bpf_map__fd(obj->maps.thresholds));
+		if (err) {
+			warning("Failed to set up outlier thresholds: %s\n",
+				strerror(-err));
+			goto cleanup_obj;
+		}
+	}
+
 	obj->links.sys_exit = bpf_program__attach(obj->progs.sys_exit);
 	if (!obj->links.sys_exit) {
 		err = -errno;
 		warning("Failed to attach sys_exit program: %s\n", strerror(-err));
 		goto cleanup_obj;
 	}
-	if (env.latency) {
+	if (env.latency || env.outliers) {
 		obj->links.sys_enter = bpf_program__attach(obj->progs.sys_enter);
 		if (!obj->links.sys_enter) {
 			err = -errno;
@@ -442,6 +653,43 @@ int main(int argc, char *argv[])
 		goto cleanup_obj;
 	}
 
+	if (env.outliers) {
+		stack_ips = calloc(env.perf_max_stack_depth, sizeof(*stack_ips));
+		ksyms = ksyms__load();
+		syms_cache = syms_cache__new(0);
+		if (!stack_ips || !ksyms || !syms_cache) {
+			err = 1;
+			warning("Failed to load symbols for stack traces\n");
+			goto cleanup_obj;
+		}
+		stackmap_fd = bpf_map__fd(obj->maps.stackmap);
+
+		err = bpf_buffer__open(buf, handle_outlier, handle_lost_events, NULL);
+		if (err) {
+			warning("Failed to open ring/perf buffer: %d\n", err);
+			goto cleanup_obj;
+		}
+
+		printf("Tracing syscall outliers... Ctrl-C to quit.\n");
+		printf("%-8s %-7s %-7s %-16s %-16s %12s %8s %s\n",
+		       "TIME", "PID", "TID", "COMM", "SYSCALL", time_colname(),
+		       "RET", "CGROUP");
+
+		time_since_start();
+		while (!exiting) {
+			err = bpf_buffer__poll(buf, POLL_TIMEOUT_MS);
+			if (err < 0 && err != -EINTR) {
+				warning("Error polling ring/perf buffer: %d\n", err);
+				goto cleanup_obj;
+			}
+			/* reset err to return 0 if exiting */
+			err = 0;
+			if (env.duration && time_since_start() >= env.duration)
+				break;
+		}
+		goto cleanup_obj;
+	}
+
 	compare = env.latency ? compare_latency : compare_count;
 	print = env.latency ? print_latency : print_count;
 
@@ -467,7 +715,11 @@ int main(int argc, char *argv[])
 	}
 
 cleanup_obj:
+	bpf_buffer__free(buf);
 	syscount_bpf__destroy(obj);
+	syms_cache__free(syms_cache);
+	ksyms__free(ksyms);
+	free(stack_ips);
 free_names:
 	free_syscall_names();
 	cleanup_core_btf(&open_opts);
@@ -4,6 +4,8 @@
 
 #define MAX_ENTRIES	8192
 #define TASK_COMM_LEN	16
+#define MAX_SYSCALLS	1024
+#define MAX_ARGS	6
 
 struct data_t {
 	__u64 count;
@@ -11,4 +13,17 @@ struct data_t {
 	char comm[TASK_COMM_LEN];
 };
 
+struct outlier_event {
+	__u64 cgroup_id;
+	__u64 lat_ns;
+	__u64 args[MAX_ARGS];
+	__s64 ret;
+	__u32 pid;
+	__u32 tid;
+	__u32 syscall_id;
+	int kernel_stack_id;
+	int user_stack_id;
+	char comm[TASK_COMM_LEN];
+};
+
 #endif
@@ -0,0 +1,139 @@
+// SPDX-License-Identifier: GPL-2.0
+#include "vmlinux.h"
+#include <bpf/bpf_helpers.h>
+#include <bpf/bpf_core_read.h>
+#include <bpf/bpf_tracing.h>
+#include "taskpmu.h"
+#include "maps.bpf.h"
+#include "core_fixes.bpf.h"
+
+const volatile bool target_per_cgroup = false;
+const volatile pid_t target_tgid = 0;
+
+/* one counter per CPU in each array, opened by user space */
+struct {
+	__uint(type, BPF_MAP_TYPE_PERF_EVENT_ARRAY);
+	__uint(key_size, sizeof(u32));
+	__uint(value_size, sizeof(u32));
+} counter0 SEC(".maps");
+
+struct {
+	__uint(type, BPF_MAP_TYPE_PERF_EVENT_ARRAY);
+	__uint(key_size, sizeof(u32));
+	__uint(value_size, sizeof(u32));
+} counter1 SEC(".maps");
+
+struct {
+	__uint(type, BPF_MAP_TYPE_PERF_EVENT_ARRAY);
+	__uint(key_size, sizeof(u32));
+	__uint(value_size, sizeof(u32));
+} counter2 SEC(".maps");
+
+/* readings of this CPU's counters at the previous context switch */
+struct snapshot {
+	struct bpf_perf_event_value values[NR_COUNTERS];
+	u64 ts;
+};
+
+struct {
+	__uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+	__uint(max_entries, 1);
+	__type(key, u32);
+	__type(value, struct snapshot);
+} last SEC(".maps");
+
+struct {
+	__uint(type, BPF_MAP_TYPE_PERCPU_HASH);
+	__uint(max_entries, MAX_ENTRIES);
+	__type(key, struct pmu_key);
+	__type(value, struct pmu_value);
+} stats SEC(".maps");
+
+static const struct pmu_value zero_value;
+
+/*
+ * Delta of a counter since the last switch, scaled up by enabled/running
+ * time when the PMU had to multiplex it.
+ */
+static __always_inline u64 counter_delta(struct bpf_perf_event_value *now,
+					 struct bpf_perf_event_value *prev)
+{
+	u64 counter = now->counter - prev->counter;
+	u64 enabled = now->enabled - prev->enabled;
+	u64 running = now->running - prev->running;
+
+	if (running && running < enabled)
+		counter = counter * enabled / running;
+	return counter;
+}
+
+static __always_inline int read_counter(void *map, struct bpf_perf_event_value *v)
+{
+	return bpf_perf_event_read_value(map, BPF_F_CURRENT_CPU, v, sizeof(*v));
+}
+
+static __always_inline int handle_switch(struct task_struct *prev)
+{
+	struct bpf_perf_event_value now[NR_COUNTERS];
+	struct pmu_key key = {};
+	struct pmu_value *val;
+	struct snapshot *snap;
+	u32 zero = 0;
+	pid_t tgid;
+	u64 ts;
+	int i;
+
+	snap = bpf_map_lookup_elem(&last, &zero);
+	if (!snap)
+		return 0;
+
+	if (read_counter(&counter0, &now[0]) ||
+	    read_counter(&counter1, &now[1]) ||
+	    read_counter(&counter2, &now[2]))
+		return 0;
+	ts = bpf_ktime_get_ns();
+
+	/* the first switch on this CPU only takes the baseline */
+	tgid = BPF_CORE_READ(prev, tgid);
+	if (!snap->ts || !BPF_CORE_READ(prev, pid))
+		goto update;
+	if (target_tgid && target_tgid != tgid)
+		goto update;
+
+	if (target_per_cgroup)
+		key.cgroup_id = get_task_cgroup_id(prev);
+	else
+		key.tgid = tgid;
+
+	val = bpf_map_lookup_or_try_init(&stats, &key, &zero_value);
+	if (!val)
+		goto update;
+
+	for (i = 0; i < NR_COUNTERS; i++)
+		val->counts[i] += counter_delta(&now[i], &snap->values[i]);
+	val->runtime_ns += ts - snap->ts;
+	if (!target_per_cgroup)
+		BPF_CORE_READ_STR_INTO(&val->comm, prev, group_leader, comm);
+
+update:
+	for (i = 0; i < NR_COUNTERS; i++)
+		snap->values[i] = now[i];
+	snap->ts = ts;
+	return 0;
+}
+
+SEC("tp_btf/sched_switch")
+int BPF_PROG(sched_switch_btf, bool preempt, struct task_struct *prev,
+	     struct task_struct *next)
+{
+	return handle_switch(prev);
+}
+
+SEC("raw_tp/sched_switch")
+int BPF_PROG(sched_switch_raw, bool preempt, struct task_struct *prev,
+	     struct task_struct *next)
+{
+	return handle_switch(prev);
+}
+
+char LICENSE[] SEC("license") = "GPL";
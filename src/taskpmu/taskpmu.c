@@ -0,0 +1,405 @@
+// SPDX-License-Identifier: (LGPL-2.1 OR BSD-2-Clause)
+#include "commons.h"
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include "taskpmu.h"
+#include "taskpmu.skel.h"
+#include "btf_helpers.h"
+#include "trace_helpers.h"
+#include "cgroup_helpers.h"
+
+struct env {
+	pid_t pid;
+	bool per_cgroup;
+	bool software;
+	bool timestamp;
+	bool verbose;
+	int rows;
+	time_t interval;
+	int times;
+} env = {
+	.rows = 20,
+	.interval = 1,
+	.times = 99999999,
+};
+
+static volatile sig_atomic_t exiting;
+static struct cgroup_cache *cgroup_cache;
+
+const char *argp_program_version = "taskpmu 0.1";
+const char *argp_program_bug_address = "Jackie Liu <liuyun01@kylinos.cn>";
+const char argp_program_doc[] =
+"Count cycles, instructions and LLC misses per process or cgroup.\n"
+"\n"
+"USAGE: taskpmu [--help] [-p PID] [-C] [-S] [-T] [-r ROWS] [interval] [count]\n"
+"\n"
+"Counters are read at every context switch, so each process is charged\n"
+"exactly what ran on its behalf, not a sample of it.\n"
+"\n"
+"EXAMPLES:\n"
+"    taskpmu            # IPC, MPKI and cycles per process, every second\n"
+"    taskpmu -C 5       # per cgroup, every 5 seconds\n"
+"    taskpmu -p 185     # process 185 only\n"
+"    taskpmu -S         # software counters, e.g. in a VM without a PMU\n";
+
+static const struct argp_option opts[] = {
+	{ "pid", 'p', "PID", 0, "Count this process only" },
+	{ "cgroups", 'C', NULL, 0, "Aggregate per cgroup instead of per process" },
+	{ "software", 'S', NULL, 0, "Use software counters (cpu-clock, faults, switches)" },
+	{ "rows", 'r', "ROWS", 0, "Maximum rows to print, default 20" },
+	{ "timestamp", 'T', NULL, 0, "Include timestamp on output" },
+	{ "verbose", 'v', NULL, 0, "Verbose debug output" },
+	{ NULL, 'h', NULL, OPTION_HIDDEN, "Show the full help" },
+	{},
+};
+
+static error_t parse_arg(int key, char *arg, struct argp_state *state)
+{
+	switch (key) {
+	case 'h':
+		argp_state_help(state, stderr, ARGP_HELP_STD_HELP);
+		break;
+	case 'v':
+		env.verbose = true;
+		break;
+	case 'p':
+		env.pid = argp_parse_pid(key, arg, state);
+		break;
+	case 'C':
+		env.per_cgroup = true;
+		break;
+	case 'S':
+		env.software = true;
+		break;
+	case 'T':
+		env.timestamp = true;
+		break;
+	case 'r':
+		env.rows = argp_parse_long(key, arg, state);
+		break;
+	case ARGP_KEY_ARG:
+		switch (state->arg_num) {
+		case 0:
+			env.interval = argp_parse_long(key, arg, state);
+			break;
+		case 1:
+			env.times = argp_parse_long(key, arg, state);
+			break;
+		default:
+			warning("Unrecognized positional argument: %s\n", arg);
+			argp_usage(state);
+		}
+		break;
+	default:
+		return ARGP_ERR_UNKNOWN;
+	}
+
+	return 0;
+}
+
+struct counter_def {
+	__u32 type;
+	__u64 config;
+	const char *name;
+};
+
+static const struct counter_def hw_counters[NR_COUNTERS] = {
+	{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, "CYCLES" },
+	{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, "INSTRUCTIONS" },
+	{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES, "LLC-MISSES" },
+};
+
+static const struct counter_def sw_counters[NR_COUNTERS] = {
+	{ PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CPU_CLOCK, "CPU-CLOCK(ns)" },
+	{ PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS, "FAULTS" },
+	{ PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES, "SWITCHES" },
+};
+
+static const struct counter_def *counters = hw_counters;
+static int nr_cpus;
+static int *fds;
+
+static int open_counter(const struct counter_def *def, int cpu)
+{
+	struct perf_event_attr attr = {
+		.type = def->type,
+		.size = sizeof(attr),
+		.config = def->config,
+	};
+
+	return syscall(__NR_perf_event_open, &attr, -1, cpu, -1, 0);
+}
+
+/* Hardware counters are missing on most VMs and some architectures. */
+static bool hw_counters_available(void)
+{
+	int fd = open_counter(&hw_counters[0], 0);
+
+	if (fd < 0)
+		return false;
+	close(fd);
+	return true;
+}
+
+static int open_counters(struct taskpmu_bpf *obj)
+{
+	struct bpf_map *maps[NR_COUNTERS] = {
+		obj->maps.counter0, obj->maps.counter1, obj->maps.counter2,
+	};
+	int i, cpu, fd;
+
+	for (i = 0; i < NR_COUNTERS; i++) {
+		for (cpu = 0; cpu < nr_cpus; cpu++) {
+			fd = open_counter(&counters[i], cpu);
+			if (fd < 0) {
+				/* Ignore CPU that is offline */
+				if (errno == ENODEV)
+					continue;
+				warning("Failed to open %s counter on CPU %d: %s\n",
+					counters[i].name, cpu, strerror(errno));
+				return -1;
+			}
+			fds[i * nr_cpus + cpu] = fd;
+
+			if (bpf_map_update_elem(bpf_map__fd(maps[i]), &cpu, &fd,
+						BPF_ANY)) {
+				warning("Failed to set up %s counter on CPU %d: %s\n",
+					counters[i].name, cpu, strerror(errno));
+				return -1;
+			}
+		}
+	}
+
+	return 0;
+}
+
+static int libbpf_print_fn(enum libbpf_print_level level, const char *format,
+			   va_list args)
+{
+	if (level == LIBBPF_DEBUG && !env.verbose)
+		return 0;
+	return vfprintf(stderr, format, args);
+}
+
+static void sig_handler(int sig)
+{
+	exiting = 1;
+}
+
+struct row {
+	struct pmu_key key;
+	struct pmu_value val;
+};
+
+static int sort_column(const void *obj1, const void *obj2)
+{
+	const struct row *r1 = obj1, *r2 = obj2;
+
+	if (r1->val.counts[COUNTER_0] == r2->val.counts[COUNTER_0])
+		return 0;
+	return r1->val.counts[COUNTER_0] < r2->val.counts[COUNTER_0] ? 1 : -1;
+}
+
+static void print_header(void)
+{
+	if (env.per_cgroup)
+		printf("%-32s", "CGROUP");
+	else
+		printf("%-8s %-16s", "PID", "COMM");
+	printf(" %14s %14s %14s", counters[0].name, counters[1].name,
+	       counters[2].name);
+	if (counters == hw_counters)
+		printf(" %6s %8s", "IPC", "MPKI");
+	printf(" %10s\n", "RUN(ms)");
+}
+
+static void print_row(const struct row *r)
+{
+	const __u64 *c = r->val.counts;
+	const char *path;
+
+	if (env.per_cgroup) {
+		path = cgroup_cache ?
+		       cgroup_cache__get_path(cgroup_cache, r->key.cgroup_id) : NULL;
+		if (path)
+			printf("%-32s", path);
+		else
+			printf("%-32llu", r->key.cgroup_id);
+	} else {
+		printf("%-8u %-16s", r->key.tgid, r->val.comm);
+	}
+
+	printf(" %14llu %14llu %14llu", c[0], c[1], c[2]);
+	if (counters == hw_counters)
+		printf(" %6.2f %8.2f", c[0] ? (double)c[1] / c[0] : 0.0,
+		       c[1] ? 1000.0 * c[2] / c[1] : 0.0);
+	printf(" %10.2f\n", r->val.runtime_ns / 1000000.0);
+}
+
+static int print_stats(int fd)
+{
+	static struct row rows[MAX_ENTRIES];
+	struct pmu_value values[nr_cpus];
+	struct pmu_key *prev = NULL, key;
+	int i, cpu, j, n = 0;
+
+	while (n < MAX_ENTRIES && !bpf_map_get_next_key(fd, prev, &key)) {
+		rows[n].key = key;
+		prev = &rows[n].key;
+		n++;
+	}
+
+	for (i = 0, j = 0; i < n; i++) {
+		key = rows[i].key;
+		if (bpf_map_lookup_elem(fd, &key, values))
+			continue;
+		bpf_map_delete_elem(fd, &key);
+
+		/* the comm is only set on the CPUs that saw the process */
+		memset(&rows[j].val, 0, sizeof(rows[j].val));
+		rows[j].key = key;
+		for (cpu = 0; cpu < nr_cpus; cpu++) {
+			for (int k = 0; k < NR_COUNTERS; k++)
+				rows[j].val.counts[k] += values[cpu].counts[k];
+			rows[j].val.runtime_ns += values[cpu].runtime_ns;
+			if (values[cpu].comm[0])
+				memcpy(rows[j].val.comm, values[cpu].comm,
+				       sizeof(rows[j].val.comm));
+		}
+		j++;
+	}
+
+	qsort(rows, j, sizeof(*rows), sort_column);
+
+	print_header();
+	for (i = 0; i < j && i < env.rows; i++)
+		print_row(&rows[i]);
+	printf("\n");
+
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	LIBBPF_OPTS(bpf_object_open_opts, open_opts);
+	static const struct argp argp = {
+		.options = opts,
+		.parser = parse_arg,
+		.doc = argp_program_doc,
+	};
+	struct taskpmu_bpf *obj = NULL;
+	int i, err;
+
+	err = argp_parse(&argp, argc, argv, 0, NULL, NULL);
+	if (err)
+		return err;
+
+	if (!bpf_is_root())
+		return 1;
+
+	libbpf_set_print(libbpf_print_fn);
+
+	nr_cpus = libbpf_num_possible_cpus();
+	if (nr_cpus < 0) {
+		warning("Failed to get # of possible cpus: '%s'!\n",
+			strerror(-nr_cpus));
+		return 1;
+	}
+
+	fds = malloc(NR_COUNTERS * nr_cpus * sizeof(*fds));
+	if (!fds) {
+		warning("Failed to alloc perf event fds\n");
+		return 1;
+	}
+	for (i = 0; i < NR_COUNTERS * nr_cpus; i++)
+		fds[i] = -1;
+
+	if (!env.software && !hw_counters_available()) {
+		warning("Hardware counters not available, using software counters\n");
+		env.software = true;
+	}
+	if (env.software)
+		counters = sw_counters;
+
+	err = ensure_core_btf(&open_opts);
+	if (err) {
+		warning("Failed to fetch necessary BTF for CO-RE: %s\n",
+			strerror(-err));
+		err = 1;
+		goto cleanup;
+	}
+
+	obj = taskpmu_bpf__open_opts(&open_opts);
+	if (!obj) {
+		warning("Failed to open BPF objects\n");
+		err = 1;
+		goto cleanup;
+	}
+
+	obj->rodata->target_per_cgroup = env.per_cgroup;
+	obj->rodata->target_tgid = env.pid;
+
+	bpf_map__set_max_entries(obj->maps.counter0, nr_cpus);
+	bpf_map__set_max_entries(obj->maps.counter1, nr_cpus);
+	bpf_map__set_max_entries(obj->maps.counter2, nr_cpus);
+
+	if (probe_tp_btf("sched_switch"))
+		bpf_program__set_autoload(obj->progs.sched_switch_raw, false);
+	else
+		bpf_program__set_autoload(obj->progs.sched_switch_btf, false);
+
+	err = taskpmu_bpf__load(obj);
+	if (err) {
+		warning("Failed to load BPF object: %d\n", err);
+		goto cleanup;
+	}
+
+	err = open_counters(obj);
+	if (err)
+		goto cleanup;
+
+	if (env.per_cgroup) {
+		cgroup_cache = cgroup_cache__new(NULL);
+		if (!cgroup_cache)
+			warning("Failed to find cgroup2 mount, printing cgroup ids\n");
+	}
+
+	err = taskpmu_bpf__attach(obj);
+	if (err) {
+		warning("Failed to attach BPF programs: %d\n", err);
+		goto cleanup;
+	}
+
+	printf("Counting %s per %s... Hit Ctrl-C to end.\n",
+	       env.software ? "software events" : "CPU cycles",
+	       env.per_cgroup ? "cgroup" : "process");
+
+	signal(SIGINT, sig_handler);
+
+	while (!exiting && env.times--) {
+		sleep(env.interval);
+		printf("\n");
+
+		if (env.timestamp) {
+			char ts[32];
+
+			strftime_now(ts, sizeof(ts), "%H:%M:%S");
+			printf("%-8s\n", ts);
+		}
+
+		err = print_stats(bpf_map__fd(obj->maps.stats));
+		if (err)
+			break;
+	}
+
+cleanup:
+	taskpmu_bpf__destroy(obj);
+	for (i = 0; i < NR_COUNTERS * nr_cpus; i++)
+		if (fds[i] >= 0)
+			close(fds[i]);
+	free(fds);
+	cgroup_cache__free(cgroup_cache);
+	cleanup_core_btf(&open_opts);
+
+	return err != 0;
+}
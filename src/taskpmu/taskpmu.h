@@ -0,0 +1,31 @@
+// SPDX-License-Identifier: (LGPL-2.1 OR BSD-2-Clause)
+#ifndef __TASKPMU_H
+#define __TASKPMU_H
+
+#define TASK_COMM_LEN	16
+#define MAX_ENTRIES	10240
+
+/*
+ * Counter slots. With hardware counters they are cycles, instructions and
+ * LLC misses; in software mode cpu-clock, page faults and context switches.
+ */
+enum counter_idx {
+	COUNTER_0,
+	COUNTER_1,
+	COUNTER_2,
+	NR_COUNTERS,
+};
+
+struct pmu_key {
+	__u64 cgroup_id;	/* 0 unless aggregating per cgroup */
+	__u32 tgid;		/* 0 when aggregating per cgroup */
+	__u32 pad;
+};
+
+struct pmu_value {
+	__u64 counts[NR_COUNTERS];
+	__u64 runtime_ns;
+	char comm[TASK_COMM_LEN];
+};
+
+#endif
@@ -3,6 +3,7 @@
 #include "tcptop.h"
 #include "tcptop.skel.h"
 #include "trace_helpers.h"
+#include "top_helpers.h"
 
 #include <arpa/inet.h>
 #include <sys/param.h>
@@ -24,6 +25,8 @@ static struct env {
         char *cgroup_path;
         bool cgroup_filtering;
         bool clear_screen;
+        bool cumulative;
+        bool json;
         bool no_summary;
         bool ipv4_only;
         bool ipv6_only;
@@ -45,13 +48,16 @@ const char *argp_program_bug_address = "Jackie Liu <liuyun01@kylinos.cn>";
 const char argp_program_doc[] =
 "Trace sending and received operation over IP.\n"
 "\n"
-"USAGE: tcptop [-h] [-p PID] [interval] [count]\n"
+"USAGE: tcptop [-h] [-p PID] [-C] [-j] [--cumulative] [interval] [count]\n"
 "\n"
 "EXAMPLES:\n"
 "    tcptop            # TCP top, refresh every 1s\n"
 "    tcptop -p 1216    # only trace PID 1216\n"
 "    tcptop -c path    # only trace the given cgroup path\n"
-"    tcptop 5 10       # 5s summaries, 10 times\n";
+"    tcptop 5 10       # 5s summaries, 10 times\n"
+"    tcptop -j 1 10    # 10 one second summaries as JSON lines\n";
+
+#define OPT_CUMULATIVE  1       /* --cumulative */
 
 static const struct argp_option opts[] = {
         { "pid", 'p', "PID", 0, "Process ID to trace" },
@@ -60,6 +66,8 @@ static const struct argp_option opts[] = {
         { "ipv6", '6', NULL, 0, "Trace IPv6 family only" },
         { "nosummary", 'S', NULL, 0, "Skip system summary line" },
         { "noclear", 'C', NULL, 0, "Don't clear the screen" },
+        { "json", 'j', NULL, 0, "Print each interval as a JSON object" },
+        { "cumulative", OPT_CUMULATIVE, NULL, 0, "Show totals since start instead of per interval" },
         { "sort", 's', "SORT", 0, "Sort columns, default all [all, sent, received]" },
         { "rows", 'r', "ROW", 0, "Maximum rows to print, default 20" },
         { "verbose", 'v', NULL, 0, "Verbose debug output" },
@@ -67,11 +75,6 @@ static const struct argp_option opts[] = {
         {}
 };
 
-struct info_t {
-        struct ip_key_t key;
-        struct traffic_t value;
-};
-
 static error_t parse_arg(int key, char *arg, struct argp_state *state)
 {
         switch (key) {
@@ -85,6 +88,12 @@ static error_t parse_arg(int key, char *arg, struct argp_state *state)
         case 'C':
                 env.clear_screen = false;
                 break;
+        case 'j':
+                env.json = true;
+                break;
+        case OPT_CUMULATIVE:
+                env.cumulative = true;
+                break;
         case 'S':
                 env.no_summary = true;
                 break;
@@ -150,72 +159,52 @@ static void sig_handler(int sig)
         exiting = 1;
 }
 
-static int sort_column(const void *obj1, const void *obj2)
+static int sort_column(const void *k1, const void *v1,
+                       const void *k2, const void *v2)
 {
-        struct info_t *i1 = (struct info_t *)obj1;
-        struct info_t *i2 = (struct info_t *)obj2;
+        const struct ip_key_t *key1 = k1, *key2 = k2;
+        const struct traffic_t *t1 = v1, *t2 = v2;
 
-        if (i1->key.family != i2->key.family) {
+        if (key1->family != key2->family) {
                 /*
-                 * i1 - i2 because we want to sort by increasing order (first
-                 * AF_INET then AF_INET6).
+                 * key1 - key2 because we want to sort by increasing order
+                 * (first AF_INET then AF_INET6).
                  */
-                return i1->key.family - i2->key.family;
+                return key1->family - key2->family;
         }
 
         if (env.sort_by == SENT)
-                return i2->value.sent - i1->value.sent;
+                return top_cmp_u64(t1->sent, t2->sent);
         else if (env.sort_by == RECEIVED)
-                return i2->value.received - i1->value.received;
+                return top_cmp_u64(t1->received, t2->received);
         else
-                return (i2->value.sent + i2->value.received) - (i1->value.sent + i1->value.received);
+                return top_cmp_u64(t1->sent + t1->received, t2->sent + t2->received);
 }
 
-static int print_stat(struct tcptop_bpf *obj)
+static int print_stat(struct top *top, struct tcptop_bpf *obj)
 {
-        struct ip_key_t key, *prev_key = NULL;
-        static struct info_t infos[OUTPUT_ROWS_LIMIT];
-        int fd = bpf_map__fd(obj->maps.ip_map);
         bool ipv6_header_printed = false;
-        int rows = 0;
-        int err = 0;
-
-        if (!env.no_summary) {
-                FILE *f = fopen("/proc/loadavg", "r");
+        int rows;
 
-                if (f) {
-                        char ts[16], buf[256];
-
-                        strftime_now(ts, sizeof(ts), "%H:%M:%S");
-                        if (fread(buf, 1, sizeof(buf), f))
-                                printf("%8s loadavg: %s\n", ts, buf);
-                        fclose(f);
-                }
-        }
-
-        while (!bpf_map_get_next_key(fd, prev_key, &infos[rows].key)) {
-                err = bpf_map_lookup_elem(fd, &infos[rows].key, &infos[rows].value);
-                if (err) {
-                        warning("bpf_map_lookup_elem failed: %s\n", strerror(errno));
-                        return err;
-                }
-                prev_key = &infos[rows].key;
-                rows++;
+        rows = top__collect(top, bpf_map__fd(obj->maps.ip_map));
+        if (rows < 0) {
+                warning("Failed to read ip_map: %s\n", strerror(-rows));
+                return rows;
         }
 
-        printf("%-6s %-12s %-21s %-21s %6s %6s", "PID", "COMM", "LADDR", "RADDR",
-               "RX_KB", "TX_KB\n");
+        top__begin(top, !env.no_summary);
 
-        qsort(infos, rows, sizeof(struct info_t), sort_column);
-        rows = MIN(rows, env.output_rows);
+        if (!top__json(top))
+                printf("%-6s %-12s %-21s %-21s %6s %6s", "PID", "COMM", "LADDR", "RADDR",
+                       "RX_KB", "TX_KB\n");
 
         for (int i = 0; i < rows; i++) {
                 /* Default width to fit IPv4 plus port. */
                 int column_width = 21;
-                struct ip_key_t *key = &infos[i].key;
-                struct traffic_t *value = &infos[i].value;
+                const struct ip_key_t *key = top__key(top, i);
+                const struct traffic_t *value = top__value(top, i);
 
-                if (key->family == AF_INET6) {
+                if (key->family == AF_INET6 && !top__json(top)) {
                         /* Width to fit IPv6 plus port. */
                         column_width = 51;
                         if (!ipv6_header_printed) {
@@ -243,25 +232,28 @@ static int print_stat(struct tcptop_bpf *obj)
                 snprintf(saddr_port, size, "%s:%d", saddr, key->lport);
                 snprintf(daddr_port, size, "%s:%d", daddr, key->dport);
 
+                if (top__json(top)) {
+                        char comm[TASK_COMM_LEN + 1] = {};
+
+                        memcpy(comm, key->name, TASK_COMM_LEN);
+                        top__json_row(top);
+                        top__json_u64(top, "pid", key->pid);
+                        top__json_str(top, "comm", comm);
+                        top__json_str(top, "laddr", saddr_port);
+                        top__json_str(top, "raddr", daddr_port);
+                        top__json_u64(top, "rx_kb", value->received / 1024);
+                        top__json_u64(top, "tx_kb", value->sent / 1024);
+                        continue;
+                }
+
                 printf("%-6d %-12.12s %-*s %-*s %6ld %6ld\n",
                        key->pid, key->name, column_width, saddr_port,
                        column_width, daddr_port,
                        value->received / 1024, value->sent / 1024);
         }
 
-        printf("\n");
-
-        prev_key = NULL;
-        while (!bpf_map_get_next_key(fd, prev_key, &key)) {
-                err = bpf_map_delete_elem(fd, &key);
-                if (err) {
-                        warning("bpf_map_delete_elem failed: %s\n", strerror(errno));
-                        return err;
-                }
-                prev_key = &key;
-        }
-
-        return err;
+        top__end(top);
+        return 0;
 }
 
 int main(int argc, char *argv[])
@@ -271,7 +263,13 @@ int main(int argc, char *argv[])
                 .parser = parse_arg,
                 .doc = argp_program_doc,
         };
+        struct top_opts top_opts = {
+                .key_size = sizeof(struct ip_key_t),
+                .value_size = sizeof(struct traffic_t),
+                .cmp = sort_column,
+        };
         struct tcptop_bpf *obj;
+        struct top *top = NULL;
         int cgfd = -1;
         int err;
         int family = -1;
@@ -328,6 +326,18 @@ int main(int argc, char *argv[])
                 goto cleanup;
         }
 
+        top_opts.max_entries = bpf_map__max_entries(obj->maps.ip_map);
+        top_opts.rows = env.output_rows;
+        top_opts.cumulative = env.cumulative;
+        top_opts.clear_screen = env.clear_screen;
+        top_opts.json = env.json;
+        top = top__new(&top_opts);
+        if (!top) {
+                err = -errno;
+                warning("Failed to create top: %s\n", strerror(errno));
+                goto cleanup;
+        }
+
         if (signal(SIGINT, sig_handler) == SIG_ERR) {
                 warning("Can't set signal handler: %s\n", strerror(errno));
                 err = 1;
@@ -337,13 +347,7 @@ int main(int argc, char *argv[])
         while (1) {
                 sleep(env.interval);
 
-                if (env.clear_screen) {
-                        err = system("clear");
-                        if (err)
-                                goto cleanup;
-                }
-
-                err = print_stat(obj);
+                err = print_stat(top, obj);
                 if (err)
                         goto cleanup;
 
@@ -352,6 +356,7 @@ int main(int argc, char *argv[])
         }
 
 cleanup:
+        top__free(top);
         if (env.cgroup_filtering && cgfd != -1)
                 close(cgfd);
         tcptop_bpf__destroy(obj);
@@ -5,11 +5,22 @@
 #include <bpf/bpf_core_read.h>
 #include "vfsstat.h"
 
-__u64 stats[S_MAXSTAT] = {};
+/* per-CPU counters, so that vfs_read/vfs_write on all CPUs don't share a line */
+struct {
+	__uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+	__uint(max_entries, 1);
+	__type(key, u32);
+	__type(value, struct vfs_stats);
+} stats SEC(".maps");
 
 static __always_inline int inc_stats(int key)
 {
-	__atomic_add_fetch(&stats[key], 1, __ATOMIC_RELAXED);
+	struct vfs_stats *s;
+	u32 zero = 0;
+
+	s = bpf_map_lookup_elem(&stats, &zero);
+	if (s)
+		s->count[key]++;
 	return 0;
 }
 
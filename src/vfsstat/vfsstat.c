@@ -4,6 +4,7 @@
 #include "vfsstat.skel.h"
 #include "btf_helpers.h"
 #include "trace_helpers.h"
+#include "map_helpers.h"
 
 static volatile sig_atomic_t exiting;
 
@@ -85,17 +86,38 @@ static void print_header(void)
 	printf("\n");
 }
 
-static void print_and_reset_stats(__u64 stats[S_MAXSTAT])
+/*
+ * The per-CPU counters are never reset, which would race with the BPF
+ * side, the rate is the difference with the previous totals instead.
+ */
+static __u64 prev[S_MAXSTAT];
+
+static int read_stats(int fd, __u64 total[S_MAXSTAT])
+{
+	__u32 zero = 0;
+
+	if (lookup_percpu_sum_u64(fd, &zero, total, S_MAXSTAT)) {
+		warning("Failed to read stats: %s\n", strerror(errno));
+		return -1;
+	}
+	return 0;
+}
+
+static int print_stats(int fd)
 {
+	__u64 total[S_MAXSTAT];
 	char s[16];
-	__u64 val;
+
+	if (read_stats(fd, total))
+		return -1;
 
 	printf("%-8s ", strftime_now(s, sizeof(s), "%H:%M:%S"));
 	for (int i = 0; i < S_MAXSTAT; i++) {
-		val = __atomic_exchange_n(&stats[i], 0, __ATOMIC_RELAXED);
-		printf(" %8llu", val / env.interval);
+		printf(" %8llu", (total[i] - prev[i]) / env.interval);
+		prev[i] = total[i];
 	}
 	printf("\n");
+	return 0;
 }
 
 static void sig_handler(int sig)
@@ -157,11 +179,6 @@ int main(int argc, char *argv[])
 		goto cleanup;
 	}
 
-	if (!skel->bss) {
-		warning("Memory-mapping BPF maps is supported starting from Linux 5.7, please upgrade.\n");
-		goto cleanup;
-	}
-
 	err = vfsstat_bpf__attach(skel);
 	if (err) {
 		warning("Failed to attach BPF programs: %s\n", strerror(-err));
@@ -170,11 +187,17 @@ int main(int argc, char *argv[])
 
 	signal(SIGINT, sig_handler);
 
+	/* start counting from here, not from load time */
+	err = read_stats(bpf_map__fd(skel->maps.stats), prev);
+	if (err)
+		goto cleanup;
 	print_header();
 
 	while (!exiting) {
 		sleep(env.interval);
-		print_and_reset_stats(skel->bss->stats);
+		err = print_stats(bpf_map__fd(skel->maps.stats));
+		if (err)
+			break;
 
 		if (--env.count == 0)
 			break;
@@ -11,5 +11,9 @@ enum stat_types {
 	S_MAXSTAT,
 };
 
+struct vfs_stats {
+	__u64 count[S_MAXSTAT];
+};
+
 #endif
 
@@ -0,0 +1,207 @@
+// SPDX-License-Identifier: (LGPL-2.1 OR BSD-2-Clause)
+/*
+ * Per-event cost of the per-CPU counters of vfsstat, cpuwalk and runqlen.
+ * Not part of the tools, build it with:
+ *
+ *   cc -O2 -o vfsstat_bench vfsstat_bench.c -lbpf -lpthread
+ *
+ * One thread pinned to every online CPU loops on 1-byte read() of /dev/zero
+ * and write() to /dev/null for DURATION seconds, so all CPUs hit vfs_read
+ * and vfs_write at once, while BPF run time stats are enabled. The loaded
+ * programs whose names start with one of the given prefixes are then
+ * reported with their number of runs and average run time:
+ *
+ *   ./vfsstat & sleep 1; ./vfsstat_bench -d 10; kill %1
+ *   ./cpuwalk & sleep 1; ./vfsstat_bench -d 10 do_sample; kill %1
+ *   ./runqlen -F 999 & sleep 1; ./vfsstat_bench -d 10 do_sample; kill %1
+ *
+ * Run it once with the tools built before the per-CPU conversion and once
+ * after, on the same machine: with shared counters NS/RUN of the vfs
+ * programs includes the counter cache line bouncing between CPUs and grows
+ * with the number of CPUs, with per-CPU counters it stays flat. The sampling
+ * programs of cpuwalk and runqlen run at the sampling frequency, the busy
+ * threads only keep every CPU out of idle so that each of them takes samples.
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <bpf/bpf.h>
+#include <bpf/libbpf.h>
+
+#define MAX_PROGS	64
+
+struct prog_stat {
+	__u32 id;
+	char name[BPF_OBJ_NAME_LEN];
+	__u64 run_time_ns;
+	__u64 run_cnt;
+};
+
+static const char *default_prefixes[] = { "kprobe_vfs_", "fentry_vfs_", NULL };
+static volatile bool exiting;
+static __u64 *loops;
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"USAGE: %s [-d DURATION] [PREFIX...]\n"
+		"    -d DURATION  seconds of load, default 10\n"
+		"    PREFIX       BPF program name prefixes to report,\n"
+		"                 default kprobe_vfs_ fentry_vfs_\n", prog);
+	exit(1);
+}
+
+static bool match(const char *name, const char **prefixes)
+{
+	for (; *prefixes; prefixes++) {
+		if (!strncmp(name, *prefixes, strlen(*prefixes)))
+			return true;
+	}
+	return false;
+}
+
+static int snapshot(struct prog_stat *stats, const char **prefixes)
+{
+	struct bpf_prog_info info;
+	__u32 id = 0, len;
+	int fd, n = 0;
+
+	while (n < MAX_PROGS && !bpf_prog_get_next_id(id, &id)) {
+		fd = bpf_prog_get_fd_by_id(id);
+		if (fd < 0)
+			continue;
+		memset(&info, 0, sizeof(info));
+		len = sizeof(info);
+		if (!bpf_obj_get_info_by_fd(fd, &info, &len) &&
+		    match(info.name, prefixes)) {
+			stats[n].id = id;
+			memcpy(stats[n].name, info.name, sizeof(stats[n].name));
+			stats[n].run_time_ns = info.run_time_ns;
+			stats[n].run_cnt = info.run_cnt;
+			n++;
+		}
+		close(fd);
+	}
+	return n;
+}
+
+static void *load_thread(void *arg)
+{
+	long cpu = (long)arg;
+	__u64 n = 0;
+	int zero, null;
+	cpu_set_t set;
+	char c;
+
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+
+	zero = open("/dev/zero", O_RDONLY);
+	null = open("/dev/null", O_WRONLY);
+	if (zero < 0 || null < 0) {
+		perror("open");
+		exit(1);
+	}
+
+	while (!exiting) {
+		if (read(zero, &c, 1) != 1 || write(null, &c, 1) != 1)
+			break;
+		n++;
+	}
+	/* written once, not to bounce a line of our own while measuring */
+	loops[cpu] = n;
+
+	close(zero);
+	close(null);
+	return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+	static struct prog_stat before[MAX_PROGS], after[MAX_PROGS];
+	const char **prefixes = default_prefixes;
+	int i, j, opt, stats_fd, nr_before, nr_after;
+	long cpu, nr_cpus, duration = 10;
+	pthread_t *threads;
+	__u64 total = 0, cnt;
+
+	while ((opt = getopt(argc, argv, "d:")) != -1) {
+		switch (opt) {
+		case 'd':
+			duration = strtol(optarg, NULL, 10);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (duration <= 0)
+		usage(argv[0]);
+	if (optind < argc)
+		prefixes = (const char **)&argv[optind];
+
+	/* stays enabled as long as the fd is open */
+	stats_fd = bpf_enable_stats(BPF_STATS_RUN_TIME);
+	if (stats_fd < 0) {
+		fprintf(stderr, "Failed to enable BPF stats: %s\n",
+			strerror(errno));
+		return 1;
+	}
+
+	nr_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	threads = calloc(nr_cpus, sizeof(*threads));
+	loops = calloc(nr_cpus, sizeof(*loops));
+	if (!threads || !loops) {
+		fprintf(stderr, "Out of memory\n");
+		return 1;
+	}
+
+	nr_before = snapshot(before, prefixes);
+	if (!nr_before) {
+		fprintf(stderr, "No loaded BPF program matches, is the tool running?\n");
+		return 1;
+	}
+
+	for (cpu = 0; cpu < nr_cpus; cpu++) {
+		if (pthread_create(&threads[cpu], NULL, load_thread, (void *)cpu)) {
+			fprintf(stderr, "Failed to create thread\n");
+			return 1;
+		}
+	}
+	sleep(duration);
+	exiting = true;
+	for (cpu = 0; cpu < nr_cpus; cpu++) {
+		pthread_join(threads[cpu], NULL);
+		total += loops[cpu];
+	}
+
+	nr_after = snapshot(after, prefixes);
+	close(stats_fd);
+
+	printf("%ld CPUs, %llu read+write loops in %lds\n\n", nr_cpus,
+	       (unsigned long long)total, duration);
+	printf("%-8s %-16s %14s %10s\n", "ID", "PROG", "RUNS", "NS/RUN");
+	for (i = 0; i < nr_after; i++) {
+		for (j = 0; j < nr_before; j++) {
+			if (before[j].id == after[i].id)
+				break;
+		}
+		if (j == nr_before)
+			continue;
+		cnt = after[i].run_cnt - before[j].run_cnt;
+		printf("%-8u %-16s %14llu %10.1f\n", after[i].id, after[i].name,
+		       (unsigned long long)cnt, cnt ?
+		       (double)(after[i].run_time_ns - before[j].run_time_ns) / cnt : 0.0);
+	}
+
+	free(threads);
+	free(loops);
+	return 0;
+}
@@ -5,6 +5,7 @@
 #include <bpf/bpf_tracing.h>
 #include "wakeuptime.h"
 #include "maps.bpf.h"
+#include "bits.bpf.h"
 
 #define PF_KTHREAD	0x00200000 /* kernel thread */
 
@@ -12,6 +13,7 @@ const volatile pid_t target_pid = 0;
 const volatile __u64 max_block_ns = -1;
 const volatile __u64 min_block_ns = 1;
 const volatile bool user_threads_only = false;
+const volatile bool graph_mode = false;
 
 struct {
 	__uint(type, BPF_MAP_TYPE_HASH);
@@ -27,6 +29,13 @@ struct {
 	__type(value, u64);
 } start SEC(".maps");
 
+struct {
+	__uint(type, BPF_MAP_TYPE_HASH);
+	__uint(max_entries, MAX_ENTRIES);
+	__type(key, struct edge_key);
+	__type(value, struct edge_val);
+} edges SEC(".maps");
+
 struct {
 	__uint(type, BPF_MAP_TYPE_STACK_TRACE);
 	__uint(key_size, sizeof(u32));
@@ -51,6 +60,33 @@ static int offcpu_sched_switch(struct task_struct *prev)
 	return 0;
 }
 
+static int wakeup_edge(void *ctx, struct task_struct *p, u64 delta)
+{
+	static const struct edge_val zero;
+	struct edge_key key = {};
+	struct edge_val *val;
+	u64 slot;
+
+	key.waker_tgid = bpf_get_current_pid_tgid() >> 32;
+	key.wakee_tgid = BPF_CORE_READ(p, tgid);
+	key.wake_stack_id = bpf_get_stackid(ctx, &stackmap, 0);
+	bpf_get_current_comm(&key.waker, sizeof(key.waker));
+	BPF_CORE_READ_STR_INTO(&key.wakee, p, comm);
+
+	val = bpf_map_lookup_or_try_init(&edges, &key, &zero);
+	if (!val)
+		return 0;
+
+	slot = log2l(delta / 1000U);
+	if (slot >= MAX_SLOTS)
+		slot = MAX_SLOTS - 1;
+	__sync_fetch_and_add(&val->count, 1);
+	__sync_fetch_and_add(&val->total_ns, delta);
+	__sync_fetch_and_add(&val->slots[slot], 1);
+
+	return 0;
+}
+
 static int wakeup(void *ctx, struct task_struct *p)
 {
 	u32 pid = BPF_CORE_READ(p, tgid);
@@ -70,6 +106,9 @@ static int wakeup(void *ctx, struct task_struct *p)
 	if ((delta < min_block_ns) || (delta > max_block_ns))
 		return 0;
 
+	if (graph_mode)
+		return wakeup_edge(ctx, p, delta);
+
 	key.wake_stack_id = bpf_get_stackid(ctx, &stackmap, 0);
 	BPF_CORE_READ_STR_INTO(&key.target, p, comm);
 	bpf_get_current_comm(&key.waker, sizeof(key.waker));
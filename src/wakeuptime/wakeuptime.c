@@ -3,6 +3,12 @@
 #include "wakeuptime.h"
 #include "wakeuptime.skel.h"
 #include "trace_helpers.h"
+#include "map_helpers.h"
+
+enum graph_format {
+	FORMAT_DOT,
+	FORMAT_JSON,
+};
 
 struct env {
 	pid_t pid;
@@ -13,6 +19,8 @@ struct env {
 	__u64 min_block_time;
 	__u64 max_block_time;
 	int duration;
+	bool graph;
+	enum graph_format format;
 } env = {
 	.verbose = false,
 	.stack_storage_size = 1024,
@@ -28,12 +36,16 @@ const char argp_program_doc[] =
 "Summarize sleep to wakeup time by waker kernel stack.\n"
 "\n"
 "USAGE: wakeuptime [-h] [-p PID | -u] [-v] [-m MIN-BLOCK-TIME] "
-"[-M MAX-BLOCK-TIME] ]--perf-max-stack-depth] [--stack-storage-size] [duration]\n"
+"[-M MAX-BLOCK-TIME] ]--perf-max-stack-depth] [--stack-storage-size] "
+"[-g [-f dot|json]] [duration]\n"
 "EXAMPLES:\n"
 "       wakeuptime              # trace blocked time with waker stacks\n"
 "       wakeuptime 5            # trace for 5 seconds only\n"
 "       wakeuptime -u           # don't include kernel threads (user only)\n"
-"       wakeuptime -p 185       # trace for PID 185 only\n";
+"       wakeuptime -p 185       # trace for PID 185 only\n"
+"       wakeuptime -g 10 > wakeups.dot\n"
+"                               # waker -> wakee graph in DOT format\n"
+"       wakeuptime -g -f json 10  # graph edges with stacks as JSON\n";
 
 #define OPT_PERF_MAX_STACK_DEPTH	1	/* --perf-max-stack-depth */
 #define OPT_STACK_STORAGE_SIZE		2	/* --stack-storage-size */
@@ -50,6 +62,8 @@ static const struct argp_option opts[] = {
 		"The amount of time in microseconds over which we store traces (default 1)" },
 	{ "max-block-time", 'M', "MAX-BLOCK-TIME", 0,
 		"The amount of time in microseconds under which we store traces (default U64_MAX)" },
+	{ "graph", 'g', NULL, 0, "Aggregate waker -> wakee edges by process" },
+	{ "format", 'f', "FORMAT", 0, "Graph output format: dot (default) or json" },
 	{ NULL, 'h', NULL, OPTION_HIDDEN, "Show the full help" },
 	{}
 };
@@ -71,6 +85,19 @@ static error_t parse_arg(int key, char *arg, struct argp_state *state)
 	case 'p':
 		env.pid = argp_parse_pid(key, arg, state);
 		break;
+	case 'g':
+		env.graph = true;
+		break;
+	case 'f':
+		if (!strcmp(arg, "dot")) {
+			env.format = FORMAT_DOT;
+		} else if (!strcmp(arg, "json")) {
+			env.format = FORMAT_JSON;
+		} else {
+			warning("Invalid format: %s\n", arg);
+			argp_usage(state);
+		}
+		break;
 	case OPT_PERF_MAX_STACK_DEPTH:
 		errno = 0;
 		env.perf_max_stack_depth = strtol(arg, NULL, 10);
@@ -181,6 +208,156 @@ static void print_map(struct ksyms *ksyms, struct wakeuptime_bpf *bpf_obj)
 	free(ip);
 }
 
+static void print_escaped(const char *str, size_t len)
+{
+	for (size_t i = 0; i < len && str[i]; i++) {
+		if (str[i] == '"' || str[i] == '\\')
+			putchar('\\');
+		putchar((unsigned char)str[i] < 0x20 ? '?' : str[i]);
+	}
+}
+
+static int edge_cmp(const void *p1, const void *p2)
+{
+	const struct edge_key *k1 = p1, *k2 = p2;
+	int ret;
+
+	if (k1->waker_tgid != k2->waker_tgid)
+		return k1->waker_tgid < k2->waker_tgid ? -1 : 1;
+	if (k1->wakee_tgid != k2->wakee_tgid)
+		return k1->wakee_tgid < k2->wakee_tgid ? -1 : 1;
+	ret = strncmp(k1->waker, k2->waker, TASK_COMM_LEN);
+	if (ret)
+		return ret;
+	return strncmp(k1->wakee, k2->wakee, TASK_COMM_LEN);
+}
+
+struct edge {
+	struct edge_key key;
+	struct edge_val val;
+};
+
+static int edge_entry_cmp(const void *p1, const void *p2)
+{
+	return edge_cmp(&((const struct edge *)p1)->key,
+			&((const struct edge *)p2)->key);
+}
+
+/* DOT output merges the per-stack edges of each waker/wakee pair */
+static void print_dot(struct edge *edges, __u32 count)
+{
+	struct edge_val sum;
+	__u32 i, j, k;
+
+	qsort(edges, count, sizeof(*edges), edge_entry_cmp);
+
+	printf("digraph wakeuptime {\n");
+	printf("\tnode [shape=box];\n");
+	for (i = 0; i < count; i = j) {
+		sum = edges[i].val;
+		for (j = i + 1; j < count && !edge_cmp(&edges[i].key, &edges[j].key); j++) {
+			sum.count += edges[j].val.count;
+			sum.total_ns += edges[j].val.total_ns;
+			for (k = 0; k < MAX_SLOTS; k++)
+				sum.slots[k] += edges[j].val.slots[k];
+		}
+
+		printf("\t\"");
+		print_escaped(edges[i].key.waker, TASK_COMM_LEN);
+		printf("\\n%u\" -> \"", edges[i].key.waker_tgid);
+		print_escaped(edges[i].key.wakee, TASK_COMM_LEN);
+		printf("\\n%u\" [label=\"count %llu\\ntotal %llu us\\np99 %llu us\", "
+		       "weight=%llu];\n", edges[i].key.wakee_tgid, sum.count,
+		       sum.total_ns / 1000, log2_hist_percentile(sum.slots, MAX_SLOTS, 99),
+		       sum.total_ns / 1000 + 1);
+	}
+	printf("}\n");
+}
+
+static void print_json(struct edge *edges, __u32 count, struct ksyms *ksyms,
+		       int stack_traces_fd, unsigned long *ip)
+{
+	const struct ksym *ksym;
+	__u32 i;
+	int j;
+
+	printf("{\"edges\": [");
+	for (i = 0; i < count; i++) {
+		const struct edge_key *key = &edges[i].key;
+		const struct edge_val *val = &edges[i].val;
+
+		printf("%s\n  {\"waker\": {\"tgid\": %u, \"comm\": \"",
+		       i ? "," : "", key->waker_tgid);
+		print_escaped(key->waker, TASK_COMM_LEN);
+		printf("\"}, \"wakee\": {\"tgid\": %u, \"comm\": \"", key->wakee_tgid);
+		print_escaped(key->wakee, TASK_COMM_LEN);
+		printf("\"}, \"count\": %llu, \"total_us\": %llu, \"hist_log2_us\": [",
+		       val->count, val->total_ns / 1000);
+		for (j = 0; j < MAX_SLOTS; j++)
+			printf("%s%u", j ? ", " : "", val->slots[j]);
+		printf("], \"stack\": [");
+		if (key->wake_stack_id >= 0 &&
+		    !bpf_map_lookup_elem(stack_traces_fd, &key->wake_stack_id, ip)) {
+			for (j = 0; j < env.perf_max_stack_depth && ip[j]; j++) {
+				ksym = ksyms__map_addr(ksyms, ip[j]);
+				printf("%s\"", j ? ", " : "");
+				if (ksym)
+					print_escaped(ksym->name, strlen(ksym->name));
+				else
+					printf("0x%lx", ip[j]);
+				printf("\"");
+			}
+		}
+		printf("]}");
+	}
+	printf("\n]}\n");
+}
+
+static void print_graph(struct ksyms *ksyms, struct wakeuptime_bpf *bpf_obj)
+{
+	struct edge_key *keys = NULL, invalid_key = { .wake_stack_id = -2 };
+	struct edge_val *vals = NULL;
+	struct edge *edges = NULL;
+	unsigned long *ip = NULL;
+	__u32 i, count = MAX_ENTRIES;
+
+	keys = calloc(MAX_ENTRIES, sizeof(*keys));
+	vals = calloc(MAX_ENTRIES, sizeof(*vals));
+	ip = calloc(env.perf_max_stack_depth, sizeof(*ip));
+	if (!keys || !vals || !ip) {
+		warning("Failed to alloc edges\n");
+		goto cleanup;
+	}
+
+	if (dump_hash(bpf_map__fd(bpf_obj->maps.edges), keys, sizeof(*keys),
+		      vals, sizeof(*vals), &count, &invalid_key)) {
+		warning("Failed to dump edges: %s\n", strerror(errno));
+		goto cleanup;
+	}
+
+	edges = calloc(count ?: 1, sizeof(*edges));
+	if (!edges) {
+		warning("Failed to alloc edges\n");
+		goto cleanup;
+	}
+	for (i = 0; i < count; i++) {
+		edges[i].key = keys[i];
+		edges[i].val = vals[i];
+	}
+
+	if (env.format == FORMAT_JSON)
+		print_json(edges, count, ksyms,
+			   bpf_map__fd(bpf_obj->maps.stackmap), ip);
+	else
+		print_dot(edges, count);
+
+cleanup:
+	free(edges);
+	free(ip);
+	free(vals);
+	free(keys);
+}
+
 int main(int argc, char *argv[])
 {
 	static const struct argp argp = {
@@ -228,6 +405,12 @@ int main(int argc, char *argv[])
 	bpf_obj->rodata->min_block_ns = env.min_block_time;
 	bpf_obj->rodata->max_block_ns = env.max_block_time;
 	bpf_obj->rodata->user_threads_only = env.user_threads_only;
+	bpf_obj->rodata->graph_mode = env.graph;
+
+	if (env.graph)
+		bpf_map__set_max_entries(bpf_obj->maps.counts, 1);
+	else
+		bpf_map__set_max_entries(bpf_obj->maps.edges, 1);
 
 	bpf_map__set_value_size(bpf_obj->maps.stackmap,
 				env.perf_max_stack_depth * sizeof(unsigned long));
@@ -257,6 +440,13 @@ int main(int argc, char *argv[])
 		goto cleanup;
 	}
 
+	if (env.graph) {
+		warning("Tracing waker -> wakee edges... Hit Ctrl-C to end.\n");
+		sleep(env.duration);
+		print_graph(ksyms, bpf_obj);
+		goto cleanup;
+	}
+
 	printf("Tracing blocked time (us) by kernel stack\n");
 	sleep(env.duration);
 	print_map(ksyms, bpf_obj);
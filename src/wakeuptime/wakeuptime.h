@@ -4,6 +4,7 @@
 
 #define MAX_ENTRIES	10240
 #define TASK_COMM_LEN	16
+#define MAX_SLOTS	26
 
 struct key_t {
 	char waker[TASK_COMM_LEN];
@@ -11,5 +12,20 @@ struct key_t {
 	int wake_stack_id;
 };
 
+/* one waker -> wakee edge of the graph mode */
+struct edge_key {
+	__u32 waker_tgid;
+	__u32 wakee_tgid;
+	char waker[TASK_COMM_LEN];
+	char wakee[TASK_COMM_LEN];
+	int wake_stack_id;
+};
+
+struct edge_val {
+	__u64 count;
+	__u64 total_ns;
+	__u32 slots[MAX_SLOTS];	/* log2 histogram of block time in us */
+};
+
 #endif
 
@@ -0,0 +1,182 @@
+// SPDX-License-Identifier: GPL-2.0
+#include "vmlinux.h"
+#include <bpf/bpf_helpers.h>
+#include <bpf/bpf_core_read.h>
+#include <bpf/bpf_tracing.h>
+#include "wqlat.h"
+#include "bits.bpf.h"
+#include "maps.bpf.h"
+
+const volatile bool targ_ms = false;
+const volatile bool targ_per_wq = false;
+const volatile bool targ_per_func = false;
+const volatile bool filter_wq = false;
+const volatile char targ_wq[WQ_NAME_LEN] = {};
+
+/* work item -> when and on which workqueue it was queued */
+struct queued {
+	u64 ts;
+	char wq[WQ_NAME_LEN];
+};
+
+/* LRU: cancelled or freed work never reaches execute_start */
+struct {
+	__uint(type, BPF_MAP_TYPE_LRU_HASH);
+	__uint(max_entries, 10240);
+	__type(key, u64);
+	__type(value, struct queued);
+} queued SEC(".maps");
+
+/* worker thread -> work item it is executing */
+struct running {
+	u64 ts;
+	struct wq_key key;
+};
+
+struct {
+	__uint(type, BPF_MAP_TYPE_HASH);
+	__uint(max_entries, 10240);
+	__type(key, u32);
+	__type(value, struct running);
+} running SEC(".maps");
+
+struct {
+	__uint(type, BPF_MAP_TYPE_PERCPU_HASH);
+	__uint(max_entries, MAX_ENTRIES);
+	__type(key, struct wq_key);
+	__type(value, struct wq_hist);
+} hists SEC(".maps");
+
+static struct wq_hist zero;
+
+static __always_inline bool wq_allowed(const char *wq)
+{
+	if (!filter_wq)
+		return true;
+
+	for (int i = 0; i < WQ_NAME_LEN; i++) {
+		if (wq[i] != targ_wq[i])
+			return false;
+		if (!wq[i])
+			break;
+	}
+	return true;
+}
+
+static __always_inline u64 slot_of(u64 delta)
+{
+	u64 slot;
+
+	delta /= targ_ms ? 1000000U : 1000U;
+	slot = log2l(delta);
+	return slot < MAX_SLOTS ? slot : MAX_SLOTS - 1;
+}
+
+static int handle_queue_work(struct pool_workqueue *pwq, struct work_struct *work)
+{
+	struct queued q = {};
+	u64 w = (u64)work;
+
+	BPF_CORE_READ_STR_INTO(&q.wq, pwq, wq, name);
+	if (!wq_allowed(q.wq))
+		return 0;
+
+	q.ts = bpf_ktime_get_ns();
+	bpf_map_update_elem(&queued, &w, &q, BPF_ANY);
+	return 0;
+}
+
+static int handle_execute_start(struct work_struct *work)
+{
+	u32 tid = (u32)bpf_get_current_pid_tgid();
+	struct running r = {};
+	struct wq_hist *hist;
+	struct queued *q;
+	u64 w = (u64)work;
+	u64 delta;
+
+	/* work queued before we started tracing has no workqueue name */
+	q = bpf_map_lookup_elem(&queued, &w);
+	if (!q)
+		return 0;
+
+	r.ts = bpf_ktime_get_ns();
+	if (!targ_per_wq)
+		r.key.func = (u64)BPF_CORE_READ(work, func);
+	if (!targ_per_func)
+		__builtin_memcpy(r.key.wq, q->wq, sizeof(r.key.wq));
+	delta = r.ts - q->ts;
+	bpf_map_delete_elem(&queued, &w);
+
+	hist = bpf_map_lookup_or_try_init(&hists, &r.key, &zero);
+	if (!hist)
+		return 0;
+	hist->count++;
+	hist->lat_total += delta;
+	hist->lat_slots[slot_of(delta)]++;
+
+	bpf_map_update_elem(&running, &tid, &r, BPF_ANY);
+	return 0;
+}
+
+static int handle_execute_end(void)
+{
+	u32 tid = (u32)bpf_get_current_pid_tgid();
+	struct wq_hist *hist;
+	struct running *r;
+	u64 delta;
+
+	r = bpf_map_lookup_elem(&running, &tid);
+	if (!r)
+		return 0;
+
+	delta = bpf_ktime_get_ns() - r->ts;
+	hist = bpf_map_lookup_elem(&hists, &r->key);
+	if (hist) {
+		hist->exec_total += delta;
+		hist->exec_slots[slot_of(delta)]++;
+	}
+
+	bpf_map_delete_elem(&running, &tid);
+	return 0;
+}
+
+SEC("tp_btf/workqueue_queue_work")
+int BPF_PROG(workqueue_queue_work_btf, int req_cpu, struct pool_workqueue *pwq,
+	     struct work_struct *work)
+{
+	return handle_queue_work(pwq, work);
+}
+
+SEC("tp_btf/workqueue_execute_start")
+int BPF_PROG(workqueue_execute_start_btf, struct work_struct *work)
+{
+	return handle_execute_start(work);
+}
+
+SEC("tp_btf/workqueue_execute_end")
+int BPF_PROG(workqueue_execute_end_btf, struct work_struct *work)
+{
+	return handle_execute_end();
+}
+
+SEC("raw_tp/workqueue_queue_work")
+int BPF_PROG(workqueue_queue_work_raw, int req_cpu, struct pool_workqueue *pwq,
+	     struct work_struct *work)
+{
+	return handle_queue_work(pwq, work);
+}
+
+SEC("raw_tp/workqueue_execute_start")
+int BPF_PROG(workqueue_execute_start_raw, struct work_struct *work)
+{
+	return handle_execute_start(work);
+}
+
+SEC("raw_tp/workqueue_execute_end")
+int BPF_PROG(workqueue_execute_end_raw, struct work_struct *work)
+{
+	return handle_execute_end();
+}
+
+char LICENSE[] SEC("license") = "GPL";
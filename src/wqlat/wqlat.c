@@ -0,0 +1,359 @@
+// SPDX-License-Identifier: (LGPL-2.1 OR BSD-2-Clause)
+#include "commons.h"
+#include "wqlat.h"
+#include "wqlat.skel.h"
+#include "btf_helpers.h"
+#include "trace_helpers.h"
+#include "map_helpers.h"
+
+#define MAX_ROWS	20
+
+struct env {
+	bool milliseconds;
+	bool summary;
+	bool per_wq;
+	bool per_func;
+	char *wq;
+	time_t interval;
+	int times;
+	bool timestamp;
+	bool verbose;
+} env = {
+	.interval = 99999999,
+	.times = 99999999,
+};
+
+static volatile sig_atomic_t exiting;
+static struct ksyms *ksyms;
+static int nr_cpus;
+
+const char *argp_program_version = "wqlat 0.1";
+const char *argp_program_bug_address = "Jackie Liu <liuyun01@kylinos.cn>";
+const char argp_program_doc[] =
+"Summarize workqueue queuing latency and work execution time.\n"
+"\n"
+"USAGE: wqlat [--help] [-T] [-m] [-s] [-W | -F] [-w WQ] [interval] [count]\n"
+"\n"
+"EXAMPLES:\n"
+"    wqlat              # histograms per workqueue and work function\n"
+"    wqlat 1 10         # print 1 second summaries, 10 times\n"
+"    wqlat -s 1         # one line per work function with percentiles\n"
+"    wqlat -W           # aggregate per workqueue only\n"
+"    wqlat -F           # aggregate per work function only\n"
+"    wqlat -w writeback # only the writeback workqueue\n"
+"    wqlat -mT 5        # 5s summaries, milliseconds, and timestamps\n";
+
+static const struct argp_option opts[] = {
+	{ "milliseconds", 'm', NULL, 0, "Millisecond histograms" },
+	{ "summary", 's', NULL, 0, "Print a summary table instead of histograms" },
+	{ "per-wq", 'W', NULL, 0, "Aggregate per workqueue only" },
+	{ "per-func", 'F', NULL, 0, "Aggregate per work function only" },
+	{ "wq", 'w', "WQ", 0, "Trace this workqueue only" },
+	{ "timestamp", 'T', NULL, 0, "Include timestamp on output" },
+	{ "verbose", 'v', NULL, 0, "Verbose debug output" },
+	{ NULL, 'h', NULL, OPTION_HIDDEN, "Show the full help" },
+	{},
+};
+
+static error_t parse_arg(int key, char *arg, struct argp_state *state)
+{
+	static int pos_args;
+
+	switch (key) {
+	case 'h':
+		argp_state_help(state, stderr, ARGP_HELP_STD_HELP);
+		break;
+	case 'v':
+		env.verbose = true;
+		break;
+	case 'm':
+		env.milliseconds = true;
+		break;
+	case 's':
+		env.summary = true;
+		break;
+	case 'W':
+		env.per_wq = true;
+		break;
+	case 'F':
+		env.per_func = true;
+		break;
+	case 'w':
+		if (strlen(arg) >= WQ_NAME_LEN) {
+			warning("Workqueue name too long: %s\n", arg);
+			argp_usage(state);
+		}
+		env.wq = arg;
+		break;
+	case 'T':
+		env.timestamp = true;
+		break;
+	case ARGP_KEY_ARG:
+		errno = 0;
+		if (pos_args == 0) {
+			env.interval = strtol(arg, NULL, 10);
+			if (errno || env.interval <= 0) {
+				warning("Invalid interval\n");
+				argp_usage(state);
+			}
+		} else if (pos_args == 1) {
+			env.times = strtol(arg, NULL, 10);
+			if (errno || env.times <= 0) {
+				warning("Invalid times\n");
+				argp_usage(state);
+			}
+		} else {
+			warning("Unrecognized positional argument: %s\n", arg);
+			argp_usage(state);
+		}
+		pos_args++;
+		break;
+	default:
+		return ARGP_ERR_UNKNOWN;
+	}
+	return 0;
+}
+
+static int libbpf_print_fn(enum libbpf_print_level level, const char *format, va_list args)
+{
+	if (level == LIBBPF_DEBUG && !env.verbose)
+		return 0;
+	return vfprintf(stderr, format, args);
+}
+
+static void sig_handler(int sig)
+{
+	exiting = 1;
+}
+
+struct wq_row {
+	struct wq_key key;
+	struct wq_hist hist;
+};
+
+static int sort_count(const void *obj1, const void *obj2)
+{
+	const struct wq_row *r1 = obj1, *r2 = obj2;
+
+	if (r1->hist.count == r2->hist.count)
+		return 0;
+	return r1->hist.count < r2->hist.count ? 1 : -1;
+}
+
+static const char *func_name(__u64 addr, char *buf, size_t size)
+{
+	const struct ksym *ksym = ksyms__map_addr(ksyms, addr);
+
+	if (ksym)
+		snprintf(buf, size, "%s", ksym->name);
+	else
+		snprintf(buf, size, "0x%llx", addr);
+	return buf;
+}
+
+static void print_row(const struct wq_row *r)
+{
+	unsigned int *lat = (unsigned int *)r->hist.lat_slots;
+	unsigned int *exec = (unsigned int *)r->hist.exec_slots;
+	double div = env.milliseconds ? 1000000.0 : 1000.0;
+	__u64 n = max(r->hist.count, 1ULL);
+	char func[64];
+
+	if (!env.per_func)
+		printf("%-24s ", r->key.wq);
+	if (!env.per_wq)
+		printf("%-32s ", func_name(r->key.func, func, sizeof(func)));
+	printf("%8llu %10.1f %10llu %10.1f %10llu\n", r->hist.count,
+	       r->hist.lat_total / div / n,
+	       log2_hist_percentile(lat, MAX_SLOTS, 99),
+	       r->hist.exec_total / div / n,
+	       log2_hist_percentile(exec, MAX_SLOTS, 99));
+}
+
+static void print_hists(const struct wq_row *r, const char *units)
+{
+	char func[64];
+
+	if (env.per_func)
+		printf("\nfunc = %s\n", func_name(r->key.func, func, sizeof(func)));
+	else if (env.per_wq)
+		printf("\nwq = %s\n", r->key.wq);
+	else
+		printf("\nwq = %s func = %s\n", r->key.wq,
+		       func_name(r->key.func, func, sizeof(func)));
+
+	printf("queue latency, %llu works\n", r->hist.count);
+	print_log2_hist((unsigned int *)r->hist.lat_slots, MAX_SLOTS, units);
+	printf("execution time\n");
+	print_log2_hist((unsigned int *)r->hist.exec_slots, MAX_SLOTS, units);
+}
+
+static int print_stats(int fd)
+{
+	static struct wq_row rows[MAX_ENTRIES];
+	const char *units = env.milliseconds ? "msecs" : "usecs";
+	struct wq_hist values[nr_cpus];
+	struct wq_key *prev = NULL, key;
+	int i, j, cpu, n = 0;
+
+	while (n < MAX_ENTRIES && !bpf_map_get_next_key(fd, prev, &key)) {
+		rows[n].key = key;
+		prev = &rows[n].key;
+		n++;
+	}
+
+	for (i = 0, j = 0; i < n; i++) {
+		struct wq_hist *h = &rows[j].hist;
+
+		key = rows[i].key;
+		if (bpf_map_lookup_elem(fd, &key, values))
+			continue;
+		bpf_map_delete_elem(fd, &key);
+
+		memset(h, 0, sizeof(*h));
+		rows[j].key = key;
+		for (cpu = 0; cpu < nr_cpus; cpu++) {
+			h->count += values[cpu].count;
+			h->lat_total += values[cpu].lat_total;
+			h->exec_total += values[cpu].exec_total;
+		}
+		percpu_sum_u32(h->lat_slots, values[0].lat_slots, MAX_SLOTS,
+			       sizeof(values[0]) / sizeof(__u32), nr_cpus);
+		percpu_sum_u32(h->exec_slots, values[0].exec_slots, MAX_SLOTS,
+			       sizeof(values[0]) / sizeof(__u32), nr_cpus);
+		j++;
+	}
+
+	qsort(rows, j, sizeof(*rows), sort_count);
+
+	if (!env.summary) {
+		for (i = 0; i < j; i++)
+			print_hists(&rows[i], units);
+		return 0;
+	}
+
+	if (!env.per_func)
+		printf("%-24s ", "WQ");
+	if (!env.per_wq)
+		printf("%-32s ", "FUNC");
+	printf("%8s %10s %10s %10s %10s\n", "COUNT", "LAT_AVG", "LAT_P99",
+	       "EXEC_AVG", "EXEC_P99");
+	for (i = 0; i < j && i < MAX_ROWS; i++)
+		print_row(&rows[i]);
+
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	LIBBPF_OPTS(bpf_object_open_opts, open_opts);
+	static const struct argp argp = {
+		.options = opts,
+		.parser = parse_arg,
+		.doc = argp_program_doc,
+	};
+	struct wqlat_bpf *obj;
+	char ts[32];
+	int err;
+
+	err = argp_parse(&argp, argc, argv, 0, NULL, NULL);
+	if (err)
+		return err;
+
+	if (!bpf_is_root())
+		return 1;
+
+	if (env.per_wq && env.per_func) {
+		warning("per-wq and per-func can't be used together.\n");
+		return 1;
+	}
+
+	libbpf_set_print(libbpf_print_fn);
+
+	nr_cpus = libbpf_num_possible_cpus();
+	if (nr_cpus < 0) {
+		warning("Failed to get # of possible cpus: '%s'!\n",
+			strerror(-nr_cpus));
+		return 1;
+	}
+
+	err = ensure_core_btf(&open_opts);
+	if (err) {
+		warning("Failed to fetch necessary BTF for CO-RE: %s\n", strerror(-err));
+		return 1;
+	}
+
+	obj = wqlat_bpf__open_opts(&open_opts);
+	if (!obj) {
+		warning("Failed to open BPF object\n");
+		return 1;
+	}
+
+	if (probe_tp_btf("workqueue_queue_work")) {
+		bpf_program__set_autoload(obj->progs.workqueue_queue_work_raw, false);
+		bpf_program__set_autoload(obj->progs.workqueue_execute_start_raw, false);
+		bpf_program__set_autoload(obj->progs.workqueue_execute_end_raw, false);
+	} else {
+		bpf_program__set_autoload(obj->progs.workqueue_queue_work_btf, false);
+		bpf_program__set_autoload(obj->progs.workqueue_execute_start_btf, false);
+		bpf_program__set_autoload(obj->progs.workqueue_execute_end_btf, false);
+	}
+
+	obj->rodata->targ_ms = env.milliseconds;
+	obj->rodata->targ_per_wq = env.per_wq;
+	obj->rodata->targ_per_func = env.per_func;
+	if (env.wq) {
+		obj->rodata->filter_wq = true;
+		strncpy((char *)obj->rodata->targ_wq, env.wq, WQ_NAME_LEN - 1);
+	}
+
+	if (!env.per_wq) {
+		ksyms = ksyms__load();
+		if (!ksyms) {
+			warning("Failed to load kallsyms\n");
+			err = 1;
+			goto cleanup;
+		}
+	}
+
+	err = wqlat_bpf__load(obj);
+	if (err) {
+		warning("Failed to load BPF object: %d\n", err);
+		goto cleanup;
+	}
+
+	err = wqlat_bpf__attach(obj);
+	if (err) {
+		warning("Failed to attach BPF programs: %d\n", err);
+		goto cleanup;
+	}
+
+	signal(SIGINT, sig_handler);
+
+	printf("Tracing workqueue latency... Hit Ctrl-C to end.\n");
+
+	/* Main loop */
+	for (;;) {
+		sleep(env.interval);
+		printf("\n");
+
+		if (env.timestamp) {
+			strftime_now(ts, sizeof(ts), "%H:%M:%S");
+			printf("%-8s\n", ts);
+		}
+
+		err = print_stats(bpf_map__fd(obj->maps.hists));
+		if (err)
+			break;
+
+		if (exiting || --env.times == 0)
+			break;
+	}
+
+cleanup:
+	wqlat_bpf__destroy(obj);
+	ksyms__free(ksyms);
+	cleanup_core_btf(&open_opts);
+
+	return err != 0;
+}
@@ -0,0 +1,23 @@
+// SPDX-License-Identifier: (LGPL-2.1 OR BSD-2-Clause)
+#ifndef __WQLAT_H
+#define __WQLAT_H
+
+#define MAX_SLOTS	27
+#define MAX_ENTRIES	1024
+#define WQ_NAME_LEN	24
+
+struct wq_key {
+	__u64 func;
+	char wq[WQ_NAME_LEN];
+};
+
+/* per-CPU value, both histograms are in usecs (msecs with -m) */
+struct wq_hist {
+	__u64 count;
+	__u64 lat_total;
+	__u64 exec_total;
+	__u32 lat_slots[MAX_SLOTS];
+	__u32 exec_slots[MAX_SLOTS];
+};
+
+#endif /* __WQLAT_H */